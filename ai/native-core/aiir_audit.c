@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+
+#include "aiir_audit.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define AUDIT_BATCH_BYTES (64u * 1024u)
+
+static bool write_all(int fd, const char *p, size_t n) {
+  while (n > 0) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += w;
+    n -= (size_t)w;
+  }
+  return true;
+}
+
+static void audit_flush_batch(AiirAudit *a, size_t n) {
+  if (n == 0) return;
+  if (a->fd >= 0) {
+    if (!write_all(a->fd, a->batch, n)) atomic_fetch_add(&a->write_errors_total, 1u);
+    else if (a->fdatasync && fdatasync(a->fd) != 0) atomic_fetch_add(&a->write_errors_total, 1u);
+  }
+  if (a->mirror_stderr) (void)write_all(STDERR_FILENO, a->batch, n);
+  atomic_fetch_add(&a->batches_total, 1u);
+}
+
+/* Moves every published slot into the batch buffer, writing whenever it fills; returns the
+   number of lines taken. */
+static size_t audit_drain(AiirAudit *a) {
+  uint64_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+  size_t used = 0, taken = 0;
+  for (;;) {
+    AiirAuditSlot *s = &a->slots[head & a->mask];
+    if (atomic_load_explicit(&s->seq, memory_order_acquire) != head + 1u) break;
+    if (used + s->len > AUDIT_BATCH_BYTES) {
+      audit_flush_batch(a, used);
+      atomic_store_explicit(&a->head, head, memory_order_release);
+      used = 0;
+    }
+    memcpy(a->batch + used, s->line, s->len);
+    used += s->len;
+    atomic_store_explicit(&s->seq, head + a->mask + 1u, memory_order_release);
+    head++;
+    taken++;
+  }
+  /* `head` only moves past lines that have been written, so aiir_audit_sync can wait on it. */
+  audit_flush_batch(a, used);
+  atomic_store_explicit(&a->head, head, memory_order_release);
+  return taken;
+}
+
+static void *audit_writer_main(void *arg) {
+  AiirAudit *a = (AiirAudit *)arg;
+  struct pollfd pfd = {.fd = a->efd, .events = POLLIN};
+  for (;;) {
+    bool stopping = atomic_load(&a->stop);
+    size_t taken = audit_drain(a);
+    if (stopping) {
+      if (taken == 0) break;
+      continue;
+    }
+    if (poll(&pfd, 1, (int)a->flush_ms) > 0) {
+      uint64_t v;
+      (void)!read(a->efd, &v, sizeof(v));
+    }
+    atomic_store(&a->wake_pending, false);
+  }
+  return NULL;
+}
+
+bool aiir_audit_open(AiirAudit *a, const char *path, const AiirAuditConfig *cfg) {
+  memset(a, 0, sizeof(*a));
+  a->fd = -1;
+  a->efd = -1;
+  a->fdatasync = cfg->fdatasync;
+  a->mirror_stderr = cfg->mirror_stderr;
+  a->flush_ms = cfg->flush_ms > 0 ? cfg->flush_ms : 1u;
+  size_t cap = 2;
+  while (cap < cfg->queue_slots) cap <<= 1;
+  a->mask = cap - 1u;
+
+  a->fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+  a->slots = (AiirAuditSlot *)malloc(cap * sizeof(AiirAuditSlot));
+  a->batch = (char *)malloc(AUDIT_BATCH_BYTES);
+  a->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (!a->slots || !a->batch || a->efd < 0) {
+    aiir_audit_close(a);
+    return false;
+  }
+  for (size_t i = 0; i < cap; i++) atomic_init(&a->slots[i].seq, (uint64_t)i);
+  /* The writer never takes signals, so a process-directed SIGTERM cannot land on it. */
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  int rc = pthread_create(&a->thread, NULL, audit_writer_main, a);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (rc != 0) {
+    aiir_audit_close(a);
+    return false;
+  }
+  a->running = true;
+  return true;
+}
+
+bool aiir_audit_enabled(const AiirAudit *a) {
+  return a->running && (a->fd >= 0 || a->mirror_stderr);
+}
+
+bool aiir_audit_push(AiirAudit *a, const char *line, size_t len) {
+  if (!aiir_audit_enabled(a)) return false;
+  if (len > AIIR_AUDIT_LINE_MAX - 1u) len = AIIR_AUDIT_LINE_MAX - 1u;
+  uint64_t pos = atomic_load_explicit(&a->tail, memory_order_relaxed);
+  AiirAuditSlot *s;
+  for (;;) {
+    s = &a->slots[pos & a->mask];
+    uint64_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+    int64_t dif = (int64_t)(seq - pos);
+    if (dif == 0) {
+      if (atomic_compare_exchange_weak_explicit(&a->tail, &pos, pos + 1u, memory_order_relaxed, memory_order_relaxed)) break;
+    } else if (dif < 0) {
+      atomic_fetch_add_explicit(&a->dropped_total, 1u, memory_order_relaxed);
+      return false;
+    } else {
+      pos = atomic_load_explicit(&a->tail, memory_order_relaxed);
+    }
+  }
+  memcpy(s->line, line, len);
+  s->line[len] = '\n';
+  s->len = (uint32_t)(len + 1u);
+  atomic_store_explicit(&s->seq, pos + 1u, memory_order_release);
+  atomic_fetch_add_explicit(&a->lines_total, 1u, memory_order_relaxed);
+
+  /* The writer wakes on its flush interval; only a half-full ring is worth a syscall. */
+  uint64_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+  if (pos + 1u - head > (a->mask + 1u) / 2u && !atomic_exchange(&a->wake_pending, true)) {
+    uint64_t one = 1;
+    (void)!write(a->efd, &one, sizeof(one));
+  }
+  return true;
+}
+
+bool aiir_audit_sync(AiirAudit *a, size_t timeout_ms) {
+  if (!a->running) return true;
+  uint64_t target = atomic_load(&a->tail);
+  uint64_t one = 1;
+  (void)!write(a->efd, &one, sizeof(one));
+  const struct timespec tick = {0, 1000000L};
+  for (size_t waited = 0; atomic_load(&a->head) < target; waited++) {
+    if (waited >= timeout_ms) return false;
+    nanosleep(&tick, NULL);
+  }
+  return true;
+}
+
+size_t aiir_audit_depth(const AiirAudit *a) {
+  uint64_t head = atomic_load_explicit(&a->head, memory_order_acquire);
+  uint64_t tail = atomic_load_explicit(&a->tail, memory_order_acquire);
+  return tail > head ? (size_t)(tail - head) : 0u;
+}
+
+size_t aiir_audit_capacity(const AiirAudit *a) {
+  return a->slots ? a->mask + 1u : 0u;
+}
+
+void aiir_audit_close(AiirAudit *a) {
+  if (a->running) {
+    uint64_t one = 1;
+    atomic_store(&a->stop, true);
+    (void)!write(a->efd, &one, sizeof(one));
+    pthread_join(a->thread, NULL);
+    a->running = false;
+  }
+  if (a->efd >= 0) close(a->efd);
+  if (a->fd >= 0) close(a->fd);
+  a->efd = -1;
+  a->fd = -1;
+  free(a->slots);
+  free(a->batch);
+  a->slots = NULL;
+  a->batch = NULL;
+}
@@ -0,0 +1,64 @@
+#ifndef AIIR_AUDIT_H
+#define AIIR_AUDIT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Longest queued line, newline included; longer lines are truncated. */
+#define AIIR_AUDIT_LINE_MAX 1408u
+
+typedef struct {
+  size_t queue_slots; /* rounded up to a power of two */
+  size_t flush_ms;    /* longest a queued line waits before it is written */
+  bool fdatasync;     /* fdatasync the log after every batch */
+  bool mirror_stderr; /* also copy every batch to stderr */
+} AiirAuditConfig;
+
+typedef struct {
+  _Atomic uint64_t seq;
+  uint32_t len;
+  char line[AIIR_AUDIT_LINE_MAX];
+} AiirAuditSlot;
+
+/* Bounded MPSC ring: any thread claims a slot with one CAS on `tail` and publishes it through
+   the slot's sequence number; the writer thread drains slots in order into batched write()s.
+   A full ring drops the line rather than blocking the caller. */
+typedef struct {
+  AiirAuditSlot *slots;
+  size_t mask;
+  _Alignas(64) _Atomic uint64_t tail;
+  _Alignas(64) _Atomic uint64_t head;
+  atomic_bool wake_pending;
+  atomic_bool stop;
+  int fd;
+  int efd;
+  bool fdatasync;
+  bool mirror_stderr;
+  size_t flush_ms;
+  bool running;
+  pthread_t thread;
+  char *batch;
+  _Atomic uint64_t lines_total;
+  _Atomic uint64_t dropped_total;
+  _Atomic uint64_t batches_total;
+  _Atomic uint64_t write_errors_total;
+} AiirAudit;
+
+/* Opens `path` for appending and starts the writer thread. A log that cannot be opened is
+   not fatal: lines then only reach the stderr mirror, or are discarded when it is off. */
+bool aiir_audit_open(AiirAudit *a, const char *path, const AiirAuditConfig *cfg);
+/* True when pushed lines go anywhere; callers can skip formatting otherwise. */
+bool aiir_audit_enabled(const AiirAudit *a);
+/* Queues one line (without its newline); returns false when the ring was full. */
+bool aiir_audit_push(AiirAudit *a, const char *line, size_t len);
+/* Waits until every line queued before the call has been written; false on timeout. */
+bool aiir_audit_sync(AiirAudit *a, size_t timeout_ms);
+size_t aiir_audit_depth(const AiirAudit *a);
+size_t aiir_audit_capacity(const AiirAudit *a);
+/* Drains every queued line, stops the writer and closes the log. */
+void aiir_audit_close(AiirAudit *a);
+
+#endif
@@ -1,15 +1,22 @@
+#define _GNU_SOURCE
+
 #include "aiir_core.h"
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 void aiir_u32_free(AiirU32Buf *b) {
   if (!b || !b->words) return;
-  free(b->words);
+  if (b->map_len) munmap(b->words, b->map_len);
+  else free(b->words);
   b->words = NULL;
   b->len = 0;
+  b->map_len = 0;
 }
 
 bool aiir_read_file(const char *path, uint8_t **out, size_t *out_len) {
@@ -67,7 +74,59 @@ bool aiir_load_u32(const char *path, AiirU32Buf *out) {
   free(raw);
   out->words = w;
   out->len = n;
+  out->map_len = 0;
+  return true;
+}
+
+/* Maps the file read-only and shared, so every process serving the same core shares one
+   page-cache copy and load time does not grow with file size. The words are used in place,
+   which only matches the on-disk little-endian layout on little-endian hosts; elsewhere (and
+   for empty files, which cannot be mapped) this falls back to aiir_load_u32. Writers must
+   replace core files by rename, never truncate them in place. */
+bool aiir_map_u32(const char *path, AiirU32Buf *out, unsigned flags) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return false;
+  }
+  size_t sz = (size_t)st.st_size;
+  if ((sz % 4u) != 0u) {
+    close(fd);
+    return false;
+  }
+  if (sz == 0) {
+    close(fd);
+    return aiir_load_u32(path, out);
+  }
+  int mflags = MAP_SHARED;
+#ifdef MAP_POPULATE
+  if (flags & AIIR_MAP_POPULATE) mflags |= MAP_POPULATE;
+#endif
+  void *p = mmap(NULL, sz, PROT_READ, mflags, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return false;
+  if (flags & AIIR_MAP_WILLNEED) (void)madvise(p, sz, MADV_WILLNEED);
+  if (flags & AIIR_MAP_RANDOM) (void)madvise(p, sz, MADV_RANDOM);
+  out->words = (uint32_t *)p;
+  out->len = sz / 4u;
+  out->map_len = sz;
   return true;
+#else
+  (void)flags;
+  return aiir_load_u32(path, out);
+#endif
+}
+
+bool aiir_map_u32_pref(const char *dir, const char *stem, AiirU32Buf *out, unsigned flags) {
+  char p1[1024];
+  char p2[1024];
+  snprintf(p1, sizeof(p1), "%s/%s.aiir", dir, stem);
+  snprintf(p2, sizeof(p2), "%s/%s.u32", dir, stem);
+  if (aiir_map_u32(p1, out, flags)) return true;
+  return aiir_map_u32(p2, out, flags);
 }
 
 bool aiir_load_u32_pref(const char *dir, const char *stem, AiirU32Buf *out) {
@@ -79,8 +138,12 @@ bool aiir_load_u32_pref(const char *dir, const char *stem, AiirU32Buf *out) {
   return aiir_load_u32(p2, out);
 }
 
+/* Writes to a temporary file and renames it over `path`, so readers that mapped the old
+   file keep a consistent copy until they unmap it. */
 bool aiir_write_u32(const char *path, const uint32_t *words, size_t len) {
-  FILE *f = fopen(path, "wb");
+  char tmp[1100];
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long)getpid()) >= (int)sizeof(tmp)) return false;
+  FILE *f = fopen(tmp, "wb");
   if (!f) return false;
   for (size_t i = 0; i < len; i++) {
     uint8_t b[4];
@@ -90,10 +153,14 @@ bool aiir_write_u32(const char *path, const uint32_t *words, size_t len) {
     b[3] = (uint8_t)((words[i] >> 24u) & 0xffu);
     if (fwrite(b, 1, 4, f) != 4) {
       fclose(f);
+      unlink(tmp);
       return false;
     }
   }
-  fclose(f);
+  if (fclose(f) != 0 || rename(tmp, path) != 0) {
+    unlink(tmp);
+    return false;
+  }
   return true;
 }
 
@@ -10,15 +10,23 @@
 #define AIIR_D2B_MAGIC 0x44324231u
 #define AIIR_D2B_VERSION 1u
 
+/* `map_len` is non-zero when `words` points into a read-only file mapping. */
 typedef struct {
   uint32_t *words;
   size_t len;
+  size_t map_len;
 } AiirU32Buf;
 
+#define AIIR_MAP_POPULATE 1u
+#define AIIR_MAP_WILLNEED 2u
+#define AIIR_MAP_RANDOM 4u
+
 void aiir_u32_free(AiirU32Buf *b);
 bool aiir_read_file(const char *path, uint8_t **out, size_t *out_len);
 bool aiir_load_u32(const char *path, AiirU32Buf *out);
 bool aiir_load_u32_pref(const char *dir, const char *stem, AiirU32Buf *out);
+bool aiir_map_u32(const char *path, AiirU32Buf *out, unsigned flags);
+bool aiir_map_u32_pref(const char *dir, const char *stem, AiirU32Buf *out, unsigned flags);
 bool aiir_write_u32(const char *path, const uint32_t *words, size_t len);
 uint32_t aiir_fnv1a32(const uint8_t *buf, size_t n);
 
@@ -1,9 +1,21 @@
+#define _GNU_SOURCE
+
 #include "aiir_drift.h"
 #include "aiir_core.h"
+#include "aiir_sdt.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+
+static const char *const core_names[AIIR_DRIFT_FILES] = {
+  "m2m.ai2ai.lite.table.aiir",
+  "m2m.ai2ai.lite.blob.aiir",
+  "m2m.ai2ai.source.adapt.table.aiir",
+  "m2m.ai2ai.source.adapt.blob.aiir",
+  "m2m.db.packet.aiir",
+};
 
 static uint32_t hash_file(const char *path) {
   uint8_t *buf = NULL;
@@ -14,39 +26,64 @@ static uint32_t hash_file(const char *path) {
   return h;
 }
 
-static uint32_t hash_core_set(const char *core_dir) {
-  const char *names[] = {
-    "m2m.ai2ai.lite.table.aiir",
-    "m2m.ai2ai.lite.blob.aiir",
-    "m2m.ai2ai.source.adapt.table.aiir",
-    "m2m.ai2ai.source.adapt.blob.aiir",
-    "m2m.db.packet.aiir",
-  };
+static uint32_t combine_hashes(const AiirDrift *d) {
   uint32_t h = 0x811c9dc5u;
-  for (size_t i = 0; i < sizeof(names)/sizeof(names[0]); i++) {
-    char p[1200];
-    snprintf(p, sizeof(p), "%s/%s", core_dir, names[i]);
-    uint32_t fh = hash_file(p);
-    h ^= fh;
+  for (size_t i = 0; i < AIIR_DRIFT_FILES; i++) {
+    h ^= d->files[i].hash;
     h *= 0x01000193u;
   }
   return h;
 }
 
-bool aiir_drift_init(AiirDrift *d, const char *core_dir, uint32_t check_every) {
+/* Refreshes one file's identity; returns true when it differs from the last check. */
+static bool stat_file(const char *path, AiirDriftFile *f) {
+  struct stat st;
+  AiirDriftFile now = {0};
+  if (stat(path, &st) == 0) {
+    now.ino = (uint64_t)st.st_ino;
+    now.size = (uint64_t)st.st_size;
+    now.mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + (int64_t)st.st_mtim.tv_nsec;
+  }
+  bool changed = now.ino != f->ino || now.size != f->size || now.mtime_ns != f->mtime_ns;
+  f->ino = now.ino;
+  f->size = now.size;
+  f->mtime_ns = now.mtime_ns;
+  return changed;
+}
+
+bool aiir_drift_init(AiirDrift *d, const char *core_dir) {
   memset(d, 0, sizeof(*d));
   snprintf(d->core_dir, sizeof(d->core_dir), "%s", core_dir);
-  d->check_every = check_every ? check_every : 200u;
-  d->base_hash = hash_core_set(core_dir);
+  for (size_t i = 0; i < AIIR_DRIFT_FILES; i++) {
+    char p[1200];
+    snprintf(p, sizeof(p), "%s/%s", core_dir, core_names[i]);
+    (void)stat_file(p, &d->files[i]);
+    d->files[i].hash = hash_file(p);
+  }
+  d->base_hash = combine_hashes(d);
   return d->base_hash != 0u;
 }
 
-void aiir_drift_tick(AiirDrift *d) {
+bool aiir_drift_check(AiirDrift *d) {
   d->checks++;
-  if (d->checks % d->check_every != 0u) return;
-  uint32_t now = hash_core_set(d->core_dir);
-  if (now != 0u && now != d->base_hash) {
-    d->drift_count++;
-    d->base_hash = now;
+  for (size_t i = 0; i < AIIR_DRIFT_FILES; i++) {
+    char p[1200];
+    snprintf(p, sizeof(p), "%s/%s", d->core_dir, core_names[i]);
+    if (!stat_file(p, &d->files[i])) continue;
+    d->files[i].hash = hash_file(p);
+    d->rehash_count++;
+    AIIR_PROBE2(drift__rehash, p, d->files[i].hash);
+  }
+  uint32_t now = combine_hashes(d);
+  if (now == d->base_hash) return false;
+  d->drift_count++;
+  d->base_hash = now;
+  return true;
+}
+
+bool aiir_drift_is_core_file(const char *name) {
+  for (size_t i = 0; i < AIIR_DRIFT_FILES; i++) {
+    if (strcmp(name, core_names[i]) == 0) return true;
   }
+  return false;
 }
@@ -4,15 +4,29 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#define AIIR_DRIFT_FILES 5u
+
+/* Identity of one core file at its last check; a file is rehashed only when these change. */
+typedef struct {
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime_ns;
+  uint32_t hash;
+} AiirDriftFile;
+
 typedef struct {
   char core_dir[1024];
+  AiirDriftFile files[AIIR_DRIFT_FILES];
   uint32_t base_hash;
   uint32_t checks;
   uint32_t drift_count;
-  uint32_t check_every;
+  uint32_t rehash_count;
 } AiirDrift;
 
-bool aiir_drift_init(AiirDrift *d, const char *core_dir, uint32_t check_every);
-void aiir_drift_tick(AiirDrift *d);
+bool aiir_drift_init(AiirDrift *d, const char *core_dir);
+/* Stats the core files, rehashes the ones whose inode/size/mtime changed and returns true
+   when the combined hash moved. */
+bool aiir_drift_check(AiirDrift *d);
+bool aiir_drift_is_core_file(const char *name);
 
 #endif
@@ -1,4 +1,5 @@
 #include "aiir_policy.h"
+#include "aiir_sdt.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -55,9 +56,10 @@ bool aiir_policy_init_from_env(AiirPolicy *p) {
 }
 
 bool aiir_policy_allow_op(const AiirPolicy *p, uint32_t op_id) {
-  if (p->allow_all_ops) return true;
-  for (size_t i = 0; i < p->allow_ops_n; i++) if (p->allow_ops[i] == op_id) return true;
-  return false;
+  bool allowed = p->allow_all_ops;
+  for (size_t i = 0; !allowed && i < p->allow_ops_n; i++) allowed = p->allow_ops[i] == op_id;
+  AIIR_PROBE2(policy__op, op_id, allowed);
+  return allowed;
 }
 
 void aiir_policy_free(AiirPolicy *p) {
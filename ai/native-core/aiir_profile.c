@@ -0,0 +1,416 @@
+#define _GNU_SOURCE
+
+#include "aiir_profile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define PROF_PROBES 64u
+
+typedef struct {
+  _Atomic uint64_t key;   /* stack hash, 0 = free; claimed by CAS */
+  _Atomic uint32_t ready; /* set once `pc`/`depth` are written */
+  uint32_t depth;
+  _Atomic uint64_t count;
+  uintptr_t pc[AIIR_PROFILE_DEPTH]; /* leaf first */
+} ProfSlot;
+
+typedef struct {
+  ProfSlot *slots;
+  size_t mask;
+  _Atomic uint64_t samples;
+  _Atomic uint64_t dropped;
+} ProfTable;
+
+/* The signal handler can only reach the run through globals. A handler counts itself in
+   `prof_in_handler` before it looks at `prof_active`, so once a run has cleared
+   `prof_active` and seen the count drop to zero no handler can still touch its table. */
+static _Atomic(ProfTable *) prof_active;
+static atomic_uint prof_in_handler;
+static atomic_bool prof_handler_installed;
+static _Thread_local uintptr_t prof_stack_lo;
+static _Thread_local uintptr_t prof_stack_hi;
+
+static size_t prof_unwind(const ucontext_t *uc, uintptr_t *pc) {
+  uintptr_t ip, fp;
+#if defined(__x86_64__)
+  ip = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+  fp = (uintptr_t)uc->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+  ip = (uintptr_t)uc->uc_mcontext.pc;
+  fp = (uintptr_t)uc->uc_mcontext.regs[29];
+#else
+  (void)uc;
+  ip = 0;
+  fp = 0;
+#endif
+  if (ip == 0) return 0;
+  size_t n = 0;
+  pc[n++] = ip;
+  /* Each frame record is {caller's frame pointer, return address}; anything that leaves the
+     thread's stack, goes backwards or is misaligned ends the walk. */
+  uintptr_t lo = prof_stack_lo, hi = prof_stack_hi;
+  while (n < AIIR_PROFILE_DEPTH && fp >= lo && hi - lo >= 2u * sizeof(uintptr_t) && fp <= hi - 2u * sizeof(uintptr_t) &&
+         (fp & (sizeof(uintptr_t) - 1u)) == 0) {
+    const uintptr_t *frame = (const uintptr_t *)fp;
+    uintptr_t next = frame[0];
+    uintptr_t ret = frame[1];
+    if (ret == 0) break;
+    pc[n++] = ret - 1u; /* inside the call instruction, so it symbolizes to the caller */
+    if (next <= fp) break;
+    fp = next;
+  }
+  return n;
+}
+
+static uint64_t prof_hash(const uintptr_t *pc, size_t n) {
+  uint64_t h = 1469598103934665603ULL;
+  const unsigned char *p = (const unsigned char *)pc;
+  for (size_t i = 0; i < n * sizeof(uintptr_t); i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h | 1u;
+}
+
+static void prof_count(ProfTable *t, const uintptr_t *pc, size_t n) {
+  atomic_fetch_add_explicit(&t->samples, 1u, memory_order_relaxed);
+  uint64_t h = prof_hash(pc, n);
+  for (size_t probe = 0; probe < PROF_PROBES; probe++) {
+    ProfSlot *s = &t->slots[(h + probe) & t->mask];
+    uint64_t k = atomic_load_explicit(&s->key, memory_order_acquire);
+    if (k == 0) {
+      if (atomic_compare_exchange_strong(&s->key, &k, h)) {
+        memcpy(s->pc, pc, n * sizeof(uintptr_t));
+        s->depth = (uint32_t)n;
+        atomic_store_explicit(&s->count, 1u, memory_order_relaxed);
+        atomic_store_explicit(&s->ready, 1u, memory_order_release);
+        return;
+      }
+    }
+    if (k != h) continue;
+    /* Another thread is still filling in this stack; counting it as dropped beats waiting
+       inside a signal handler. */
+    if (!atomic_load_explicit(&s->ready, memory_order_acquire)) break;
+    if (s->depth == n && memcmp(s->pc, pc, n * sizeof(uintptr_t)) == 0) {
+      atomic_fetch_add_explicit(&s->count, 1u, memory_order_relaxed);
+      return;
+    }
+  }
+  atomic_fetch_add_explicit(&t->dropped, 1u, memory_order_relaxed);
+}
+
+static void prof_on_sigprof(int sig, siginfo_t *si, void *ucv) {
+  (void)sig;
+  (void)si;
+  int saved_errno = errno;
+  atomic_fetch_add(&prof_in_handler, 1u);
+  ProfTable *t = atomic_load(&prof_active);
+  if (t) {
+    uintptr_t pc[AIIR_PROFILE_DEPTH];
+    size_t n = prof_unwind((const ucontext_t *)ucv, pc);
+    if (n > 0) prof_count(t, pc, n);
+  }
+  atomic_fetch_sub(&prof_in_handler, 1u);
+  errno = saved_errno;
+}
+
+bool aiir_profile_init(AiirProfiler *p, size_t thread_count) {
+  memset(p, 0, sizeof(*p));
+  p->threads = (AiirProfileThread *)calloc(thread_count ? thread_count : 1u, sizeof(AiirProfileThread));
+  if (!p->threads) return false;
+  p->thread_count = thread_count;
+  return true;
+}
+
+void aiir_profile_register_thread(AiirProfiler *p, size_t slot) {
+  if (!p->threads || slot >= p->thread_count) return;
+  pthread_attr_t attr;
+  if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+    void *addr = NULL;
+    size_t size = 0;
+    if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+      prof_stack_lo = (uintptr_t)addr;
+      prof_stack_hi = (uintptr_t)addr + size;
+    }
+    pthread_attr_destroy(&attr);
+  }
+  AiirProfileThread *th = &p->threads[slot];
+  th->thread = pthread_self();
+  th->tid = (pid_t)syscall(SYS_gettid);
+  atomic_store_explicit(&th->registered, true, memory_order_release);
+}
+
+void aiir_profile_free(AiirProfiler *p) {
+  free(p->threads);
+  p->threads = NULL;
+  p->thread_count = 0;
+}
+
+/* ---- symbolization ---- */
+
+typedef struct {
+  uintptr_t lo;
+  uintptr_t hi;
+  const char *name;
+} ProfSym;
+
+typedef struct {
+  void *map;
+  size_t map_len;
+  ProfSym *syms;
+  size_t n;
+} ProfSymtab;
+
+static int first_object_bias(struct dl_phdr_info *info, size_t size, void *arg) {
+  (void)size;
+  *(uintptr_t *)arg = (uintptr_t)info->dlpi_addr;
+  return 1;
+}
+
+static int sym_cmp(const void *a, const void *b) {
+  uintptr_t x = ((const ProfSym *)a)->lo, y = ((const ProfSym *)b)->lo;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Function symbols of the running executable (.symtab, or .dynsym when stripped). */
+static void symtab_load(ProfSymtab *st) {
+  memset(st, 0, sizeof(*st));
+  int fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return;
+  struct stat sb;
+  if (fstat(fd, &sb) != 0 || sb.st_size < (off_t)sizeof(ElfW(Ehdr))) {
+    close(fd);
+    return;
+  }
+  void *map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return;
+  st->map = map;
+  st->map_len = (size_t)sb.st_size;
+
+  const unsigned char *b = (const unsigned char *)map;
+  const ElfW(Ehdr) *eh = (const ElfW(Ehdr) *)map;
+  if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_shoff == 0 || eh->e_shentsize != sizeof(ElfW(Shdr)) ||
+      eh->e_shoff + (size_t)eh->e_shnum * sizeof(ElfW(Shdr)) > st->map_len) {
+    return;
+  }
+  const ElfW(Shdr) *sh = (const ElfW(Shdr) *)(b + eh->e_shoff);
+  const ElfW(Shdr) *symsec = NULL;
+  for (size_t i = 0; i < eh->e_shnum; i++) {
+    if (sh[i].sh_type == SHT_SYMTAB) symsec = &sh[i];
+    if (sh[i].sh_type == SHT_DYNSYM && !symsec) symsec = &sh[i];
+  }
+  if (!symsec || symsec->sh_link >= eh->e_shnum) return;
+  const ElfW(Shdr) *strsec = &sh[symsec->sh_link];
+  if (symsec->sh_offset + symsec->sh_size > st->map_len || strsec->sh_offset + strsec->sh_size > st->map_len) return;
+
+  uintptr_t bias = 0;
+  dl_iterate_phdr(first_object_bias, &bias);
+  const ElfW(Sym) *sym = (const ElfW(Sym) *)(b + symsec->sh_offset);
+  size_t count = symsec->sh_size / sizeof(ElfW(Sym));
+  const char *strs = (const char *)(b + strsec->sh_offset);
+  st->syms = (ProfSym *)malloc((count ? count : 1u) * sizeof(ProfSym));
+  if (!st->syms) return;
+  for (size_t i = 0; i < count; i++) {
+    /* ELF32_ST_TYPE and ELF64_ST_TYPE are the same low nibble. */
+    if ((sym[i].st_info & 0xfu) != STT_FUNC || sym[i].st_value == 0 || sym[i].st_name >= strsec->sh_size) continue;
+    ProfSym *s = &st->syms[st->n++];
+    s->lo = bias + (uintptr_t)sym[i].st_value;
+    s->hi = s->lo + (sym[i].st_size ? (uintptr_t)sym[i].st_size : 1u);
+    s->name = strs + sym[i].st_name;
+  }
+  qsort(st->syms, st->n, sizeof(ProfSym), sym_cmp);
+}
+
+static void symtab_free(ProfSymtab *st) {
+  free(st->syms);
+  if (st->map) munmap(st->map, st->map_len);
+  memset(st, 0, sizeof(*st));
+}
+
+typedef struct {
+  uintptr_t pc;
+  const char *name;
+  uintptr_t base;
+} ProfObjQuery;
+
+static int object_of_pc(struct dl_phdr_info *info, size_t size, void *arg) {
+  (void)size;
+  ProfObjQuery *q = (ProfObjQuery *)arg;
+  for (size_t i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+    if (ph->p_type != PT_LOAD) continue;
+    uintptr_t lo = (uintptr_t)info->dlpi_addr + (uintptr_t)ph->p_vaddr;
+    if (q->pc >= lo && q->pc < lo + (uintptr_t)ph->p_memsz) {
+      q->name = info->dlpi_name;
+      q->base = (uintptr_t)info->dlpi_addr;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static const char *frame_name(const ProfSymtab *st, uintptr_t pc, char *buf, size_t cap) {
+  size_t lo = 0, hi = st->n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2u;
+    if (st->syms[mid].lo <= pc) lo = mid + 1u;
+    else hi = mid;
+  }
+  if (lo > 0 && pc < st->syms[lo - 1u].hi) return st->syms[lo - 1u].name;
+  ProfObjQuery q = {pc, NULL, 0};
+  dl_iterate_phdr(object_of_pc, &q);
+  if (q.name && q.name[0] != '\0') {
+    const char *slash = strrchr(q.name, '/');
+    snprintf(buf, cap, "%s+0x%llx", slash ? slash + 1 : q.name, (unsigned long long)(pc - q.base));
+  } else {
+    snprintf(buf, cap, "0x%llx", (unsigned long long)pc);
+  }
+  return buf;
+}
+
+static bool emit_folded(const ProfTable *t, AiirProfileEmitFn emit, void *ctx) {
+  ProfSymtab st;
+  symtab_load(&st);
+  char line[AIIR_PROFILE_DEPTH * 96u + 32u];
+  bool ok = true;
+  for (size_t i = 0; ok && i <= t->mask; i++) {
+    const ProfSlot *s = &t->slots[i];
+    if (!atomic_load_explicit(&s->ready, memory_order_acquire)) continue;
+    size_t len = 0;
+    for (size_t k = s->depth; k-- > 0;) {
+      char tmp[96];
+      const char *name = frame_name(&st, s->pc[k], tmp, sizeof(tmp));
+      int w = snprintf(line + len, sizeof(line) - len, "%s%.80s", len ? ";" : "", name);
+      if (w > 0) len += (size_t)w;
+    }
+    int w = snprintf(line + len, sizeof(line) - len, " %llu\n",
+                     (unsigned long long)atomic_load_explicit(&s->count, memory_order_relaxed));
+    if (w > 0) len += (size_t)w;
+    ok = emit(ctx, line, len);
+  }
+  uint64_t dropped = atomic_load(&t->dropped);
+  if (ok && dropped > 0) {
+    int w = snprintf(line, sizeof(line), "[dropped] %llu\n", (unsigned long long)dropped);
+    ok = emit(ctx, line, (size_t)w);
+  }
+  symtab_free(&st);
+  return ok;
+}
+
+/* ---- run ---- */
+
+static bool prof_install_handler(void) {
+  if (atomic_load(&prof_handler_installed)) return true;
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = prof_on_sigprof;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGPROF, &sa, NULL) != 0) return false;
+  atomic_store(&prof_handler_installed, true);
+  return true;
+}
+
+static void prof_sleep(unsigned seconds) {
+  struct timespec until;
+  clock_gettime(CLOCK_MONOTONIC, &until);
+  until.tv_sec += (time_t)seconds;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
+  }
+}
+
+struct AiirProfileRun {
+  ProfTable t;
+  size_t thread_count;
+  timer_t *timers;
+  bool *armed;
+};
+
+static void run_free(AiirProfileRun *r) {
+  free(r->t.slots);
+  free(r->timers);
+  free(r->armed);
+  free(r);
+}
+
+AiirProfileRun *aiir_profile_start(AiirProfiler *p, unsigned hz, size_t table_slots) {
+  if (hz == 0 || !p->threads) return NULL;
+  size_t cap = 256u;
+  while (cap < table_slots) cap <<= 1;
+  AiirProfileRun *r = (AiirProfileRun *)calloc(1, sizeof(*r));
+  if (!r) return NULL;
+  r->thread_count = p->thread_count;
+  r->t.slots = (ProfSlot *)calloc(cap, sizeof(ProfSlot));
+  r->timers = (timer_t *)calloc(p->thread_count ? p->thread_count : 1u, sizeof(timer_t));
+  r->armed = (bool *)calloc(p->thread_count ? p->thread_count : 1u, sizeof(bool));
+  if (!r->t.slots || !r->timers || !r->armed || !prof_install_handler()) {
+    run_free(r);
+    return NULL;
+  }
+  r->t.mask = cap - 1u;
+  ProfTable *none = NULL;
+  if (!atomic_compare_exchange_strong(&prof_active, &none, &r->t)) {
+    run_free(r);
+    return NULL;
+  }
+
+  long period_ns = 1000000000L / (long)hz;
+  struct itimerspec its;
+  its.it_interval.tv_sec = period_ns / 1000000000L;
+  its.it_interval.tv_nsec = period_ns % 1000000000L;
+  its.it_value = its.it_interval;
+  for (size_t i = 0; i < p->thread_count; i++) {
+    AiirProfileThread *th = &p->threads[i];
+    if (!atomic_load_explicit(&th->registered, memory_order_acquire)) continue;
+    clockid_t cpu;
+    if (pthread_getcpuclockid(th->thread, &cpu) != 0) continue;
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_notify_thread_id = th->tid;
+    if (timer_create(cpu, &sev, &r->timers[i]) != 0) continue;
+    r->armed[i] = true;
+    (void)timer_settime(r->timers[i], 0, &its, NULL);
+  }
+  return r;
+}
+
+bool aiir_profile_finish(AiirProfileRun *r, AiirProfileEmitFn emit, void *ctx, uint64_t *samples) {
+  for (size_t i = 0; i < r->thread_count; i++) {
+    if (r->armed[i]) timer_delete(r->timers[i]);
+  }
+  atomic_store(&prof_active, NULL);
+  while (atomic_load(&prof_in_handler) != 0) sched_yield();
+  if (samples) *samples = atomic_load(&r->t.samples);
+  bool ok = !emit || emit_folded(&r->t, emit, ctx);
+  run_free(r);
+  return ok;
+}
+
+bool aiir_profile_run(AiirProfiler *p, unsigned seconds, unsigned hz, size_t table_slots, AiirProfileEmitFn emit,
+                      void *ctx, uint64_t *samples) {
+  if (samples) *samples = 0;
+  AiirProfileRun *r = aiir_profile_start(p, hz, table_slots);
+  if (!r) return false;
+  prof_sleep(seconds);
+  return aiir_profile_finish(r, emit, ctx, samples);
+}
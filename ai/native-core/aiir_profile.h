@@ -0,0 +1,52 @@
+#ifndef AIIR_PROFILE_H
+#define AIIR_PROFILE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define AIIR_PROFILE_DEPTH 48u
+
+/* A thread that can be sampled; filled in by the thread itself. */
+typedef struct {
+  pthread_t thread;
+  pid_t tid;
+  _Atomic bool registered;
+} AiirProfileThread;
+
+/* In-process CPU sampling profiler. During a run every registered thread gets a timer on its
+   own CPU-time clock that sends it SIGPROF `hz` times per CPU-second; the handler walks the
+   frame-pointer chain (bounded by the thread's stack) and counts the stack in a lock-free
+   open-addressing table. Only one run at a time per process. */
+typedef struct {
+  AiirProfileThread *threads;
+  size_t thread_count;
+} AiirProfiler;
+
+/* Appends `n` bytes of output; false stops the run's output with an error. */
+typedef bool (*AiirProfileEmitFn)(void *ctx, const char *s, size_t n);
+
+bool aiir_profile_init(AiirProfiler *p, size_t thread_count);
+/* Called by the thread that owns `slot` before it does any work worth sampling. */
+void aiir_profile_register_thread(AiirProfiler *p, size_t slot);
+typedef struct AiirProfileRun AiirProfileRun;
+
+/* Arms the sampling timers and returns the run; NULL when it could not start or another run
+   is in progress. `table_slots` bounds the distinct stacks kept (a power of two is used). The
+   caller keeps working meanwhile and ends the run with aiir_profile_finish. */
+AiirProfileRun *aiir_profile_start(AiirProfiler *p, unsigned hz, size_t table_slots);
+/* Stops sampling, emits one folded stack per line ("outer;...;leaf count\n", as
+   flamegraph.pl and speedscope read it) and frees the run. Functions of the executable are
+   named from its symbol table; other frames are "<object>+0x<offset>" or a bare address.
+   Samples that found no room are reported on a "[dropped]" line. A NULL `emit` discards the
+   stacks. `samples`, when not NULL, receives the number of samples taken. */
+bool aiir_profile_finish(AiirProfileRun *r, AiirProfileEmitFn emit, void *ctx, uint64_t *samples);
+/* aiir_profile_start, a sleep of `seconds` on the calling thread, then aiir_profile_finish. */
+bool aiir_profile_run(AiirProfiler *p, unsigned seconds, unsigned hz, size_t table_slots, AiirProfileEmitFn emit,
+                      void *ctx, uint64_t *samples);
+void aiir_profile_free(AiirProfiler *p);
+
+#endif
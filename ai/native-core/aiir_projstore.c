@@ -0,0 +1,1038 @@
+#define _GNU_SOURCE
+
+#include "aiir_projstore.h"
+
+#include "aiir_core.h"
+#include "aiir_wal.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROJ_NIL UINT32_MAX
+#define PROJ_REC_CRC_LEN (sizeof(AiirProjectRecord) - sizeof(uint32_t))
+#define PROJ_HDR_CRC_LEN 60u
+#define PROJ_WRITE_BUF (1u << 20)
+#define PROJ_TIER_RATIO 4u
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+} ProjLogHeader;
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t count;
+  uint64_t min_seq;
+  uint64_t max_seq;
+  uint64_t idem_count;
+  uint64_t reserved;
+  uint32_t reserved32;
+  uint32_t crc; /* over the 60 bytes before it */
+} ProjSegHeader;
+
+/* Idempotency index entry, sorted by (hash, seq) so the first match is the oldest project. */
+typedef struct {
+  uint32_t hash;
+  uint32_t rec;
+  uint64_t seq;
+} ProjIdemEntry;
+
+/* `crc` covers everything between the header and itself. */
+typedef struct {
+  char magic[8];
+  uint64_t records_off;
+  uint64_t idem_off;
+  uint32_t crc;
+  uint32_t reserved;
+} ProjSegFooter;
+
+_Static_assert(sizeof(AiirProjectRecord) == 536, "project record must stay 536 bytes");
+_Static_assert(sizeof(ProjSegHeader) == 64, "segment header must stay 64 bytes");
+_Static_assert(sizeof(ProjSegFooter) == 32, "segment footer must stay 32 bytes");
+_Static_assert(sizeof(ProjIdemEntry) == 16, "idem entry must stay 16 bytes");
+
+struct AiirProjSegment {
+  char path[1300];
+  uint8_t *map;
+  size_t map_len;
+  const AiirProjectRecord *recs;
+  const ProjIdemEntry *idem;
+  uint64_t count;
+  uint64_t idem_count;
+  uint64_t min_seq;
+  uint64_t max_seq;
+};
+
+static bool write_all(int fd, const void *buf, size_t n) {
+  const char *p = (const char *)buf;
+  while (n > 0) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += w;
+    n -= (size_t)w;
+  }
+  return true;
+}
+
+static void sync_dir(const char *dir) {
+  int dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dfd < 0) return;
+  (void)fsync(dfd);
+  close(dfd);
+}
+
+static uint32_t str_hash(const char *s) {
+  return aiir_fnv1a32((const uint8_t *)s, strlen(s));
+}
+
+static bool field_set(char *dst, size_t cap, const char *src) {
+  size_t n = strlen(src);
+  if (n >= cap) return false;
+  memcpy(dst, src, n + 1u);
+  return true;
+}
+
+static bool record_valid(const AiirProjectRecord *r) {
+  return r->crc == aiir_crc32c(0, r, PROJ_REC_CRC_LEN) && memchr(r->project_ref, '\0', sizeof(r->project_ref)) &&
+         memchr(r->db_ref, '\0', sizeof(r->db_ref)) && memchr(r->idem, '\0', sizeof(r->idem));
+}
+
+/* ---- memtable ---- */
+
+static uint32_t mem_find_idem(const AiirProjectStore *ps, const char *idem, uint32_t hash) {
+  if (ps->mem_cap == 0) return PROJ_NIL;
+  for (uint32_t i = ps->mem_idem_buckets[hash & ps->mem_mask]; i != PROJ_NIL; i = ps->mem_idem_next[i]) {
+    if (strcmp(ps->mem[i].idem, idem) == 0) return i;
+  }
+  return PROJ_NIL;
+}
+
+static uint32_t mem_find_db(const AiirProjectStore *ps, const char *db_ref, uint32_t hash) {
+  if (ps->mem_cap == 0) return PROJ_NIL;
+  for (uint32_t i = ps->mem_ref_buckets[hash & ps->mem_mask]; i != PROJ_NIL; i = ps->mem_ref_next[i]) {
+    if (strcmp(ps->mem[i].db_ref, db_ref) == 0) return i;
+  }
+  return PROJ_NIL;
+}
+
+/* Only the first project carrying an idempotency key is linked under it. */
+static void mem_link(AiirProjectStore *ps, uint32_t i) {
+  const AiirProjectRecord *r = &ps->mem[i];
+  uint32_t rh = str_hash(r->db_ref);
+  ps->mem_ref_next[i] = ps->mem_ref_buckets[rh & ps->mem_mask];
+  ps->mem_ref_buckets[rh & ps->mem_mask] = i;
+  ps->mem_idem_next[i] = PROJ_NIL;
+  if (r->idem[0] == '\0') return;
+  uint32_t ih = str_hash(r->idem);
+  if (mem_find_idem(ps, r->idem, ih) != PROJ_NIL) return;
+  ps->mem_idem_next[i] = ps->mem_idem_buckets[ih & ps->mem_mask];
+  ps->mem_idem_buckets[ih & ps->mem_mask] = i;
+}
+
+static void mem_relink(AiirProjectStore *ps) {
+  for (size_t b = 0; b <= ps->mem_mask && ps->mem_cap > 0; b++) {
+    ps->mem_idem_buckets[b] = PROJ_NIL;
+    ps->mem_ref_buckets[b] = PROJ_NIL;
+  }
+  for (size_t i = 0; i < ps->mem_n; i++) mem_link(ps, (uint32_t)i);
+}
+
+/* Makes room for one more record; callers hold the write side of `lock`. */
+static bool mem_reserve(AiirProjectStore *ps) {
+  if (ps->mem_n < ps->mem_cap) return true;
+  size_t cap = ps->mem_cap ? ps->mem_cap * 2u : 256u;
+  if (cap > PROJ_NIL) return false;
+  AiirProjectRecord *mem = (AiirProjectRecord *)realloc(ps->mem, cap * sizeof(AiirProjectRecord));
+  if (!mem) return false;
+  ps->mem = mem;
+  uint32_t *in = (uint32_t *)realloc(ps->mem_idem_next, cap * sizeof(uint32_t));
+  if (!in) return false;
+  ps->mem_idem_next = in;
+  uint32_t *rn = (uint32_t *)realloc(ps->mem_ref_next, cap * sizeof(uint32_t));
+  if (!rn) return false;
+  ps->mem_ref_next = rn;
+  uint32_t *ib = (uint32_t *)malloc(cap * sizeof(uint32_t));
+  uint32_t *rb = (uint32_t *)malloc(cap * sizeof(uint32_t));
+  if (!ib || !rb) {
+    free(ib);
+    free(rb);
+    return false;
+  }
+  free(ps->mem_idem_buckets);
+  free(ps->mem_ref_buckets);
+  ps->mem_idem_buckets = ib;
+  ps->mem_ref_buckets = rb;
+  ps->mem_cap = cap;
+  ps->mem_mask = cap - 1u;
+  mem_relink(ps);
+  return true;
+}
+
+/* ---- segments ---- */
+
+static void seg_free(AiirProjSegment *s) {
+  if (!s) return;
+  if (s->map) munmap(s->map, s->map_len);
+  free(s);
+}
+
+static AiirProjSegment *seg_open(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ProjSegHeader) + sizeof(ProjSegFooter)) {
+    close(fd);
+    return NULL;
+  }
+  size_t len = (size_t)st.st_size;
+  uint8_t *map = (uint8_t *)mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return NULL;
+  const ProjSegHeader *h = (const ProjSegHeader *)(const void *)map;
+  const ProjSegFooter *f = (const ProjSegFooter *)(const void *)(map + len - sizeof(ProjSegFooter));
+  size_t body = len - sizeof(ProjSegHeader) - sizeof(ProjSegFooter);
+  bool ok = memcmp(h->magic, AIIR_PROJSTORE_SEG_MAGIC, 8) == 0 && h->version == AIIR_PROJSTORE_VERSION &&
+            h->record_size == sizeof(AiirProjectRecord) && h->crc == aiir_crc32c(0, h, PROJ_HDR_CRC_LEN) &&
+            memcmp(f->magic, AIIR_PROJSTORE_FOOT_MAGIC, 8) == 0 && h->count <= body / sizeof(AiirProjectRecord) &&
+            h->idem_count <= h->count && f->records_off == sizeof(ProjSegHeader) &&
+            f->idem_off == f->records_off + h->count * sizeof(AiirProjectRecord) &&
+            f->idem_off + h->idem_count * sizeof(ProjIdemEntry) == len - sizeof(ProjSegFooter);
+  if (ok) {
+    uint32_t crc = aiir_crc32c(0, map + sizeof(ProjSegHeader), body);
+    ok = f->crc == aiir_crc32c(crc, f, offsetof(ProjSegFooter, crc));
+  }
+  AiirProjSegment *s = ok ? (AiirProjSegment *)calloc(1, sizeof(*s)) : NULL;
+  if (!s) {
+    munmap(map, len);
+    return NULL;
+  }
+  snprintf(s->path, sizeof(s->path), "%s", path);
+  s->map = map;
+  s->map_len = len;
+  s->recs = (const AiirProjectRecord *)(const void *)(map + f->records_off);
+  s->idem = (const ProjIdemEntry *)(const void *)(map + f->idem_off);
+  s->count = h->count;
+  s->idem_count = h->idem_count;
+  s->min_seq = h->min_seq;
+  s->max_seq = h->max_seq;
+  (void)madvise(map, len, MADV_RANDOM);
+  return s;
+}
+
+static const AiirProjectRecord *seg_find_db(const AiirProjSegment *s, const char *db_ref) {
+  uint64_t lo = 0, hi = s->count;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2u;
+    int c = strcmp(s->recs[mid].db_ref, db_ref);
+    if (c == 0) return &s->recs[mid];
+    if (c < 0) lo = mid + 1u;
+    else hi = mid;
+  }
+  return NULL;
+}
+
+static const AiirProjectRecord *seg_find_idem(const AiirProjSegment *s, const char *idem, uint32_t hash) {
+  uint64_t lo = 0, hi = s->idem_count;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2u;
+    if (s->idem[mid].hash < hash) lo = mid + 1u;
+    else hi = mid;
+  }
+  for (; lo < s->idem_count && s->idem[lo].hash == hash; lo++) {
+    const AiirProjectRecord *r = &s->recs[s->idem[lo].rec];
+    if (strcmp(r->idem, idem) == 0) return r;
+  }
+  return NULL;
+}
+
+/* Streams one segment to `<final>.tmp`: records (already in db_ref order) first, then the
+   idempotency index, footer and finally the header, and renames it into place. */
+typedef struct {
+  int fd;
+  uint8_t *buf;
+  size_t used;
+  uint32_t crc;
+  uint64_t count;
+  uint64_t min_seq;
+  uint64_t max_seq;
+  ProjIdemEntry *idem;
+  size_t idem_n;
+  size_t idem_cap;
+  char last_db[64];
+  bool ok;
+} SegWriter;
+
+static bool sw_flush(SegWriter *sw) {
+  if (sw->ok && sw->used > 0 && !write_all(sw->fd, sw->buf, sw->used)) sw->ok = false;
+  sw->used = 0;
+  return sw->ok;
+}
+
+static void sw_put(SegWriter *sw, const void *p, size_t n) {
+  sw->crc = aiir_crc32c(sw->crc, p, n);
+  const uint8_t *b = (const uint8_t *)p;
+  while (n > 0 && sw->ok) {
+    size_t take = PROJ_WRITE_BUF - sw->used;
+    if (take > n) take = n;
+    memcpy(sw->buf + sw->used, b, take);
+    sw->used += take;
+    b += take;
+    n -= take;
+    if (sw->used == PROJ_WRITE_BUF) (void)sw_flush(sw);
+  }
+}
+
+static bool sw_open(SegWriter *sw, const char *tmp) {
+  memset(sw, 0, sizeof(*sw));
+  sw->ok = true;
+  sw->min_seq = UINT64_MAX;
+  sw->buf = (uint8_t *)malloc(PROJ_WRITE_BUF);
+  sw->fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  ProjSegHeader blank;
+  memset(&blank, 0, sizeof(blank));
+  if (!sw->buf || sw->fd < 0 || !write_all(sw->fd, &blank, sizeof(blank))) sw->ok = false;
+  return sw->ok;
+}
+
+/* Takes the next record in db_ref order; a repeated db_ref keeps the older project. */
+static void sw_record(SegWriter *sw, const AiirProjectRecord *r) {
+  if (sw->count > 0 && strcmp(sw->last_db, r->db_ref) == 0) return;
+  if (sw->count >= PROJ_NIL) {
+    sw->ok = false;
+    return;
+  }
+  if (r->idem[0] != '\0') {
+    if (sw->idem_n == sw->idem_cap) {
+      size_t cap = sw->idem_cap ? sw->idem_cap * 2u : 1024u;
+      ProjIdemEntry *v = (ProjIdemEntry *)realloc(sw->idem, cap * sizeof(*v));
+      if (!v) {
+        sw->ok = false;
+        return;
+      }
+      sw->idem = v;
+      sw->idem_cap = cap;
+    }
+    sw->idem[sw->idem_n].hash = str_hash(r->idem);
+    sw->idem[sw->idem_n].rec = (uint32_t)sw->count;
+    sw->idem[sw->idem_n].seq = r->seq;
+    sw->idem_n++;
+  }
+  sw_put(sw, r, sizeof(*r));
+  memcpy(sw->last_db, r->db_ref, sizeof(sw->last_db));
+  if (r->seq < sw->min_seq) sw->min_seq = r->seq;
+  if (r->seq > sw->max_seq) sw->max_seq = r->seq;
+  sw->count++;
+}
+
+static int cmp_idem_entry(const void *a, const void *b) {
+  const ProjIdemEntry *x = (const ProjIdemEntry *)a, *y = (const ProjIdemEntry *)b;
+  if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static AiirProjSegment *sw_finish(SegWriter *sw, const char *dir, const char *tmp, uint64_t min_seq, uint64_t max_seq) {
+  AiirProjSegment *seg = NULL;
+  char path[1300];
+  path[0] = '\0';
+  if (sw->ok && sw->count > 0) {
+    if (sw->idem_n > 1u) qsort(sw->idem, sw->idem_n, sizeof(ProjIdemEntry), cmp_idem_entry);
+    if (sw->idem_n > 0) sw_put(sw, sw->idem, sw->idem_n * sizeof(ProjIdemEntry));
+    ProjSegFooter f;
+    memset(&f, 0, sizeof(f));
+    memcpy(f.magic, AIIR_PROJSTORE_FOOT_MAGIC, 8);
+    f.records_off = sizeof(ProjSegHeader);
+    f.idem_off = f.records_off + sw->count * sizeof(AiirProjectRecord);
+    f.crc = aiir_crc32c(sw->crc, &f, offsetof(ProjSegFooter, crc));
+    sw->crc = 0;
+    sw_put(sw, &f, sizeof(f));
+    ProjSegHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, AIIR_PROJSTORE_SEG_MAGIC, 8);
+    h.version = AIIR_PROJSTORE_VERSION;
+    h.record_size = sizeof(AiirProjectRecord);
+    h.count = sw->count;
+    /* The name and header carry the whole seq range merged, even where duplicates were
+       dropped, so a crash between rename and unlink is recognised on open. */
+    h.min_seq = min_seq;
+    h.max_seq = max_seq;
+    h.idem_count = sw->idem_n;
+    h.crc = aiir_crc32c(0, &h, PROJ_HDR_CRC_LEN);
+    if (sw_flush(sw) && (pwrite(sw->fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || fdatasync(sw->fd) != 0)) sw->ok = false;
+    snprintf(path, sizeof(path), "%s/seg-%016llx-%016llx.aps", dir, (unsigned long long)min_seq, (unsigned long long)max_seq);
+  }
+  if (sw->fd >= 0) close(sw->fd);
+  free(sw->buf);
+  free(sw->idem);
+  if (sw->ok && path[0] && rename(tmp, path) == 0) {
+    sync_dir(dir);
+    seg = seg_open(path);
+  } else {
+    (void)unlink(tmp);
+  }
+  return seg;
+}
+
+static int cmp_record_db(const void *a, const void *b) {
+  const AiirProjectRecord *x = (const AiirProjectRecord *)a, *y = (const AiirProjectRecord *)b;
+  int c = strcmp(x->db_ref, y->db_ref);
+  if (c != 0) return c;
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/* ---- active log ---- */
+
+static void log_path(const AiirProjectStore *ps, char *out, size_t cap, const char *suffix) {
+  snprintf(out, cap, "%s/active.log%s", ps->dir, suffix);
+}
+
+static int log_create(const char *path, const AiirProjectRecord *recs, size_t n, bool sync) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0666);
+  if (fd < 0) return -1;
+  ProjLogHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, AIIR_PROJSTORE_LOG_MAGIC, 8);
+  h.version = AIIR_PROJSTORE_VERSION;
+  h.record_size = sizeof(AiirProjectRecord);
+  if (!write_all(fd, &h, sizeof(h)) || (n > 0 && !write_all(fd, recs, n * sizeof(*recs))) || (sync && fdatasync(fd) != 0)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* Loads the active log into the memtable, skipping what sealed segments already hold and
+   cutting a torn or damaged tail. */
+static bool log_replay(AiirProjectStore *ps, uint64_t sealed_max) {
+  char path[1100];
+  log_path(ps, path, sizeof(path), "");
+  int fd = open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    fd = log_create(path, NULL, 0, true);
+    if (fd < 0) return false;
+    sync_dir(ps->dir);
+    ps->log_fd = fd;
+    ps->log_bytes = sizeof(ProjLogHeader);
+    return true;
+  }
+  ProjLogHeader h;
+  ssize_t got = pread(fd, &h, sizeof(h), 0);
+  if (got != (ssize_t)sizeof(h) || memcmp(h.magic, AIIR_PROJSTORE_LOG_MAGIC, 8) != 0 ||
+      h.version != AIIR_PROJSTORE_VERSION || h.record_size != sizeof(AiirProjectRecord)) {
+    close(fd);
+    /* Not a log this build can read: keep it aside (never overwriting an earlier one) and
+       start an empty log. An empty file is only a create that never got its header. */
+    if (got > 0) {
+      char bad[1120];
+      snprintf(bad, sizeof(bad), "%s.bad", path);
+      for (unsigned i = 1; access(bad, F_OK) == 0 && i < 1000u; i++) snprintf(bad, sizeof(bad), "%s.bad.%u", path, i);
+      if (rename(path, bad) != 0) return false;
+      atomic_fetch_add(&ps->errors_total, 1u);
+    }
+    fd = log_create(path, NULL, 0, true);
+    if (fd < 0) return false;
+    sync_dir(ps->dir);
+    ps->log_fd = fd;
+    ps->log_bytes = sizeof(ProjLogHeader);
+    return true;
+  }
+  uint64_t off = sizeof(h), last = 0;
+  AiirProjectRecord r;
+  while (pread(fd, &r, sizeof(r), (off_t)off) == (ssize_t)sizeof(r)) {
+    if (!record_valid(&r) || r.seq <= last) break;
+    off += sizeof(r);
+    last = r.seq;
+    if (r.seq >= ps->next_seq) ps->next_seq = r.seq + 1u;
+    if (r.seq <= sealed_max) continue;
+    if (!mem_reserve(ps)) {
+      close(fd);
+      return false;
+    }
+    ps->mem[ps->mem_n] = r;
+    mem_link(ps, (uint32_t)ps->mem_n);
+    ps->mem_n++;
+  }
+  if (ftruncate(fd, (off_t)off) != 0) {
+    close(fd);
+    return false;
+  }
+  close(fd);
+  ps->log_fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+  ps->log_bytes = off;
+  return ps->log_fd >= 0;
+}
+
+/* ---- maintenance ---- */
+
+static bool seg_list_insert(AiirProjectStore *ps, size_t at, size_t remove, AiirProjSegment *seg) {
+  if (remove == 0) {
+    AiirProjSegment **v = (AiirProjSegment **)realloc(ps->segs, (ps->nseg + 1u) * sizeof(*v));
+    if (!v) return false;
+    ps->segs = v;
+  }
+  memmove(&ps->segs[at + 1u], &ps->segs[at + remove], (ps->nseg - at - remove) * sizeof(*ps->segs));
+  ps->segs[at] = seg;
+  ps->nseg = ps->nseg + 1u - remove;
+  return true;
+}
+
+/* Writes the current memtable as a segment, then drops those records from the memtable and
+   rewrites the active log with whatever was created meanwhile. */
+static bool projstore_seal(AiirProjectStore *ps) {
+  pthread_rwlock_rdlock(&ps->lock);
+  size_t n = ps->mem_n;
+  AiirProjectRecord *copy = n > 0 ? (AiirProjectRecord *)malloc(n * sizeof(AiirProjectRecord)) : NULL;
+  if (copy) memcpy(copy, ps->mem, n * sizeof(AiirProjectRecord));
+  pthread_rwlock_unlock(&ps->lock);
+  if (n == 0) return true;
+  if (!copy) return false;
+
+  uint64_t min_seq = copy[0].seq, max_seq = copy[n - 1u].seq;
+  qsort(copy, n, sizeof(*copy), cmp_record_db);
+  char tmp[1100];
+  snprintf(tmp, sizeof(tmp), "%s/seal.tmp", ps->dir);
+  SegWriter sw;
+  (void)sw_open(&sw, tmp);
+  for (size_t i = 0; i < n; i++) sw_record(&sw, &copy[i]);
+  free(copy);
+  AiirProjSegment *seg = sw_finish(&sw, ps->dir, tmp, min_seq, max_seq);
+  if (!seg) return false;
+
+  pthread_mutex_lock(&ps->append_lock);
+  pthread_rwlock_wrlock(&ps->lock);
+  bool ok = seg_list_insert(ps, ps->nseg, 0, seg);
+  if (ok) {
+    ps->mem_n -= n;
+    memmove(ps->mem, ps->mem + n, ps->mem_n * sizeof(AiirProjectRecord));
+    mem_relink(ps);
+    /* If the rewrite fails the old log stays: its sealed records are skipped on replay. */
+    char path[1100], next[1100];
+    log_path(ps, path, sizeof(path), "");
+    log_path(ps, next, sizeof(next), ".tmp");
+    int fd = log_create(next, ps->mem, ps->mem_n, true);
+    if (fd >= 0 && rename(next, path) == 0) {
+      close(ps->log_fd);
+      ps->log_fd = fd;
+      ps->log_bytes = sizeof(ProjLogHeader) + ps->mem_n * sizeof(AiirProjectRecord);
+      sync_dir(ps->dir);
+    } else if (fd >= 0) {
+      close(fd);
+      (void)unlink(next);
+    }
+  }
+  pthread_rwlock_unlock(&ps->lock);
+  pthread_mutex_unlock(&ps->append_lock);
+  if (!ok) {
+    (void)unlink(seg->path);
+    seg_free(seg);
+    return false;
+  }
+  atomic_fetch_add(&ps->seals_total, 1u);
+  return true;
+}
+
+/* Size-tiered: the newest run of segments no more than PROJ_TIER_RATIO times the newest one
+   is merged once it is `compact_segments` long. Returns the run as [*lo, *hi). */
+static bool pick_merge(AiirProjectStore *ps, size_t *lo, size_t *hi) {
+  pthread_rwlock_rdlock(&ps->lock);
+  size_t n = ps->nseg;
+  bool pick = false;
+  if (n >= 2u) {
+    uint64_t base = ps->segs[n - 1u]->count;
+    size_t k = n - 1u;
+    while (k > 0 && ps->segs[k - 1u]->count < base * PROJ_TIER_RATIO) k--;
+    if (n - k >= ps->cfg.compact_segments) {
+      *lo = k;
+      *hi = n;
+      pick = true;
+    }
+  }
+  pthread_rwlock_unlock(&ps->lock);
+  return pick;
+}
+
+/* K-way merge of segments [lo, hi) by db_ref into one segment. Segments are immutable and
+   only this thread replaces them, so they are read without the lock. */
+static bool projstore_merge(AiirProjectStore *ps, size_t lo, size_t hi) {
+  size_t k = hi - lo;
+  pthread_rwlock_rdlock(&ps->lock);
+  AiirProjSegment **in = (AiirProjSegment **)malloc(k * sizeof(*in));
+  if (in) memcpy(in, &ps->segs[lo], k * sizeof(*in));
+  pthread_rwlock_unlock(&ps->lock);
+  uint64_t *pos = (uint64_t *)calloc(k, sizeof(uint64_t));
+  if (!in || !pos) {
+    free(in);
+    free(pos);
+    return false;
+  }
+  uint64_t min_seq = UINT64_MAX, max_seq = 0;
+  for (size_t i = 0; i < k; i++) {
+    if (in[i]->min_seq < min_seq) min_seq = in[i]->min_seq;
+    if (in[i]->max_seq > max_seq) max_seq = in[i]->max_seq;
+    (void)madvise(in[i]->map, in[i]->map_len, MADV_SEQUENTIAL);
+  }
+  char tmp[1100];
+  snprintf(tmp, sizeof(tmp), "%s/merge.tmp", ps->dir);
+  SegWriter sw;
+  (void)sw_open(&sw, tmp);
+  for (;;) {
+    const AiirProjectRecord *best = NULL;
+    size_t bi = 0;
+    for (size_t i = 0; i < k; i++) {
+      if (pos[i] >= in[i]->count) continue;
+      const AiirProjectRecord *r = &in[i]->recs[pos[i]];
+      if (!best || cmp_record_db(r, best) < 0) {
+        best = r;
+        bi = i;
+      }
+    }
+    if (!best || !sw.ok) break;
+    sw_record(&sw, best);
+    pos[bi]++;
+  }
+  free(pos);
+  for (size_t i = 0; i < k; i++) (void)madvise(in[i]->map, in[i]->map_len, MADV_RANDOM);
+  AiirProjSegment *seg = sw_finish(&sw, ps->dir, tmp, min_seq, max_seq);
+  if (!seg) {
+    free(in);
+    return false;
+  }
+  pthread_rwlock_wrlock(&ps->lock);
+  (void)seg_list_insert(ps, lo, k, seg);
+  pthread_rwlock_unlock(&ps->lock);
+  for (size_t i = 0; i < k; i++) {
+    (void)unlink(in[i]->path);
+    seg_free(in[i]);
+  }
+  free(in);
+  sync_dir(ps->dir);
+  atomic_fetch_add(&ps->compactions_total, 1u);
+  return true;
+}
+
+static void projstore_maintain(AiirProjectStore *ps) {
+  pthread_mutex_lock(&ps->maint_lock);
+  pthread_rwlock_rdlock(&ps->lock);
+  bool seal = ps->mem_n >= ps->cfg.seal_records;
+  pthread_rwlock_unlock(&ps->lock);
+  if (seal && !projstore_seal(ps)) atomic_fetch_add(&ps->errors_total, 1u);
+  size_t lo, hi;
+  while (pick_merge(ps, &lo, &hi)) {
+    if (!projstore_merge(ps, lo, hi)) {
+      atomic_fetch_add(&ps->errors_total, 1u);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ps->maint_lock);
+}
+
+/* Rewrites the export file when projects were created since it was last written. */
+static void projstore_export_due(AiirProjectStore *ps) {
+  if (ps->export_path[0] == '\0') return;
+  pthread_mutex_lock(&ps->append_lock);
+  uint64_t seq = ps->next_seq;
+  pthread_mutex_unlock(&ps->append_lock);
+  if (seq == ps->export_seq) return;
+  size_t n = 0;
+  if (aiir_projstore_export_ndjson(ps, ps->export_path, &n)) ps->export_seq = seq;
+  else atomic_fetch_add(&ps->errors_total, 1u);
+}
+
+static void *projstore_bg_main(void *arg) {
+  AiirProjectStore *ps = (AiirProjectStore *)arg;
+  size_t wait_ms = ps->export_path[0] ? ps->cfg.export_interval_ms : 5000u;
+  pthread_mutex_lock(&ps->bg_lock);
+  while (!ps->bg_stop) {
+    pthread_mutex_unlock(&ps->bg_lock);
+    projstore_maintain(ps);
+    projstore_export_due(ps);
+    pthread_mutex_lock(&ps->bg_lock);
+    /* Appends wake the thread once the memtable is full; the timeout retries after errors
+       and paces the export. */
+    struct timespec until;
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec += (time_t)(wait_ms / 1000u);
+    until.tv_nsec += (long)(wait_ms % 1000u) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000L;
+    }
+    while (!ps->bg_stop && !ps->bg_pending) {
+      if (pthread_cond_timedwait(&ps->bg_wake, &ps->bg_lock, &until) == ETIMEDOUT) break;
+    }
+    ps->bg_pending = false;
+  }
+  pthread_mutex_unlock(&ps->bg_lock);
+  projstore_export_due(ps);
+  return NULL;
+}
+
+/* ---- public ---- */
+
+static int cmp_seg_range(const void *a, const void *b) {
+  const AiirProjSegment *x = *(AiirProjSegment *const *)a, *y = *(AiirProjSegment *const *)b;
+  if (x->min_seq != y->min_seq) return x->min_seq < y->min_seq ? -1 : 1;
+  return x->max_seq > y->max_seq ? -1 : x->max_seq < y->max_seq;
+}
+
+static bool load_segments(AiirProjectStore *ps) {
+  DIR *d = opendir(ps->dir);
+  if (!d) return false;
+  struct dirent *e;
+  size_t cap = 0;
+  bool ok = true;
+  while (ok && (e = readdir(d)) != NULL) {
+    const char *nm = e->d_name;
+    char path[1300];
+    snprintf(path, sizeof(path), "%s/%s", ps->dir, nm);
+    size_t nl = strlen(nm);
+    if (nl > 4u && strcmp(nm + nl - 4u, ".tmp") == 0) {
+      (void)unlink(path);
+      continue;
+    }
+    unsigned long long a, b;
+    char tail[8];
+    if (sscanf(nm, "seg-%16llx-%16llx%7s", &a, &b, tail) != 3 || strcmp(tail, ".aps") != 0) continue;
+    AiirProjSegment *s = seg_open(path);
+    if (!s) {
+      char bad[1310];
+      snprintf(bad, sizeof(bad), "%s.bad", path);
+      (void)rename(path, bad);
+      atomic_fetch_add(&ps->errors_total, 1u);
+      continue;
+    }
+    if (ps->nseg == cap) {
+      size_t nc = cap ? cap * 2u : 16u;
+      AiirProjSegment **v = (AiirProjSegment **)realloc(ps->segs, nc * sizeof(*v));
+      if (!v) {
+        seg_free(s);
+        ok = false;
+        break;
+      }
+      ps->segs = v;
+      cap = nc;
+    }
+    ps->segs[ps->nseg++] = s;
+  }
+  closedir(d);
+  if (!ok) return false;
+  if (ps->nseg > 1u) qsort(ps->segs, ps->nseg, sizeof(*ps->segs), cmp_seg_range);
+  /* Inputs of a merge that finished its rename but not its unlinks lie inside its range. */
+  size_t kept = 0;
+  for (size_t i = 0; i < ps->nseg; i++) {
+    AiirProjSegment *s = ps->segs[i];
+    if (kept > 0 && s->max_seq <= ps->segs[kept - 1u]->max_seq) {
+      (void)unlink(s->path);
+      seg_free(s);
+      continue;
+    }
+    ps->segs[kept++] = s;
+  }
+  ps->nseg = kept;
+  return true;
+}
+
+bool aiir_projstore_open(AiirProjectStore *ps, const char *dir, const AiirProjectStoreConfig *cfg) {
+  memset(ps, 0, sizeof(*ps));
+  ps->log_fd = -1;
+  if ((size_t)snprintf(ps->dir, sizeof(ps->dir), "%s", dir) >= sizeof(ps->dir)) return false;
+  ps->cfg = *cfg;
+  if (cfg->export_path && (size_t)snprintf(ps->export_path, sizeof(ps->export_path), "%s", cfg->export_path) >=
+                              sizeof(ps->export_path)) {
+    return false;
+  }
+  ps->cfg.export_path = NULL;
+  if (ps->cfg.export_interval_ms == 0) ps->cfg.export_interval_ms = 1u;
+  if (ps->cfg.seal_records == 0) ps->cfg.seal_records = 1u;
+  if (ps->cfg.compact_segments < 2u) ps->cfg.compact_segments = 2u;
+  if (mkdir(ps->dir, 0750) != 0 && errno != EEXIST) return false;
+  pthread_condattr_t ca;
+  pthread_condattr_init(&ca);
+  pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+  pthread_rwlock_init(&ps->lock, NULL);
+  pthread_mutex_init(&ps->append_lock, NULL);
+  pthread_mutex_init(&ps->maint_lock, NULL);
+  pthread_mutex_init(&ps->bg_lock, NULL);
+  pthread_cond_init(&ps->bg_wake, &ca);
+  pthread_condattr_destroy(&ca);
+
+  if (!load_segments(ps)) return false;
+  uint64_t sealed_max = 0;
+  for (size_t i = 0; i < ps->nseg; i++) {
+    if (ps->segs[i]->max_seq > sealed_max) sealed_max = ps->segs[i]->max_seq;
+  }
+  ps->next_seq = sealed_max + 1u;
+  if (!log_replay(ps, sealed_max)) return false;
+  /* An empty store has nothing to export yet; anything else is written on the first pass. */
+  ps->export_seq = ps->next_seq == 1u ? 1u : 0u;
+
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  int rc = pthread_create(&ps->thread, NULL, projstore_bg_main, ps);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (rc != 0) return false;
+  ps->running = true;
+  return true;
+}
+
+bool aiir_projstore_find_idem(AiirProjectStore *ps, const char *idem, AiirProjectRecord *out) {
+  if (!idem || !*idem) return false;
+  uint32_t hash = str_hash(idem);
+  bool found = false;
+  pthread_rwlock_rdlock(&ps->lock);
+  for (size_t i = 0; i < ps->nseg && !found; i++) {
+    const AiirProjectRecord *r = seg_find_idem(ps->segs[i], idem, hash);
+    if (r) {
+      *out = *r;
+      found = true;
+    }
+  }
+  if (!found) {
+    uint32_t i = mem_find_idem(ps, idem, hash);
+    if (i != PROJ_NIL) {
+      *out = ps->mem[i];
+      found = true;
+    }
+  }
+  pthread_rwlock_unlock(&ps->lock);
+  return found;
+}
+
+static bool has_db_locked(const AiirProjectStore *ps, const char *project_ref, const char *db_ref) {
+  uint32_t i = mem_find_db(ps, db_ref, str_hash(db_ref));
+  if (i != PROJ_NIL) return !project_ref || strcmp(ps->mem[i].project_ref, project_ref) == 0;
+  for (size_t k = ps->nseg; k-- > 0;) {
+    const AiirProjectRecord *r = seg_find_db(ps->segs[k], db_ref);
+    if (r) return !project_ref || strcmp(r->project_ref, project_ref) == 0;
+  }
+  return false;
+}
+
+bool aiir_projstore_has_db(AiirProjectStore *ps, const char *project_ref, const char *db_ref) {
+  pthread_rwlock_rdlock(&ps->lock);
+  bool ok = has_db_locked(ps, project_ref, db_ref);
+  pthread_rwlock_unlock(&ps->lock);
+  return ok;
+}
+
+static bool projstore_append(AiirProjectStore *ps, AiirProjectRecord *rec, bool sync, size_t *mem_after) {
+  pthread_mutex_lock(&ps->append_lock);
+  /* Reserve first so a record that reached the log always makes it into the memtable. */
+  pthread_rwlock_wrlock(&ps->lock);
+  bool ok = mem_reserve(ps);
+  pthread_rwlock_unlock(&ps->lock);
+  if (ok) {
+    rec->seq = ps->next_seq;
+    rec->crc = aiir_crc32c(0, rec, PROJ_REC_CRC_LEN);
+    ok = write_all(ps->log_fd, rec, sizeof(*rec)) && (!sync || fdatasync(ps->log_fd) == 0);
+    if (!ok) (void)!ftruncate(ps->log_fd, (off_t)ps->log_bytes);
+  }
+  size_t mem_n = 0;
+  if (ok) {
+    ps->log_bytes += sizeof(*rec);
+    ps->next_seq++;
+    pthread_rwlock_wrlock(&ps->lock);
+    ps->mem[ps->mem_n] = *rec;
+    mem_link(ps, (uint32_t)ps->mem_n);
+    mem_n = ++ps->mem_n;
+    pthread_rwlock_unlock(&ps->lock);
+  } else {
+    atomic_fetch_add(&ps->errors_total, 1u);
+  }
+  pthread_mutex_unlock(&ps->append_lock);
+  if (mem_n >= ps->cfg.seal_records) {
+    pthread_mutex_lock(&ps->bg_lock);
+    ps->bg_pending = true;
+    pthread_cond_signal(&ps->bg_wake);
+    pthread_mutex_unlock(&ps->bg_lock);
+  }
+  if (mem_after) *mem_after = mem_n;
+  return ok;
+}
+
+bool aiir_projstore_append(AiirProjectStore *ps, AiirProjectRecord *rec) {
+  return projstore_append(ps, rec, ps->cfg.fdatasync, NULL);
+}
+
+/* Copies the string value of "key" from a flat JSON line; values written by the gateway are
+   plain tokens, so escapes are only stepped over. */
+static bool ndjson_str(const char *line, const char *key, char *out, size_t cap) {
+  char pat[64];
+  snprintf(pat, sizeof(pat), "\"%s\":\"", key);
+  const char *p = strstr(line, pat);
+  if (!p) return false;
+  p += strlen(pat);
+  size_t n = 0;
+  for (; *p && *p != '"'; p++) {
+    if (*p == '\\' && p[1]) p++;
+    if (n + 1u >= cap) return false;
+    out[n++] = *p;
+  }
+  if (*p != '"') return false;
+  out[n] = '\0';
+  return true;
+}
+
+static uint64_t ndjson_u64(const char *line, const char *key) {
+  char pat[64];
+  snprintf(pat, sizeof(pat), "\"%s\":", key);
+  const char *p = strstr(line, pat);
+  return p ? strtoull(p + strlen(pat), NULL, 10) : 0u;
+}
+
+bool aiir_projstore_import_ndjson(AiirProjectStore *ps, const char *path, size_t *imported, size_t *skipped) {
+  *imported = 0;
+  *skipped = 0;
+  FILE *fp = fopen(path, "r");
+  if (!fp) return false;
+  char line[4096];
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), fp)) {
+    AiirProjectRecord r;
+    memset(&r, 0, sizeof(r));
+    if (!ndjson_str(line, "project_ref", r.project_ref, sizeof(r.project_ref)) ||
+        !ndjson_str(line, "db_ref", r.db_ref, sizeof(r.db_ref)) || r.project_ref[0] == '\0' || r.db_ref[0] == '\0' ||
+        aiir_projstore_has_db(ps, NULL, r.db_ref)) {
+      if (line[0] != '\n') (*skipped)++;
+      continue;
+    }
+    if (!ndjson_str(line, "idempotency_key", r.idem, sizeof(r.idem))) r.idem[0] = '\0';
+    if (!ndjson_str(line, "project_name", r.project_name, sizeof(r.project_name))) r.project_name[0] = '\0';
+    if (!ndjson_str(line, "db_profile", r.db_profile, sizeof(r.db_profile))) r.db_profile[0] = '\0';
+    if (!ndjson_str(line, "region", r.region, sizeof(r.region))) r.region[0] = '\0';
+    if (!ndjson_str(line, "contract_version", r.contract_version, sizeof(r.contract_version))) {
+      (void)field_set(r.contract_version, sizeof(r.contract_version), "hal.v1");
+    }
+    if (!ndjson_str(line, "intent", r.intent, sizeof(r.intent))) {
+      (void)field_set(r.intent, sizeof(r.intent), "create_project");
+    }
+    r.ts = ndjson_u64(line, "ts");
+    r.retention_days = (uint32_t)ndjson_u64(line, "retention_days");
+    size_t mem_n = 0;
+    ok = projstore_append(ps, &r, false, &mem_n);
+    if (ok) (*imported)++;
+    /* Keep the memtable bounded when importing faster than the background thread seals. */
+    if (ok && mem_n >= ps->cfg.seal_records * 4u) projstore_maintain(ps);
+  }
+  fclose(fp);
+  pthread_mutex_lock(&ps->append_lock);
+  if (ok && *imported > 0 && fdatasync(ps->log_fd) != 0) ok = false;
+  pthread_mutex_unlock(&ps->append_lock);
+  return ok;
+}
+
+static int cmp_record_seq(const void *a, const void *b) {
+  const AiirProjectRecord *x = *(const AiirProjectRecord *const *)a, *y = *(const AiirProjectRecord *const *)b;
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static void export_line(FILE *fp, const AiirProjectRecord *r) {
+  fprintf(fp,
+          "{\"ts\":%llu,\"project_ref\":\"%s\",\"db_ref\":\"%s\",\"project_name\":\"%s\",\"db_profile\":\"%s\",\"region\":\"%s\",\"retention_days\":%u,\"idempotency_key\":\"%s\",\"contract_version\":\"%s\",\"intent\":\"%s\"}\n",
+          (unsigned long long)r->ts, r->project_ref, r->db_ref, r->project_name, r->db_profile, r->region,
+          (unsigned)r->retention_days, r->idem, r->contract_version, r->intent);
+}
+
+/* Segments cover disjoint, increasing seq ranges and the memtable follows them, so sorting
+   each segment by seq on its own gives creation order overall. `maint_lock` keeps the
+   segment list from being sealed into or merged meanwhile; creates go on while it runs. */
+bool aiir_projstore_export_ndjson(AiirProjectStore *ps, const char *path, size_t *exported) {
+  *exported = 0;
+  char tmp[1100];
+  if ((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp)) return false;
+  pthread_mutex_lock(&ps->maint_lock);
+  pthread_rwlock_rdlock(&ps->lock);
+  size_t nseg = ps->nseg, mem_n = ps->mem_n;
+  AiirProjSegment **segs = (AiirProjSegment **)malloc((nseg ? nseg : 1u) * sizeof(*segs));
+  AiirProjectRecord *mem = (AiirProjectRecord *)malloc((mem_n ? mem_n : 1u) * sizeof(*mem));
+  if (segs) memcpy(segs, ps->segs, nseg * sizeof(*segs));
+  if (mem) memcpy(mem, ps->mem, mem_n * sizeof(*mem));
+  pthread_rwlock_unlock(&ps->lock);
+  FILE *fp = segs && mem ? fopen(tmp, "w") : NULL;
+  bool ok = fp != NULL;
+  for (size_t i = 0; ok && i < nseg; i++) {
+    const AiirProjSegment *s = segs[i];
+    const AiirProjectRecord **order = (const AiirProjectRecord **)malloc((s->count ? s->count : 1u) * sizeof(*order));
+    if (!order) {
+      ok = false;
+      break;
+    }
+    for (uint64_t k = 0; k < s->count; k++) order[k] = &s->recs[k];
+    qsort(order, (size_t)s->count, sizeof(*order), cmp_record_seq);
+    for (uint64_t k = 0; k < s->count; k++) export_line(fp, order[k]);
+    *exported += (size_t)s->count;
+    free(order);
+  }
+  pthread_mutex_unlock(&ps->maint_lock);
+  for (size_t i = 0; ok && i < mem_n; i++) export_line(fp, &mem[i]);
+  *exported += ok ? mem_n : 0u;
+  free(segs);
+  free(mem);
+  if (fp) {
+    ok = fflush(fp) == 0 && !ferror(fp) && fdatasync(fileno(fp)) == 0 && ok;
+    ok = fclose(fp) == 0 && ok;
+  }
+  if (ok && rename(tmp, path) != 0) ok = false;
+  if (!ok) (void)unlink(tmp);
+  return ok;
+}
+
+size_t aiir_projstore_count(AiirProjectStore *ps) {
+  pthread_rwlock_rdlock(&ps->lock);
+  uint64_t n = ps->mem_n;
+  for (size_t i = 0; i < ps->nseg; i++) n += ps->segs[i]->count;
+  pthread_rwlock_unlock(&ps->lock);
+  return (size_t)n;
+}
+
+void aiir_projstore_shape(AiirProjectStore *ps, size_t *segments, size_t *memtable) {
+  pthread_rwlock_rdlock(&ps->lock);
+  *segments = ps->nseg;
+  *memtable = ps->mem_n;
+  pthread_rwlock_unlock(&ps->lock);
+}
+
+void aiir_projstore_close(AiirProjectStore *ps) {
+  if (ps->running) {
+    pthread_mutex_lock(&ps->bg_lock);
+    ps->bg_stop = true;
+    pthread_cond_signal(&ps->bg_wake);
+    pthread_mutex_unlock(&ps->bg_lock);
+    pthread_join(ps->thread, NULL);
+    ps->running = false;
+  }
+  for (size_t i = 0; i < ps->nseg; i++) seg_free(ps->segs[i]);
+  free(ps->segs);
+  free(ps->mem);
+  free(ps->mem_idem_next);
+  free(ps->mem_ref_next);
+  free(ps->mem_idem_buckets);
+  free(ps->mem_ref_buckets);
+  if (ps->log_fd >= 0) close(ps->log_fd);
+  ps->segs = NULL;
+  ps->nseg = 0;
+  ps->mem = NULL;
+  ps->mem_idem_next = ps->mem_ref_next = ps->mem_idem_buckets = ps->mem_ref_buckets = NULL;
+  ps->mem_n = ps->mem_cap = 0;
+  ps->log_fd = -1;
+  pthread_cond_destroy(&ps->bg_wake);
+  pthread_mutex_destroy(&ps->bg_lock);
+  pthread_mutex_destroy(&ps->maint_lock);
+  pthread_mutex_destroy(&ps->append_lock);
+  pthread_rwlock_destroy(&ps->lock);
+}
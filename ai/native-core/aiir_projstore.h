@@ -0,0 +1,105 @@
+#ifndef AIIR_PROJSTORE_H
+#define AIIR_PROJSTORE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AIIR_PROJSTORE_LOG_MAGIC "AIIRPLG1"
+#define AIIR_PROJSTORE_SEG_MAGIC "AIIRPSG1"
+#define AIIR_PROJSTORE_FOOT_MAGIC "AIIRPSF1"
+#define AIIR_PROJSTORE_VERSION 1u
+
+/* One project, fixed layout, host byte order. Strings are NUL-terminated within their field;
+   `crc` is the CRC-32C of everything before it. `seq` orders projects by creation. */
+typedef struct {
+  uint64_t seq;
+  uint64_t ts;
+  char project_ref[64];
+  char db_ref[64];
+  char idem[96];
+  char project_name[96];
+  char db_profile[64];
+  char region[64];
+  char contract_version[24];
+  char intent[40];
+  uint32_t retention_days;
+  uint32_t crc;
+} AiirProjectRecord;
+
+typedef struct {
+  size_t seal_records;     /* memtable size that triggers writing it out as a segment */
+  size_t compact_segments; /* merge once this many segments of similar size pile up */
+  bool fdatasync;          /* fdatasync the active log after every create */
+  const char *export_path; /* projects.ndjson kept in step by the background thread; NULL for none */
+  size_t export_interval_ms;
+} AiirProjectStoreConfig;
+
+typedef struct AiirProjSegment AiirProjSegment;
+
+/* Log-structured store in one directory:
+   - `active.log`: every create since the last seal, appended one record at a time; its
+     records also live in an in-memory table hashed by idempotency key and db_ref
+   - `seg-<min seq>-<max seq>.aps`: immutable segments, records sorted by db_ref, followed by
+     an idempotency-key hash index and a CRC-checked footer; read through mmap
+   A background thread seals a full memtable into a segment and merges runs of similarly
+   sized segments. Lookups take the read side of `lock` and never touch the disk index
+   beyond the mapped pages they binary-search. */
+typedef struct {
+  char dir[1024];
+  AiirProjectStoreConfig cfg;
+  pthread_rwlock_t lock;          /* segment list and memtable */
+  pthread_mutex_t append_lock;    /* active log writes; taken before `lock` */
+  pthread_mutex_t maint_lock;     /* one seal or merge at a time */
+  AiirProjSegment **segs;         /* oldest first */
+  size_t nseg;
+  AiirProjectRecord *mem;
+  uint32_t *mem_idem_next;
+  uint32_t *mem_ref_next;
+  uint32_t *mem_idem_buckets;
+  uint32_t *mem_ref_buckets;
+  size_t mem_n;
+  size_t mem_cap;
+  size_t mem_mask;
+  int log_fd;
+  uint64_t log_bytes;
+  uint64_t next_seq;
+  pthread_mutex_t bg_lock;
+  pthread_cond_t bg_wake;
+  bool bg_stop;
+  bool bg_pending;
+  bool running;
+  pthread_t thread;
+  char export_path[1024];
+  uint64_t export_seq; /* next_seq when the export file was last written; background thread only */
+  _Atomic uint64_t seals_total;
+  _Atomic uint64_t compactions_total;
+  _Atomic uint64_t errors_total;
+} AiirProjectStore;
+
+/* Opens (creating when missing) the store in `dir`, replays the active log, maps every
+   segment and starts the background sealer/compactor. A segment left behind by an
+   interrupted compaction is removed; a damaged one is renamed to `<name>.bad` and skipped.
+   With an export path the same thread rewrites that file every `export_interval_ms` while
+   projects are being created, and once more on close. */
+bool aiir_projstore_open(AiirProjectStore *ps, const char *dir, const AiirProjectStoreConfig *cfg);
+/* Finds the first project created with `idem`. */
+bool aiir_projstore_find_idem(AiirProjectStore *ps, const char *idem, AiirProjectRecord *out);
+bool aiir_projstore_has_db(AiirProjectStore *ps, const char *project_ref, const char *db_ref);
+/* Assigns `seq` and `crc`, writes the record to the active log and makes it visible;
+   false when it could not be written. */
+bool aiir_projstore_append(AiirProjectStore *ps, AiirProjectRecord *rec);
+/* Appends every project of a projects.ndjson file whose db_ref is not stored yet, with one
+   sync at the end. Returns false only when the file cannot be read or a write fails. */
+bool aiir_projstore_import_ndjson(AiirProjectStore *ps, const char *path, size_t *imported, size_t *skipped);
+/* Writes every project, oldest first, as projects.ndjson lines to `<path>.tmp` and renames
+   it over `path`. */
+bool aiir_projstore_export_ndjson(AiirProjectStore *ps, const char *path, size_t *exported);
+size_t aiir_projstore_count(AiirProjectStore *ps);
+void aiir_projstore_shape(AiirProjectStore *ps, size_t *segments, size_t *memtable);
+/* Stops the background thread and unmaps everything; the active log keeps unsealed projects. */
+void aiir_projstore_close(AiirProjectStore *ps);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef AIIR_SDT_H
+#define AIIR_SDT_H
+
+#include <stdint.h>
+
+/* USDT (SystemTap SDT) probes, compatible with what <sys/sdt.h> emits, so bpftrace, perf
+   and stap find them as `usdt:<binary>:aiir:<name>` without the header being installed.
+   A probe is one `nop` plus an ELF note (.note.stapsdt) recording its address and where
+   its arguments live; nothing runs until a tracer attaches and patches the nop. Every
+   argument is passed as a 64-bit unsigned value; strings are passed as pointers (read them
+   with str(argN)). Define AIIR_NO_SDT to compile the probes out. */
+
+#if !defined(AIIR_NO_SDT) && defined(__GNUC__) && defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__))
+
+#define AIIR_SDT_ASM(name, args)                                              \
+  "990: nop\n"                                                                \
+  ".pushsection .note.stapsdt,\"?\",\"note\"\n"                               \
+  ".balign 4\n"                                                               \
+  ".4byte 992f-991f, 994f-993f, 3\n"                                          \
+  "991: .asciz \"stapsdt\"\n"                                                 \
+  "992: .balign 4\n"                                                          \
+  "993: .8byte 990b\n"                                                        \
+  ".8byte _.stapsdt.base\n"                                                   \
+  ".8byte 0\n"                                                                \
+  ".asciz \"aiir\"\n"                                                         \
+  ".asciz \"" #name "\"\n"                                                    \
+  ".asciz \"" args "\"\n"                                                     \
+  "994: .balign 4\n"                                                          \
+  ".popsection\n"                                                             \
+  ".ifndef _.stapsdt.base\n"                                                  \
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"     \
+  ".weak _.stapsdt.base\n"                                                    \
+  ".hidden _.stapsdt.base\n"                                                  \
+  "_.stapsdt.base: .space 1\n"                                                \
+  ".size _.stapsdt.base, 1\n"                                                 \
+  ".popsection\n"                                                             \
+  ".endif\n"
+
+#define AIIR_SDT_ARG(n, x) [a##n] "nor"((uint64_t)(x))
+
+#define AIIR_PROBE(name) __asm__ __volatile__(AIIR_SDT_ASM(name, ""))
+#define AIIR_PROBE1(name, x1) __asm__ __volatile__(AIIR_SDT_ASM(name, "8@%[a1]") : : AIIR_SDT_ARG(1, x1))
+#define AIIR_PROBE2(name, x1, x2) \
+  __asm__ __volatile__(AIIR_SDT_ASM(name, "8@%[a1] 8@%[a2]") : : AIIR_SDT_ARG(1, x1), AIIR_SDT_ARG(2, x2))
+#define AIIR_PROBE3(name, x1, x2, x3)                                                             \
+  __asm__ __volatile__(AIIR_SDT_ASM(name, "8@%[a1] 8@%[a2] 8@%[a3]") : : AIIR_SDT_ARG(1, x1), \
+                       AIIR_SDT_ARG(2, x2), AIIR_SDT_ARG(3, x3))
+#define AIIR_PROBE4(name, x1, x2, x3, x4)                                                                   \
+  __asm__ __volatile__(AIIR_SDT_ASM(name, "8@%[a1] 8@%[a2] 8@%[a3] 8@%[a4]") : : AIIR_SDT_ARG(1, x1), \
+                       AIIR_SDT_ARG(2, x2), AIIR_SDT_ARG(3, x3), AIIR_SDT_ARG(4, x4))
+
+#else
+
+#define AIIR_PROBE(name) ((void)0)
+#define AIIR_PROBE1(name, x1) ((void)(x1))
+#define AIIR_PROBE2(name, x1, x2) ((void)(x1), (void)(x2))
+#define AIIR_PROBE3(name, x1, x2, x3) ((void)(x1), (void)(x2), (void)(x3))
+#define AIIR_PROBE4(name, x1, x2, x3, x4) ((void)(x1), (void)(x2), (void)(x3), (void)(x4))
+
+#endif
+
+#endif
@@ -0,0 +1,196 @@
+#include "aiir_sha256.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define AIIR_SHA256_X86 1
+#endif
+
+typedef void (*Sha256BlocksFn)(uint32_t s[8], const uint8_t *p, size_t nblocks);
+
+static const uint32_t k256[64] = {
+  0x428a2f98u,0x71374491u,0xb5c0fbcfu,0xe9b5dba5u,0x3956c25bu,0x59f111f1u,0x923f82a4u,0xab1c5ed5u,
+  0xd807aa98u,0x12835b01u,0x243185beu,0x550c7dc3u,0x72be5d74u,0x80deb1feu,0x9bdc06a7u,0xc19bf174u,
+  0xe49b69c1u,0xefbe4786u,0x0fc19dc6u,0x240ca1ccu,0x2de92c6fu,0x4a7484aau,0x5cb0a9dcu,0x76f988dau,
+  0x983e5152u,0xa831c66du,0xb00327c8u,0xbf597fc7u,0xc6e00bf3u,0xd5a79147u,0x06ca6351u,0x14292967u,
+  0x27b70a85u,0x2e1b2138u,0x4d2c6dfcu,0x53380d13u,0x650a7354u,0x766a0abbu,0x81c2c92eu,0x92722c85u,
+  0xa2bfe8a1u,0xa81a664bu,0xc24b8b70u,0xc76c51a3u,0xd192e819u,0xd6990624u,0xf40e3585u,0x106aa070u,
+  0x19a4c116u,0x1e376c08u,0x2748774cu,0x34b0bcb5u,0x391c0cb3u,0x4ed8aa4au,0x5b9cca4fu,0x682e6ff3u,
+  0x748f82eeu,0x78a5636fu,0x84c87814u,0x8cc70208u,0x90befffau,0xa4506cebu,0xbef9a3f7u,0xc67178f2u
+};
+
+static inline uint32_t ror32(uint32_t x, uint32_t n) { return (x >> n) | (x << (32u - n)); }
+
+/* Portable compression, used when the CPU has no SHA extensions. */
+static void sha256_blocks_scalar(uint32_t s[8], const uint8_t *p, size_t nblocks) {
+  for (; nblocks > 0; nblocks--, p += 64) {
+    uint32_t w[64];
+    for (uint32_t i = 0; i < 16; i++) {
+      uint32_t j = i * 4u;
+      w[i] = ((uint32_t)p[j] << 24) | ((uint32_t)p[j + 1u] << 16) | ((uint32_t)p[j + 2u] << 8) | (uint32_t)p[j + 3u];
+    }
+    for (uint32_t i = 16; i < 64; i++) {
+      uint32_t s0 = ror32(w[i - 15u], 7u) ^ ror32(w[i - 15u], 18u) ^ (w[i - 15u] >> 3u);
+      uint32_t s1 = ror32(w[i - 2u], 17u) ^ ror32(w[i - 2u], 19u) ^ (w[i - 2u] >> 10u);
+      w[i] = w[i - 16u] + s0 + w[i - 7u] + s1;
+    }
+    uint32_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (uint32_t i = 0; i < 64; i++) {
+      uint32_t S1 = ror32(e, 6u) ^ ror32(e, 11u) ^ ror32(e, 25u);
+      uint32_t ch = (e & f) ^ ((~e) & g);
+      uint32_t t1 = h + S1 + ch + k256[i] + w[i];
+      uint32_t S0 = ror32(a, 2u) ^ ror32(a, 13u) ^ ror32(a, 22u);
+      uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+      uint32_t t2 = S0 + maj;
+      h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+    }
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+    s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+  }
+}
+
+#ifdef AIIR_SHA256_X86
+/* The SHA extensions keep the state as ABEF/CDGH pairs and run two rounds per sha256rnds2;
+   the schedule for group i is rebuilt in place from groups i-4..i-1. */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_shani(uint32_t s[8], const uint8_t *p, size_t nblocks) {
+  const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+  __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(const void *)&s[0]), 0xb1);
+  __m128i st1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(const void *)&s[4]), 0x1b);
+  __m128i st0 = _mm_alignr_epi8(tmp, st1, 8);
+  st1 = _mm_blend_epi16(st1, tmp, 0xf0);
+
+  for (; nblocks > 0; nblocks--, p += 64) {
+    __m128i abef = st0, cdgh = st1;
+    __m128i w[4];
+    for (int i = 0; i < 4; i++) {
+      w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(const void *)(p + i * 16)), bswap);
+    }
+    for (int i = 0; i < 16; i++) {
+      if (i >= 4) {
+        __m128i t = _mm_add_epi32(_mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]),
+                                  _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+        w[i & 3] = _mm_sha256msg2_epu32(t, w[(i + 3) & 3]);
+      }
+      __m128i m = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *)(const void *)&k256[i * 4]));
+      st1 = _mm_sha256rnds2_epu32(st1, st0, m);
+      st0 = _mm_sha256rnds2_epu32(st0, st1, _mm_shuffle_epi32(m, 0x0e));
+    }
+    st0 = _mm_add_epi32(st0, abef);
+    st1 = _mm_add_epi32(st1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(st0, 0x1b);
+  st1 = _mm_shuffle_epi32(st1, 0xb1);
+  _mm_storeu_si128((__m128i *)(void *)&s[0], _mm_blend_epi16(tmp, st1, 0xf0));
+  _mm_storeu_si128((__m128i *)(void *)&s[4], _mm_alignr_epi8(st1, tmp, 8));
+}
+#endif
+
+static Sha256BlocksFn sha256_blocks = sha256_blocks_scalar;
+
+void aiir_sha256_select(void) {
+#ifdef AIIR_SHA256_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) {
+    sha256_blocks = sha256_blocks_shani;
+  }
+#endif
+}
+
+void aiir_sha256_init(AiirSha256 *c) {
+  c->s[0] = 0x6a09e667u; c->s[1] = 0xbb67ae85u; c->s[2] = 0x3c6ef372u; c->s[3] = 0xa54ff53au;
+  c->s[4] = 0x510e527fu; c->s[5] = 0x9b05688cu; c->s[6] = 0x1f83d9abu; c->s[7] = 0x5be0cd19u;
+  c->bits = 0;
+  c->len = 0;
+}
+
+void aiir_sha256_update(AiirSha256 *c, const uint8_t *p, size_t n) {
+  if (n == 0) return;
+  if (c->len > 0) {
+    size_t take = 64u - c->len;
+    if (take > n) take = n;
+    memcpy(c->buf + c->len, p, take);
+    c->len += take;
+    p += take;
+    n -= take;
+    if (c->len < 64u) return;
+    sha256_blocks(c->s, c->buf, 1u);
+    c->bits += 512u;
+    c->len = 0;
+  }
+  /* Whole blocks are compressed straight from the caller's buffer. */
+  size_t nblocks = n / 64u;
+  if (nblocks > 0) {
+    sha256_blocks(c->s, p, nblocks);
+    c->bits += (uint64_t)nblocks * 512u;
+    p += nblocks * 64u;
+    n -= nblocks * 64u;
+  }
+  memcpy(c->buf, p, n);
+  c->len = n;
+}
+
+void aiir_sha256_final(AiirSha256 *c, uint8_t out[32]) {
+  c->bits += (uint64_t)c->len * 8u;
+  c->buf[c->len++] = 0x80u;
+  if (c->len > 56u) {
+    memset(c->buf + c->len, 0, 64u - c->len);
+    sha256_blocks(c->s, c->buf, 1u);
+    c->len = 0u;
+  }
+  memset(c->buf + c->len, 0, 56u - c->len);
+  for (int i = 0; i < 8; i++) c->buf[56 + i] = (uint8_t)(c->bits >> (56 - i * 8));
+  sha256_blocks(c->s, c->buf, 1u);
+  for (uint32_t i = 0; i < 8u; i++) {
+    out[i * 4u] = (uint8_t)(c->s[i] >> 24);
+    out[i * 4u + 1u] = (uint8_t)(c->s[i] >> 16);
+    out[i * 4u + 2u] = (uint8_t)(c->s[i] >> 8);
+    out[i * 4u + 3u] = (uint8_t)(c->s[i]);
+  }
+}
+
+void aiir_hmac_key_init(AiirHmacKey *k, const uint8_t *key, size_t key_len) {
+  uint8_t k0[64], pad[64];
+  memset(k0, 0, sizeof(k0));
+  if (key_len > 64u) {
+    AiirSha256 c;
+    aiir_sha256_init(&c);
+    aiir_sha256_update(&c, key, key_len);
+    aiir_sha256_final(&c, k0);
+  } else if (key_len > 0) {
+    memcpy(k0, key, key_len);
+  }
+  AiirSha256 c;
+  for (size_t i = 0; i < 64u; i++) pad[i] = (uint8_t)(k0[i] ^ 0x36u);
+  aiir_sha256_init(&c);
+  sha256_blocks(c.s, pad, 1u);
+  memcpy(k->inner, c.s, sizeof(k->inner));
+  for (size_t i = 0; i < 64u; i++) pad[i] = (uint8_t)(k0[i] ^ 0x5cu);
+  aiir_sha256_init(&c);
+  sha256_blocks(c.s, pad, 1u);
+  memcpy(k->outer, c.s, sizeof(k->outer));
+}
+
+void aiir_hmac_sha256_keyed(const AiirHmacKey *k, const uint8_t *msg, size_t msg_len, uint8_t out[32]) {
+  uint8_t tmp[32];
+  AiirSha256 c;
+  memcpy(c.s, k->inner, sizeof(c.s));
+  c.bits = 512u;
+  c.len = 0;
+  aiir_sha256_update(&c, msg, msg_len);
+  aiir_sha256_final(&c, tmp);
+
+  memcpy(c.s, k->outer, sizeof(c.s));
+  c.bits = 512u;
+  c.len = 0;
+  aiir_sha256_update(&c, tmp, sizeof(tmp));
+  aiir_sha256_final(&c, out);
+}
+
+void aiir_hmac_sha256(const uint8_t *key, size_t key_len, const uint8_t *msg, size_t msg_len, uint8_t out[32]) {
+  AiirHmacKey k;
+  aiir_hmac_key_init(&k, key, key_len);
+  aiir_hmac_sha256_keyed(&k, msg, msg_len, out);
+}
@@ -0,0 +1,33 @@
+#ifndef AIIR_SHA256_H
+#define AIIR_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  uint32_t s[8];
+  uint64_t bits;
+  uint8_t buf[64];
+  size_t len;
+} AiirSha256;
+
+/* Chaining values after compressing the ipad and opad key blocks; a keyed MAC over a short
+   message then costs one inner and one outer compression. */
+typedef struct {
+  uint32_t inner[8];
+  uint32_t outer[8];
+} AiirHmacKey;
+
+/* Picks the SHA-NI compression when the CPU supports it, portable C otherwise. Call once
+   before any worker thread hashes; hashing before it is still correct. */
+void aiir_sha256_select(void);
+
+void aiir_sha256_init(AiirSha256 *c);
+void aiir_sha256_update(AiirSha256 *c, const uint8_t *p, size_t n);
+void aiir_sha256_final(AiirSha256 *c, uint8_t out[32]);
+
+void aiir_hmac_key_init(AiirHmacKey *k, const uint8_t *key, size_t key_len);
+void aiir_hmac_sha256_keyed(const AiirHmacKey *k, const uint8_t *msg, size_t msg_len, uint8_t out[32]);
+void aiir_hmac_sha256(const uint8_t *key, size_t key_len, const uint8_t *msg, size_t msg_len, uint8_t out[32]);
+
+#endif
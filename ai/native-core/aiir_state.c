@@ -1,26 +1,365 @@
+#define _GNU_SOURCE
+
 #include "aiir_state.h"
 
+#include "aiir_core.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+
+/* Snapshot file: this header, `ops_n` AiirExecStat entries, then the CRC-32C of everything
+   before it. Host byte order, like the WAL. */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t metric_count;
+  uint64_t wal_lsn;
+  uint64_t exec_total;
+  uint64_t last_ts_ms;
+  uint64_t gateway_seq;
+  uint64_t written_ms;
+  uint64_t ops_n;
+  uint64_t metrics[AIIR_STATE_METRICS_MAX];
+} SnapHeader;
+
+_Static_assert(sizeof(AiirExecStat) == 24, "exec stat must stay 24 bytes");
+_Static_assert(sizeof(SnapHeader) == 64 + 8 * AIIR_STATE_METRICS_MAX, "snapshot header must stay packed");
+
+static uint64_t now_wall_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000u + (uint64_t)(ts.tv_nsec / 1000000);
+}
+
+static bool write_all(int fd, const void *buf, size_t n) {
+  const char *p = (const char *)buf;
+  while (n > 0) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += w;
+    n -= (size_t)w;
+  }
+  return true;
+}
+
+static void sync_parent_dir(const char *path) {
+  char dir[1024];
+  const char *slash = strrchr(path, '/');
+  if (slash) snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+  else snprintf(dir, sizeof(dir), ".");
+  if (dir[0] == '\0') snprintf(dir, sizeof(dir), "/");
+  int dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dfd < 0) return;
+  (void)fsync(dfd);
+  close(dfd);
+}
+
+static size_t op_hash(uint32_t op_id, size_t mask) {
+  return (size_t)((op_id * 0x9e3779b1u) & mask);
+}
+
+static bool image_grow(AiirStateImage *img) {
+  size_t cap = img->ops_cap ? img->ops_cap * 2u : 64u;
+  AiirExecStat *ops = (AiirExecStat *)calloc(cap, sizeof(AiirExecStat));
+  if (!ops) return false;
+  for (size_t i = 0; i < img->ops_cap; i++) {
+    const AiirExecStat *e = &img->ops[i];
+    if (!e->used) continue;
+    size_t k = op_hash(e->op_id, cap - 1u);
+    while (ops[k].used) k = (k + 1u) & (cap - 1u);
+    ops[k] = *e;
+  }
+  free(img->ops);
+  img->ops = ops;
+  img->ops_cap = cap;
+  return true;
+}
+
+/* Returns the entry for `op_id`, adding it when missing; NULL only when growing failed. */
+static AiirExecStat *image_op(AiirStateImage *img, uint32_t op_id) {
+  if ((img->ops_n + 1u) * 4u > img->ops_cap * 3u && !image_grow(img)) return NULL;
+  size_t mask = img->ops_cap - 1u;
+  size_t k = op_hash(op_id, mask);
+  while (img->ops[k].used) {
+    if (img->ops[k].op_id == op_id) return &img->ops[k];
+    k = (k + 1u) & mask;
+  }
+  AiirExecStat *e = &img->ops[k];
+  e->op_id = op_id;
+  e->used = 1u;
+  e->count = 0;
+  e->last_ts_ms = 0;
+  img->ops_n++;
+  return e;
+}
+
+/* Applies one WAL record; records the image already covers are ignored, so replay and the
+   commit hook can overlap safely. */
+static void image_fold(AiirStateImage *img, const AiirWalRecord *r) {
+  if (r->lsn <= img->wal_lsn) return;
+  img->wal_lsn = r->lsn;
+  if (r->type != AIIR_WAL_REC_DBEXEC) return;
+  img->exec_total++;
+  if (r->ts_ms > img->last_ts_ms) img->last_ts_ms = r->ts_ms;
+  AiirExecStat *e = image_op(img, r->op_id);
+  if (!e) return;
+  e->count++;
+  if (r->ts_ms > e->last_ts_ms) e->last_ts_ms = r->ts_ms;
+}
+
+static bool image_copy(AiirStateImage *dst, const AiirStateImage *src) {
+  if (dst->ops_cap != src->ops_cap) {
+    AiirExecStat *ops = (AiirExecStat *)realloc(dst->ops, (src->ops_cap ? src->ops_cap : 1u) * sizeof(AiirExecStat));
+    if (!ops) return false;
+    dst->ops = ops;
+    dst->ops_cap = src->ops_cap;
+  }
+  AiirExecStat *ops = dst->ops;
+  size_t cap = dst->ops_cap;
+  *dst = *src;
+  dst->ops = ops;
+  dst->ops_cap = cap;
+  if (cap > 0) memcpy(dst->ops, src->ops, cap * sizeof(AiirExecStat));
+  return true;
+}
+
+static void image_free(AiirStateImage *img) {
+  free(img->ops);
+  memset(img, 0, sizeof(*img));
+}
 
-bool aiir_state_init(AiirState *s, const char *wal_path, const char *snapshot_path, const char *meta_json) {
+static bool snapshot_load(AiirState *s) {
+  uint8_t *raw = NULL;
+  size_t len = 0;
+  if (!aiir_read_file(s->snapshot_path, &raw, &len)) return false;
+  SnapHeader h;
+  memset(&h, 0, sizeof(h));
+  bool ok = len >= sizeof(h) + sizeof(uint32_t);
+  if (ok) {
+    memcpy(&h, raw, sizeof(h));
+    ok = memcmp(h.magic, AIIR_SNAPSHOT_MAGIC, sizeof(h.magic)) == 0 && h.version == AIIR_SNAPSHOT_VERSION &&
+         h.metric_count <= AIIR_STATE_METRICS_MAX && h.ops_n <= (len - sizeof(h)) / sizeof(AiirExecStat) &&
+         len == sizeof(h) + h.ops_n * sizeof(AiirExecStat) + sizeof(uint32_t);
+  }
+  if (ok) {
+    uint32_t crc;
+    memcpy(&crc, raw + len - sizeof(crc), sizeof(crc));
+    ok = crc == aiir_crc32c(0, raw, len - sizeof(crc));
+  }
+  AiirStateImage *img = &s->live;
+  for (uint64_t i = 0; ok && i < h.ops_n; i++) {
+    AiirExecStat e;
+    memcpy(&e, raw + sizeof(h) + i * sizeof(e), sizeof(e));
+    AiirExecStat *slot = image_op(img, e.op_id);
+    if (!slot) ok = false;
+    else {
+      slot->count = e.count;
+      slot->last_ts_ms = e.last_ts_ms;
+    }
+  }
+  free(raw);
+  if (!ok) {
+    image_free(img);
+    return false;
+  }
+  img->wal_lsn = h.wal_lsn;
+  img->exec_total = h.exec_total;
+  img->last_ts_ms = h.last_ts_ms;
+  img->gateway_seq = h.gateway_seq;
+  img->metric_count = h.metric_count;
+  memcpy(img->metrics, h.metrics, sizeof(img->metrics));
+  return true;
+}
+
+/* Writes the image next to the snapshot, syncs it and renames it into place, so a crash
+   leaves either the old snapshot or the new one. */
+static bool snapshot_write(const char *path, const AiirStateImage *img) {
+  SnapHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, AIIR_SNAPSHOT_MAGIC, sizeof(h.magic));
+  h.version = AIIR_SNAPSHOT_VERSION;
+  h.metric_count = img->metric_count;
+  h.wal_lsn = img->wal_lsn;
+  h.exec_total = img->exec_total;
+  h.last_ts_ms = img->last_ts_ms;
+  h.gateway_seq = img->gateway_seq;
+  h.written_ms = now_wall_ms();
+  h.ops_n = img->ops_n;
+  memcpy(h.metrics, img->metrics, sizeof(h.metrics));
+
+  size_t len = sizeof(h) + img->ops_n * sizeof(AiirExecStat) + sizeof(uint32_t);
+  uint8_t *buf = (uint8_t *)malloc(len);
+  if (!buf) return false;
+  memcpy(buf, &h, sizeof(h));
+  size_t off = sizeof(h);
+  for (size_t i = 0; i < img->ops_cap; i++) {
+    if (!img->ops[i].used) continue;
+    memcpy(buf + off, &img->ops[i], sizeof(AiirExecStat));
+    off += sizeof(AiirExecStat);
+  }
+  uint32_t crc = aiir_crc32c(0, buf, off);
+  memcpy(buf + off, &crc, sizeof(crc));
+
+  char tmp[1100];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  bool ok = fd >= 0 && write_all(fd, buf, len) && fdatasync(fd) == 0;
+  if (fd >= 0) close(fd);
+  free(buf);
+  if (ok) ok = rename(tmp, path) == 0;
+  if (!ok) {
+    (void)unlink(tmp);
+    return false;
+  }
+  sync_parent_dir(path);
+  return true;
+}
+
+static void state_on_commit(void *ctx, const AiirWalRecord *recs, size_t n) {
+  AiirState *s = (AiirState *)ctx;
+  pthread_mutex_lock(&s->lock);
+  for (size_t i = 0; i < n; i++) image_fold(&s->live, &recs[i]);
+  pthread_mutex_unlock(&s->lock);
+}
+
+static bool state_replay_visit(const AiirWalRecord *r, void *ctx) {
+  AiirState *s = (AiirState *)ctx;
+  if (r->lsn > s->live.wal_lsn) s->replayed++;
+  image_fold(&s->live, r);
+  return true;
+}
+
+bool aiir_state_init(AiirState *s, const char *wal_path, const char *snapshot_path, const AiirWalConfig *wal_cfg,
+                     bool sync_commit) {
   memset(s, 0, sizeof(*s));
   snprintf(s->wal_path, sizeof(s->wal_path), "%s", wal_path && *wal_path ? wal_path : "/var/www/aiir/ai/state/ai.wal");
-  snprintf(s->snapshot_path, sizeof(s->snapshot_path), "%s", snapshot_path && *snapshot_path ? snapshot_path : "/var/www/aiir/ai/state/snapshot.json");
+  snprintf(s->snapshot_path, sizeof(s->snapshot_path), "%s", snapshot_path && *snapshot_path ? snapshot_path : "/var/www/aiir/ai/state/snapshot.aiir");
+  s->wal_sync_commit = sync_commit;
+  pthread_condattr_t ca;
+  pthread_condattr_init(&ca);
+  pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_mutex_init(&s->snap_lock, NULL);
+  pthread_mutex_init(&s->timer_lock, NULL);
+  pthread_cond_init(&s->timer, &ca);
+  pthread_condattr_destroy(&ca);
 
-  FILE *sf = fopen(s->snapshot_path, "w");
-  if (!sf) return false;
-  time_t t = time(NULL);
-  fprintf(sf, "{\"ts\":%lld,\"meta\":%s}\n", (long long)t, meta_json ? meta_json : "{}");
-  fclose(sf);
+  /* A missing, damaged or pre-binary snapshot just means replaying the whole WAL. */
+  if (snapshot_load(s)) s->loaded_lsn = s->live.wal_lsn;
+  s->written_lsn = s->loaded_lsn;
+  s->written_seq = s->live.gateway_seq;
+  memcpy(s->written_metrics, s->live.metrics, sizeof(s->written_metrics));
+
+  AiirWalConfig cfg = *wal_cfg;
+  cfg.min_next_lsn = s->live.wal_lsn + 1u;
+  cfg.on_commit = state_on_commit;
+  cfg.on_commit_ctx = s;
+  if (!aiir_wal_open(&s->wal, s->wal_path, &cfg)) return false;
+  /* Nothing is appended until init returns, so the tail can be folded without the lock. */
+  AiirWalScanStats st;
+  (void)aiir_wal_scan(s->wal_path, s->live.wal_lsn + 1u, state_replay_visit, s, &st);
+  return true;
+}
+
+static void *state_snapshot_main(void *arg) {
+  AiirState *s = (AiirState *)arg;
+  pthread_mutex_lock(&s->timer_lock);
+  while (!s->stop) {
+    pthread_mutex_unlock(&s->timer_lock);
+    (void)aiir_state_snapshot(s);
+    pthread_mutex_lock(&s->timer_lock);
+    struct timespec until;
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec += (time_t)s->interval_sec;
+    while (!s->stop) {
+      if (pthread_cond_timedwait(&s->timer, &s->timer_lock, &until) == ETIMEDOUT) break;
+    }
+  }
+  pthread_mutex_unlock(&s->timer_lock);
+  return NULL;
+}
+
+bool aiir_state_start_snapshots(AiirState *s, size_t interval_sec, AiirStateCollectFn collect, void *ctx) {
+  s->interval_sec = interval_sec > 0 ? interval_sec : 1u;
+  s->collect = collect;
+  s->collect_ctx = ctx;
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  int rc = pthread_create(&s->thread, NULL, state_snapshot_main, s);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (rc != 0) return false;
+  s->running = true;
   return true;
 }
 
-void aiir_state_log_dbexec(const AiirState *s, uint32_t op_id, uint32_t proc_id, size_t argc) {
-  FILE *wf = fopen(s->wal_path, "a");
-  if (!wf) return;
-  time_t t = time(NULL);
-  fprintf(wf, "{\"ts\":%lld,\"opId\":%u,\"procId\":%u,\"argc\":%zu}\n", (long long)t, op_id, proc_id, argc);
-  fclose(wf);
+bool aiir_state_snapshot(AiirState *s) {
+  pthread_mutex_lock(&s->snap_lock);
+  pthread_mutex_lock(&s->lock);
+  bool ok = image_copy(&s->shadow, &s->live);
+  pthread_mutex_unlock(&s->lock);
+  if (ok && s->collect) s->collect(s->collect_ctx, &s->shadow);
+  bool changed = atomic_load(&s->snapshots_total) == 0 || s->shadow.wal_lsn != s->written_lsn ||
+                 s->shadow.gateway_seq != s->written_seq ||
+                 memcmp(s->shadow.metrics, s->written_metrics, sizeof(s->written_metrics)) != 0;
+  if (ok && changed) {
+    ok = snapshot_write(s->snapshot_path, &s->shadow);
+    if (ok) {
+      s->written_lsn = s->shadow.wal_lsn;
+      s->written_seq = s->shadow.gateway_seq;
+      memcpy(s->written_metrics, s->shadow.metrics, sizeof(s->written_metrics));
+      atomic_fetch_add(&s->snapshots_total, 1u);
+    } else {
+      atomic_fetch_add(&s->snapshot_errors_total, 1u);
+    }
+  }
+  pthread_mutex_unlock(&s->snap_lock);
+  return ok;
+}
+
+bool aiir_state_log_dbexec(AiirState *s, uint32_t op_id, uint32_t proc_id, size_t argc) {
+  AiirWalRecord r;
+  memset(&r, 0, sizeof(r));
+  r.ts_ms = now_wall_ms();
+  r.op_id = op_id;
+  r.proc_id = proc_id;
+  r.argc = argc > UINT16_MAX ? UINT16_MAX : (uint16_t)argc;
+  r.type = AIIR_WAL_REC_DBEXEC;
+  return aiir_wal_append(&s->wal, &r, s->wal_sync_commit);
+}
+
+void aiir_state_applied(AiirState *s, uint64_t *wal_lsn, uint64_t *exec_total) {
+  pthread_mutex_lock(&s->lock);
+  *wal_lsn = s->live.wal_lsn;
+  *exec_total = s->live.exec_total;
+  pthread_mutex_unlock(&s->lock);
+}
+
+void aiir_state_close(AiirState *s) {
+  bool snapshots = s->running;
+  if (s->running) {
+    pthread_mutex_lock(&s->timer_lock);
+    s->stop = true;
+    pthread_cond_signal(&s->timer);
+    pthread_mutex_unlock(&s->timer_lock);
+    pthread_join(s->thread, NULL);
+    s->running = false;
+  }
+  aiir_wal_close(&s->wal);
+  if (snapshots) (void)aiir_state_snapshot(s);
+  image_free(&s->live);
+  image_free(&s->shadow);
+  pthread_cond_destroy(&s->timer);
+  pthread_mutex_destroy(&s->timer_lock);
+  pthread_mutex_destroy(&s->snap_lock);
+  pthread_mutex_destroy(&s->lock);
 }
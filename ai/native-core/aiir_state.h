@@ -1,16 +1,84 @@
 #ifndef AIIR_STATE_H
 #define AIIR_STATE_H
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#include "aiir_wal.h"
+
+#define AIIR_SNAPSHOT_MAGIC "AIIRSNP1"
+#define AIIR_SNAPSHOT_VERSION 1u
+#define AIIR_STATE_METRICS_MAX 32u
+
+/* Exec history for one op, folded from its WAL records. */
+typedef struct {
+  uint32_t op_id;
+  uint32_t used;
+  uint64_t count;
+  uint64_t last_ts_ms;
+} AiirExecStat;
+
+/* Everything a snapshot carries. The exec history is exactly the WAL folded up to `wal_lsn`;
+   the gateway sequence and the metric counters are whatever the owner reported last. */
+typedef struct {
+  uint64_t wal_lsn;
+  uint64_t exec_total;
+  uint64_t last_ts_ms;
+  uint64_t gateway_seq;
+  uint32_t metric_count;
+  uint64_t metrics[AIIR_STATE_METRICS_MAX];
+  AiirExecStat *ops; /* open-addressed by op_id, `ops_cap` a power of two */
+  size_t ops_cap;
+  size_t ops_n;
+} AiirStateImage;
+
+/* Fills the gateway sequence and metrics of `img`; runs on the snapshot thread. */
+typedef void (*AiirStateCollectFn)(void *ctx, AiirStateImage *img);
+
 typedef struct {
   char wal_path[1024];
   char snapshot_path[1024];
+  AiirWal wal;
+  bool wal_sync_commit;
+  /* `live` follows every WAL commit; the snapshot writer copies it into `shadow` under the
+     lock and serializes the copy without holding it. */
+  pthread_mutex_t lock;
+  AiirStateImage live;
+  AiirStateImage shadow;
+  pthread_mutex_t snap_lock;
+  uint64_t loaded_lsn;   /* WAL position of the snapshot found at startup, 0 without one */
+  uint64_t replayed;     /* WAL records folded in after that snapshot */
+  _Atomic uint64_t written_lsn; /* what the last snapshot written carried */
+  uint64_t written_seq;
+  uint64_t written_metrics[AIIR_STATE_METRICS_MAX];
+  _Atomic uint64_t snapshots_total;
+  _Atomic uint64_t snapshot_errors_total;
+  AiirStateCollectFn collect;
+  void *collect_ctx;
+  size_t interval_sec;
+  pthread_mutex_t timer_lock;
+  pthread_cond_t timer;
+  bool stop;
+  bool running;
+  pthread_t thread;
 } AiirState;
 
-bool aiir_state_init(AiirState *s, const char *wal_path, const char *snapshot_path, const char *meta_json);
-void aiir_state_log_dbexec(const AiirState *s, uint32_t op_id, uint32_t proc_id, size_t argc);
+/* Loads the snapshot at `snapshot_path` when it is valid, replays the WAL records after its
+   position and opens the WAL. With `sync_commit`, aiir_state_log_dbexec returns only once its
+   WAL commit is written. */
+bool aiir_state_init(AiirState *s, const char *wal_path, const char *snapshot_path, const AiirWalConfig *wal_cfg,
+                     bool sync_commit);
+/* Starts the snapshot thread: one snapshot right away, then one every `interval_sec`. */
+bool aiir_state_start_snapshots(AiirState *s, size_t interval_sec, AiirStateCollectFn collect, void *ctx);
+/* Writes a snapshot now; skipped (and true) when nothing changed since the last one. */
+bool aiir_state_snapshot(AiirState *s);
+bool aiir_state_log_dbexec(AiirState *s, uint32_t op_id, uint32_t proc_id, size_t argc);
+/* Copies the WAL position and exec total the live image has reached. */
+void aiir_state_applied(AiirState *s, uint64_t *wal_lsn, uint64_t *exec_total);
+/* Commits the WAL, writes a final snapshot when the snapshot thread ran, and releases all. */
+void aiir_state_close(AiirState *s);
 
 #endif
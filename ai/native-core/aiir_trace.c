@@ -0,0 +1,256 @@
+#define _GNU_SOURCE
+
+#include "aiir_trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(AiirTraceEvent) == 24, "trace event must stay 24 bytes");
+_Static_assert(sizeof(AiirTraceHeader) == 32, "trace header must stay 32 bytes");
+
+static const char *const phase_names[AIIR_TRACE_PHASES] = {
+  "request", "read", "parse", "json", "capability", "policy", "args", "sig", "wal", "respond", "write",
+};
+
+static bool write_all(int fd, const void *buf, size_t n) {
+  const char *p = (const char *)buf;
+  while (n > 0) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += w;
+    n -= (size_t)w;
+  }
+  return true;
+}
+
+static uint64_t clock_us(clockid_t id) {
+  struct timespec ts;
+  clock_gettime(id, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)(ts.tv_nsec / 1000);
+}
+
+bool aiir_trace_ring_init(AiirTraceRing *r, size_t cap) {
+  memset(r, 0, sizeof(*r));
+  r->ev = (AiirTraceEvent *)calloc(cap, sizeof(AiirTraceEvent));
+  if (!r->ev) return false;
+  r->cap = cap;
+  pthread_mutex_init(&r->lock, NULL);
+  return true;
+}
+
+void aiir_trace_ring_push(AiirTraceRing *r, const AiirTraceEvent *ev, size_t n) {
+  if (!r->ev || n == 0) return;
+  if (n > r->cap) {
+    ev += n - r->cap;
+    n = r->cap;
+  }
+  pthread_mutex_lock(&r->lock);
+  size_t at = (size_t)(r->pushed % r->cap);
+  size_t first = r->cap - at < n ? r->cap - at : n;
+  memcpy(&r->ev[at], ev, first * sizeof(*ev));
+  if (first < n) memcpy(&r->ev[0], ev + first, (n - first) * sizeof(*ev));
+  r->pushed += n;
+  pthread_mutex_unlock(&r->lock);
+}
+
+size_t aiir_trace_ring_read(AiirTraceRing *r, uint64_t *from, AiirTraceEvent *out, size_t max, uint64_t *lost) {
+  if (!r->ev) return 0;
+  pthread_mutex_lock(&r->lock);
+  uint64_t oldest = r->pushed > r->cap ? r->pushed - r->cap : 0u;
+  if (*from < oldest) {
+    if (lost) *lost += oldest - *from;
+    *from = oldest;
+  }
+  size_t n = 0;
+  while (n < max && *from < r->pushed) {
+    size_t at = (size_t)(*from % r->cap);
+    size_t run = r->cap - at;
+    if (run > r->pushed - *from) run = (size_t)(r->pushed - *from);
+    if (run > max - n) run = max - n;
+    memcpy(out + n, &r->ev[at], run * sizeof(*out));
+    n += run;
+    *from += run;
+  }
+  pthread_mutex_unlock(&r->lock);
+  return n;
+}
+
+void aiir_trace_ring_free(AiirTraceRing *r) {
+  if (!r->ev) return;
+  free(r->ev);
+  r->ev = NULL;
+  pthread_mutex_destroy(&r->lock);
+}
+
+void aiir_trace_header_init(AiirTraceHeader *h) {
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, AIIR_TRACE_MAGIC, 8);
+  h->version = AIIR_TRACE_VERSION;
+  h->event_size = sizeof(AiirTraceEvent);
+  h->mono_origin_us = clock_us(CLOCK_MONOTONIC);
+  h->wall_origin_us = clock_us(CLOCK_REALTIME);
+}
+
+bool aiir_trace_header_valid(const AiirTraceHeader *h) {
+  return memcmp(h->magic, AIIR_TRACE_MAGIC, 8) == 0 && h->version == AIIR_TRACE_VERSION &&
+         h->event_size == sizeof(AiirTraceEvent);
+}
+
+const char *aiir_trace_phase_name(uint8_t phase) {
+  return phase < AIIR_TRACE_PHASES ? phase_names[phase] : "unknown";
+}
+
+/* ---- file sink ---- */
+
+static void sink_drain(AiirTraceSink *s) {
+  for (size_t i = 0; i < s->ring_count; i++) {
+    for (;;) {
+      uint64_t lost = 0;
+      size_t n = aiir_trace_ring_read(s->rings[i], &s->next[i], s->buf, s->buf_cap, &lost);
+      if (lost > 0) atomic_fetch_add(&s->lost_total, lost);
+      if (n == 0) break;
+      if (!write_all(s->fd, s->buf, n * sizeof(AiirTraceEvent))) atomic_fetch_add(&s->write_errors_total, 1u);
+      else atomic_fetch_add(&s->events_total, n);
+      if (n < s->buf_cap) break;
+    }
+  }
+}
+
+static void *sink_main(void *arg) {
+  AiirTraceSink *s = (AiirTraceSink *)arg;
+  pthread_mutex_lock(&s->lock);
+  while (!s->stop) {
+    struct timespec until;
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec += (time_t)(s->interval_ms / 1000u);
+    until.tv_nsec += (long)(s->interval_ms % 1000u) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000L;
+    }
+    int rc = 0;
+    while (!s->stop && rc != ETIMEDOUT) rc = pthread_cond_timedwait(&s->wake, &s->lock, &until);
+    pthread_mutex_unlock(&s->lock);
+    sink_drain(s);
+    pthread_mutex_lock(&s->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+bool aiir_trace_sink_start(AiirTraceSink *s, const char *path, AiirTraceRing **rings, size_t ring_count,
+                           size_t interval_ms) {
+  memset(s, 0, sizeof(*s));
+  s->fd = -1;
+  s->rings = rings;
+  s->ring_count = ring_count;
+  s->interval_ms = interval_ms ? interval_ms : 1u;
+  s->buf_cap = 4096u;
+  s->next = (uint64_t *)calloc(ring_count ? ring_count : 1u, sizeof(uint64_t));
+  s->buf = (AiirTraceEvent *)malloc(s->buf_cap * sizeof(AiirTraceEvent));
+  if (!s->next || !s->buf) goto fail;
+  /* Only what happens from now on goes to the file. */
+  for (size_t i = 0; i < ring_count; i++) {
+    pthread_mutex_lock(&rings[i]->lock);
+    s->next[i] = rings[i]->pushed;
+    pthread_mutex_unlock(&rings[i]->lock);
+  }
+  s->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0640);
+  AiirTraceHeader h;
+  aiir_trace_header_init(&h);
+  if (s->fd < 0 || !write_all(s->fd, &h, sizeof(h))) goto fail;
+
+  pthread_condattr_t ca;
+  pthread_condattr_init(&ca);
+  pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->wake, &ca);
+  pthread_condattr_destroy(&ca);
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  int rc = pthread_create(&s->thread, NULL, sink_main, s);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (rc != 0) {
+    pthread_cond_destroy(&s->wake);
+    pthread_mutex_destroy(&s->lock);
+    goto fail;
+  }
+  s->running = true;
+  return true;
+
+fail:
+  if (s->fd >= 0) close(s->fd);
+  s->fd = -1;
+  free(s->next);
+  free(s->buf);
+  s->next = NULL;
+  s->buf = NULL;
+  return false;
+}
+
+void aiir_trace_sink_stop(AiirTraceSink *s) {
+  if (!s->running) return;
+  pthread_mutex_lock(&s->lock);
+  s->stop = true;
+  pthread_cond_signal(&s->wake);
+  pthread_mutex_unlock(&s->lock);
+  pthread_join(s->thread, NULL);
+  s->running = false;
+  sink_drain(s);
+  (void)fdatasync(s->fd);
+  close(s->fd);
+  s->fd = -1;
+  pthread_cond_destroy(&s->wake);
+  pthread_mutex_destroy(&s->lock);
+  free(s->next);
+  free(s->buf);
+  s->next = NULL;
+  s->buf = NULL;
+}
+
+/* ---- Chrome trace-event JSON ---- */
+
+bool aiir_trace_to_chrome(const char *path, FILE *out, AiirTraceRouteNameFn route_name, uint64_t *events) {
+  *events = 0;
+  FILE *in = fopen(path, "rb");
+  if (!in) return false;
+  AiirTraceHeader h;
+  if (fread(&h, sizeof(h), 1, in) != 1 || !aiir_trace_header_valid(&h)) {
+    fclose(in);
+    return false;
+  }
+  fputs("{\"traceEvents\":[\n", out);
+  fputs("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"aiir-runtime\"}}", out);
+  uint64_t base = h.mono_origin_us;
+  uint32_t seen_workers[64] = {0};
+  AiirTraceEvent e;
+  while (fread(&e, sizeof(e), 1, in) == 1) {
+    uint64_t ts = e.ts_us >= base ? e.ts_us - base : 0u;
+    if (e.worker < 64u * 32u && !(seen_workers[e.worker / 32u] & (1u << (e.worker % 32u)))) {
+      seen_workers[e.worker / 32u] |= 1u << (e.worker % 32u);
+      fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"worker-%u\"}}",
+              (unsigned)e.worker, (unsigned)e.worker);
+    }
+    const char *route = route_name ? route_name(e.route) : NULL;
+    fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"", aiir_trace_phase_name(e.phase));
+    if (route) fputs(route, out);
+    else fprintf(out, "route-%u", (unsigned)e.route);
+    fprintf(out, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu,\"dur\":%u,\"args\":{\"req\":%u",
+            (unsigned)e.worker, (unsigned long long)ts, (unsigned)e.dur_us, (unsigned)e.req_id);
+    if (e.op_id != 0) fprintf(out, ",\"opId\":%u", (unsigned)e.op_id);
+    fputs("}}", out);
+    (*events)++;
+  }
+  fputs("\n]}\n", out);
+  fclose(in);
+  return !ferror(out);
+}
@@ -0,0 +1,104 @@
+#ifndef AIIR_TRACE_H
+#define AIIR_TRACE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define AIIR_TRACE_MAGIC "AIIRTRC1"
+#define AIIR_TRACE_VERSION 1u
+
+/* Request phases. Spans of one request share `req_id`; AIIR_TRACE_REQUEST covers the whole
+   handler, the others nest inside it except READ and WRITE, which wrap it on the socket. */
+typedef enum {
+  AIIR_TRACE_REQUEST = 0,
+  AIIR_TRACE_READ,
+  AIIR_TRACE_PARSE,
+  AIIR_TRACE_JSON,
+  AIIR_TRACE_CAPABILITY,
+  AIIR_TRACE_POLICY,
+  AIIR_TRACE_ARGS,
+  AIIR_TRACE_SIG,
+  AIIR_TRACE_WAL,
+  AIIR_TRACE_RESPOND,
+  AIIR_TRACE_WRITE,
+  AIIR_TRACE_PHASES
+} AiirTracePhase;
+
+/* One span, fixed layout, host byte order; `ts_us` is CLOCK_MONOTONIC. */
+typedef struct {
+  uint64_t ts_us;
+  uint32_t dur_us;
+  uint32_t req_id;
+  uint32_t op_id;
+  uint16_t worker;
+  uint8_t phase;
+  uint8_t route;
+} AiirTraceEvent;
+
+/* A trace file (and a /debug/trace body) is this header followed by events. */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t event_size;
+  uint64_t mono_origin_us; /* CLOCK_MONOTONIC when the file was started; no event is older */
+  uint64_t wall_origin_us; /* CLOCK_REALTIME at the same moment */
+} AiirTraceHeader;
+
+/* The last `cap` spans of one worker. The worker pushes a whole request at once; readers copy
+   under the same lock, so it is held for one memcpy either way. */
+typedef struct {
+  pthread_mutex_t lock;
+  AiirTraceEvent *ev;
+  size_t cap;
+  uint64_t pushed; /* events ever pushed; slot = index % cap */
+} AiirTraceRing;
+
+/* Appends every ring's new events to a trace file every `interval_ms`. Events overwritten
+   before the sink got to them are counted in `lost_total`. */
+typedef struct {
+  int fd;
+  AiirTraceRing **rings;
+  uint64_t *next; /* per ring: first event not yet written */
+  size_t ring_count;
+  size_t interval_ms;
+  AiirTraceEvent *buf;
+  size_t buf_cap;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  bool stop;
+  bool running;
+  pthread_t thread;
+  _Atomic uint64_t events_total;
+  _Atomic uint64_t lost_total;
+  _Atomic uint64_t write_errors_total;
+} AiirTraceSink;
+
+bool aiir_trace_ring_init(AiirTraceRing *r, size_t cap);
+void aiir_trace_ring_push(AiirTraceRing *r, const AiirTraceEvent *ev, size_t n);
+/* Copies up to `max` events pushed at or after `*from` (older ones are gone and counted in
+   `*lost`), oldest first, and advances `*from` past them. */
+size_t aiir_trace_ring_read(AiirTraceRing *r, uint64_t *from, AiirTraceEvent *out, size_t max, uint64_t *lost);
+void aiir_trace_ring_free(AiirTraceRing *r);
+
+void aiir_trace_header_init(AiirTraceHeader *h);
+bool aiir_trace_header_valid(const AiirTraceHeader *h);
+const char *aiir_trace_phase_name(uint8_t phase);
+
+/* Creates (truncating) `path`, writes the header and starts the sink thread. */
+bool aiir_trace_sink_start(AiirTraceSink *s, const char *path, AiirTraceRing **rings, size_t ring_count,
+                           size_t interval_ms);
+/* Writes what the rings still hold and stops the thread. */
+void aiir_trace_sink_stop(AiirTraceSink *s);
+
+/* Names a route id, NULL when unknown. */
+typedef const char *(*AiirTraceRouteNameFn)(unsigned route);
+
+/* Converts a trace file to Chrome trace-event JSON (chrome://tracing, Perfetto): one complete
+   ("X") event per span, one thread per worker, timestamps relative to the header's origin. */
+bool aiir_trace_to_chrome(const char *path, FILE *out, AiirTraceRouteNameFn route_name, uint64_t *events);
+
+#endif
@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+
+#include "aiir_wal.h"
+#include "aiir_sdt.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(AiirWalRecord) == 32, "wal record must stay 32 bytes");
+_Static_assert(sizeof(AiirWalSegHeader) == 32, "wal header must stay 32 bytes");
+
+#define WAL_REC_CRC_LEN 28u
+#define WAL_HDR_CRC_LEN 28u
+#define WAL_SCAN_CHUNK 1024u
+
+enum { SEG_OK, SEG_TORN, SEG_CORRUPT, SEG_EMPTY, SEG_NO_HEADER, SEG_UNREADABLE };
+
+typedef struct {
+  uint64_t base;
+  char path[1300];
+} WalSegName;
+
+typedef struct {
+  uint64_t base_lsn;
+  uint64_t last_lsn;
+  uint64_t valid_bytes;
+  uint64_t records;
+  bool halted;
+} WalSegScan;
+
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init(void) {
+  for (uint32_t i = 0; i < 256u; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) c = (c & 1u) ? (c >> 1) ^ 0x82f63b78u : c >> 1;
+    crc32c_table[i] = c;
+  }
+}
+
+uint32_t aiir_crc32c(uint32_t crc, const void *p, size_t n) {
+  pthread_once(&crc32c_once, crc32c_init);
+  const uint8_t *b = (const uint8_t *)p;
+  crc = ~crc;
+  while (n-- > 0) crc = crc32c_table[(crc ^ *b++) & 0xffu] ^ (crc >> 8);
+  return ~crc;
+}
+
+static bool write_all(int fd, const void *buf, size_t n) {
+  const char *p = (const char *)buf;
+  while (n > 0) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += w;
+    n -= (size_t)w;
+  }
+  return true;
+}
+
+static void header_fill(AiirWalSegHeader *h, uint64_t base_lsn) {
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, AIIR_WAL_MAGIC, sizeof(h->magic));
+  h->version = AIIR_WAL_VERSION;
+  h->record_size = (uint32_t)sizeof(AiirWalRecord);
+  h->base_lsn = base_lsn;
+  h->crc = aiir_crc32c(0, h, WAL_HDR_CRC_LEN);
+}
+
+static bool header_valid(const AiirWalSegHeader *h) {
+  return memcmp(h->magic, AIIR_WAL_MAGIC, sizeof(h->magic)) == 0 && h->version == AIIR_WAL_VERSION &&
+         h->record_size == sizeof(AiirWalRecord) && h->base_lsn > 0 && h->crc == aiir_crc32c(0, h, WAL_HDR_CRC_LEN);
+}
+
+static bool record_valid(const AiirWalRecord *r) {
+  return r->crc == aiir_crc32c(0, r, WAL_REC_CRC_LEN);
+}
+
+/* Walks one segment, calling `fn` for valid records with lsn >= from_lsn. LSNs only have to
+   increase: a commit that failed to write leaves a gap, not a break. */
+static int scan_segment(const char *file, uint64_t from_lsn, AiirWalVisitFn fn, void *ctx, WalSegScan *ss) {
+  memset(ss, 0, sizeof(*ss));
+  FILE *f = fopen(file, "rb");
+  if (!f) return SEG_UNREADABLE;
+  AiirWalSegHeader h;
+  size_t got = fread(&h, 1, sizeof(h), f);
+  if (got == 0) {
+    fclose(f);
+    return SEG_EMPTY;
+  }
+  if (got < sizeof(h) || !header_valid(&h)) {
+    fclose(f);
+    return SEG_NO_HEADER;
+  }
+  ss->base_lsn = h.base_lsn;
+  ss->last_lsn = h.base_lsn - 1u;
+  ss->valid_bytes = sizeof(h);
+  AiirWalRecord *buf = (AiirWalRecord *)malloc(WAL_SCAN_CHUNK * sizeof(AiirWalRecord));
+  if (!buf) {
+    fclose(f);
+    return SEG_UNREADABLE;
+  }
+  int rc = SEG_OK;
+  for (;;) {
+    size_t n = fread(buf, 1, WAL_SCAN_CHUNK * sizeof(AiirWalRecord), f);
+    size_t whole = n / sizeof(AiirWalRecord);
+    for (size_t i = 0; i < whole; i++) {
+      const AiirWalRecord *r = &buf[i];
+      if (!record_valid(r) || r->lsn <= ss->last_lsn) {
+        rc = SEG_CORRUPT;
+        goto out;
+      }
+      ss->last_lsn = r->lsn;
+      ss->valid_bytes += sizeof(AiirWalRecord);
+      ss->records++;
+      if (fn && r->lsn >= from_lsn && !fn(r, ctx)) {
+        ss->halted = true;
+        goto out;
+      }
+    }
+    if (n % sizeof(AiirWalRecord) != 0) {
+      rc = SEG_TORN;
+      break;
+    }
+    if (n < WAL_SCAN_CHUNK * sizeof(AiirWalRecord)) break;
+  }
+out:
+  free(buf);
+  fclose(f);
+  return rc;
+}
+
+static int cmp_seg(const void *a, const void *b) {
+  uint64_t x = ((const WalSegName *)a)->base, y = ((const WalSegName *)b)->base;
+  return x < y ? -1 : x > y;
+}
+
+/* Collects the rotated segments `path.<16 hex digits>` in LSN order. */
+static bool list_segments(const char *path, WalSegName **out, size_t *out_n) {
+  *out = NULL;
+  *out_n = 0;
+  char dir[1024];
+  const char *slash = strrchr(path, '/');
+  const char *base = slash ? slash + 1 : path;
+  if (slash) snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+  else snprintf(dir, sizeof(dir), ".");
+  if (dir[0] == '\0') snprintf(dir, sizeof(dir), "/");
+  size_t blen = strlen(base);
+  DIR *d = opendir(dir);
+  if (!d) return false;
+  WalSegName *v = NULL;
+  size_t n = 0, c = 0;
+  bool ok = true;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    const char *nm = e->d_name;
+    if (strncmp(nm, base, blen) != 0 || nm[blen] != '.' || strlen(nm + blen + 1u) != 16u) continue;
+    char *end = NULL;
+    unsigned long long lsn = strtoull(nm + blen + 1u, &end, 16);
+    if (!end || *end != '\0' || lsn == 0) continue;
+    if (n == c) {
+      size_t nc = c ? c * 2u : 16u;
+      WalSegName *nv = (WalSegName *)realloc(v, nc * sizeof(*nv));
+      if (!nv) {
+        ok = false;
+        break;
+      }
+      v = nv;
+      c = nc;
+    }
+    v[n].base = (uint64_t)lsn;
+    snprintf(v[n].path, sizeof(v[n].path), "%s/%s", dir, nm);
+    n++;
+  }
+  closedir(d);
+  if (!ok) {
+    free(v);
+    return false;
+  }
+  if (n > 1u) qsort(v, n, sizeof(*v), cmp_seg);
+  *out = v;
+  *out_n = n;
+  return true;
+}
+
+static void sync_parent_dir(const char *path) {
+  char dir[1024];
+  const char *slash = strrchr(path, '/');
+  if (slash) snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+  else snprintf(dir, sizeof(dir), ".");
+  if (dir[0] == '\0') snprintf(dir, sizeof(dir), "/");
+  int dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dfd < 0) return;
+  (void)fsync(dfd);
+  close(dfd);
+}
+
+static int open_fresh_segment(const char *path, uint64_t base_lsn, bool sync) {
+  int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd < 0) return -1;
+  AiirWalSegHeader h;
+  header_fill(&h, base_lsn);
+  if (!write_all(fd, &h, sizeof(h)) || (sync && fdatasync(fd) != 0)) {
+    close(fd);
+    return -1;
+  }
+  if (sync) sync_parent_dir(path);
+  return fd;
+}
+
+/* Moves the full active segment to its rotated name and starts a new one at `next_lsn`. */
+static bool wal_rotate(AiirWal *w, uint64_t base_lsn, uint64_t next_lsn) {
+  char rotated[1100];
+  snprintf(rotated, sizeof(rotated), "%s.%016llx", w->path, (unsigned long long)base_lsn);
+  if (w->cfg.fdatasync && fdatasync(w->fd) != 0) return false;
+  if (rename(w->path, rotated) != 0) return false;
+  int fd = open_fresh_segment(w->path, next_lsn, w->cfg.fdatasync);
+  if (fd < 0) {
+    (void)rename(rotated, w->path);
+    return false;
+  }
+  close(w->fd);
+  w->fd = fd;
+  w->seg_base_lsn = next_lsn;
+  w->seg_bytes = sizeof(AiirWalSegHeader);
+  atomic_fetch_add(&w->rotations_total, 1u);
+  return true;
+}
+
+static bool wal_write_batch(AiirWal *w, const AiirWalRecord *recs, size_t n) {
+  size_t bytes = n * sizeof(AiirWalRecord);
+  if (w->seg_bytes > sizeof(AiirWalSegHeader) && w->seg_bytes + bytes > w->cfg.segment_bytes) {
+    (void)wal_rotate(w, w->seg_base_lsn, recs[0].lsn);
+  }
+  if (!write_all(w->fd, recs, bytes)) {
+    /* Cut a partial write so the next commit starts on a record boundary. */
+    (void)!ftruncate(w->fd, (off_t)w->seg_bytes);
+    return false;
+  }
+  w->seg_bytes += bytes;
+  return !w->cfg.fdatasync || fdatasync(w->fd) == 0;
+}
+
+static void *wal_flusher_main(void *arg) {
+  AiirWal *w = (AiirWal *)arg;
+  pthread_mutex_lock(&w->lock);
+  for (;;) {
+    while (!w->stop && w->pending_n == 0) pthread_cond_wait(&w->work, &w->lock);
+    if (w->pending_n == 0) break;
+    if (w->cfg.commit_delay_us > 0 && !w->stop && w->pending_n < w->cfg.group_max) {
+      struct timespec until;
+      clock_gettime(CLOCK_MONOTONIC, &until);
+      uint64_t ns = (uint64_t)until.tv_nsec + (uint64_t)w->cfg.commit_delay_us * 1000u;
+      until.tv_sec += (time_t)(ns / 1000000000u);
+      until.tv_nsec = (long)(ns % 1000000000u);
+      while (!w->stop && w->pending_n < w->cfg.group_max) {
+        if (pthread_cond_timedwait(&w->work, &w->lock, &until) == ETIMEDOUT) break;
+      }
+    }
+    AiirWalRecord *batch = w->pending;
+    size_t n = w->pending_n;
+    w->pending = w->flushing;
+    w->flushing = batch;
+    w->pending_n = 0;
+    pthread_cond_broadcast(&w->done);
+    pthread_mutex_unlock(&w->lock);
+
+    AIIR_PROBE2(wal__commit__start, batch[0].lsn, n);
+    bool ok = wal_write_batch(w, batch, n);
+    AIIR_PROBE3(wal__commit__done, batch[n - 1u].lsn, n, ok);
+    if (ok && w->cfg.on_commit) w->cfg.on_commit(w->cfg.on_commit_ctx, batch, n);
+
+    pthread_mutex_lock(&w->lock);
+    if (!ok) {
+      w->failed_lo = batch[0].lsn;
+      w->failed_hi = batch[n - 1u].lsn;
+      atomic_fetch_add(&w->errors_total, 1u);
+    }
+    w->durable_lsn = batch[n - 1u].lsn;
+    atomic_fetch_add(&w->commits_total, 1u);
+    pthread_cond_broadcast(&w->done);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+bool aiir_wal_open(AiirWal *w, const char *path, const AiirWalConfig *cfg) {
+  memset(w, 0, sizeof(*w));
+  w->fd = -1;
+  if ((size_t)snprintf(w->path, sizeof(w->path), "%s", path) >= sizeof(w->path)) return false;
+  w->cfg = *cfg;
+  if (w->cfg.group_max == 0) w->cfg.group_max = 1u;
+  if (w->cfg.segment_bytes < sizeof(AiirWalSegHeader) + sizeof(AiirWalRecord)) {
+    w->cfg.segment_bytes = sizeof(AiirWalSegHeader) + sizeof(AiirWalRecord);
+  }
+
+  /* The newest rotated segment carries the LSN to continue from when there is no active one. */
+  uint64_t next = 1u;
+  WalSegName *segs = NULL;
+  size_t nseg = 0;
+  if (list_segments(w->path, &segs, &nseg) && nseg > 0) {
+    WalSegScan ss;
+    int rc = scan_segment(segs[nseg - 1u].path, UINT64_MAX, NULL, NULL, &ss);
+    next = (rc == SEG_EMPTY || rc == SEG_NO_HEADER || rc == SEG_UNREADABLE) ? segs[nseg - 1u].base : ss.last_lsn + 1u;
+  }
+  free(segs);
+
+  WalSegScan ss;
+  int rc = scan_segment(w->path, UINT64_MAX, NULL, NULL, &ss);
+  if (rc == SEG_NO_HEADER) {
+    char legacy[1100];
+    snprintf(legacy, sizeof(legacy), "%s.legacy", w->path);
+    if (rename(w->path, legacy) != 0) return false;
+    rc = SEG_UNREADABLE;
+  }
+  if (rc == SEG_OK || rc == SEG_TORN || rc == SEG_CORRUPT) {
+    w->fd = open(w->path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (w->fd < 0) return false;
+    /* A crash can leave a partial or unsynced record at the tail; drop it. */
+    if (rc != SEG_OK && ftruncate(w->fd, (off_t)ss.valid_bytes) != 0) {
+      close(w->fd);
+      return false;
+    }
+    if (ss.last_lsn + 1u > next) next = ss.last_lsn + 1u;
+    w->seg_base_lsn = ss.base_lsn;
+    w->seg_bytes = ss.valid_bytes;
+  } else {
+    w->fd = open_fresh_segment(w->path, next, cfg->fdatasync);
+    if (w->fd < 0) return false;
+    w->seg_base_lsn = next;
+    w->seg_bytes = sizeof(AiirWalSegHeader);
+  }
+  if (cfg->min_next_lsn > next) next = cfg->min_next_lsn;
+  w->next_lsn = next;
+  w->durable_lsn = next - 1u;
+
+  w->pending = (AiirWalRecord *)malloc(w->cfg.group_max * sizeof(AiirWalRecord));
+  w->flushing = (AiirWalRecord *)malloc(w->cfg.group_max * sizeof(AiirWalRecord));
+  if (!w->pending || !w->flushing) {
+    aiir_wal_close(w);
+    return false;
+  }
+  pthread_condattr_t ca;
+  pthread_condattr_init(&ca);
+  pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->work, &ca);
+  pthread_cond_init(&w->done, NULL);
+  pthread_condattr_destroy(&ca);
+
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  int prc = pthread_create(&w->thread, NULL, wal_flusher_main, w);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (prc != 0) {
+    pthread_cond_destroy(&w->work);
+    pthread_cond_destroy(&w->done);
+    pthread_mutex_destroy(&w->lock);
+    aiir_wal_close(w);
+    return false;
+  }
+  w->running = true;
+  return true;
+}
+
+bool aiir_wal_append(AiirWal *w, AiirWalRecord *rec, bool wait) {
+  if (!w->running) return false;
+  pthread_mutex_lock(&w->lock);
+  while (!w->stop && w->pending_n == w->cfg.group_max) {
+    pthread_cond_signal(&w->work);
+    pthread_cond_wait(&w->done, &w->lock);
+  }
+  if (w->stop) {
+    pthread_mutex_unlock(&w->lock);
+    return false;
+  }
+  rec->lsn = w->next_lsn++;
+  rec->crc = aiir_crc32c(0, rec, WAL_REC_CRC_LEN);
+  w->pending[w->pending_n++] = *rec;
+  AIIR_PROBE3(wal__append, rec->lsn, rec->op_id, w->pending_n);
+  if (w->pending_n == 1u || w->pending_n == w->cfg.group_max) pthread_cond_signal(&w->work);
+  atomic_fetch_add_explicit(&w->records_total, 1u, memory_order_relaxed);
+  bool ok = true;
+  if (wait) {
+    while (w->durable_lsn < rec->lsn) pthread_cond_wait(&w->done, &w->lock);
+    ok = rec->lsn < w->failed_lo || rec->lsn > w->failed_hi;
+  }
+  pthread_mutex_unlock(&w->lock);
+  return ok;
+}
+
+bool aiir_wal_sync(AiirWal *w, size_t timeout_ms) {
+  if (!w->running) return true;
+  pthread_mutex_lock(&w->lock);
+  uint64_t target = w->next_lsn - 1u;
+  pthread_cond_signal(&w->work);
+  pthread_mutex_unlock(&w->lock);
+  const struct timespec tick = {0, 1000000L};
+  for (size_t waited = 0; aiir_wal_durable_lsn(w) < target; waited++) {
+    if (waited >= timeout_ms) return false;
+    nanosleep(&tick, NULL);
+  }
+  return true;
+}
+
+uint64_t aiir_wal_durable_lsn(AiirWal *w) {
+  if (!w->running) return w->durable_lsn;
+  pthread_mutex_lock(&w->lock);
+  uint64_t v = w->durable_lsn;
+  pthread_mutex_unlock(&w->lock);
+  return v;
+}
+
+void aiir_wal_close(AiirWal *w) {
+  if (w->running) {
+    pthread_mutex_lock(&w->lock);
+    w->stop = true;
+    pthread_cond_signal(&w->work);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+    w->running = false;
+    pthread_cond_destroy(&w->work);
+    pthread_cond_destroy(&w->done);
+    pthread_mutex_destroy(&w->lock);
+  }
+  if (w->fd >= 0) close(w->fd);
+  w->fd = -1;
+  free(w->pending);
+  free(w->flushing);
+  w->pending = NULL;
+  w->flushing = NULL;
+}
+
+bool aiir_wal_scan(const char *path, uint64_t from_lsn, AiirWalVisitFn fn, void *ctx, AiirWalScanStats *st) {
+  memset(st, 0, sizeof(*st));
+  WalSegName *segs = NULL;
+  size_t nseg = 0;
+  (void)list_segments(path, &segs, &nseg);
+
+  /* Rotated segments wholly below from_lsn are skipped without being read. */
+  uint64_t active_base = UINT64_MAX;
+  FILE *f = fopen(path, "rb");
+  if (f) {
+    AiirWalSegHeader h;
+    if (fread(&h, 1, sizeof(h), f) == sizeof(h) && header_valid(&h)) active_base = h.base_lsn;
+    fclose(f);
+  }
+  bool any = false;
+  for (size_t i = 0; i <= nseg; i++) {
+    const char *file = i < nseg ? segs[i].path : path;
+    if (i < nseg) {
+      uint64_t next_base = i + 1u < nseg ? segs[i + 1u].base : active_base;
+      if (next_base != UINT64_MAX && next_base <= from_lsn) continue;
+    }
+    WalSegScan ss;
+    int rc = scan_segment(file, from_lsn, fn, ctx, &ss);
+    if (rc == SEG_UNREADABLE) continue;
+    any = true;
+    st->segments++;
+    st->records += ss.records;
+    if (ss.last_lsn > st->last_lsn) st->last_lsn = ss.last_lsn;
+    if (rc == SEG_TORN) st->torn++;
+    if (rc == SEG_CORRUPT || rc == SEG_NO_HEADER) st->corrupt++;
+    if (ss.halted) break;
+  }
+  free(segs);
+  return any;
+}
@@ -0,0 +1,107 @@
+#ifndef AIIR_WAL_H
+#define AIIR_WAL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AIIR_WAL_MAGIC "AIIRWAL1"
+#define AIIR_WAL_VERSION 1u
+#define AIIR_WAL_REC_DBEXEC 1u
+
+/* One fixed-size record, stored in host byte order like the core files. `crc` is the
+   CRC-32C of the 28 bytes before it. LSNs start at 1 and increase by one per record. */
+typedef struct {
+  uint64_t lsn;
+  uint64_t ts_ms;
+  uint32_t op_id;
+  uint32_t proc_id;
+  uint16_t argc;
+  uint8_t type;
+  uint8_t reserved;
+  uint32_t crc;
+} AiirWalRecord;
+
+/* Every segment starts with this header; `base_lsn` is the LSN of its first record. */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t base_lsn;
+  uint32_t reserved;
+  uint32_t crc;
+} AiirWalSegHeader;
+
+typedef bool (*AiirWalVisitFn)(const AiirWalRecord *r, void *ctx);
+/* Called on the flusher thread with each batch once it is written, in LSN order. */
+typedef void (*AiirWalCommitFn)(void *ctx, const AiirWalRecord *recs, size_t n);
+
+typedef struct {
+  size_t segment_bytes;   /* rotate the active segment once it would grow past this */
+  size_t commit_delay_us; /* how long a commit may wait for more records to join it */
+  size_t group_max;       /* records per commit; appenders wait when this many are queued */
+  bool fdatasync;         /* fdatasync after every commit */
+  uint64_t min_next_lsn;  /* never hand out an LSN below this, e.g. one a snapshot already covers */
+  AiirWalCommitFn on_commit;
+  void *on_commit_ctx;
+} AiirWalConfig;
+
+/* The active segment lives at `path`; a full segment is renamed to `path.<base_lsn as 16 hex
+   digits>` and a fresh one started. Appenders only copy their record into the pending batch;
+   one flusher thread writes each batch with a single write() and fdatasync(), so concurrent
+   appends share a commit. */
+typedef struct {
+  char path[1024];
+  AiirWalConfig cfg;
+  int fd;
+  uint64_t seg_base_lsn;
+  uint64_t seg_bytes;
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  AiirWalRecord *pending;
+  AiirWalRecord *flushing;
+  size_t pending_n;
+  uint64_t next_lsn;
+  uint64_t durable_lsn;
+  uint64_t failed_lo;
+  uint64_t failed_hi;
+  bool stop;
+  bool running;
+  pthread_t thread;
+  _Atomic uint64_t records_total;
+  _Atomic uint64_t commits_total;
+  _Atomic uint64_t rotations_total;
+  _Atomic uint64_t errors_total;
+} AiirWal;
+
+typedef struct {
+  uint64_t segments;
+  uint64_t records;
+  uint64_t last_lsn;
+  uint64_t torn;    /* segments that ended in a partial record */
+  uint64_t corrupt; /* segments cut short by a bad header, CRC or LSN gap */
+} AiirWalScanStats;
+
+uint32_t aiir_crc32c(uint32_t crc, const void *p, size_t n);
+
+/* Opens or creates the active segment, cuts a torn tail left by a crash and starts the
+   flusher. A file at `path` without a WAL header (the old JSON-lines log) is moved aside to
+   `path.legacy`. */
+bool aiir_wal_open(AiirWal *w, const char *path, const AiirWalConfig *cfg);
+/* Assigns the record's LSN and CRC and queues it. With `wait`, returns once its commit is
+   written (and synced when configured), false if that commit failed. */
+bool aiir_wal_append(AiirWal *w, AiirWalRecord *rec, bool wait);
+/* Waits until everything appended before the call is committed; false on timeout. */
+bool aiir_wal_sync(AiirWal *w, size_t timeout_ms);
+uint64_t aiir_wal_durable_lsn(AiirWal *w);
+/* Commits everything queued, stops the flusher and closes the segment. */
+void aiir_wal_close(AiirWal *w);
+
+/* Visits every valid record with lsn >= from_lsn across all segments in LSN order; stops
+   early when `fn` returns false. Returns false only when no segment could be read. */
+bool aiir_wal_scan(const char *path, uint64_t from_lsn, AiirWalVisitFn fn, void *ctx, AiirWalScanStats *st);
+
+#endif
@@ -1,23 +1,47 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 #include "../native-core/aiir_core.h"
 #include "../native-core/aiir_policy.h"
 #include "../native-core/aiir_state.h"
 #include "../native-core/aiir_drift.h"
+#include "../native-core/aiir_sha256.h"
+#include "../native-core/aiir_audit.h"
+#include "../native-core/aiir_projstore.h"
+#include "../native-core/aiir_profile.h"
+#include "../native-core/aiir_sdt.h"
+#include "../native-core/aiir_trace.h"
 
 #define A2A_SEC_CODE 1u
 #define A2A_SEC_SLOT 2u
@@ -28,8 +52,8 @@
 #define D2B_SEC_SIG 2u
 
 #define REQ_BUF_MAX_HARD (1024 * 1024)
-#define RESP_BUF_MAX (1024 * 1024)
-#define CAP_NONCE_RING_MAX 512u
+#define WORKERS_MAX 256u
+#define RESP_IOV_BATCH 64u
 #define CAP_NONCE_MAX_LEN 64u
 
 typedef struct {
@@ -45,6 +69,8 @@ typedef struct {
   uint32_t proc_id;
   uint32_t min_args;
   uint32_t max_args;
+  uint32_t sig_off; /* this op's signatures in CoreGen.sigs, sorted by arg_index */
+  uint32_t sig_len;
 } DbOp;
 
 typedef struct {
@@ -70,39 +96,313 @@ typedef struct {
   char *s;
 } JsonVal;
 
+/* A response segment: `ext` points at bytes that outlive the response (literals,
+   pre-rendered errors); otherwise the bytes live at `off` in RespBuf.buf. */
+typedef struct {
+  const char *ext;
+  size_t off;
+  size_t len;
+} RespSeg;
+
+/* Responses are queued as segments and flushed with writev. `buf` holds the owned bytes
+   (headers and rendered bodies) and is reused across requests on a connection. */
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t cap;
+  RespSeg *segs;
+  size_t seg_count;
+  size_t seg_cap;
+  size_t total; /* bytes queued across all segments */
+  bool keep_alive; /* Connection header written by http_response */
+} RespBuf;
+
+/* Per-worker bump allocator for request-scoped data (parsed JSON values and strings). A
+   worker handles one request at a time and resets the arena once the response is queued, so
+   steady-state requests reuse the same chunks instead of calling malloc/free. */
+#define ARENA_CHUNK 16384u
+#define ARENA_ALIGN 16u
+
+typedef struct ArenaChunk ArenaChunk;
+struct ArenaChunk {
+  ArenaChunk *next;
+  size_t cap;
+  size_t used;
+  _Alignas(16) char data[];
+};
+
+typedef struct {
+  ArenaChunk *head;
+  ArenaChunk *tail;
+  ArenaChunk *cur;
+  void *last; /* most recent allocation, the only one arena_grow can extend in place */
+} Arena;
+
+/* Constant error responses, rendered once at startup in both Connection variants and queued
+   without copying. */
+#define RESP_ERRORS(X) \
+  X(RESP_ERR_ADAPT, 400, "adapt") \
+  X(RESP_ERR_ARGC, 400, "argc") \
+  X(RESP_ERR_ARGS, 400, "args") \
+  X(RESP_ERR_BODY_SHORT, 400, "body-short") \
+  X(RESP_ERR_CAPABILITY, 400, "capability") \
+  X(RESP_ERR_CONTENT_LENGTH, 400, "content-length") \
+  X(RESP_ERR_CONTRACT_VERSION, 400, "contract_version") \
+  X(RESP_ERR_DB_PROFILE, 400, "db_profile") \
+  X(RESP_ERR_DB_REF, 400, "db_ref") \
+  X(RESP_ERR_HEADERS, 400, "headers") \
+  X(RESP_ERR_ID, 400, "id") \
+  X(RESP_ERR_IDEMPOTENCY_KEY, 400, "idempotency_key") \
+  X(RESP_ERR_INTENT, 400, "intent") \
+  X(RESP_ERR_JSON, 400, "json") \
+  X(RESP_ERR_OP, 400, "op") \
+  X(RESP_ERR_OPID, 400, "opId") \
+  X(RESP_ERR_OP_ID, 400, "op_id") \
+  X(RESP_ERR_PACKET, 400, "packet") \
+  X(RESP_ERR_PAYLOAD, 400, "payload") \
+  X(RESP_ERR_POLICY_DB_EXEC, 400, "policy-db-exec") \
+  X(RESP_ERR_POLICY_OP, 400, "policy-op") \
+  X(RESP_ERR_PROJECT_NAME, 400, "project_name") \
+  X(RESP_ERR_PROJECT_REF, 400, "project_ref") \
+  X(RESP_ERR_REGION, 400, "region") \
+  X(RESP_ERR_REQUEST, 400, "request") \
+  X(RESP_ERR_REQ_ID, 400, "req_id") \
+  X(RESP_ERR_SIG_ARITY, 400, "sig-arity") \
+  X(RESP_ERR_TYPE, 400, "type") \
+  X(RESP_ERR_DB_REF_MISSING, 404, "db_ref") \
+  X(RESP_ERR_FILE_ID, 404, "file-id") \
+  X(RESP_ERR_GATEWAY_DISABLED, 404, "gateway-disabled") \
+  X(RESP_ERR_ROUTE, 404, "route") \
+  X(RESP_ERR_RATE_LIMIT, 429, "rate-limit") \
+  X(RESP_ERR_TRANSFER_ENCODING, 501, "transfer-encoding") \
+  X(RESP_ERR_BUSY, 503, "busy") \
+  X(RESP_ERR_CIRCUIT_OPEN, 503, "circuit-open") \
+  X(RESP_ERR_STORE, 503, "store")
+
+typedef enum {
+#define RESP_ERR_ENUM(id, code, err) id,
+  RESP_ERRORS(RESP_ERR_ENUM)
+#undef RESP_ERR_ENUM
+  RESP_ERR_COUNT
+} RespErr;
+
+typedef struct {
+  int code;
+  const char *err;
+  char *wire[2]; /* [0] Connection: close, [1] keep-alive */
+  size_t wire_len[2];
+} RespErrWire;
+
+static RespErrWire resp_errors[RESP_ERR_COUNT] = {
+#define RESP_ERR_ROW(id, code, err) {code, err, {NULL, NULL}, {0, 0}},
+  RESP_ERRORS(RESP_ERR_ROW)
+#undef RESP_ERR_ROW
+};
+
+#define HTTP_MAX_HEADERS 64u
+
+typedef struct {
+  uint32_t name_off;
+  uint32_t name_len;
+  uint32_t value_off;
+  uint32_t value_len;
+} HttpHeader;
+
+/* A request head indexed in one pass. Offsets are relative to the start of the request, so
+   the index survives the receive buffer growing while the body arrives; `base` and
+   `body_len` are bound once the whole request is buffered. */
+typedef struct {
+  const char *base;
+  size_t scan;
+  bool head_done;
+  bool bad;
+  bool keep_alive;
+  bool transfer_encoding; /* any Transfer-Encoding header; such a body is never framed */
+  bool frame_ambiguous;   /* Transfer-Encoding, or a repeated or invalid Content-Length */
+  uint32_t method_len;
+  uint32_t path_off;
+  uint32_t path_len;
+  HttpHeader headers[HTTP_MAX_HEADERS];
+  size_t header_count;
+  size_t head_len;
+  long content_length;
+  size_t body_len;
+} HttpReq;
+
+typedef enum {
+  MET_REQUESTS_TOTAL = 0,
+  MET_RESPONSES_2XX,
+  MET_RESPONSES_4XX,
+  MET_RESPONSES_5XX,
+  MET_RATE_LIMITED_TOTAL,
+  MET_CIRCUIT_OPEN_TOTAL,
+  MET_DB_EXEC_ALLOW_TOTAL,
+  MET_DB_EXEC_DENY_TOTAL,
+  MET_CAPABILITY_DENY_TOTAL,
+  MET_RENDER_CACHE_HIT_TOTAL,
+  MET_RENDER_CACHE_MISS_TOTAL,
+  MET_RENDER_CACHE_EVICT_TOTAL,
+  MET_COUNT
+} MetricId;
+
+/* Written by one worker only; /metrics and /health sum all workers. */
+typedef struct {
+  _Alignas(64) _Atomic uint64_t v[MET_COUNT];
+} RuntimeMetrics;
+
+typedef enum {
+  ROUTE_HEALTH = 0,
+  ROUTE_META,
+  ROUTE_RENDER,
+  ROUTE_DB_EXEC,
+  ROUTE_GATEWAY_PROJECT_CREATE,
+  ROUTE_GATEWAY_DB_EXEC,
+  ROUTE_OTHER, /* /metrics, /openapi.json, unknown routes and unparsable requests */
+  ROUTE_COUNT
+} RouteId;
+
+#define LATENCY_BUCKETS 15u
+
+/* Handler latency per route: fixed buckets on a monotonic microsecond clock, one writer per
+   worker like RuntimeMetrics. `bucket[LATENCY_BUCKETS]` counts what exceeds every bound. */
+typedef struct {
+  _Alignas(64) _Atomic uint64_t bucket[ROUTE_COUNT][LATENCY_BUCKETS + 1u];
+  _Atomic uint64_t sum_us[ROUTE_COUNT];
+} RouteLatency;
+
+/* Allow/deny counts per D2B op, shared by all workers: open addressing over op_id, a slot
+   claimed with a CAS on `key` (op_id + 1, 0 when empty) and never released. Only ops present in
+   the core that served the request get a slot, so clients cannot grow the label set. */
+typedef struct {
+  _Atomic uint32_t key;
+  _Atomic uint64_t allow;
+  _Atomic uint64_t deny;
+} OpStat;
+
+typedef struct {
+  OpStat *slots;
+  uint32_t mask;
+  size_t max_ops;
+  _Atomic size_t used;
+  _Atomic uint64_t overflow_total;
+} OpStats;
+
+typedef struct Worker Worker;
+
+#define TRACE_PENDING_MAX 16u
+
+/* One loaded core generation: the lite/adapt tables and blobs plus the D2B op/sig index.
+   Requests pin the generation that was current when they started; a reload publishes a new
+   one and frees the old one once no worker has it pinned. */
 typedef struct {
+  uint64_t id;
   AiirU32Buf lite_table;
   AiirU32Buf lite_blob;
   AiirU32Buf adapt_table;
   AiirU32Buf adapt_blob;
   AiirU32Buf db_packet;
-  AiirPolicy policy;
-  AiirState state;
-  AiirDrift drift;
-
+  uint32_t *adapt_rows; /* file_id -> adapt row + 1, 0 when the file has no source fallback */
   DbOp *ops;
   size_t ops_count;
+  uint32_t *op_slots; /* open addressing over op_id: index into ops + 1, 0 when empty */
+  uint32_t op_mask;
   DbSig *sigs;
   size_t sig_count;
+} CoreGen;
+
+/* Capability nonces that have been consumed, kept until their capability expires. Entries
+   live in a fixed pool chained from hash buckets; a min-heap on expiry finds the ones that can
+   be dropped. A live nonce is never dropped: when the pool is full, new claims are refused. */
+#define NONCE_NIL UINT32_MAX
+
+typedef struct {
+  char nonce[CAP_NONCE_MAX_LEN + 1u];
+  int64_t exp_ts;
+  uint32_t hash;
+  uint32_t next; /* bucket chain, or free list when unused */
+  uint32_t heap_pos;
+} NonceEntry;
+
+typedef struct {
+  pthread_mutex_t lock;
+  NonceEntry *entries;
+  uint32_t *buckets;
+  uint32_t *heap; /* entry indices ordered by exp_ts */
+  uint32_t free_head;
+  size_t bucket_mask;
+  size_t capacity;
+  size_t count;
+  uint64_t expired_total;
+  uint64_t full_total;
+} NonceCache;
+
+/* Serialized /ai/render bodies keyed by (core generation, file id), in LRU order. Entries
+   are immutable once inserted; the shard holds one reference and every reader one more while
+   it copies the body, so the copy runs outside the shard lock. */
+typedef struct RenderEntry RenderEntry;
+struct RenderEntry {
+  RenderEntry *lru_prev;
+  RenderEntry *lru_next;
+  RenderEntry *hnext;
+  atomic_uint refs;
+  uint64_t gen;
+  uint32_t file_id;
+  size_t len;
+  char body[];
+};
+
+typedef struct {
+  pthread_mutex_t lock;
+  RenderEntry **buckets;
+  size_t bucket_mask;
+  RenderEntry *head; /* most recently used */
+  RenderEntry *tail;
+  size_t bytes;
+  size_t cap_bytes;
+  size_t entries;
+} RenderShard;
+
+#define RENDER_CACHE_SHARDS_MAX 16u
+
+/* Split by key hash so workers rendering different ids take different locks. */
+typedef struct {
+  RenderShard *shards;
+  size_t shard_mask;
+  size_t cap_bytes;
+} RenderCache;
+
+typedef struct {
+  char core_dir[1024];
+  _Atomic(CoreGen *) core;
+  uint64_t core_next_id; /* reload thread only */
+  int reload_efd;
+  bool reload_on_drift;
+  _Atomic uint64_t core_reload_total;
+  _Atomic uint64_t core_reload_fail_total;
+  pthread_t reload_thread;
+  atomic_bool reload_stop;
+  AiirPolicy policy;
+  AiirState state;
+  /* Owned by the watcher thread; requests only read the published counters. */
+  AiirDrift drift;
+  size_t drift_poll_ms;
+  size_t drift_settle_ms;
+  atomic_bool drift_inotify;
+  _Atomic uint64_t drift_total;
+  _Atomic uint64_t drift_checks_total;
+  _Atomic uint64_t drift_rehash_total;
+  RenderCache render_cache;
 
   bool cap_required;
   char cap_secret[256];
+  AiirHmacKey cap_key;
   size_t cap_max_future_sec;
-  char cap_nonce_ring[CAP_NONCE_RING_MAX][CAP_NONCE_MAX_LEN + 1u];
-  size_t cap_nonce_count;
-  size_t cap_nonce_next;
+  NonceCache cap_nonces;
   char audit_path[384];
-  FILE *audit_fp;
-
-  uint64_t metric_requests_total;
-  uint64_t metric_responses_2xx;
-  uint64_t metric_responses_4xx;
-  uint64_t metric_responses_5xx;
-  uint64_t metric_rate_limited_total;
-  uint64_t metric_circuit_open_total;
-  uint64_t metric_db_exec_allow_total;
-  uint64_t metric_db_exec_deny_total;
-  uint64_t metric_capability_deny_total;
+  AiirAudit audit;
+
+  Worker *workers;
+  size_t worker_count;
   bool log_requests;
 
   bool gateway_enable;
@@ -114,39 +414,245 @@ typedef struct {
   char gateway_db_default_profile[64];
   char gateway_db_region[64];
   size_t gateway_db_retention_days;
-  uint64_t gateway_seq;
+  OpStats op_stats;
+  char gateway_store_dir[384];
+  AiirProjectStore gateway_store;
+  bool gateway_store_open;
+  _Atomic uint64_t gateway_seq;
+  bool trace_enabled;
+  size_t trace_ring;
+  char trace_path[1024];
+  size_t trace_flush_ms;
+  AiirTraceRing **trace_rings;
+  AiirTraceSink trace_sink;
+  bool profile_enabled;
+  size_t profile_hz;
+  size_t profile_max_sec;
+  size_t profile_stacks;
+  AiirProfiler profiler;
+  atomic_bool profile_busy;
+  size_t snapshot_interval_sec;
+  pthread_mutex_t gateway_lock;
 } Runtime;
 
+typedef struct {
+  const char *db_mode;
+  size_t req_cap;
+  size_t body_cap;
+  size_t timeout_ms;
+  size_t rate_limit_rps;
+  size_t cb_fail_threshold;
+  size_t cb_cooldown_sec;
+  size_t max_conns;
+  size_t keepalive_timeout_ms;
+  size_t keepalive_max;
+  bool blocking;
+} ServeCfg;
+
+/* Shared by all workers and updated without a lock. The rate-limit window is one word, the
+   second it belongs to in the high 32 bits and the requests admitted in it in the low 32, so
+   a new second resets the count in the same compare-and-swap that admits the request. */
+typedef struct {
+  _Atomic uint64_t rl_state;
+  atomic_size_t consecutive_fail;
+  _Atomic int64_t cb_open_until;
+} ServeGuard;
+
+struct Worker {
+  Runtime *rt;
+  const ServeCfg *cfg;
+  ServeGuard *guard;
+  CoreGen *core;
+  _Atomic(CoreGen *) core_pin; /* hazard slot: the generation `core` points into, or NULL */
+  size_t id;
+  int sfd;
+  pthread_t thread;
+  Arena arena;
+  RuntimeMetrics metrics;
+  RouteLatency latency;
+  RouteId route; /* set by handle_request for the request in flight */
+  int status;    /* status of the response rendered for it, 0 until there is one */
+  /* Tracing (AI_TRACE=1): spans of the request in flight collect in `trace_pending` and reach
+     the ring in one push when it ends; the read and parse spans that led to it wait in
+     `trace_read`/`trace_parse` until then. */
+  AiirTraceRing trace;
+  AiirTraceEvent trace_pending[TRACE_PENDING_MAX];
+  size_t trace_n;
+  uint32_t trace_req;
+  uint32_t trace_op;
+  AiirTraceEvent trace_read;
+  AiirTraceEvent trace_parse;
+  /* A /debug/profile run this worker started without waiting for it. `profile_defer` is set
+     when the epoll loop has a timer for it; the handler then sets `profile_deferred` and the
+     loop parks the connection until the run is due. */
+  bool profile_defer;
+  bool profile_deferred;
+  AiirProfileRun *profile_run;
+  unsigned profile_sec;
+  uint64_t profile_start_us;
+  char profile_peer[128];
+  char profile_path[2048];
+};
+
 static size_t parse_env_size(const char *name, size_t defv, size_t minv, size_t maxv);
 static bool is_ascii_token(const char *s, size_t min_len, size_t max_len, const char *extra_allowed);
 static bool is_known_contract_version(const char *v);
 static bool is_known_create_intent(const char *intent);
 static bool is_known_db_exec_intent(const char *intent);
 
+/* Vector scans over JSON text. The tokenizer uses them to skip string contents and nested
+   values; the response writer uses the string scan to find the bytes that need escaping. */
+typedef const char *(*JsonScanFn)(const char *p, const char *end);
+
+/* First byte in [p, end) that ends plain string content: a quote, a backslash or a control
+   character. Returns end when there is none. */
+static const char *json_scan_string_scalar(const char *p, const char *end) {
+  while (p < end) {
+    unsigned char c = (unsigned char)*p;
+    if (c == '"' || c == '\\' || c < 0x20u) return p;
+    p++;
+  }
+  return end;
+}
+
+/* First quote or bracket in [p, end); everything else inside a nested value is skipped. */
+static const char *json_scan_nest_scalar(const char *p, const char *end) {
+  while (p < end) {
+    char c = *p;
+    if (c == '"' || c == '[' || c == ']' || c == '{' || c == '}') return p;
+    p++;
+  }
+  return end;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define JSON_SCAN_X86 1
+
+/* Controls are the bytes with the top three bits clear; '[' and '{' (and ']' and '}') differ
+   only in bit 5, so one OR folds each pair into a single compare. */
+static const char *json_scan_string_sse2(const char *p, const char *end) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i bslash = _mm_set1_epi8('\\');
+  const __m128i high = _mm_set1_epi8((char)0xe0);
+  const __m128i zero = _mm_setzero_si128();
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(const void *)p);
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+                             _mm_cmpeq_epi8(_mm_and_si128(v, high), zero));
+    unsigned bits = (unsigned)_mm_movemask_epi8(m);
+    if (bits) return p + __builtin_ctz(bits);
+    p += 16;
+  }
+  return json_scan_string_scalar(p, end);
+}
+
+static const char *json_scan_nest_sse2(const char *p, const char *end) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i fold = _mm_set1_epi8(0x20);
+  const __m128i open = _mm_set1_epi8('{');
+  const __m128i close = _mm_set1_epi8('}');
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(const void *)p);
+    __m128i f = _mm_or_si128(v, fold);
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_or_si128(_mm_cmpeq_epi8(f, open), _mm_cmpeq_epi8(f, close)));
+    unsigned bits = (unsigned)_mm_movemask_epi8(m);
+    if (bits) return p + __builtin_ctz(bits);
+    p += 16;
+  }
+  return json_scan_nest_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *json_scan_string_avx2(const char *p, const char *end) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i bslash = _mm256_set1_epi8('\\');
+  const __m256i high = _mm256_set1_epi8((char)0xe0);
+  const __m256i zero = _mm256_setzero_si256();
+  while (end - p >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)p);
+    __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, bslash)),
+                                _mm256_cmpeq_epi8(_mm256_and_si256(v, high), zero));
+    unsigned bits = (unsigned)_mm256_movemask_epi8(m);
+    if (bits) return p + __builtin_ctz(bits);
+    p += 32;
+  }
+  return json_scan_string_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *json_scan_nest_avx2(const char *p, const char *end) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i fold = _mm256_set1_epi8(0x20);
+  const __m256i open = _mm256_set1_epi8('{');
+  const __m256i close = _mm256_set1_epi8('}');
+  while (end - p >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)p);
+    __m256i f = _mm256_or_si256(v, fold);
+    __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                                _mm256_or_si256(_mm256_cmpeq_epi8(f, open), _mm256_cmpeq_epi8(f, close)));
+    unsigned bits = (unsigned)_mm256_movemask_epi8(m);
+    if (bits) return p + __builtin_ctz(bits);
+    p += 32;
+  }
+  return json_scan_nest_sse2(p, end);
+}
+
+static JsonScanFn json_scan_string = json_scan_string_sse2;
+static JsonScanFn json_scan_nest = json_scan_nest_sse2;
+#else
+static JsonScanFn json_scan_string = json_scan_string_scalar;
+static JsonScanFn json_scan_nest = json_scan_nest_scalar;
+#endif
+
+/* Picks the widest scanner the CPU supports; called once before the workers start. */
+static void json_scan_init(void) {
+#ifdef JSON_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    json_scan_string = json_scan_string_avx2;
+    json_scan_nest = json_scan_nest_avx2;
+  }
+#endif
+}
+
+/* Writes the escape sequence for one byte that json_scan_string stopped at. */
+static size_t json_escape_byte(unsigned char c, char out[6]) {
+  static const char hex[] = "0123456789abcdef";
+  out[0] = '\\';
+  switch (c) {
+    case '"': out[1] = '"'; return 2;
+    case '\\': out[1] = '\\'; return 2;
+    case '\n': out[1] = 'n'; return 2;
+    case '\r': out[1] = 'r'; return 2;
+    case '\t': out[1] = 't'; return 2;
+    default:
+      out[1] = 'u';
+      out[2] = '0';
+      out[3] = '0';
+      out[4] = hex[c >> 4];
+      out[5] = hex[c & 15u];
+      return 6;
+  }
+}
+
+/* Runs without escapes are found by the vector scan and copied whole. */
 static bool json_escape_copy(const char *src, size_t src_len, char *dst, size_t dst_cap, size_t *dst_len) {
+  const char *p = src;
+  const char *end = src + src_len;
   size_t w = 0;
-  for (size_t i = 0; i < src_len; i++) {
-    unsigned char c = (unsigned char)src[i];
-    const char *rep = NULL;
-    char tmp[7];
-    if (c == '\\') rep = "\\\\";
-    else if (c == '"') rep = "\\\"";
-    else if (c == '\n') rep = "\\n";
-    else if (c == '\r') rep = "\\r";
-    else if (c == '\t') rep = "\\t";
-    else if (c < 0x20) {
-      snprintf(tmp, sizeof(tmp), "\\u%04x", c);
-      rep = tmp;
-    }
-    if (rep) {
-      size_t rl = strlen(rep);
-      if (w + rl >= dst_cap) return false;
-      memcpy(dst + w, rep, rl);
-      w += rl;
-    } else {
-      if (w + 1 >= dst_cap) return false;
-      dst[w++] = (char)c;
-    }
+  while (p < end) {
+    const char *q = json_scan_string(p, end);
+    size_t run = (size_t)(q - p);
+    if (w + run >= dst_cap) return false;
+    memcpy(dst + w, p, run);
+    w += run;
+    if (q == end) break;
+    char rep[6];
+    size_t rl = json_escape_byte((unsigned char)*q, rep);
+    if (w + rl >= dst_cap) return false;
+    memcpy(dst + w, rep, rl);
+    w += rl;
+    p = q + 1;
   }
   if (w >= dst_cap) return false;
   dst[w] = '\0';
@@ -154,14 +660,29 @@ static bool json_escape_copy(const char *src, size_t src_len, char *dst, size_t
   return true;
 }
 
-static bool find_header_end(const char *req, size_t n, size_t *header_end) {
-  for (size_t i = 0; i + 3 < n; i++) {
-    if (req[i] == '\r' && req[i + 1] == '\n' && req[i + 2] == '\r' && req[i + 3] == '\n') {
-      *header_end = i + 4;
-      return true;
-    }
+/* Decimal digits of v, two per division; dst needs room for 20 bytes. */
+static size_t fmt_u64(char *dst, uint64_t v) {
+  static const char pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+  char tmp[20];
+  size_t i = sizeof(tmp);
+  while (v >= 100u) {
+    size_t d = (size_t)(v % 100u) * 2u;
+    v /= 100u;
+    tmp[--i] = pairs[d + 1u];
+    tmp[--i] = pairs[d];
   }
-  return false;
+  if (v >= 10u) {
+    size_t d = (size_t)v * 2u;
+    tmp[--i] = pairs[d + 1u];
+    tmp[--i] = pairs[d];
+  } else {
+    tmp[--i] = (char)('0' + v);
+  }
+  memcpy(dst, tmp + i, sizeof(tmp) - i);
+  return sizeof(tmp) - i;
 }
 
 static bool parse_env_bool(const char *name, bool defv) {
@@ -172,63 +693,163 @@ static bool parse_env_bool(const char *name, bool defv) {
   return defv;
 }
 
+/* Timeouts, sweeps and request latency all run on the monotonic clock, so a wall-clock step
+   neither fires deadlines early nor shows up as latency. */
+static uint64_t mono_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)(ts.tv_nsec / 1000);
+}
+
 static uint64_t now_ms(void) {
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
-  return (uint64_t)tv.tv_sec * 1000ULL + (uint64_t)(tv.tv_usec / 1000);
-}
-
-static bool parse_method_path(const char *req, char *method, size_t method_cap, char *path, size_t path_cap) {
-  const char *sp1 = strchr(req, ' ');
-  if (!sp1) return false;
-  size_t mlen = (size_t)(sp1 - req);
-  if (mlen == 0 || mlen + 1 > method_cap) return false;
-  memcpy(method, req, mlen);
-  method[mlen] = '\0';
-
-  const char *sp2 = strchr(sp1 + 1, ' ');
-  if (!sp2) return false;
-  size_t plen = (size_t)(sp2 - (sp1 + 1));
-  if (plen == 0 || plen + 1 > path_cap) return false;
-  memcpy(path, sp1 + 1, plen);
-  path[plen] = '\0';
-  return true;
+  return mono_us() / 1000u;
+}
+
+static void http_req_reset(HttpReq *r) {
+  r->base = NULL;
+  r->scan = 0;
+  r->head_done = false;
+  r->bad = false;
+  r->keep_alive = false;
+  r->transfer_encoding = false;
+  r->frame_ambiguous = false;
+  r->method_len = 0;
+  r->path_off = 0;
+  r->path_len = 0;
+  r->header_count = 0;
+  r->head_len = 0;
+  r->content_length = 0;
+  r->body_len = 0;
 }
 
-static long parse_content_length(const char *headers) {
-  const char *p = headers;
-  while (*p) {
-    if ((p[0] == 'C' || p[0] == 'c') && strncasecmp(p, "Content-Length:", 15) == 0) {
-      p += 15;
-      while (*p == ' ' || *p == '\t') p++;
-      return strtol(p, NULL, 10);
+static bool http_name_eq(const char *p, size_t n, const char *name) {
+  return strlen(name) == n && strncasecmp(p, name, n) == 0;
+}
+
+static bool http_value_has(const char *v, size_t n, const char *token) {
+  size_t tn = strlen(token);
+  for (size_t i = 0; i + tn <= n; i++) {
+    if (strncasecmp(v + i, token, tn) == 0) return true;
+  }
+  return false;
+}
+
+/* Indexes the request line and header lines of buf[0, len). Malformed lines, too many
+   headers or a repeated/garbled Content-Length mark the request bad or unframed; the handler
+   turns those into 400s. Chunked bodies are not supported: any Transfer-Encoding, with or
+   without Content-Length, leaves the request unframed and gets a 501. */
+static void http_index_head(HttpReq *r, const char *buf, size_t len) {
+  const char *end = buf + len;
+  const char *eol = memmem(buf, len, "\r\n", 2);
+  const char *sp1 = eol ? memchr(buf, ' ', (size_t)(eol - buf)) : NULL;
+  const char *sp2 = sp1 ? memchr(sp1 + 1, ' ', (size_t)(eol - sp1 - 1)) : NULL;
+  if (!sp2) {
+    r->bad = true;
+    return;
+  }
+  r->method_len = (uint32_t)(sp1 - buf);
+  r->path_off = (uint32_t)(sp1 + 1 - buf);
+  r->path_len = (uint32_t)(sp2 - sp1 - 1);
+  bool http11 = (size_t)(eol - sp2 - 1) == 8u && strncmp(sp2 + 1, "HTTP/1.1", 8) == 0;
+  r->keep_alive = http11;
+
+  bool have_cl = false;
+  const char *p = eol + 2;
+  while (p < end) {
+    const char *le = memmem(p, (size_t)(end - p), "\r\n", 2);
+    if (!le) le = end;
+    if (le == p) break;
+    const char *colon = memchr(p, ':', (size_t)(le - p));
+    if (!colon || r->header_count == HTTP_MAX_HEADERS) {
+      r->bad = true;
+      return;
+    }
+    const char *v = colon + 1;
+    while (v < le && (*v == ' ' || *v == '\t')) v++;
+    const char *ve = le;
+    while (ve > v && (ve[-1] == ' ' || ve[-1] == '\t')) ve--;
+    HttpHeader *h = &r->headers[r->header_count++];
+    h->name_off = (uint32_t)(p - buf);
+    h->name_len = (uint32_t)(colon - p);
+    h->value_off = (uint32_t)(v - buf);
+    h->value_len = (uint32_t)(ve - v);
+
+    if (http_name_eq(p, h->name_len, "Content-Length")) {
+      long cl = 0;
+      bool digits = v < ve;
+      for (const char *d = v; d < ve && digits; d++) {
+        if (*d < '0' || *d > '9' || cl > (LONG_MAX - 9) / 10) digits = false;
+        else cl = cl * 10 + (*d - '0');
+      }
+      r->content_length = (!digits || (have_cl && r->content_length != cl)) ? -1 : cl;
+      if (!digits || have_cl) r->frame_ambiguous = true;
+      have_cl = true;
+    } else if (http_name_eq(p, h->name_len, "Transfer-Encoding")) {
+      r->transfer_encoding = true;
+      r->frame_ambiguous = true;
+    } else if (http_name_eq(p, h->name_len, "Connection")) {
+      size_t vn = (size_t)(ve - v);
+      if (http_value_has(v, vn, "close")) r->keep_alive = false;
+      else if (http_value_has(v, vn, "keep-alive")) r->keep_alive = true;
     }
-    const char *nl = strstr(p, "\r\n");
-    if (!nl) break;
-    p = nl + 2;
+    p = le + 2;
   }
-  return 0;
 }
 
-static bool get_header_value(const char *req, const char *name, char *out, size_t out_cap) {
-  size_t name_len = strlen(name);
-  const char *p = req;
-  while (*p) {
-    const char *line_end = strstr(p, "\r\n");
-    if (!line_end) break;
-    if (line_end == p) break;
-    if (strncasecmp(p, name, name_len) == 0 && p[name_len] == ':') {
-      const char *v = p + name_len + 1;
-      while (v < line_end && (*v == ' ' || *v == '\t')) v++;
-      size_t n = (size_t)(line_end - v);
-      if (n + 1u > out_cap) return false;
-      memcpy(out, v, n);
-      out[n] = '\0';
-      return true;
-    }
-    p = line_end + 2;
+/* Looks for the end of the head in buf[0, n), resuming where the previous call stopped so a
+   request arriving in many segments is scanned once. Indexes the head when found. */
+static bool http_scan_head(HttpReq *r, const char *buf, size_t n) {
+  if (r->head_done) return true;
+  size_t from = r->scan > 3u ? r->scan - 3u : 0u;
+  const char *e = n > from ? memmem(buf + from, n - from, "\r\n\r\n", 4) : NULL;
+  r->scan = n;
+  if (!e) return false;
+  r->head_done = true;
+  r->head_len = (size_t)(e + 4 - buf);
+  http_index_head(r, buf, r->head_len - 2u);
+  return true;
+}
+
+/* Total length of a framed request (head plus declared body). Returns false when the head is
+   incomplete or malformed, or Content-Length cannot frame the body (it never does next to a
+   Transfer-Encoding). */
+static bool http_frame(const HttpReq *r, size_t body_cap, size_t *req_len) {
+  if (!r->head_done || r->bad || r->transfer_encoding || r->content_length < 0 ||
+      r->content_length > (long)body_cap)
+    return false;
+  *req_len = r->head_len + (size_t)r->content_length;
+  return true;
+}
+
+/* Binds the index to the buffered request at `base`, `len` bytes long. Heads that never
+   completed are indexed as far as they go so the handler can still name the route. */
+static void http_bind(HttpReq *r, const char *base, size_t len) {
+  if (!r->head_done) {
+    r->head_len = len;
+    http_index_head(r, base, len);
   }
-  return false;
+  r->base = base;
+  r->body_len = len > r->head_len ? len - r->head_len : 0u;
+}
+
+static const char *http_header(const HttpReq *r, const char *name, size_t *len) {
+  for (size_t i = 0; i < r->header_count; i++) {
+    const HttpHeader *h = &r->headers[i];
+    if (http_name_eq(r->base + h->name_off, h->name_len, name)) {
+      *len = h->value_len;
+      return r->base + h->value_off;
+    }
+  }
+  return NULL;
+}
+
+static bool http_header_copy(const HttpReq *r, const char *name, char *out, size_t out_cap) {
+  size_t n = 0;
+  const char *v = http_header(r, name, &n);
+  if (!v || n + 1u > out_cap) return false;
+  memcpy(out, v, n);
+  out[n] = '\0';
+  return true;
 }
 
 static bool is_valid_nonce(const char *nonce) {
@@ -241,137 +862,143 @@ static bool is_valid_nonce(const char *nonce) {
   return true;
 }
 
-static bool cap_nonce_seen(const Runtime *rt, const char *nonce) {
-  for (size_t i = 0; i < rt->cap_nonce_count; i++) {
-    if (strcmp(rt->cap_nonce_ring[i], nonce) == 0) return true;
+static bool nonce_cache_init(NonceCache *c, size_t capacity) {
+  memset(c, 0, sizeof(*c));
+  pthread_mutex_init(&c->lock, NULL);
+  c->free_head = NONCE_NIL;
+  if (capacity == 0) return true;
+  size_t n = 16u;
+  while (n < capacity) n <<= 1;
+  c->entries = (NonceEntry *)calloc(capacity, sizeof(NonceEntry));
+  c->buckets = (uint32_t *)malloc(n * sizeof(uint32_t));
+  c->heap = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  if (!c->entries || !c->buckets || !c->heap) return false;
+  for (size_t i = 0; i < n; i++) c->buckets[i] = NONCE_NIL;
+  for (size_t i = 0; i < capacity; i++) c->entries[i].next = i + 1u < capacity ? (uint32_t)(i + 1u) : NONCE_NIL;
+  c->free_head = 0;
+  c->bucket_mask = n - 1u;
+  c->capacity = capacity;
+  return true;
+}
+
+static void nonce_cache_destroy(NonceCache *c) {
+  free(c->entries);
+  free(c->buckets);
+  free(c->heap);
+  c->entries = NULL;
+  c->buckets = NULL;
+  c->heap = NULL;
+  pthread_mutex_destroy(&c->lock);
+}
+
+static void nonce_heap_set(NonceCache *c, size_t pos, uint32_t idx) {
+  c->heap[pos] = idx;
+  c->entries[idx].heap_pos = (uint32_t)pos;
+}
+
+static void nonce_heap_up(NonceCache *c, size_t pos) {
+  uint32_t idx = c->heap[pos];
+  int64_t exp = c->entries[idx].exp_ts;
+  while (pos > 0) {
+    size_t parent = (pos - 1u) / 2u;
+    if (c->entries[c->heap[parent]].exp_ts <= exp) break;
+    nonce_heap_set(c, pos, c->heap[parent]);
+    pos = parent;
   }
-  return false;
+  nonce_heap_set(c, pos, idx);
 }
 
-static void cap_nonce_add(Runtime *rt, const char *nonce) {
-  size_t n = strlen(nonce);
-  if (n > CAP_NONCE_MAX_LEN) n = CAP_NONCE_MAX_LEN;
-  memcpy(rt->cap_nonce_ring[rt->cap_nonce_next], nonce, n);
-  rt->cap_nonce_ring[rt->cap_nonce_next][n] = '\0';
-  rt->cap_nonce_next = (rt->cap_nonce_next + 1u) % CAP_NONCE_RING_MAX;
-  if (rt->cap_nonce_count < CAP_NONCE_RING_MAX) rt->cap_nonce_count++;
+static void nonce_heap_down(NonceCache *c, size_t pos) {
+  uint32_t idx = c->heap[pos];
+  int64_t exp = c->entries[idx].exp_ts;
+  for (;;) {
+    size_t child = pos * 2u + 1u;
+    if (child >= c->count) break;
+    if (child + 1u < c->count && c->entries[c->heap[child + 1u]].exp_ts < c->entries[c->heap[child]].exp_ts) child++;
+    if (exp <= c->entries[c->heap[child]].exp_ts) break;
+    nonce_heap_set(c, pos, c->heap[child]);
+    pos = child;
+  }
+  nonce_heap_set(c, pos, idx);
 }
 
-typedef struct {
-  uint32_t s[8];
-  uint64_t bits;
-  uint8_t buf[64];
-  size_t len;
-} Sha256Ctx;
-
-static const uint32_t k256[64] = {
-  0x428a2f98u,0x71374491u,0xb5c0fbcfu,0xe9b5dba5u,0x3956c25bu,0x59f111f1u,0x923f82a4u,0xab1c5ed5u,
-  0xd807aa98u,0x12835b01u,0x243185beu,0x550c7dc3u,0x72be5d74u,0x80deb1feu,0x9bdc06a7u,0xc19bf174u,
-  0xe49b69c1u,0xefbe4786u,0x0fc19dc6u,0x240ca1ccu,0x2de92c6fu,0x4a7484aau,0x5cb0a9dcu,0x76f988dau,
-  0x983e5152u,0xa831c66du,0xb00327c8u,0xbf597fc7u,0xc6e00bf3u,0xd5a79147u,0x06ca6351u,0x14292967u,
-  0x27b70a85u,0x2e1b2138u,0x4d2c6dfcu,0x53380d13u,0x650a7354u,0x766a0abbu,0x81c2c92eu,0x92722c85u,
-  0xa2bfe8a1u,0xa81a664bu,0xc24b8b70u,0xc76c51a3u,0xd192e819u,0xd6990624u,0xf40e3585u,0x106aa070u,
-  0x19a4c116u,0x1e376c08u,0x2748774cu,0x34b0bcb5u,0x391c0cb3u,0x4ed8aa4au,0x5b9cca4fu,0x682e6ff3u,
-  0x748f82eeu,0x78a5636fu,0x84c87814u,0x8cc70208u,0x90befffau,0xa4506cebu,0xbef9a3f7u,0xc67178f2u
-};
+static uint32_t nonce_cache_find_locked(const NonceCache *c, const char *nonce, uint32_t hash) {
+  for (uint32_t i = c->buckets[hash & c->bucket_mask]; i != NONCE_NIL; i = c->entries[i].next) {
+    const NonceEntry *e = &c->entries[i];
+    if (e->hash == hash && strcmp(e->nonce, nonce) == 0) return i;
+  }
+  return NONCE_NIL;
+}
 
-static uint32_t ror32(uint32_t x, uint32_t n) { return (x >> n) | (x << (32u - n)); }
-
-static void sha256_block(Sha256Ctx *c, const uint8_t b[64]) {
-  uint32_t w[64];
-  for (uint32_t i = 0; i < 16; i++) {
-    uint32_t j = i * 4u;
-    w[i] = ((uint32_t)b[j] << 24) | ((uint32_t)b[j + 1u] << 16) | ((uint32_t)b[j + 2u] << 8) | (uint32_t)b[j + 3u];
-  }
-  for (uint32_t i = 16; i < 64; i++) {
-    uint32_t s0 = ror32(w[i - 15u], 7u) ^ ror32(w[i - 15u], 18u) ^ (w[i - 15u] >> 3u);
-    uint32_t s1 = ror32(w[i - 2u], 17u) ^ ror32(w[i - 2u], 19u) ^ (w[i - 2u] >> 10u);
-    w[i] = w[i - 16u] + s0 + w[i - 7u] + s1;
-  }
-  uint32_t a = c->s[0], b0 = c->s[1], c0 = c->s[2], d = c->s[3], e = c->s[4], f = c->s[5], g = c->s[6], h = c->s[7];
-  for (uint32_t i = 0; i < 64; i++) {
-    uint32_t S1 = ror32(e, 6u) ^ ror32(e, 11u) ^ ror32(e, 25u);
-    uint32_t ch = (e & f) ^ ((~e) & g);
-    uint32_t t1 = h + S1 + ch + k256[i] + w[i];
-    uint32_t S0 = ror32(a, 2u) ^ ror32(a, 13u) ^ ror32(a, 22u);
-    uint32_t maj = (a & b0) ^ (a & c0) ^ (b0 & c0);
-    uint32_t t2 = S0 + maj;
-    h = g; g = f; f = e; e = d + t1; d = c0; c0 = b0; b0 = a; a = t1 + t2;
-  }
-  c->s[0] += a; c->s[1] += b0; c->s[2] += c0; c->s[3] += d;
-  c->s[4] += e; c->s[5] += f; c->s[6] += g; c->s[7] += h;
-}
-
-static void sha256_init(Sha256Ctx *c) {
-  c->s[0] = 0x6a09e667u; c->s[1] = 0xbb67ae85u; c->s[2] = 0x3c6ef372u; c->s[3] = 0xa54ff53au;
-  c->s[4] = 0x510e527fu; c->s[5] = 0x9b05688cu; c->s[6] = 0x1f83d9abu; c->s[7] = 0x5be0cd19u;
-  c->bits = 0;
-  c->len = 0;
-}
-
-static void sha256_update(Sha256Ctx *c, const uint8_t *p, size_t n) {
-  while (n > 0) {
-    size_t take = 64u - c->len;
-    if (take > n) take = n;
-    memcpy(c->buf + c->len, p, take);
-    c->len += take;
-    p += take;
-    n -= take;
-    if (c->len == 64u) {
-      sha256_block(c, c->buf);
-      c->bits += 512u;
-      c->len = 0;
-    }
-  }
-}
-
-static void sha256_final(Sha256Ctx *c, uint8_t out[32]) {
-  c->bits += (uint64_t)c->len * 8u;
-  c->buf[c->len++] = 0x80u;
-  if (c->len > 56u) {
-    while (c->len < 64u) c->buf[c->len++] = 0u;
-    sha256_block(c, c->buf);
-    c->len = 0u;
-  }
-  while (c->len < 56u) c->buf[c->len++] = 0u;
-  for (int i = 7; i >= 0; i--) {
-    c->buf[c->len++] = (uint8_t)((c->bits >> (i * 8)) & 0xffu);
-  }
-  sha256_block(c, c->buf);
-  for (uint32_t i = 0; i < 8u; i++) {
-    out[i * 4u] = (uint8_t)(c->s[i] >> 24);
-    out[i * 4u + 1u] = (uint8_t)(c->s[i] >> 16);
-    out[i * 4u + 2u] = (uint8_t)(c->s[i] >> 8);
-    out[i * 4u + 3u] = (uint8_t)(c->s[i]);
-  }
-}
-
-static void hmac_sha256(const uint8_t *key, size_t key_len, const uint8_t *msg, size_t msg_len, uint8_t out[32]) {
-  uint8_t k0[64], kipad[64], kopad[64], tmp[32];
-  memset(k0, 0, sizeof(k0));
-  if (key_len > 64u) {
-    Sha256Ctx c;
-    sha256_init(&c);
-    sha256_update(&c, key, key_len);
-    sha256_final(&c, k0);
-  } else {
-    memcpy(k0, key, key_len);
+static void nonce_cache_remove_locked(NonceCache *c, uint32_t idx) {
+  NonceEntry *e = &c->entries[idx];
+  uint32_t *link = &c->buckets[e->hash & c->bucket_mask];
+  while (*link != idx) link = &c->entries[*link].next;
+  *link = e->next;
+  size_t pos = e->heap_pos;
+  c->count--;
+  if (pos < c->count) {
+    uint32_t moved = c->heap[c->count];
+    nonce_heap_set(c, pos, moved);
+    nonce_heap_up(c, pos);
+    nonce_heap_down(c, c->entries[moved].heap_pos);
   }
-  for (size_t i = 0; i < 64u; i++) {
-    kipad[i] = (uint8_t)(k0[i] ^ 0x36u);
-    kopad[i] = (uint8_t)(k0[i] ^ 0x5cu);
+  e->next = c->free_head;
+  c->free_head = idx;
+}
+
+/* A nonce whose capability has expired can no longer be replayed: the signature covers the
+   expiry, so the request would be rejected as expired before the nonce is consulted. */
+static void nonce_cache_expire_locked(NonceCache *c, int64_t now) {
+  while (c->count > 0 && c->entries[c->heap[0]].exp_ts < now) {
+    nonce_cache_remove_locked(c, c->heap[0]);
+    c->expired_total++;
   }
-  Sha256Ctx c1;
-  sha256_init(&c1);
-  sha256_update(&c1, kipad, sizeof(kipad));
-  sha256_update(&c1, msg, msg_len);
-  sha256_final(&c1, tmp);
+}
+
+static bool cap_nonce_seen(Runtime *rt, const char *nonce, int64_t now) {
+  NonceCache *c = &rt->cap_nonces;
+  uint32_t hash = aiir_fnv1a32((const uint8_t *)nonce, strlen(nonce));
+  pthread_mutex_lock(&c->lock);
+  uint32_t idx = nonce_cache_find_locked(c, nonce, hash);
+  bool seen = idx != NONCE_NIL && c->entries[idx].exp_ts >= now;
+  pthread_mutex_unlock(&c->lock);
+  return seen;
+}
 
-  Sha256Ctx c2;
-  sha256_init(&c2);
-  sha256_update(&c2, kopad, sizeof(kopad));
-  sha256_update(&c2, tmp, sizeof(tmp));
-  sha256_final(&c2, out);
+/* Re-checks under the lock so two workers racing on one nonce cannot both consume it. Returns 1
+   when the nonce is claimed, 0 when it was already used, and -1 (counted) when every slot holds
+   a live nonce: evicting one would let its capability be replayed. */
+static int cap_nonce_claim(Runtime *rt, const char *nonce, int64_t exp_ts, int64_t now) {
+  NonceCache *c = &rt->cap_nonces;
+  size_t n = strlen(nonce);
+  if (n > CAP_NONCE_MAX_LEN) n = CAP_NONCE_MAX_LEN;
+  uint32_t hash = aiir_fnv1a32((const uint8_t *)nonce, n);
+  pthread_mutex_lock(&c->lock);
+  nonce_cache_expire_locked(c, now);
+  if (nonce_cache_find_locked(c, nonce, hash) != NONCE_NIL) {
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+  }
+  if (c->count == c->capacity) {
+    c->full_total++;
+    pthread_mutex_unlock(&c->lock);
+    return -1;
+  }
+  uint32_t idx = c->free_head;
+  NonceEntry *e = &c->entries[idx];
+  c->free_head = e->next;
+  memcpy(e->nonce, nonce, n);
+  e->nonce[n] = '\0';
+  e->exp_ts = exp_ts;
+  e->hash = hash;
+  e->next = c->buckets[hash & c->bucket_mask];
+  c->buckets[hash & c->bucket_mask] = idx;
+  nonce_heap_set(c, c->count, idx);
+  c->count++;
+  nonce_heap_up(c, c->count - 1u);
+  pthread_mutex_unlock(&c->lock);
+  return 1;
 }
 
 static void cap_sig_hex(const Runtime *rt, uint32_t op_id, long long exp_ts, const char *nonce, char out_hex[65]) {
@@ -380,7 +1007,7 @@ static void cap_sig_hex(const Runtime *rt, uint32_t op_id, long long exp_ts, con
   if (n < 0) n = 0;
   if ((size_t)n >= sizeof(msg)) n = (int)(sizeof(msg) - 1u);
   uint8_t mac[32];
-  hmac_sha256((const uint8_t *)rt->cap_secret, strlen(rt->cap_secret), (const uint8_t *)msg, (size_t)n, mac);
+  aiir_hmac_sha256_keyed(&rt->cap_key, (const uint8_t *)msg, (size_t)n, mac);
   static const char *hex = "0123456789abcdef";
   for (size_t i = 0; i < 32u; i++) {
     out_hex[i * 2u] = hex[(mac[i] >> 4) & 0x0fu];
@@ -402,12 +1029,12 @@ static bool constant_time_eq_hex(const char *a, const char *b) {
 }
 
 static void audit_log(Runtime *rt, const char *peer, const char *method, const char *path, int status, const char *event, uint32_t op_id, const char *reason) {
+  if (!aiir_audit_enabled(&rt->audit)) return;
   char ts[32];
   time_t now = time(NULL);
   struct tm tmv;
   memset(&tmv, 0, sizeof(tmv));
-  struct tm *ptm = gmtime(&now);
-  if (ptm) tmv = *ptm;
+  (void)gmtime_r(&now, &tmv);
   strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", &tmv);
 
   char peer_e[256], method_e[64], path_e[512], event_e[96], reason_e[192];
@@ -419,34 +1046,32 @@ static void audit_log(Runtime *rt, const char *peer, const char *method, const c
   (void)json_escape_copy(reason ? reason : "-", strlen(reason ? reason : "-"), reason_e, sizeof(reason_e), &out_len);
 
   char line[1400];
-  snprintf(line, sizeof(line),
-           "{\"ts\":\"%s\",\"event\":\"%s\",\"status\":%d,\"peer\":\"%s\",\"method\":\"%s\",\"path\":\"%s\",\"opId\":%u,\"reason\":\"%s\"}",
-           ts, event_e, status, peer_e, method_e, path_e, op_id, reason_e);
-
-  fprintf(stderr, "%s\n", line);
-  if (rt->audit_fp) {
-    fprintf(rt->audit_fp, "%s\n", line);
-    fflush(rt->audit_fp);
-  }
+  int n = snprintf(line, sizeof(line),
+                   "{\"ts\":\"%s\",\"event\":\"%s\",\"status\":%d,\"peer\":\"%s\",\"method\":\"%s\",\"path\":\"%s\",\"opId\":%u,\"reason\":\"%s\"}",
+                   ts, event_e, status, peer_e, method_e, path_e, op_id, reason_e);
+  if (n < 0) return;
+  if ((size_t)n >= sizeof(line)) n = (int)(sizeof(line) - 1u);
+  /* The writer thread batches the line out to the log (and the stderr mirror). */
+  (void)aiir_audit_push(&rt->audit, line, (size_t)n);
 }
 
-static void request_log(Runtime *rt, const char *peer, const char *method, const char *path, int status, const char *reason, uint64_t start_ms) {
+static void request_log(Runtime *rt, const char *peer, const char *method, const char *path, int status, const char *reason, uint64_t start_us) {
   if (!rt->log_requests) return;
-  uint64_t elapsed_ms = 0;
-  uint64_t n = now_ms();
-  if (n >= start_ms) elapsed_ms = n - start_ms;
+  uint64_t elapsed_us = 0;
+  uint64_t n = mono_us();
+  if (n >= start_us) elapsed_us = n - start_us;
   char msg[64];
-  snprintf(msg, sizeof(msg), "request-latency-ms=%llu", (unsigned long long)elapsed_ms);
+  snprintf(msg, sizeof(msg), "request-latency-us=%llu", (unsigned long long)elapsed_us);
   audit_log(rt, peer, method, path, status, "request", 0u, reason ? reason : msg);
 }
 
-static bool validate_capability(Runtime *rt, const char *req, uint32_t op_id, char *deny_reason, size_t deny_reason_cap) {
+static bool capability_check(Runtime *rt, const HttpReq *req, uint32_t op_id, char *deny_reason, size_t deny_reason_cap) {
   if (!rt->cap_required) return true;
   char h_op[64], h_exp[64], h_nonce[128], h_sig[128];
-  if (!get_header_value(req, "X-AIIR-Cap-Op", h_op, sizeof(h_op)) ||
-      !get_header_value(req, "X-AIIR-Cap-Exp", h_exp, sizeof(h_exp)) ||
-      !get_header_value(req, "X-AIIR-Cap-Nonce", h_nonce, sizeof(h_nonce)) ||
-      !get_header_value(req, "X-AIIR-Cap-Sig", h_sig, sizeof(h_sig))) {
+  if (!http_header_copy(req, "X-AIIR-Cap-Op", h_op, sizeof(h_op)) ||
+      !http_header_copy(req, "X-AIIR-Cap-Exp", h_exp, sizeof(h_exp)) ||
+      !http_header_copy(req, "X-AIIR-Cap-Nonce", h_nonce, sizeof(h_nonce)) ||
+      !http_header_copy(req, "X-AIIR-Cap-Sig", h_sig, sizeof(h_sig))) {
     snprintf(deny_reason, deny_reason_cap, "cap-missing");
     return false;
   }
@@ -477,7 +1102,7 @@ static bool validate_capability(Runtime *rt, const char *req, uint32_t op_id, ch
     snprintf(deny_reason, deny_reason_cap, "cap-nonce");
     return false;
   }
-  if (cap_nonce_seen(rt, h_nonce)) {
+  if (cap_nonce_seen(rt, h_nonce, (int64_t)now)) {
     snprintf(deny_reason, deny_reason_cap, "cap-replay");
     return false;
   }
@@ -489,19 +1114,115 @@ static bool validate_capability(Runtime *rt, const char *req, uint32_t op_id, ch
     return false;
   }
 
-  cap_nonce_add(rt, h_nonce);
+  int claimed = cap_nonce_claim(rt, h_nonce, (int64_t)exp_ts, (int64_t)now);
+  if (claimed <= 0) {
+    snprintf(deny_reason, deny_reason_cap, claimed < 0 ? "nonce_cache_full" : "cap-replay");
+    return false;
+  }
+  return true;
+}
+
+static bool validate_capability(Runtime *rt, const HttpReq *req, uint32_t op_id, char *deny_reason, size_t deny_reason_cap) {
+  bool ok = capability_check(rt, req, op_id, deny_reason, deny_reason_cap);
+  AIIR_PROBE3(capability__verdict, op_id, ok, ok ? "ok" : deny_reason);
+  return ok;
+}
+
+static uint32_t op_slot_hash(uint32_t op_id) {
+  return op_id * 0x9e3779b1u;
+}
+
+static const DbOp *find_op(const CoreGen *core, uint32_t op_id) {
+  for (uint32_t h = op_slot_hash(op_id);; h++) {
+    uint32_t slot = core->op_slots[h & core->op_mask];
+    if (slot == 0) return NULL;
+    if (core->ops[slot - 1u].op_id == op_id) return &core->ops[slot - 1u];
+  }
+}
+
+static bool op_stats_init(OpStats *st, size_t max_ops) {
+  memset(st, 0, sizeof(*st));
+  size_t cap = 16u;
+  while (cap < max_ops * 2u) cap *= 2u;
+  st->slots = (OpStat *)calloc(cap, sizeof(OpStat));
+  if (!st->slots) return false;
+  st->mask = (uint32_t)(cap - 1u);
+  st->max_ops = max_ops;
   return true;
 }
 
-static const DbOp *find_op(const Runtime *rt, uint32_t op_id) {
-  for (size_t i = 0; i < rt->ops_count; i++) {
-    if (rt->ops[i].op_id == op_id) return &rt->ops[i];
+static void op_stats_free(OpStats *st) {
+  free(st->slots);
+  st->slots = NULL;
+}
+
+static OpStat *op_stats_slot(OpStats *st, uint32_t op_id) {
+  if (!st->slots || op_id == UINT32_MAX) return NULL;
+  uint32_t key = op_id + 1u;
+  for (uint32_t h = op_slot_hash(op_id);; h++) {
+    OpStat *e = &st->slots[h & st->mask];
+    uint32_t k = atomic_load_explicit(&e->key, memory_order_acquire);
+    if (k == key) return e;
+    if (k != 0) continue;
+    /* Claiming keeps at most max_ops keys in a table twice that size, so probes terminate. */
+    if (atomic_fetch_add(&st->used, 1u) >= st->max_ops) {
+      atomic_fetch_sub(&st->used, 1u);
+      atomic_fetch_add(&st->overflow_total, 1u);
+      return NULL;
+    }
+    uint32_t expect = 0;
+    if (atomic_compare_exchange_strong(&e->key, &expect, key)) return e;
+    atomic_fetch_sub(&st->used, 1u);
+    if (expect == key) return e;
   }
-  return NULL;
 }
 
-static bool load_db_index(Runtime *rt) {
-  AiirU32Buf *p = &rt->db_packet;
+static void op_stats_note(OpStats *st, uint32_t op_id, bool allowed) {
+  OpStat *e = op_stats_slot(st, op_id);
+  if (e) atomic_fetch_add_explicit(allowed ? &e->allow : &e->deny, 1u, memory_order_relaxed);
+}
+
+static int sig_cmp(const void *a, const void *b) {
+  const DbSig *x = (const DbSig *)a;
+  const DbSig *y = (const DbSig *)b;
+  if (x->op_id != y->op_id) return x->op_id < y->op_id ? -1 : 1;
+  if (x->arg_index != y->arg_index) return x->arg_index < y->arg_index ? -1 : 1;
+  return 0;
+}
+
+/* Groups the signatures per op (sorted by arg_index) and builds the op_id hash index,
+   keeping at least half the slots empty so probes stay short. Duplicate op_ids resolve to
+   the first row, as the D2B table is read in order. */
+static bool build_db_lookup(CoreGen *core) {
+  qsort(core->sigs, core->sig_count, sizeof(DbSig), sig_cmp);
+  size_t cap = 8u;
+  while (cap < core->ops_count * 2u) cap <<= 1;
+  if (cap > UINT32_MAX) return false;
+  core->op_slots = (uint32_t *)calloc(cap, sizeof(uint32_t));
+  if (!core->op_slots) return false;
+  core->op_mask = (uint32_t)(cap - 1u);
+  for (size_t i = 0; i < core->ops_count; i++) {
+    DbOp *op = &core->ops[i];
+    size_t lo = 0, hi = core->sig_count;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2u;
+      if (core->sigs[mid].op_id < op->op_id) lo = mid + 1u;
+      else hi = mid;
+    }
+    size_t end = lo;
+    while (end < core->sig_count && core->sigs[end].op_id == op->op_id) end++;
+    op->sig_off = (uint32_t)lo;
+    op->sig_len = (uint32_t)(end - lo);
+    if (find_op(core, op->op_id)) continue;
+    uint32_t h = op_slot_hash(op->op_id);
+    while (core->op_slots[h & core->op_mask] != 0) h++;
+    core->op_slots[h & core->op_mask] = (uint32_t)i + 1u;
+  }
+  return true;
+}
+
+static bool load_db_index(CoreGen *core) {
+  AiirU32Buf *p = &core->db_packet;
   if (p->len < 8 || p->words[0] != AIIR_D2B_MAGIC) return false;
   uint32_t sec_count = p->words[2];
   uint32_t toc_base = p->words[4];
@@ -528,55 +1249,326 @@ static bool load_db_index(Runtime *rt) {
   }
   if (!ops_words || !sig_words || (ops_len % 6u) != 0 || (sig_len % 4u) != 0) return false;
 
-  rt->ops_count = ops_len / 6u;
-  rt->sig_count = sig_len / 4u;
-  rt->ops = (DbOp *)calloc(rt->ops_count, sizeof(DbOp));
-  rt->sigs = (DbSig *)calloc(rt->sig_count, sizeof(DbSig));
-  if (!rt->ops || !rt->sigs) return false;
+  core->ops_count = ops_len / 6u;
+  core->sig_count = sig_len / 4u;
+  core->ops = (DbOp *)calloc(core->ops_count, sizeof(DbOp));
+  core->sigs = (DbSig *)calloc(core->sig_count, sizeof(DbSig));
+  if (!core->ops || !core->sigs) return false;
 
-  for (size_t i = 0; i < rt->ops_count; i++) {
+  for (size_t i = 0; i < core->ops_count; i++) {
     size_t k = i * 6u;
-    rt->ops[i].op_id = ops_words[k];
-    rt->ops[i].engine_id = ops_words[k + 1u];
-    rt->ops[i].acl_id = ops_words[k + 2u];
-    rt->ops[i].proc_id = ops_words[k + 3u];
-    rt->ops[i].min_args = ops_words[k + 4u];
-    rt->ops[i].max_args = ops_words[k + 5u];
-  }
-  for (size_t i = 0; i < rt->sig_count; i++) {
+    core->ops[i].op_id = ops_words[k];
+    core->ops[i].engine_id = ops_words[k + 1u];
+    core->ops[i].acl_id = ops_words[k + 2u];
+    core->ops[i].proc_id = ops_words[k + 3u];
+    core->ops[i].min_args = ops_words[k + 4u];
+    core->ops[i].max_args = ops_words[k + 5u];
+  }
+  for (size_t i = 0; i < core->sig_count; i++) {
     size_t k = i * 4u;
-    rt->sigs[i].op_id = sig_words[k];
-    rt->sigs[i].arg_index = sig_words[k + 1u];
-    rt->sigs[i].type_id = sig_words[k + 2u];
-    rt->sigs[i].flags = sig_words[k + 3u];
+    core->sigs[i].op_id = sig_words[k];
+    core->sigs[i].arg_index = sig_words[k + 1u];
+    core->sigs[i].type_id = sig_words[k + 2u];
+    core->sigs[i].flags = sig_words[k + 3u];
+  }
+  return build_db_lookup(core);
+}
+
+/* Dense map over the lite file ids, built from column 0 of the adapt table (the
+   source.adapt.ids file is a copy of that column). Rows naming ids outside the lite table
+   are unreachable from /ai/render and skipped; the first row for an id wins. */
+static bool build_adapt_index(CoreGen *core) {
+  size_t files = core->lite_table.len / 3u;
+  core->adapt_rows = (uint32_t *)calloc(files ? files : 1u, sizeof(uint32_t));
+  if (!core->adapt_rows) return false;
+  for (size_t i = 0; i < core->adapt_table.len / 3u; i++) {
+    uint32_t id = core->adapt_table.words[i * 3u];
+    if (id < files && core->adapt_rows[id] == 0) core->adapt_rows[id] = (uint32_t)i + 1u;
+  }
+  return true;
+}
+
+/* AI_CORE_MMAP (default on) maps the core files instead of copying them into the heap. */
+static bool load_core_words(const char *core_dir, const char *stem, AiirU32Buf *out) {
+  if (!parse_env_bool("AI_CORE_MMAP", true)) return aiir_load_u32_pref(core_dir, stem, out);
+  unsigned flags = parse_env_bool("AI_CORE_MMAP_POPULATE", false) ? AIIR_MAP_POPULATE : 0u;
+  const char *adv = getenv("AI_CORE_MADVISE");
+  if (adv && strcasecmp(adv, "willneed") == 0) flags |= AIIR_MAP_WILLNEED;
+  else if (adv && strcasecmp(adv, "random") == 0) flags |= AIIR_MAP_RANDOM;
+  return aiir_map_u32_pref(core_dir, stem, out, flags);
+}
+
+static size_t render_entry_cost(const RenderEntry *e) {
+  return sizeof(RenderEntry) + e->len + 1u;
+}
+
+static uint64_t render_hash(uint64_t gen, uint32_t file_id) {
+  uint64_t h = (gen * 0x9e3779b97f4a7c15ull) ^ ((uint64_t)file_id * 0xc2b2ae3d27d4eb4full);
+  return h ^ (h >> 29);
+}
+
+/* Buckets take the low bits of the hash, shards the top ones. */
+static RenderShard *render_shard(const RenderCache *c, uint64_t h) {
+  return &c->shards[(size_t)(h >> 56) & c->shard_mask];
+}
+
+static size_t render_bucket(const RenderShard *s, uint64_t h) {
+  return (size_t)h & s->bucket_mask;
+}
+
+static void render_entry_release(RenderEntry *e) {
+  if (atomic_fetch_sub_explicit(&e->refs, 1u, memory_order_acq_rel) == 1u) free(e);
+}
+
+static void render_lru_unlink(RenderShard *s, RenderEntry *e) {
+  if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+  else s->head = e->lru_next;
+  if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+  else s->tail = e->lru_prev;
+  e->lru_prev = e->lru_next = NULL;
+}
+
+static void render_lru_push_front(RenderShard *s, RenderEntry *e) {
+  e->lru_prev = NULL;
+  e->lru_next = s->head;
+  if (s->head) s->head->lru_prev = e;
+  s->head = e;
+  if (!s->tail) s->tail = e;
+}
+
+/* Caller holds s->lock; readers still copying keep the entry alive until they release it. */
+static void render_shard_drop(RenderShard *s, RenderEntry *e) {
+  RenderEntry **pp = &s->buckets[render_bucket(s, render_hash(e->gen, e->file_id))];
+  while (*pp != e) pp = &(*pp)->hnext;
+  *pp = e->hnext;
+  render_lru_unlink(s, e);
+  s->bytes -= render_entry_cost(e);
+  s->entries--;
+  render_entry_release(e);
+}
+
+/* AI_RENDER_CACHE_BYTES bounds the serialized bodies plus entry overhead; 0 disables the
+   cache. The budget is split into up to 16 shards of at least 256 KiB each, and one bucket
+   per KiB of a shard's share keeps chains short for typical render sizes. */
+static bool render_cache_init(RenderCache *c, size_t cap_bytes) {
+  memset(c, 0, sizeof(*c));
+  c->cap_bytes = cap_bytes;
+  if (cap_bytes == 0) return true;
+  size_t shards = 1u;
+  while (shards < RENDER_CACHE_SHARDS_MAX && cap_bytes / (shards * 2u) >= 256u * 1024u) shards <<= 1;
+  c->shards = (RenderShard *)calloc(shards, sizeof(RenderShard));
+  if (!c->shards) return false;
+  c->shard_mask = shards - 1u;
+  for (size_t i = 0; i < shards; i++) pthread_mutex_init(&c->shards[i].lock, NULL);
+  for (size_t i = 0; i < shards; i++) {
+    RenderShard *s = &c->shards[i];
+    s->cap_bytes = cap_bytes / shards;
+    size_t n = 64u;
+    while (n < s->cap_bytes / 1024u && n < 65536u) n <<= 1;
+    s->buckets = (RenderEntry **)calloc(n, sizeof(RenderEntry *));
+    if (!s->buckets) return false;
+    s->bucket_mask = n - 1u;
+  }
+  return true;
+}
+
+static void render_cache_clear(RenderCache *c) {
+  if (!c->shards) return;
+  for (size_t i = 0; i <= c->shard_mask; i++) {
+    RenderShard *s = &c->shards[i];
+    pthread_mutex_lock(&s->lock);
+    while (s->head) render_shard_drop(s, s->head);
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+static void render_cache_destroy(RenderCache *c) {
+  if (!c->shards) return;
+  render_cache_clear(c);
+  for (size_t i = 0; i <= c->shard_mask; i++) {
+    free(c->shards[i].buckets);
+    pthread_mutex_destroy(&c->shards[i].lock);
+  }
+  free(c->shards);
+  c->shards = NULL;
+}
+
+/* A hit becomes the most recently used entry of its shard and is returned with a reference
+   the caller drops with render_entry_release. */
+static RenderEntry *render_cache_get(RenderCache *c, uint64_t gen, uint32_t file_id) {
+  if (!c->shards) return NULL;
+  uint64_t h = render_hash(gen, file_id);
+  RenderShard *s = render_shard(c, h);
+  pthread_mutex_lock(&s->lock);
+  RenderEntry *e = s->buckets[render_bucket(s, h)];
+  while (e && (e->gen != gen || e->file_id != file_id)) e = e->hnext;
+  if (e) {
+    render_lru_unlink(s, e);
+    render_lru_push_front(s, e);
+    atomic_fetch_add_explicit(&e->refs, 1u, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return e;
+}
+
+/* Inserts a serialized body, evicting from the cold end of its shard until it fits. Bodies
+   larger than a quarter of a shard's budget are not cached. Returns the number of evicted
+   entries. */
+static size_t render_cache_put(RenderCache *c, uint64_t gen, uint32_t file_id, const char *body, size_t len) {
+  if (!c->shards) return 0;
+  uint64_t h = render_hash(gen, file_id);
+  RenderShard *s = render_shard(c, h);
+  if (sizeof(RenderEntry) + len + 1u > s->cap_bytes / 4u) return 0;
+  RenderEntry *e = (RenderEntry *)malloc(sizeof(RenderEntry) + len + 1u);
+  if (!e) return 0;
+  atomic_init(&e->refs, 1u);
+  e->gen = gen;
+  e->file_id = file_id;
+  e->len = len;
+  memcpy(e->body, body, len);
+  e->body[len] = '\0';
+  size_t evicted = 0;
+  pthread_mutex_lock(&s->lock);
+  size_t b = render_bucket(s, h);
+  for (RenderEntry *x = s->buckets[b]; x; x = x->hnext) {
+    if (x->gen == gen && x->file_id == file_id) {
+      pthread_mutex_unlock(&s->lock);
+      free(e);
+      return 0;
+    }
+  }
+  while (s->tail && s->bytes + render_entry_cost(e) > s->cap_bytes) {
+    render_shard_drop(s, s->tail);
+    evicted++;
+  }
+  e->hnext = s->buckets[b];
+  s->buckets[b] = e;
+  render_lru_push_front(s, e);
+  s->bytes += render_entry_cost(e);
+  s->entries++;
+  pthread_mutex_unlock(&s->lock);
+  return evicted;
+}
+
+static void render_cache_usage(RenderCache *c, size_t *entries, size_t *bytes) {
+  *entries = 0;
+  *bytes = 0;
+  for (size_t i = 0; c->shards && i <= c->shard_mask; i++) {
+    RenderShard *s = &c->shards[i];
+    pthread_mutex_lock(&s->lock);
+    *entries += s->entries;
+    *bytes += s->bytes;
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+static void core_gen_free(CoreGen *core) {
+  aiir_u32_free(&core->lite_table);
+  aiir_u32_free(&core->lite_blob);
+  aiir_u32_free(&core->adapt_table);
+  aiir_u32_free(&core->adapt_blob);
+  aiir_u32_free(&core->db_packet);
+  free(core->adapt_rows);
+  free(core->ops);
+  free(core->op_slots);
+  free(core->sigs);
+  free(core);
+}
+
+static CoreGen *core_gen_load(const char *core_dir, uint64_t id) {
+  CoreGen *core = (CoreGen *)calloc(1, sizeof(CoreGen));
+  if (!core) return NULL;
+  core->id = id;
+  if (!load_core_words(core_dir, "m2m.ai2ai.lite.table", &core->lite_table) ||
+      !load_core_words(core_dir, "m2m.ai2ai.lite.blob", &core->lite_blob) ||
+      !load_core_words(core_dir, "m2m.ai2ai.source.adapt.table", &core->adapt_table) ||
+      !load_core_words(core_dir, "m2m.ai2ai.source.adapt.blob", &core->adapt_blob) ||
+      !load_core_words(core_dir, "m2m.db.packet", &core->db_packet) ||
+      (core->lite_table.len % 3u) != 0u || (core->adapt_table.len % 3u) != 0u ||
+      !build_adapt_index(core) || !load_db_index(core)) {
+    core_gen_free(core);
+    return NULL;
+  }
+  return core;
+}
+
+/* Pins the current generation in the worker's hazard slot without a shared lock or counter.
+   The slot is published before rt->core is read again: if a reload swapped the generation in
+   between, the re-read sees the new one and the pin moves to it; otherwise the reload's scan
+   of the slots sees the pin and waits for it. */
+static CoreGen *core_acquire(Worker *w) {
+  CoreGen *core = atomic_load_explicit(&w->rt->core, memory_order_acquire);
+  for (;;) {
+    atomic_store_explicit(&w->core_pin, core, memory_order_seq_cst);
+    CoreGen *cur = atomic_load_explicit(&w->rt->core, memory_order_seq_cst);
+    if (cur == core) return core;
+    core = cur;
+  }
+}
+
+static void core_release(Worker *w) {
+  atomic_store_explicit(&w->core_pin, NULL, memory_order_release);
+}
+
+/* Frees a generation that is no longer published once every worker has dropped its pin on
+   it. Pins last one request, so this waits at most for the slowest request in flight. */
+static void core_retire(Runtime *rt, CoreGen *old) {
+  for (size_t i = 0; i < rt->worker_count; i++) {
+    while (atomic_load_explicit(&rt->workers[i].core_pin, memory_order_seq_cst) == old) {
+      struct timespec ts = {0, 200000L};
+      nanosleep(&ts, NULL);
+    }
+  }
+  core_gen_free(old);
+}
+
+/* Loads the core directory into a new generation and swaps it in. In-flight requests keep
+   the generation they pinned; on failure the current one stays in service. */
+static bool core_reload(Runtime *rt) {
+  uint64_t id = ++rt->core_next_id;
+  uint64_t start_us = mono_us();
+  CoreGen *fresh = core_gen_load(rt->core_dir, id);
+  AIIR_PROBE3(core__reload, id, fresh != NULL, mono_us() - start_us);
+  if (!fresh) {
+    atomic_fetch_add_explicit(&rt->core_reload_fail_total, 1u, memory_order_relaxed);
+    fprintf(stderr, "core-reload-failed %s\n", rt->core_dir);
+    return false;
   }
+  core_retire(rt, atomic_exchange_explicit(&rt->core, fresh, memory_order_seq_cst));
+  render_cache_clear(&rt->render_cache);
+  atomic_fetch_add_explicit(&rt->core_reload_total, 1u, memory_order_relaxed);
   return true;
 }
 
 static bool load_runtime(const char *core_dir, Runtime *rt) {
   memset(rt, 0, sizeof(*rt));
-  if (!aiir_load_u32_pref(core_dir, "m2m.ai2ai.lite.table", &rt->lite_table)) return false;
-  if (!aiir_load_u32_pref(core_dir, "m2m.ai2ai.lite.blob", &rt->lite_blob)) return false;
-  if (!aiir_load_u32_pref(core_dir, "m2m.ai2ai.source.adapt.table", &rt->adapt_table)) return false;
-  if (!aiir_load_u32_pref(core_dir, "m2m.ai2ai.source.adapt.blob", &rt->adapt_blob)) return false;
-  if (!aiir_load_u32_pref(core_dir, "m2m.db.packet", &rt->db_packet)) return false;
-
-  if ((rt->lite_table.len % 3u) != 0u) return false;
-  if ((rt->adapt_table.len % 3u) != 0u) return false;
-  if (!load_db_index(rt)) return false;
+  rt->reload_efd = -1;
+  pthread_mutex_init(&rt->gateway_lock, NULL);
+  snprintf(rt->core_dir, sizeof(rt->core_dir), "%s", core_dir);
+  rt->core_next_id = 1u;
+  CoreGen *core = core_gen_load(core_dir, rt->core_next_id);
+  if (!core) return false;
+  atomic_init(&rt->core, core);
+  rt->reload_on_drift = parse_env_bool("AI_CORE_RELOAD_ON_DRIFT", true);
+  if (!render_cache_init(&rt->render_cache, parse_env_size("AI_RENDER_CACHE_BYTES", 8u * 1024u * 1024u, 0u, 1024u * 1024u * 1024u))) return false;
   if (!aiir_policy_init_from_env(&rt->policy)) return false;
   const char *wal = getenv("AI_WAL_PATH");
   const char *snap = getenv("AI_SNAPSHOT_PATH");
-  char meta[256];
-  snprintf(meta, sizeof(meta), "{\"files\":%zu}", rt->lite_table.len / 3u);
-  if (!aiir_state_init(&rt->state, wal, snap, meta)) return false;
-  uint32_t check_every = 200u;
-  const char *ce = getenv("AI_DRIFT_CHECK_EVERY");
-  if (ce && *ce) {
-    unsigned long v = strtoul(ce, NULL, 10);
-    if (v > 0 && v <= 1000000u) check_every = (uint32_t)v;
-  }
-  if (!aiir_drift_init(&rt->drift, core_dir, check_every)) return false;
+  AiirWalConfig wal_cfg;
+  memset(&wal_cfg, 0, sizeof(wal_cfg));
+  wal_cfg.segment_bytes = parse_env_size("AI_WAL_SEGMENT_BYTES", 64u * 1024u * 1024u, 4096u, (size_t)1 << 34);
+  wal_cfg.commit_delay_us = parse_env_size("AI_WAL_COMMIT_DELAY_US", 0u, 0u, 100000u);
+  wal_cfg.group_max = parse_env_size("AI_WAL_GROUP_MAX", 1024u, 1u, 65536u);
+  wal_cfg.fdatasync = parse_env_bool("AI_WAL_FSYNC", true);
+  bool wal_sync_commit = parse_env_bool("AI_WAL_SYNC_COMMIT", true);
+  if (!aiir_state_init(&rt->state, wal, snap, &wal_cfg, wal_sync_commit)) return false;
+  /* Reference numbers continue from the last snapshot; refs also carry the second they were
+     made, so the few handed out after it and lost in a crash cannot come back. */
+  atomic_store(&rt->gateway_seq, rt->state.live.gateway_seq);
+  rt->snapshot_interval_sec = parse_env_size("AI_SNAPSHOT_INTERVAL_SEC", 60u, 1u, 86400u);
+  if (!aiir_drift_init(&rt->drift, core_dir)) return false;
+  rt->drift_poll_ms = parse_env_size("AI_CORE_DRIFT_POLL_MS", 5000u, 100u, 3600000u);
+  rt->drift_settle_ms = parse_env_size("AI_CORE_DRIFT_SETTLE_MS", 200u, 0u, 60000u);
 
   rt->cap_required = parse_env_bool("AI_CAP_REQUIRE", false);
   const char *cap_secret = getenv("AI_CAP_SECRET");
@@ -587,14 +1579,35 @@ static bool load_runtime(const char *core_dir, Runtime *rt) {
     rt->cap_secret[0] = '\0';
   }
   if (rt->cap_required && rt->cap_secret[0] == '\0') return false;
+  /* Capability MACs reuse the key's ipad/opad midstates instead of rehashing the secret. */
+  aiir_hmac_key_init(&rt->cap_key, (const uint8_t *)rt->cap_secret, strlen(rt->cap_secret));
   rt->cap_max_future_sec = parse_env_size("AI_CAP_MAX_FUTURE_SEC", 120u, 1u, 86400u);
+  /* Consumed nonces are only tracked when capabilities are enforced. */
+  size_t nonce_cap = parse_env_size("AI_CAP_NONCE_CACHE", 65536u, 16u, 16u * 1024u * 1024u);
+  if (!nonce_cache_init(&rt->cap_nonces, rt->cap_required ? nonce_cap : 0u)) return false;
+  if (!op_stats_init(&rt->op_stats, parse_env_size("AI_OP_METRICS_MAX", 4096u, 16u, 1024u * 1024u))) return false;
 
   const char *audit_path = getenv("AI_AUDIT_LOG_PATH");
   if (!audit_path || !*audit_path) audit_path = "/var/www/aiir/ai/log/runtime_audit.log";
   strncpy(rt->audit_path, audit_path, sizeof(rt->audit_path) - 1u);
   rt->audit_path[sizeof(rt->audit_path) - 1u] = '\0';
-  rt->audit_fp = fopen(rt->audit_path, "a");
+  AiirAuditConfig audit_cfg;
+  audit_cfg.queue_slots = parse_env_size("AI_AUDIT_QUEUE", 2048u, 64u, 1024u * 1024u);
+  audit_cfg.flush_ms = parse_env_size("AI_AUDIT_FLUSH_MS", 50u, 1u, 10000u);
+  const char *durability = getenv("AI_AUDIT_DURABILITY");
+  audit_cfg.fdatasync = durability && strcasecmp(durability, "fdatasync") == 0;
+  audit_cfg.mirror_stderr = parse_env_bool("AI_AUDIT_STDERR", true);
+  if (!aiir_audit_open(&rt->audit, rt->audit_path, &audit_cfg)) return false;
   rt->log_requests = parse_env_bool("AI_LOG_REQUESTS", true);
+  rt->trace_enabled = parse_env_bool("AI_TRACE", false);
+  rt->trace_ring = parse_env_size("AI_TRACE_RING", 16384u, 256u, 4u * 1024u * 1024u);
+  rt->trace_flush_ms = parse_env_size("AI_TRACE_FLUSH_MS", 200u, 10u, 60000u);
+  const char *trace_path = getenv("AI_TRACE_FILE");
+  snprintf(rt->trace_path, sizeof(rt->trace_path), "%s", trace_path ? trace_path : "");
+  rt->profile_enabled = parse_env_bool("AI_PROFILE", false);
+  rt->profile_hz = parse_env_size("AI_PROFILE_HZ", 99u, 1u, 1000u);
+  rt->profile_max_sec = parse_env_size("AI_PROFILE_MAX_SEC", 60u, 1u, 600u);
+  rt->profile_stacks = parse_env_size("AI_PROFILE_STACKS", 16384u, 256u, 1024u * 1024u);
 
   rt->gateway_enable = parse_env_bool("AIIR_GATEWAY_ENABLE", false);
   const char *hm = getenv("AIIR_HUMAN_DB_MODE");
@@ -606,6 +1619,10 @@ static bool load_runtime(const char *core_dir, Runtime *rt) {
   if (!pf || !*pf) pf = "/var/www/aiir/ai/state/projects.ndjson";
   strncpy(rt->gateway_projects_file, pf, sizeof(rt->gateway_projects_file) - 1u);
   rt->gateway_projects_file[sizeof(rt->gateway_projects_file) - 1u] = '\0';
+  const char *sd = getenv("AIIR_PROJECT_STORE_DIR");
+  if (!sd || !*sd) sd = "/var/www/aiir/ai/state/projects.store";
+  strncpy(rt->gateway_store_dir, sd, sizeof(rt->gateway_store_dir) - 1u);
+  rt->gateway_store_dir[sizeof(rt->gateway_store_dir) - 1u] = '\0';
 
   const char *prov = getenv("AIIR_DB_PROVIDER");
   if (!prov || !*prov) prov = "default";
@@ -627,98 +1644,575 @@ static bool load_runtime(const char *core_dir, Runtime *rt) {
   if (!is_ascii_token(rt->gateway_db_default_profile, 1u, 63u, "._-")) return false;
   if (!is_ascii_token(rt->gateway_db_region, 1u, 63u, "._-")) return false;
   if (rt->gateway_enable) {
-    FILE *pfp = fopen(rt->gateway_projects_file, "a");
-    if (!pfp) return false;
-    fclose(pfp);
+    AiirProjectStoreConfig store_cfg;
+    store_cfg.seal_records = parse_env_size("AIIR_PROJECT_STORE_SEAL_RECORDS", 65536u, 1024u, 4u * 1024u * 1024u);
+    store_cfg.compact_segments = parse_env_size("AIIR_PROJECT_STORE_COMPACT_SEGMENTS", 4u, 2u, 64u);
+    store_cfg.fdatasync = parse_env_bool("AIIR_PROJECT_STORE_FSYNC", true);
+    /* The projects file is only written for tooling that asks for it, off the request path. */
+    store_cfg.export_path = parse_env_bool("AIIR_PROJECTS_FILE_EXPORT", true) ? rt->gateway_projects_file : NULL;
+    store_cfg.export_interval_ms = parse_env_size("AIIR_PROJECTS_FILE_EXPORT_MS", 1000u, 100u, 3600000u);
+    if (!aiir_projstore_open(&rt->gateway_store, rt->gateway_store_dir, &store_cfg)) return false;
+    rt->gateway_store_open = true;
+    /* A fresh store takes over an existing projects file once. */
+    if (aiir_projstore_count(&rt->gateway_store) == 0 && access(rt->gateway_projects_file, F_OK) == 0) {
+      size_t imported = 0, skipped = 0;
+      if (!aiir_projstore_import_ndjson(&rt->gateway_store, rt->gateway_projects_file, &imported, &skipped)) return false;
+      if (imported > 0 || skipped > 0) fprintf(stderr, "project-store-imported %zu skipped %zu\n", imported, skipped);
+    }
   }
   return true;
 }
 
 static void free_runtime(Runtime *rt) {
-  aiir_u32_free(&rt->lite_table);
-  aiir_u32_free(&rt->lite_blob);
-  aiir_u32_free(&rt->adapt_table);
-  aiir_u32_free(&rt->adapt_blob);
-  aiir_u32_free(&rt->db_packet);
+  CoreGen *core = atomic_exchange(&rt->core, NULL);
+  if (core) core_gen_free(core);
   aiir_policy_free(&rt->policy);
-  if (rt->audit_fp) fclose(rt->audit_fp);
-  free(rt->ops);
-  free(rt->sigs);
-}
-
-static int json_response(int fd, int code, const char *body) {
-  const char *msg =
-      (code == 200) ? "OK" :
-      (code == 202) ? "Accepted" :
-      (code == 400) ? "Bad Request" :
-      (code == 404) ? "Not Found" :
-      (code == 429) ? "Too Many Requests" :
-      (code == 503) ? "Service Unavailable" :
-      "Error";
-  char hdr[512];
-  int bl = (int)strlen(body);
-  int n = snprintf(hdr, sizeof(hdr),
-                   "HTTP/1.1 %d %s\r\n"
-                   "Content-Type: application/json; charset=utf-8\r\n"
-                   "Cache-Control: no-store\r\n"
-                   "Content-Length: %d\r\n"
-                   "Connection: close\r\n\r\n",
-                   code, msg, bl);
-  if (n < 0) return -1;
-  if (write(fd, hdr, (size_t)n) < 0) return -1;
-  if (write(fd, body, (size_t)bl) < 0) return -1;
-  return 0;
+  aiir_audit_close(&rt->audit);
+  aiir_state_close(&rt->state);
+  aiir_trace_sink_stop(&rt->trace_sink);
+  for (size_t i = 0; rt->workers && i < rt->worker_count; i++) aiir_trace_ring_free(&rt->workers[i].trace);
+  free(rt->trace_rings);
+  aiir_profile_free(&rt->profiler);
+  free(rt->workers);
+  render_cache_destroy(&rt->render_cache);
+  nonce_cache_destroy(&rt->cap_nonces);
+  op_stats_free(&rt->op_stats);
+  if (rt->gateway_store_open) aiir_projstore_close(&rt->gateway_store);
+  pthread_mutex_destroy(&rt->gateway_lock);
 }
 
-static void metric_track_status(Runtime *rt, int code) {
-  if (code >= 200 && code < 300) rt->metric_responses_2xx++;
-  else if (code >= 400 && code < 500) rt->metric_responses_4xx++;
-  else if (code >= 500 && code < 600) rt->metric_responses_5xx++;
-}
-
-static int json_response_tr(Runtime *rt, int fd, int code, const char *body) {
-  metric_track_status(rt, code);
-  return json_response(fd, code, body);
-}
-
-static int text_response_tr(Runtime *rt, int fd, int code, const char *body) {
-  metric_track_status(rt, code);
-  const char *msg =
-      (code == 200) ? "OK" :
-      (code == 400) ? "Bad Request" :
-      (code == 404) ? "Not Found" :
-      (code == 429) ? "Too Many Requests" :
-      (code == 503) ? "Service Unavailable" :
-      "Error";
-  char hdr[512];
-  int bl = (int)strlen(body);
-  int n = snprintf(hdr, sizeof(hdr),
-                   "HTTP/1.1 %d %s\r\n"
-                   "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
-                   "Cache-Control: no-store\r\n"
-                   "Content-Length: %d\r\n"
-                   "Connection: close\r\n\r\n",
-                   code, msg, bl);
-  if (n < 0) return -1;
-  if (write(fd, hdr, (size_t)n) < 0) return -1;
-  if (write(fd, body, (size_t)bl) < 0) return -1;
-  return 0;
+static ArenaChunk *arena_chunk_new(size_t cap) {
+  ArenaChunk *c = (ArenaChunk *)malloc(sizeof(ArenaChunk) + cap);
+  if (!c) return NULL;
+  c->next = NULL;
+  c->cap = cap;
+  c->used = 0;
+  return c;
 }
 
-static bool get_packet_by_id(const Runtime *rt, uint32_t id, const uint32_t **pkt, uint32_t *pkt_len) {
-  uint32_t files = (uint32_t)(rt->lite_table.len / 3u);
-  if (id >= files) return false;
-  uint32_t p = id * 3u;
-  uint32_t off = rt->lite_table.words[p + 1u];
-  uint32_t len = rt->lite_table.words[p + 2u];
-  if ((uint64_t)off + (uint64_t)len > rt->lite_blob.len) return false;
-  *pkt = rt->lite_blob.words + off;
-  *pkt_len = len;
-  return true;
+static void *arena_alloc(Arena *a, size_t n) {
+  n = (n + ARENA_ALIGN - 1u) & ~(size_t)(ARENA_ALIGN - 1u);
+  if (n == 0) n = ARENA_ALIGN;
+  while (a->cur && a->cur->used + n > a->cur->cap) a->cur = a->cur->next;
+  if (!a->cur) {
+    ArenaChunk *c = arena_chunk_new(n > ARENA_CHUNK ? n : ARENA_CHUNK);
+    if (!c) return NULL;
+    if (a->tail) a->tail->next = c;
+    else a->head = c;
+    a->tail = c;
+    a->cur = c;
+  }
+  void *p = a->cur->data + a->cur->used;
+  a->cur->used += n;
+  a->last = p;
+  return p;
 }
 
-static bool parse_a2a_summary(const uint32_t *w, uint32_t n, uint32_t *code_records, uint32_t *slot_records, uint32_t *meta_records) {
-  if (n < 8u || w[0] != AIIR_A2A_MAGIC) return false;
+/* Resizes the most recent allocation in place when its chunk has room; otherwise copies. */
+static void *arena_grow(Arena *a, void *p, size_t old_n, size_t new_n) {
+  if (p && p == a->last) {
+    size_t old_a = (old_n + ARENA_ALIGN - 1u) & ~(size_t)(ARENA_ALIGN - 1u);
+    size_t new_a = (new_n + ARENA_ALIGN - 1u) & ~(size_t)(ARENA_ALIGN - 1u);
+    if (a->cur->used - old_a + new_a <= a->cur->cap) {
+      a->cur->used = a->cur->used - old_a + new_a;
+      return p;
+    }
+  }
+  void *np = arena_alloc(a, new_n);
+  if (np && p) memcpy(np, p, old_n);
+  return np;
+}
+
+/* Keeps every chunk for the next request. */
+static void arena_reset(Arena *a) {
+  for (ArenaChunk *c = a->head; c; c = c->next) c->used = 0;
+  a->cur = a->head;
+  a->last = NULL;
+}
+
+static void arena_free(Arena *a) {
+  ArenaChunk *c = a->head;
+  while (c) {
+    ArenaChunk *next = c->next;
+    free(c);
+    c = next;
+  }
+  memset(a, 0, sizeof(*a));
+}
+
+static bool resp_reserve(RespBuf *r, size_t extra) {
+  if (r->len + extra <= r->cap) return true;
+  size_t nc = r->cap ? r->cap : 4096u;
+  while (nc < r->len + extra) nc *= 2u;
+  char *nb = (char *)realloc(r->buf, nc);
+  if (!nb) return false;
+  r->buf = nb;
+  r->cap = nc;
+  return true;
+}
+
+/* Adds `n` bytes to the wire order; owned bytes that follow the previous owned segment
+   extend it instead of starting a new one. */
+static bool resp_push_seg(RespBuf *r, const char *ext, size_t off, size_t n) {
+  if (n == 0) return true;
+  RespSeg *last = r->seg_count ? &r->segs[r->seg_count - 1u] : NULL;
+  if (last && !ext && !last->ext && last->off + last->len == off) {
+    last->len += n;
+    r->total += n;
+    return true;
+  }
+  if (r->seg_count == r->seg_cap) {
+    size_t nc = r->seg_cap ? r->seg_cap * 2u : 8u;
+    RespSeg *ns = (RespSeg *)realloc(r->segs, nc * sizeof(RespSeg));
+    if (!ns) return false;
+    r->segs = ns;
+    r->seg_cap = nc;
+  }
+  r->segs[r->seg_count].ext = ext;
+  r->segs[r->seg_count].off = off;
+  r->segs[r->seg_count].len = n;
+  r->seg_count++;
+  r->total += n;
+  return true;
+}
+
+static bool resp_append(RespBuf *r, const char *p, size_t n) {
+  size_t off = r->len;
+  if (!resp_reserve(r, n)) return false;
+  memcpy(r->buf + off, p, n);
+  r->len += n;
+  return resp_push_seg(r, NULL, off, n);
+}
+
+/* `p` must outlive the response (string literals, pre-rendered responses). */
+static bool resp_append_static(RespBuf *r, const char *p, size_t n) {
+  return resp_push_seg(r, p, 0, n);
+}
+
+/* Staged bytes are owned but not yet part of the response: a body is staged first so its
+   length is known, then its header is appended and both are queued in wire order. */
+static size_t resp_stage_begin(const RespBuf *r) {
+  return r->len;
+}
+
+static bool resp_stage(RespBuf *r, const char *p, size_t n) {
+  if (!resp_reserve(r, n)) return false;
+  memcpy(r->buf + r->len, p, n);
+  r->len += n;
+  return true;
+}
+
+static void resp_stage_abort(RespBuf *r, size_t mark) {
+  r->len = mark;
+}
+
+/* Response writer: bodies and heads are assembled from literals, escaped strings and
+   integers staged straight into the response buffer, without going through printf. */
+#define RESP_STAGE_LIT(r, lit) resp_stage((r), (lit), sizeof(lit) - 1u)
+
+static bool resp_stage_str(RespBuf *r, const char *s) {
+  return resp_stage(r, s, strlen(s));
+}
+
+static bool resp_stage_u64(RespBuf *r, uint64_t v) {
+  if (!resp_reserve(r, 20u)) return false;
+  r->len += fmt_u64(r->buf + r->len, v);
+  return true;
+}
+
+static bool resp_stage_bool(RespBuf *r, bool v) {
+  return v ? RESP_STAGE_LIT(r, "true") : RESP_STAGE_LIT(r, "false");
+}
+
+/* JSON string contents (no quotes); every input byte expands to at most six. */
+static bool resp_stage_escaped(RespBuf *r, const char *s, size_t n) {
+  size_t cap = n * 6u + 1u;
+  size_t w = 0;
+  if (!resp_reserve(r, cap) || !json_escape_copy(s, n, r->buf + r->len, cap, &w)) return false;
+  r->len += w;
+  return true;
+}
+
+static bool resp_stage_escaped_str(RespBuf *r, const char *s) {
+  return resp_stage_escaped(r, s, strlen(s));
+}
+
+static void resp_reset(RespBuf *r) {
+  r->len = 0;
+  r->seg_count = 0;
+  r->total = 0;
+}
+
+static void resp_free(RespBuf *r) {
+  free(r->buf);
+  free(r->segs);
+  r->buf = NULL;
+  r->segs = NULL;
+  r->len = 0;
+  r->cap = 0;
+  r->seg_count = 0;
+  r->seg_cap = 0;
+  r->total = 0;
+}
+
+/* One writev over the queued segments, starting `off` bytes into the response. */
+static ssize_t resp_writev(int fd, const RespBuf *r, size_t off) {
+  struct iovec iov[RESP_IOV_BATCH];
+  int n = 0;
+  for (size_t i = 0; i < r->seg_count && n < (int)RESP_IOV_BATCH; i++) {
+    const RespSeg *s = &r->segs[i];
+    if (off >= s->len) {
+      off -= s->len;
+      continue;
+    }
+    const char *base = s->ext ? s->ext : r->buf + s->off;
+    iov[n].iov_base = (void *)(base + off);
+    iov[n].iov_len = s->len - off;
+    off = 0;
+    n++;
+  }
+  if (n == 0) return 0;
+  return writev(fd, iov, n);
+}
+
+static bool resp_write_all(int fd, const RespBuf *r) {
+  size_t off = 0;
+  while (off < r->total) {
+    ssize_t w = resp_writev(fd, r, off);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (w == 0) return false;
+    off += (size_t)w;
+  }
+  return true;
+}
+
+static const char *status_text(int code) {
+  return (code == 200) ? "OK" :
+         (code == 202) ? "Accepted" :
+         (code == 400) ? "Bad Request" :
+         (code == 404) ? "Not Found" :
+         (code == 429) ? "Too Many Requests" :
+         (code == 501) ? "Not Implemented" :
+         (code == 503) ? "Service Unavailable" :
+         "Error";
+}
+
+static int http_head(RespBuf *out, int code, const char *content_type, size_t body_len) {
+  size_t mark = resp_stage_begin(out);
+  bool ok = RESP_STAGE_LIT(out, "HTTP/1.1 ") && resp_stage_u64(out, (uint64_t)code) && RESP_STAGE_LIT(out, " ") &&
+            resp_stage_str(out, status_text(code)) && RESP_STAGE_LIT(out, "\r\nContent-Type: ") &&
+            resp_stage_str(out, content_type) && RESP_STAGE_LIT(out, "\r\nCache-Control: no-store\r\nContent-Length: ") &&
+            resp_stage_u64(out, body_len) &&
+            (out->keep_alive ? RESP_STAGE_LIT(out, "\r\nConnection: keep-alive\r\n\r\n")
+                             : RESP_STAGE_LIT(out, "\r\nConnection: close\r\n\r\n"));
+  if (!ok) {
+    resp_stage_abort(out, mark);
+    return -1;
+  }
+  return resp_push_seg(out, NULL, mark, out->len - mark) ? 0 : -1;
+}
+
+static int http_response(RespBuf *out, int code, const char *content_type, const char *body) {
+  size_t bl = strlen(body);
+  if (http_head(out, code, content_type, bl) != 0 || !resp_append(out, body, bl)) return -1;
+  return 0;
+}
+
+/* Queues the body staged since `mark` behind a freshly rendered header. */
+static int http_response_staged(RespBuf *out, int code, const char *content_type, size_t mark) {
+  size_t bl = out->len - mark;
+  if (http_head(out, code, content_type, bl) != 0 || !resp_push_seg(out, NULL, mark, bl)) return -1;
+  return 0;
+}
+
+static int json_response(RespBuf *out, int code, const char *body) {
+  return http_response(out, code, "application/json; charset=utf-8", body);
+}
+
+static void metric_inc(Worker *w, MetricId id) {
+  _Atomic uint64_t *c = &w->metrics.v[id];
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1u, memory_order_relaxed);
+}
+
+static void metrics_sum(const Runtime *rt, uint64_t out[MET_COUNT]) {
+  memset(out, 0, sizeof(uint64_t) * MET_COUNT);
+  for (size_t i = 0; i < rt->worker_count; i++) {
+    for (size_t k = 0; k < MET_COUNT; k++) {
+      out[k] += atomic_load_explicit(&rt->workers[i].metrics.v[k], memory_order_relaxed);
+    }
+  }
+}
+
+static const uint64_t latency_bounds_us[LATENCY_BUCKETS] = {
+  50u, 100u, 250u, 500u, 1000u, 2500u, 5000u, 10000u, 25000u, 50000u, 100000u, 250000u, 500000u, 1000000u, 2500000u,
+};
+static const char *const latency_bounds_le[LATENCY_BUCKETS] = {
+  "0.00005", "0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01",
+  "0.025", "0.05", "0.1", "0.25", "0.5", "1", "2.5",
+};
+static const char *const route_names[ROUTE_COUNT] = {
+  "health", "meta", "render", "db_exec", "gateway_project_create", "gateway_db_exec", "other",
+};
+
+const char *ai_runtime_route_name(unsigned route) {
+  return route < ROUTE_COUNT ? route_names[route] : NULL;
+}
+
+static void latency_observe(Worker *w, RouteId route, uint64_t us) {
+  size_t b = 0;
+  while (b < LATENCY_BUCKETS && us > latency_bounds_us[b]) b++;
+  _Atomic uint64_t *c = &w->latency.bucket[route][b];
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1u, memory_order_relaxed);
+  _Atomic uint64_t *sum = &w->latency.sum_us[route];
+  atomic_store_explicit(sum, atomic_load_explicit(sum, memory_order_relaxed) + us, memory_order_relaxed);
+}
+
+/* Start of a span; 0 when tracing is off, which makes every trace_* call below a no-op. */
+static uint64_t trace_begin(const Worker *w) {
+  return w->rt->trace_enabled ? mono_us() : 0u;
+}
+
+static void trace_fill(Worker *w, AiirTraceEvent *e, AiirTracePhase phase, uint64_t start_us) {
+  uint64_t d = mono_us() - start_us;
+  e->ts_us = start_us;
+  e->dur_us = d > UINT32_MAX ? UINT32_MAX : (uint32_t)d;
+  e->req_id = 0;
+  e->op_id = 0;
+  e->worker = (uint16_t)w->id;
+  e->phase = (uint8_t)phase;
+  e->route = 0;
+}
+
+/* A span of the request in flight; request id, opId and route are filled in when it ends. */
+static void trace_span(Worker *w, AiirTracePhase phase, uint64_t start_us) {
+  if (start_us == 0 || w->trace_n >= TRACE_PENDING_MAX) return;
+  trace_fill(w, &w->trace_pending[w->trace_n++], phase, start_us);
+}
+
+/* A read or parse span that precedes the request; a second one before the request starts
+   (a request that arrives in pieces) widens the first. */
+static void trace_stash(Worker *w, AiirTraceEvent *slot, AiirTracePhase phase, uint64_t start_us) {
+  if (start_us == 0) return;
+  if (slot->ts_us != 0) start_us = slot->ts_us;
+  trace_fill(w, slot, phase, start_us);
+}
+
+static void trace_request_end(Worker *w, uint64_t start_us) {
+  if (!w->rt->trace_enabled) return;
+  AiirTraceEvent ev[TRACE_PENDING_MAX + 3u];
+  size_t n = 0;
+  w->trace_req++;
+  if (w->trace_read.ts_us != 0) ev[n++] = w->trace_read;
+  if (w->trace_parse.ts_us != 0) ev[n++] = w->trace_parse;
+  trace_fill(w, &ev[n++], AIIR_TRACE_REQUEST, start_us);
+  memcpy(&ev[n], w->trace_pending, w->trace_n * sizeof(AiirTraceEvent));
+  n += w->trace_n;
+  for (size_t i = 0; i < n; i++) {
+    ev[i].req_id = w->trace_req;
+    ev[i].op_id = w->trace_op;
+    ev[i].route = (uint8_t)w->route;
+  }
+  aiir_trace_ring_push(&w->trace, ev, n);
+  memset(&w->trace_read, 0, sizeof(w->trace_read));
+  memset(&w->trace_parse, 0, sizeof(w->trace_parse));
+  w->trace_n = 0;
+}
+
+/* Copies request id, opId and route of the request this worker served last into `tag`. */
+static void trace_tag(const Worker *w, AiirTraceEvent *tag) {
+  tag->req_id = w->trace_req;
+  tag->op_id = w->trace_op;
+  tag->route = (uint8_t)w->route;
+}
+
+/* Writing out responses; the span is attributed to the last of them, as tagged. */
+static void trace_write(Worker *w, const AiirTraceEvent *tag, uint64_t start_us) {
+  if (start_us == 0) return;
+  AiirTraceEvent ev;
+  trace_fill(w, &ev, AIIR_TRACE_WRITE, start_us);
+  ev.req_id = tag->req_id;
+  ev.op_id = tag->op_id;
+  ev.route = tag->route;
+  aiir_trace_ring_push(&w->trace, &ev, 1u);
+}
+
+static bool profile_emit(void *ctx, const char *s, size_t n) {
+  return resp_stage((RespBuf *)ctx, s, n);
+}
+
+/* A denied /ai/db/exec whose opId is known; it is attributed to that op only when the op exists. */
+static void db_exec_denied(Worker *w, uint32_t op_id) {
+  metric_inc(w, MET_DB_EXEC_DENY_TOTAL);
+  if (find_op(w->core, op_id)) op_stats_note(&w->rt->op_stats, op_id, false);
+}
+
+static int op_key_cmp(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* Seconds with microsecond precision, without going through printf. */
+static bool resp_stage_micros(RespBuf *r, uint64_t us) {
+  char frac[7];
+  uint64_t f = us % 1000000u;
+  for (int i = 5; i >= 0; i--) {
+    frac[i] = (char)('0' + f % 10u);
+    f /= 10u;
+  }
+  frac[6] = '\0';
+  return resp_stage_u64(r, us / 1000000u) && RESP_STAGE_LIT(r, ".") && resp_stage_str(r, frac);
+}
+
+/* Prometheus histogram per route, summed over workers. */
+static bool stage_latency_metrics(const Runtime *rt, RespBuf *out) {
+  bool ok = RESP_STAGE_LIT(out, "# TYPE aiir_runtime_request_duration_seconds histogram\n");
+  for (size_t r = 0; ok && r < ROUTE_COUNT; r++) {
+    uint64_t counts[LATENCY_BUCKETS + 1u] = {0};
+    uint64_t sum_us = 0;
+    for (size_t i = 0; i < rt->worker_count; i++) {
+      const RouteLatency *l = &rt->workers[i].latency;
+      for (size_t b = 0; b <= LATENCY_BUCKETS; b++) counts[b] += atomic_load_explicit(&l->bucket[r][b], memory_order_relaxed);
+      sum_us += atomic_load_explicit(&l->sum_us[r], memory_order_relaxed);
+    }
+    uint64_t cum = 0;
+    for (size_t b = 0; ok && b <= LATENCY_BUCKETS; b++) {
+      cum += counts[b];
+      ok = RESP_STAGE_LIT(out, "aiir_runtime_request_duration_seconds_bucket{route=\"") && resp_stage_str(out, route_names[r]) &&
+           RESP_STAGE_LIT(out, "\",le=\"") && resp_stage_str(out, b < LATENCY_BUCKETS ? latency_bounds_le[b] : "+Inf") &&
+           RESP_STAGE_LIT(out, "\"} ") && resp_stage_u64(out, cum) && RESP_STAGE_LIT(out, "\n");
+    }
+    ok = ok && RESP_STAGE_LIT(out, "aiir_runtime_request_duration_seconds_sum{route=\"") && resp_stage_str(out, route_names[r]) &&
+         RESP_STAGE_LIT(out, "\"} ") && resp_stage_micros(out, sum_us) && RESP_STAGE_LIT(out, "\n") &&
+         RESP_STAGE_LIT(out, "aiir_runtime_request_duration_seconds_count{route=\"") && resp_stage_str(out, route_names[r]) &&
+         RESP_STAGE_LIT(out, "\"} ") && resp_stage_u64(out, cum) && RESP_STAGE_LIT(out, "\n");
+  }
+  return ok;
+}
+
+/* Per-op allow/deny counters, in op_id order. */
+static bool stage_op_metrics(OpStats *st, RespBuf *out) {
+  bool ok = RESP_STAGE_LIT(out, "# TYPE aiir_runtime_op_overflow_total counter\naiir_runtime_op_overflow_total ") &&
+            resp_stage_u64(out, atomic_load(&st->overflow_total)) && RESP_STAGE_LIT(out, "\n");
+  if (!ok || !st->slots) return ok;
+  size_t n = 0, cap = (size_t)st->mask + 1u;
+  uint32_t *keys = (uint32_t *)malloc(cap * sizeof(uint32_t));
+  if (!keys) return false;
+  for (size_t i = 0; i < cap; i++) {
+    uint32_t k = atomic_load_explicit(&st->slots[i].key, memory_order_acquire);
+    if (k != 0) keys[n++] = k;
+  }
+  if (n > 1u) qsort(keys, n, sizeof(uint32_t), op_key_cmp);
+  for (int kind = 0; ok && kind < 2; kind++) {
+    const char *name = kind == 0 ? "aiir_runtime_op_allow_total" : "aiir_runtime_op_deny_total";
+    ok = RESP_STAGE_LIT(out, "# TYPE ") && resp_stage_str(out, name) && RESP_STAGE_LIT(out, " counter\n");
+    for (size_t i = 0; ok && i < n; i++) {
+      OpStat *e = op_stats_slot(st, keys[i] - 1u);
+      uint64_t v = e ? atomic_load_explicit(kind == 0 ? &e->allow : &e->deny, memory_order_relaxed) : 0u;
+      ok = resp_stage_str(out, name) && RESP_STAGE_LIT(out, "{op_id=\"") && resp_stage_u64(out, keys[i] - 1u) &&
+           RESP_STAGE_LIT(out, "\"} ") && resp_stage_u64(out, v) && RESP_STAGE_LIT(out, "\n");
+    }
+  }
+  free(keys);
+  return ok;
+}
+
+_Static_assert(MET_COUNT <= AIIR_STATE_METRICS_MAX, "snapshot holds every metric counter");
+
+/* Snapshot collector: the gateway sequence and the request counters summed over workers. */
+static void state_collect(void *ctx, AiirStateImage *img) {
+  const Runtime *rt = (const Runtime *)ctx;
+  uint64_t m[MET_COUNT];
+  metrics_sum(rt, m);
+  img->gateway_seq = atomic_load(&rt->gateway_seq);
+  img->metric_count = MET_COUNT;
+  memcpy(img->metrics, m, sizeof(m));
+}
+
+static void metric_track_status(Worker *w, int code) {
+  w->status = code;
+  if (code >= 200 && code < 300) metric_inc(w, MET_RESPONSES_2XX);
+  else if (code >= 400 && code < 500) metric_inc(w, MET_RESPONSES_4XX);
+  else if (code >= 500 && code < 600) metric_inc(w, MET_RESPONSES_5XX);
+}
+
+static int json_response_static_tr(Worker *w, RespBuf *out, int code, const char *body, size_t len) {
+  metric_track_status(w, code);
+  if (http_head(out, code, "application/json; charset=utf-8", len) != 0 || !resp_append_static(out, body, len)) return -1;
+  return 0;
+}
+
+static int text_response_staged_tr(Worker *w, RespBuf *out, int code, size_t mark) {
+  metric_track_status(w, code);
+  return http_response_staged(out, code, "text/plain; version=0.0.4; charset=utf-8", mark);
+}
+
+static int binary_response_staged_tr(Worker *w, RespBuf *out, int code, size_t mark) {
+  metric_track_status(w, code);
+  return http_response_staged(out, code, "application/octet-stream", mark);
+}
+
+static int plain_response_staged_tr(Worker *w, RespBuf *out, int code, size_t mark) {
+  metric_track_status(w, code);
+  return http_response_staged(out, code, "text/plain; charset=utf-8", mark);
+}
+
+static int json_response_staged_tr(Worker *w, RespBuf *out, int code, size_t mark) {
+  metric_track_status(w, code);
+  return http_response_staged(out, code, "application/json; charset=utf-8", mark);
+}
+
+static int json_error_tr(Worker *w, RespBuf *out, RespErr e) {
+  const RespErrWire *re = &resp_errors[e];
+  int ka = out->keep_alive ? 1 : 0;
+  metric_track_status(w, re->code);
+  return resp_append_static(out, re->wire[ka], re->wire_len[ka]) ? 0 : -1;
+}
+
+static bool resp_errors_init(void) {
+  for (size_t i = 0; i < RESP_ERR_COUNT; i++) {
+    char body[128];
+    snprintf(body, sizeof(body), "{\"ok\":0,\"err\":\"%s\"}", resp_errors[i].err);
+    for (int ka = 0; ka < 2; ka++) {
+      RespBuf r = {0};
+      r.keep_alive = ka != 0;
+      if (json_response(&r, resp_errors[i].code, body) != 0) {
+        resp_free(&r);
+        return false;
+      }
+      resp_errors[i].wire[ka] = r.buf;
+      resp_errors[i].wire_len[ka] = r.len;
+      free(r.segs);
+    }
+  }
+  return true;
+}
+
+static void resp_errors_free(void) {
+  for (size_t i = 0; i < RESP_ERR_COUNT; i++) {
+    for (int ka = 0; ka < 2; ka++) {
+      free(resp_errors[i].wire[ka]);
+      resp_errors[i].wire[ka] = NULL;
+    }
+  }
+}
+
+static bool get_packet_by_id(const CoreGen *core, uint32_t id, const uint32_t **pkt, uint32_t *pkt_len) {
+  uint32_t files = (uint32_t)(core->lite_table.len / 3u);
+  if (id >= files) return false;
+  uint32_t p = id * 3u;
+  uint32_t off = core->lite_table.words[p + 1u];
+  uint32_t len = core->lite_table.words[p + 2u];
+  if ((uint64_t)off + (uint64_t)len > core->lite_blob.len) return false;
+  *pkt = core->lite_blob.words + off;
+  *pkt_len = len;
+  return true;
+}
+
+static bool parse_a2a_summary(const uint32_t *w, uint32_t n, uint32_t *code_records, uint32_t *slot_records, uint32_t *meta_records) {
+  if (n < 8u || w[0] != AIIR_A2A_MAGIC) return false;
   uint32_t sec_count = w[2];
   uint32_t toc_base = w[4];
   uint32_t total = w[6];
@@ -760,72 +2254,206 @@ static bool parse_a2a_summary(const uint32_t *w, uint32_t n, uint32_t *code_reco
   return true;
 }
 
-static bool find_adapt(const Runtime *rt, uint32_t file_id, uint32_t *off, uint32_t *len) {
-  for (size_t i = 0; i < rt->adapt_table.len; i += 3u) {
-    if (rt->adapt_table.words[i] == file_id) {
-      *off = rt->adapt_table.words[i + 1u];
-      *len = rt->adapt_table.words[i + 2u];
-      return true;
-    }
+/* Callers have already bounded file_id by the lite table (get_packet_by_id). */
+static bool find_adapt(const CoreGen *core, uint32_t file_id, uint32_t *off, uint32_t *len) {
+  uint32_t row = core->adapt_rows[file_id];
+  if (row == 0) return false;
+  *off = core->adapt_table.words[(row - 1u) * 3u + 1u];
+  *len = core->adapt_table.words[(row - 1u) * 3u + 2u];
+  return true;
+}
+
+/* Stages the JSON-escaped first 4 KiB of a source fallback (one byte per blob word). */
+static bool stage_source_preview(const CoreGen *core, uint32_t off, uint32_t len, RespBuf *out) {
+  size_t raw_len = len < 4096u ? len : 4096u;
+  char tmp[4096];
+  for (size_t i = 0; i < raw_len; i++) {
+    tmp[i] = (char)(core->adapt_blob.words[off + i] & 0xffu);
   }
-  return false;
+  return resp_stage_escaped(out, tmp, raw_len);
 }
 
-static bool build_source_preview(const Runtime *rt, uint32_t file_id, char *out, size_t out_cap, uint32_t *fallback_len) {
-  uint32_t off = 0, len = 0;
-  *fallback_len = 0;
-  if (!find_adapt(rt, file_id, &off, &len)) {
-    out[0] = '\0';
-    return true;
+/* Request bodies are tokenized once into an index of their top-level fields; handlers then
+   look fields up by key instead of rescanning the body for each one. The long runs (string
+   contents and nested values) are skipped with a vector scan for the bytes that can end them. */
+#define JSON_INDEX_MAX_FIELDS 32u
+#define JSON_NEST_MAX 64u
+
+typedef struct {
+  uint32_t key_off;
+  uint32_t key_len; /* raw key bytes between the quotes */
+  uint32_t val_off;
+  uint32_t val_len; /* whole value token, quotes and brackets included */
+} JsonField;
+
+typedef struct {
+  const char *base;
+  size_t count;
+  JsonField fields[JSON_INDEX_MAX_FIELDS];
+} JsonIndex;
+
+static const char *json_skip_ws(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+  return p;
+}
+
+static bool json_skip_string(const char **pp, const char *end) {
+  const char *p = *pp + 1;
+  for (;;) {
+    p = json_scan_string(p, end);
+    if (p >= end) return false;
+    if (*p == '"') break;
+    if (*p != '\\' || end - p < 2) return false;
+    char e = p[1];
+    if (e == 'u') {
+      if (end - p < 6) return false;
+      for (int i = 2; i < 6; i++) {
+        if (!isxdigit((unsigned char)p[i])) return false;
+      }
+      p += 6;
+    } else if (e == '"' || e == '\\' || e == '/' || e == 'b' || e == 'f' || e == 'n' || e == 'r' || e == 't') {
+      p += 2;
+    } else {
+      return false;
+    }
   }
-  if ((uint64_t)off + (uint64_t)len > rt->adapt_blob.len) return false;
-  *fallback_len = len;
+  *pp = p + 1;
+  return true;
+}
 
-  size_t raw_len = len < 4096u ? len : 4096u;
-  char tmp[4097];
-  for (size_t i = 0; i < raw_len; i++) {
-    tmp[i] = (char)(rt->adapt_blob.words[off + i] & 0xffu);
+/* Skips an object or array, checking that strings are well formed and brackets match. */
+static bool json_skip_nested(const char **pp, const char *end) {
+  const char *p = *pp;
+  uint64_t arrays = 0; /* one bit per open level, set for '[' */
+  unsigned depth = 0;
+  for (;;) {
+    char c = *p;
+    if (c == '"') {
+      if (!json_skip_string(&p, end)) return false;
+    } else if (c == '[' || c == '{') {
+      if (depth == JSON_NEST_MAX) return false;
+      arrays = (arrays << 1) | (c == '[' ? 1u : 0u);
+      depth++;
+      p++;
+    } else {
+      if (depth == 0 || (arrays & 1u) != (c == ']' ? 1u : 0u)) return false;
+      arrays >>= 1;
+      p++;
+      if (--depth == 0) break;
+    }
+    p = json_scan_nest(p, end);
+    if (p >= end) return false;
   }
-  tmp[raw_len] = '\0';
-  size_t escaped_len = 0;
-  return json_escape_copy(tmp, raw_len, out, out_cap, &escaped_len);
+  *pp = p;
+  return true;
 }
 
-static bool parse_json_int(const char *s, const char *key, long long *out) {
-  const char *p = strstr(s, key);
-  if (!p) return false;
-  p += strlen(key);
-  while (*p && *p != ':') p++;
-  if (*p != ':') return false;
-  p++;
-  while (*p == ' ' || *p == '\t') p++;
-  char *end = NULL;
-  long long v = strtoll(p, &end, 10);
-  if (end == p) return false;
-  *out = v;
+static bool json_skip_digits(const char **pp, const char *end) {
+  const char *p = *pp;
+  while (p < end && *p >= '0' && *p <= '9') p++;
+  if (p == *pp) return false;
+  *pp = p;
   return true;
 }
 
-static const char *skip_ws(const char *p);
-static bool parse_json_string(const char **pp, char **out_s);
+static bool json_skip_scalar(const char **pp, const char *end) {
+  const char *p = *pp;
+  size_t left = (size_t)(end - p);
+  if (left >= 4 && (memcmp(p, "true", 4) == 0 || memcmp(p, "null", 4) == 0)) {
+    *pp = p + 4;
+    return true;
+  }
+  if (left >= 5 && memcmp(p, "false", 5) == 0) {
+    *pp = p + 5;
+    return true;
+  }
+  if (p < end && *p == '-') p++;
+  if (!json_skip_digits(&p, end)) return false;
+  if (p < end && *p == '.') {
+    p++;
+    if (!json_skip_digits(&p, end)) return false;
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    p++;
+    if (p < end && (*p == '+' || *p == '-')) p++;
+    if (!json_skip_digits(&p, end)) return false;
+  }
+  *pp = p;
+  return true;
+}
 
-static bool parse_json_string_key(const char *s, const char *key, char *out, size_t out_cap) {
-  const char *p = strstr(s, key);
-  if (!p) return false;
-  p += strlen(key);
-  while (*p && *p != ':') p++;
-  if (*p != ':') return false;
-  p++;
-  p = skip_ws(p);
-  char *tmp = NULL;
-  if (!parse_json_string(&p, &tmp) || !tmp) return false;
-  size_t n = strlen(tmp);
-  if (n + 1u > out_cap) {
-    free(tmp);
+/* Indexes the top-level fields of the JSON object in s[0, len). Fails unless the whole input
+   is one object with well-formed values and at most JSON_INDEX_MAX_FIELDS fields. */
+static bool json_index_build(JsonIndex *ix, const char *s, size_t len) {
+  const char *p = s;
+  const char *end = s + len;
+  ix->base = s;
+  ix->count = 0;
+  p = json_skip_ws(p, end);
+  if (p >= end || *p != '{') return false;
+  p = json_skip_ws(p + 1, end);
+  if (p < end && *p == '}') return json_skip_ws(p + 1, end) == end;
+  for (;;) {
+    if (p >= end || *p != '"') return false;
+    const char *key = p;
+    if (!json_skip_string(&p, end)) return false;
+    const char *key_end = p;
+    p = json_skip_ws(p, end);
+    if (p >= end || *p != ':') return false;
+    p = json_skip_ws(p + 1, end);
+    if (p >= end) return false;
+    const char *val = p;
+    bool ok;
+    if (*p == '"') ok = json_skip_string(&p, end);
+    else if (*p == '{' || *p == '[') ok = json_skip_nested(&p, end);
+    else ok = json_skip_scalar(&p, end);
+    if (!ok || ix->count == JSON_INDEX_MAX_FIELDS) return false;
+    JsonField *f = &ix->fields[ix->count++];
+    f->key_off = (uint32_t)(key + 1 - s);
+    f->key_len = (uint32_t)(key_end - key - 2);
+    f->val_off = (uint32_t)(val - s);
+    f->val_len = (uint32_t)(p - val);
+    p = json_skip_ws(p, end);
+    if (p < end && *p == ',') {
+      p = json_skip_ws(p + 1, end);
+      continue;
+    }
+    if (p < end && *p == '}') break;
     return false;
   }
-  memcpy(out, tmp, n + 1u);
-  free(tmp);
+  return json_skip_ws(p + 1, end) == end;
+}
+
+/* The first field with this key wins, as it did when fields were found by substring search. */
+static const JsonField *json_index_find(const JsonIndex *ix, const char *key) {
+  size_t n = strlen(key);
+  for (size_t i = 0; i < ix->count; i++) {
+    const JsonField *f = &ix->fields[i];
+    if (f->key_len == n && memcmp(ix->base + f->key_off, key, n) == 0) return f;
+  }
+  return NULL;
+}
+
+static bool parse_json_string_to(const char **pp, char *out, size_t out_cap);
+
+static bool json_get_string(const JsonIndex *ix, const char *key, char *out, size_t out_cap) {
+  const JsonField *f = json_index_find(ix, key);
+  if (!f || ix->base[f->val_off] != '"') return false;
+  const char *p = ix->base + f->val_off;
+  return parse_json_string_to(&p, out, out_cap);
+}
+
+/* Integers only: fractions, exponents and out-of-range values are rejected. */
+static bool json_get_int(const JsonIndex *ix, const char *key, long long *out) {
+  const JsonField *f = json_index_find(ix, key);
+  if (!f) return false;
+  const char *p = ix->base + f->val_off;
+  if (*p != '-' && !(*p >= '0' && *p <= '9')) return false;
+  char *end = NULL;
+  errno = 0;
+  long long v = strtoll(p, &end, 10);
+  if (errno != 0 || end != p + f->val_len) return false;
+  *out = v;
   return true;
 }
 
@@ -856,61 +2484,51 @@ static bool is_known_db_exec_intent(const char *intent) {
 
 static void gen_ref(char *out, size_t out_cap, const char *prefix, Runtime *rt) {
   uint64_t t = (uint64_t)time(NULL);
-  rt->gateway_seq++;
-  snprintf(out, out_cap, "%s_%llx%llx", prefix, (unsigned long long)t, (unsigned long long)rt->gateway_seq);
+  uint64_t seq = atomic_fetch_add_explicit(&rt->gateway_seq, 1u, memory_order_relaxed) + 1u;
+  snprintf(out, out_cap, "%s_%llx%llx", prefix, (unsigned long long)t, (unsigned long long)seq);
+}
+
+static bool stage_project_created(RespBuf *out, const char *project_ref, const char *db_ref, bool idempotent) {
+  return RESP_STAGE_LIT(out, "{\"ok\":1,\"project_ref\":\"") && resp_stage_escaped_str(out, project_ref) &&
+         RESP_STAGE_LIT(out, "\",\"db_ref\":\"") && resp_stage_escaped_str(out, db_ref) &&
+         RESP_STAGE_LIT(out, "\",\"status\":\"provisioning\",\"events_channel\":\"aiir.ev.project.") &&
+         resp_stage_escaped_str(out, project_ref) &&
+         (idempotent ? RESP_STAGE_LIT(out, "\",\"idempotent\":1}") : RESP_STAGE_LIT(out, "\"}"));
 }
 
+/* Callers hold gateway_lock. */
 static bool gateway_find_project_by_idempotency(Runtime *rt, const char *idempotency_key,
                                                 char *project_ref, size_t project_ref_cap,
                                                 char *db_ref, size_t db_ref_cap) {
   if (!idempotency_key || !*idempotency_key) return false;
-  FILE *fp = fopen(rt->gateway_projects_file, "r");
-  if (!fp) return false;
-  char line[4096];
-  bool ok = false;
-  while (fgets(line, sizeof(line), fp)) {
-    char idem[128];
-    if (!parse_json_string_key(line, "\"idempotency_key\"", idem, sizeof(idem))) continue;
-    if (strcmp(idem, idempotency_key) != 0) continue;
-    if (!parse_json_string_key(line, "\"project_ref\"", project_ref, project_ref_cap)) continue;
-    if (!parse_json_string_key(line, "\"db_ref\"", db_ref, db_ref_cap)) continue;
-    ok = true;
-    break;
-  }
-  fclose(fp);
-  return ok;
+  AiirProjectRecord rec;
+  if (!aiir_projstore_find_idem(&rt->gateway_store, idempotency_key, &rec)) return false;
+  snprintf(project_ref, project_ref_cap, "%s", rec.project_ref);
+  snprintf(db_ref, db_ref_cap, "%s", rec.db_ref);
+  return true;
 }
 
+/* Callers hold gateway_lock. */
 static bool gateway_store_project(Runtime *rt, const char *project_ref, const char *db_ref, const char *project_name,
                                   const char *db_profile, const char *region, size_t retention_days, const char *idempotency_key,
                                   const char *contract_version, const char *intent) {
-  FILE *fp = fopen(rt->gateway_projects_file, "a");
-  if (!fp) return false;
-  fprintf(fp,
-          "{\"ts\":%llu,\"project_ref\":\"%s\",\"db_ref\":\"%s\",\"project_name\":\"%s\",\"db_profile\":\"%s\",\"region\":\"%s\",\"retention_days\":%zu,\"idempotency_key\":\"%s\",\"contract_version\":\"%s\",\"intent\":\"%s\"}\n",
-          (unsigned long long)time(NULL), project_ref, db_ref, project_name, db_profile, region, retention_days,
-          idempotency_key ? idempotency_key : "",
-          contract_version ? contract_version : "hal.v1",
-          intent ? intent : "create_project");
-  fclose(fp);
-  return true;
+  AiirProjectRecord rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.ts = (uint64_t)time(NULL);
+  rec.retention_days = (uint32_t)retention_days;
+  snprintf(rec.project_ref, sizeof(rec.project_ref), "%s", project_ref);
+  snprintf(rec.db_ref, sizeof(rec.db_ref), "%s", db_ref);
+  snprintf(rec.idem, sizeof(rec.idem), "%s", idempotency_key ? idempotency_key : "");
+  snprintf(rec.project_name, sizeof(rec.project_name), "%s", project_name);
+  snprintf(rec.db_profile, sizeof(rec.db_profile), "%s", db_profile);
+  snprintf(rec.region, sizeof(rec.region), "%s", region);
+  snprintf(rec.contract_version, sizeof(rec.contract_version), "%s", contract_version ? contract_version : "hal.v1");
+  snprintf(rec.intent, sizeof(rec.intent), "%s", intent ? intent : "create_project");
+  return aiir_projstore_append(&rt->gateway_store, &rec);
 }
 
 static bool gateway_project_db_exists(Runtime *rt, const char *project_ref, const char *db_ref) {
-  FILE *fp = fopen(rt->gateway_projects_file, "r");
-  if (!fp) return false;
-  char pr[160], dr[160], line[2048];
-  snprintf(pr, sizeof(pr), "\"project_ref\":\"%s\"", project_ref);
-  snprintf(dr, sizeof(dr), "\"db_ref\":\"%s\"", db_ref);
-  bool ok = false;
-  while (fgets(line, sizeof(line), fp)) {
-    if (strstr(line, pr) && strstr(line, dr)) {
-      ok = true;
-      break;
-    }
-  }
-  fclose(fp);
-  return ok;
+  return aiir_projstore_has_db(&rt->gateway_store, project_ref, db_ref);
 }
 
 static const char *skip_ws(const char *p) {
@@ -918,74 +2536,81 @@ static const char *skip_ws(const char *p) {
   return p;
 }
 
-static bool parse_json_string(const char **pp, char **out_s) {
+/* Decodes the JSON string at *pp into out (NUL-terminated). Escapes other than \n, \r
+   and \t decode to the escaped character. On failure out is left empty. */
+static bool parse_json_string_to(const char **pp, char *out, size_t out_cap) {
   const char *p = *pp;
-  if (*p != '"') return false;
+  if (*p != '"' || out_cap == 0) return false;
   p++;
-  size_t cap = 128;
   size_t len = 0;
-  char *buf = (char *)malloc(cap);
-  if (!buf) return false;
+  bool ok = true;
   while (*p && *p != '"') {
     char c = *p++;
     if (c == '\\') {
       char e = *p++;
-      if (!e) { free(buf); return false; }
+      if (!e) { ok = false; break; }
       if (e == 'n') c = '\n';
       else if (e == 'r') c = '\r';
       else if (e == 't') c = '\t';
       else c = e;
     }
-    if (len + 1 >= cap) {
-      cap *= 2;
-      char *nb = (char *)realloc(buf, cap);
-      if (!nb) { free(buf); return false; }
-      buf = nb;
-    }
-    buf[len++] = c;
+    if (len + 1u >= out_cap) { ok = false; break; }
+    out[len++] = c;
   }
-  if (*p != '"') { free(buf); return false; }
-  p++;
-  buf[len] = '\0';
+  if (!ok || *p != '"') {
+    out[0] = '\0';
+    return false;
+  }
+  out[len] = '\0';
+  *pp = p + 1;
+  return true;
+}
+
+/* Arena-backed variant: the encoded length bounds the decoded one. */
+static bool parse_json_string(Arena *a, const char **pp, char **out_s) {
+  const char *p = *pp;
+  if (*p != '"') return false;
+  const char *q = p + 1;
+  while (*q && *q != '"') {
+    if (*q == '\\' && q[1]) q++;
+    q++;
+  }
+  size_t cap = (size_t)(q - p);
+  char *buf = (char *)arena_alloc(a, cap);
+  if (!buf || !parse_json_string_to(pp, buf, cap)) return false;
   *out_s = buf;
-  *pp = p;
   return true;
 }
 
-static bool parse_json_args(const char *body, JsonVal **out_vals, size_t *out_n) {
-  const char *p = strstr(body, "\"args\"");
-  if (!p) {
+static bool parse_json_args(Arena *a, const JsonIndex *ix, JsonVal **out_vals, size_t *out_n) {
+  const JsonField *f = json_index_find(ix, "args");
+  if (!f) {
     *out_vals = NULL;
     *out_n = 0;
     return true;
   }
-  p = strchr(p, ':');
-  if (!p) return false;
-  p++;
-  p = skip_ws(p);
+  const char *p = ix->base + f->val_off;
   if (*p != '[') return false;
   p++;
 
   size_t cap = 8;
   size_t n = 0;
-  JsonVal *arr = (JsonVal *)calloc(cap, sizeof(JsonVal));
+  JsonVal *arr = (JsonVal *)arena_alloc(a, cap * sizeof(JsonVal));
   if (!arr) return false;
 
   while (1) {
     p = skip_ws(p);
     if (*p == ']') { p++; break; }
     if (n >= cap) {
+      arr = (JsonVal *)arena_grow(a, arr, cap * sizeof(JsonVal), cap * 2u * sizeof(JsonVal));
+      if (!arr) return false;
       cap *= 2;
-      JsonVal *na = (JsonVal *)realloc(arr, cap * sizeof(JsonVal));
-      if (!na) { free(arr); return false; }
-      memset(na + n, 0, (cap - n) * sizeof(JsonVal));
-      arr = na;
     }
 
     JsonVal v = {0};
     if (*p == '"') {
       v.t = JV_STRING;
-      if (!parse_json_string(&p, &v.s)) { free(arr); return false; }
+      if (!parse_json_string(a, &p, &v.s)) return false;
     } else if (strncmp(p, "true", 4) == 0) {
       v.t = JV_BOOL; v.b = true; p += 4;
     } else if (strncmp(p, "false", 5) == 0) {
@@ -995,11 +2620,7 @@ static bool parse_json_args(const char *body, JsonVal **out_vals, size_t *out_n)
     } else {
       char *end = NULL;
       double d = strtod(p, &end);
-      if (end == p) {
-        for (size_t k = 0; k < n; k++) free(arr[k].s);
-        free(arr);
-        return false;
-      }
+      if (end == p) return false;
       v.t = JV_NUMBER;
       v.num = d;
       long long iv = (long long)d;
@@ -1015,8 +2636,6 @@ static bool parse_json_args(const char *body, JsonVal **out_vals, size_t *out_n)
       continue;
     }
     if (*p == ']') { p++; break; }
-    for (size_t k = 0; k < n; k++) free(arr[k].s);
-    free(arr);
     return false;
   }
 
@@ -1037,19 +2656,6 @@ static bool type_check(uint32_t type_id, const JsonVal *v) {
   }
 }
 
-static uint32_t count_sig_for_op(const Runtime *rt, uint32_t op_id) {
-  uint32_t c = 0;
-  for (size_t i = 0; i < rt->sig_count; i++) if (rt->sigs[i].op_id == op_id) c++;
-  return c;
-}
-
-static const DbSig *find_sig(const Runtime *rt, uint32_t op_id, uint32_t arg_index) {
-  for (size_t i = 0; i < rt->sig_count; i++) {
-    if (rt->sigs[i].op_id == op_id && rt->sigs[i].arg_index == arg_index) return &rt->sigs[i];
-  }
-  return NULL;
-}
-
 static size_t parse_env_size(const char *name, size_t defv, size_t minv, size_t maxv) {
   const char *s = getenv(name);
   if (!s || !*s) return defv;
@@ -1061,60 +2667,201 @@ static size_t parse_env_size(const char *name, size_t defv, size_t minv, size_t
   return (size_t)v;
 }
 
-static int handle_request(Runtime *rt, int cfd, const char *peer, const char *db_mode, size_t req_cap, size_t body_cap) {
-  uint64_t start_ms = now_ms();
-  char *req = (char *)malloc(req_cap + 1);
-  if (!req) return -1;
-  ssize_t got = read(cfd, req, req_cap);
-  if (got <= 0) { free(req); return -1; }
-  req[got] = '\0';
-  rt->metric_requests_total++;
+static int handle_request(Worker *w, RespBuf *out, const char *peer, const HttpReq *req, uint64_t start_us) {
+  Runtime *rt = w->rt;
+  const CoreGen *core = w->core;
+  const char *db_mode = w->cfg->db_mode;
+  size_t body_cap = w->cfg->body_cap;
+  AIIR_PROBE3(request__start, w->id, req->base + req->path_off, req->path_len);
+  metric_inc(w, MET_REQUESTS_TOTAL);
 
   char method[16], path[2048];
-  if (!parse_method_path(req, method, sizeof(method), path, sizeof(path))) {
-    json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"request\"}");
+  if (req->bad || req->method_len == 0 || req->method_len >= sizeof(method) ||
+      req->path_len == 0 || req->path_len >= sizeof(path)) {
+    json_error_tr(w, out, RESP_ERR_REQUEST);
     audit_log(rt, peer, "-", "-", 400, "request-parse", 0u, "request");
-    request_log(rt, peer, "-", "-", 400, "request-parse", start_ms);
-    free(req);
+    request_log(rt, peer, "-", "-", 400, "request-parse", start_us);
     return 0;
   }
-
+  /* Checked before routing: the body length is unknown, so nothing after the head is trusted
+     and the connection closes after this response. */
+  if (req->transfer_encoding) {
+    json_error_tr(w, out, RESP_ERR_TRANSFER_ENCODING);
+    audit_log(rt, peer, "-", "-", 501, "request-parse", 0u, "transfer-encoding");
+    request_log(rt, peer, "-", "-", 501, "request-parse", start_us);
+    return 0;
+  }
+  memcpy(method, req->base, req->method_len);
+  method[req->method_len] = '\0';
+  memcpy(path, req->base + req->path_off, req->path_len);
+  path[req->path_len] = '\0';
+
   if (strcmp(method, "GET") == 0 && strcmp(path, "/metrics") == 0) {
-    char body[2048];
-    int n = snprintf(body, sizeof(body),
-                     "# TYPE aiir_runtime_requests_total counter\n"
-                     "aiir_runtime_requests_total %llu\n"
-                     "# TYPE aiir_runtime_responses_2xx_total counter\n"
-                     "aiir_runtime_responses_2xx_total %llu\n"
-                     "# TYPE aiir_runtime_responses_4xx_total counter\n"
-                     "aiir_runtime_responses_4xx_total %llu\n"
-                     "# TYPE aiir_runtime_responses_5xx_total counter\n"
-                     "aiir_runtime_responses_5xx_total %llu\n"
-                     "# TYPE aiir_runtime_rate_limited_total counter\n"
-                     "aiir_runtime_rate_limited_total %llu\n"
-                     "# TYPE aiir_runtime_circuit_open_total counter\n"
-                     "aiir_runtime_circuit_open_total %llu\n"
-                     "# TYPE aiir_runtime_db_exec_allow_total counter\n"
-                     "aiir_runtime_db_exec_allow_total %llu\n"
-                     "# TYPE aiir_runtime_db_exec_deny_total counter\n"
-                     "aiir_runtime_db_exec_deny_total %llu\n"
-                     "# TYPE aiir_runtime_capability_deny_total counter\n"
-                     "aiir_runtime_capability_deny_total %llu\n",
-                     (unsigned long long)rt->metric_requests_total,
-                     (unsigned long long)rt->metric_responses_2xx,
-                     (unsigned long long)rt->metric_responses_4xx,
-                     (unsigned long long)rt->metric_responses_5xx,
-                     (unsigned long long)rt->metric_rate_limited_total,
-                     (unsigned long long)rt->metric_circuit_open_total,
-                     (unsigned long long)rt->metric_db_exec_allow_total,
-                     (unsigned long long)rt->metric_db_exec_deny_total,
-                     (unsigned long long)rt->metric_capability_deny_total);
-    if (n < 0) n = 0;
-    if ((size_t)n >= sizeof(body)) n = (int)(sizeof(body) - 1u);
-    body[n] = '\0';
-    text_response_tr(rt, cfd, 200, body);
-    request_log(rt, peer, method, path, 200, "metrics", start_ms);
-    free(req);
+    uint64_t m[MET_COUNT];
+    metrics_sum(rt, m);
+    size_t cache_entries, cache_bytes;
+    render_cache_usage(&rt->render_cache, &cache_entries, &cache_bytes);
+    NonceCache *nc = &rt->cap_nonces;
+    pthread_mutex_lock(&nc->lock);
+    size_t nonce_entries = nc->count;
+    uint64_t nonce_expired = nc->expired_total;
+    uint64_t nonce_full = nc->full_total;
+    pthread_mutex_unlock(&nc->lock);
+    size_t gateway_projects = 0, store_segments = 0, store_memtable = 0;
+    if (rt->gateway_store_open) {
+      gateway_projects = aiir_projstore_count(&rt->gateway_store);
+      aiir_projstore_shape(&rt->gateway_store, &store_segments, &store_memtable);
+    }
+    uint64_t applied_lsn, exec_history;
+    aiir_state_applied(&rt->state, &applied_lsn, &exec_history);
+    const struct {
+      const char *name;
+      const char *type;
+      uint64_t v;
+    } lines[] = {
+      {"aiir_runtime_requests_total", "counter", m[MET_REQUESTS_TOTAL]},
+      {"aiir_runtime_responses_2xx_total", "counter", m[MET_RESPONSES_2XX]},
+      {"aiir_runtime_responses_4xx_total", "counter", m[MET_RESPONSES_4XX]},
+      {"aiir_runtime_responses_5xx_total", "counter", m[MET_RESPONSES_5XX]},
+      {"aiir_runtime_rate_limited_total", "counter", m[MET_RATE_LIMITED_TOTAL]},
+      {"aiir_runtime_circuit_open_total", "counter", m[MET_CIRCUIT_OPEN_TOTAL]},
+      {"aiir_runtime_db_exec_allow_total", "counter", m[MET_DB_EXEC_ALLOW_TOTAL]},
+      {"aiir_runtime_db_exec_deny_total", "counter", m[MET_DB_EXEC_DENY_TOTAL]},
+      {"aiir_runtime_capability_deny_total", "counter", m[MET_CAPABILITY_DENY_TOTAL]},
+      {"aiir_runtime_core_generation", "gauge", core->id},
+      {"aiir_runtime_core_reload_total", "counter", atomic_load(&rt->core_reload_total)},
+      {"aiir_runtime_core_reload_fail_total", "counter", atomic_load(&rt->core_reload_fail_total)},
+      {"aiir_runtime_core_drift_total", "counter", atomic_load(&rt->drift_total)},
+      {"aiir_runtime_core_drift_checks_total", "counter", atomic_load(&rt->drift_checks_total)},
+      {"aiir_runtime_core_drift_rehash_total", "counter", atomic_load(&rt->drift_rehash_total)},
+      {"aiir_runtime_render_cache_hit_total", "counter", m[MET_RENDER_CACHE_HIT_TOTAL]},
+      {"aiir_runtime_render_cache_miss_total", "counter", m[MET_RENDER_CACHE_MISS_TOTAL]},
+      {"aiir_runtime_render_cache_eviction_total", "counter", m[MET_RENDER_CACHE_EVICT_TOTAL]},
+      {"aiir_runtime_render_cache_entries", "gauge", cache_entries},
+      {"aiir_runtime_render_cache_bytes", "gauge", cache_bytes},
+      {"aiir_runtime_cap_nonce_entries", "gauge", nonce_entries},
+      {"aiir_runtime_cap_nonce_capacity", "gauge", nc->capacity},
+      {"aiir_runtime_cap_nonce_expired_total", "counter", nonce_expired},
+      {"aiir_runtime_cap_nonce_full_total", "counter", nonce_full},
+      {"aiir_runtime_gateway_projects", "gauge", gateway_projects},
+      {"aiir_runtime_project_store_segments", "gauge", store_segments},
+      {"aiir_runtime_project_store_memtable_records", "gauge", store_memtable},
+      {"aiir_runtime_project_store_seals_total", "counter", atomic_load(&rt->gateway_store.seals_total)},
+      {"aiir_runtime_project_store_compactions_total", "counter", atomic_load(&rt->gateway_store.compactions_total)},
+      {"aiir_runtime_project_store_errors_total", "counter", atomic_load(&rt->gateway_store.errors_total)},
+      {"aiir_runtime_wal_records_total", "counter", atomic_load(&rt->state.wal.records_total)},
+      {"aiir_runtime_wal_commits_total", "counter", atomic_load(&rt->state.wal.commits_total)},
+      {"aiir_runtime_wal_rotations_total", "counter", atomic_load(&rt->state.wal.rotations_total)},
+      {"aiir_runtime_wal_errors_total", "counter", atomic_load(&rt->state.wal.errors_total)},
+      {"aiir_runtime_wal_durable_lsn", "gauge", aiir_wal_durable_lsn(&rt->state.wal)},
+      {"aiir_runtime_state_applied_lsn", "gauge", applied_lsn},
+      {"aiir_runtime_state_replayed_records", "gauge", rt->state.replayed},
+      {"aiir_runtime_db_exec_history_total", "counter", exec_history},
+      {"aiir_runtime_snapshot_lsn", "gauge", atomic_load(&rt->state.written_lsn)},
+      {"aiir_runtime_snapshots_total", "counter", atomic_load(&rt->state.snapshots_total)},
+      {"aiir_runtime_snapshot_errors_total", "counter", atomic_load(&rt->state.snapshot_errors_total)},
+      {"aiir_runtime_audit_queue_depth", "gauge", aiir_audit_depth(&rt->audit)},
+      {"aiir_runtime_audit_queue_capacity", "gauge", aiir_audit_capacity(&rt->audit)},
+      {"aiir_runtime_audit_lines_total", "counter", atomic_load(&rt->audit.lines_total)},
+      {"aiir_runtime_audit_dropped_total", "counter", atomic_load(&rt->audit.dropped_total)},
+      {"aiir_runtime_audit_batches_total", "counter", atomic_load(&rt->audit.batches_total)},
+      {"aiir_runtime_audit_write_errors_total", "counter", atomic_load(&rt->audit.write_errors_total)},
+      {"aiir_runtime_trace_file_events_total", "counter", atomic_load(&rt->trace_sink.events_total)},
+      {"aiir_runtime_trace_file_lost_total", "counter", atomic_load(&rt->trace_sink.lost_total)},
+      {"aiir_runtime_trace_file_write_errors_total", "counter", atomic_load(&rt->trace_sink.write_errors_total)},
+    };
+    size_t mark = resp_stage_begin(out);
+    bool ok = true;
+    for (size_t i = 0; ok && i < sizeof(lines) / sizeof(lines[0]); i++) {
+      ok = RESP_STAGE_LIT(out, "# TYPE ") && resp_stage_str(out, lines[i].name) && RESP_STAGE_LIT(out, " ") &&
+           resp_stage_str(out, lines[i].type) && RESP_STAGE_LIT(out, "\n") && resp_stage_str(out, lines[i].name) &&
+           RESP_STAGE_LIT(out, " ") && resp_stage_u64(out, lines[i].v) && RESP_STAGE_LIT(out, "\n");
+    }
+    ok = ok && stage_latency_metrics(rt, out) && stage_op_metrics(&rt->op_stats, out);
+    if (!ok) {
+      resp_stage_abort(out, mark);
+      return -1;
+    }
+    text_response_staged_tr(w, out, 200, mark);
+    request_log(rt, peer, method, path, 200, "metrics", start_us);
+    return 0;
+  }
+
+  /* What the trace rings hold, in the trace-file format; only when tracing is on and only
+     for loopback peers, since spans carry op ids. Anything else is an unknown route. */
+  if (rt->trace_enabled && strcmp(method, "GET") == 0 && strcmp(path, "/debug/trace") == 0 &&
+      strncmp(peer, "127.", 4) == 0) {
+    size_t mark = resp_stage_begin(out);
+    AiirTraceHeader h;
+    aiir_trace_header_init(&h);
+    bool ok = resp_stage(out, (const char *)&h, sizeof(h));
+    uint64_t origin = h.mono_origin_us;
+    AiirTraceEvent chunk[256];
+    for (size_t i = 0; ok && i < rt->worker_count; i++) {
+      uint64_t from = 0;
+      size_t n;
+      while (ok && (n = aiir_trace_ring_read(&rt->workers[i].trace, &from, chunk, 256u, NULL)) > 0) {
+        for (size_t k = 0; k < n; k++) {
+          if (chunk[k].ts_us < origin) origin = chunk[k].ts_us;
+        }
+        ok = resp_stage(out, (const char *)chunk, n * sizeof(chunk[0]));
+      }
+    }
+    if (!ok) {
+      resp_stage_abort(out, mark);
+      return -1;
+    }
+    /* The wall clock stays paired with the monotonic one it was read with. */
+    h.wall_origin_us -= h.mono_origin_us - origin;
+    h.mono_origin_us = origin;
+    memcpy(out->buf + mark, &h, sizeof(h));
+    binary_response_staged_tr(w, out, 200, mark);
+    request_log(rt, peer, method, path, 200, "trace", start_us);
+    return 0;
+  }
+
+  /* Samples every worker for ?seconds=N (default 10) and returns folded stacks; same exposure
+     rules as /debug/trace. Only one run is in progress at a time. In epoll mode the response is
+     left to the loop, which keeps serving while the run lasts; otherwise the worker sleeps. */
+  if (rt->profile_enabled && strcmp(method, "GET") == 0 && strncmp(path, "/debug/profile", 14) == 0 &&
+      (path[14] == '\0' || path[14] == '?') && strncmp(peer, "127.", 4) == 0) {
+    unsigned long seconds = 10u;
+    const char *sq = strstr(path + 14, "seconds=");
+    if (sq) seconds = strtoul(sq + 8, NULL, 10);
+    if (seconds < 1u) seconds = 1u;
+    if (seconds > rt->profile_max_sec) seconds = rt->profile_max_sec;
+    if (atomic_exchange(&rt->profile_busy, true)) {
+      json_error_tr(w, out, RESP_ERR_BUSY);
+      request_log(rt, peer, method, path, 503, "profile-busy", start_us);
+      return 0;
+    }
+    if (w->profile_defer) {
+      w->profile_run = aiir_profile_start(&rt->profiler, (unsigned)rt->profile_hz, rt->profile_stacks);
+      if (!w->profile_run) {
+        atomic_store(&rt->profile_busy, false);
+        return -1;
+      }
+      w->profile_deferred = true;
+      w->profile_sec = (unsigned)seconds;
+      w->profile_start_us = start_us;
+      snprintf(w->profile_peer, sizeof(w->profile_peer), "%s", peer);
+      snprintf(w->profile_path, sizeof(w->profile_path), "%s", path);
+      return 0;
+    }
+    /* The run needs no core: unpinned, a reload (and the shutdown signal the reload thread
+       also takes) need not wait out the sleep. */
+    core_release(w);
+    size_t mark = resp_stage_begin(out);
+    bool ok = aiir_profile_run(&rt->profiler, (unsigned)seconds, (unsigned)rt->profile_hz, rt->profile_stacks,
+                               profile_emit, out, NULL);
+    w->core = core_acquire(w);
+    atomic_store(&rt->profile_busy, false);
+    if (!ok) {
+      resp_stage_abort(out, mark);
+      return -1;
+    }
+    plain_response_staged_tr(w, out, 200, mark);
+    request_log(rt, peer, method, path, 200, "profile", start_us);
     return 0;
   }
 
@@ -1132,141 +2879,180 @@ static int handle_request(Runtime *rt, int cfd, const char *peer, const char *db
       "\"/ai/db/exec\":{\"post\":{\"requestBody\":{\"required\":true,\"content\":{\"application/json\":{\"schema\":{\"type\":\"object\",\"required\":[\"opId\"],\"properties\":{\"opId\":{\"type\":\"integer\",\"minimum\":0},\"args\":{\"type\":\"array\"}}}}}},"
       "\"parameters\":[{\"name\":\"X-AIIR-Cap-Op\",\"in\":\"header\",\"required\":false,\"schema\":{\"type\":\"string\"}},{\"name\":\"X-AIIR-Cap-Exp\",\"in\":\"header\",\"required\":false,\"schema\":{\"type\":\"string\"}},{\"name\":\"X-AIIR-Cap-Nonce\",\"in\":\"header\",\"required\":false,\"schema\":{\"type\":\"string\"}},{\"name\":\"X-AIIR-Cap-Sig\",\"in\":\"header\",\"required\":false,\"schema\":{\"type\":\"string\"}}],"
       "\"responses\":{\"200\":{\"description\":\"DB exec accepted\"},\"400\":{\"description\":\"Policy or capability denied\"}}}}}}";
-    json_response_tr(rt, cfd, 200, body);
-    request_log(rt, peer, method, path, 200, "openapi", start_ms);
-    free(req);
+    json_response_static_tr(w, out, 200, body, strlen(body));
+    request_log(rt, peer, method, path, 200, "openapi", start_us);
     return 0;
   }
 
   if (strcmp(method, "GET") == 0 && strcmp(path, "/health") == 0) {
+    w->route = ROUTE_HEALTH;
     int wal_exists = access(rt->state.wal_path, F_OK) == 0 ? 1 : 0;
     int snap_exists = access(rt->state.snapshot_path, F_OK) == 0 ? 1 : 0;
-    char body[4096];
-    snprintf(body, sizeof(body),
-             "{\"ok\":1,\"service\":\"ai-ir-runtime-native\",\"dbMode\":\"%.64s\","
-             "\"driftCount\":%u,\"checks\":%u,\"policy\":{\"allowDbExec\":%s,\"allowAllOps\":%s},"
-             "\"capability\":{\"required\":%s,\"maxFutureSec\":%zu},"
-             "\"gateway\":{\"enabled\":%s,\"humanIndirect\":%s},"
-             "\"metrics\":{\"requestsTotal\":%llu,\"responses2xx\":%llu,\"responses4xx\":%llu,\"responses5xx\":%llu},"
-             "\"audit\":{\"path\":\"%.256s\"},"
-             "\"state\":{\"walPath\":\"%.384s\",\"walExists\":%d,\"snapshotPath\":\"%.384s\",\"snapshotExists\":%d}}",
-             db_mode,
-             rt->drift.drift_count,
-             rt->drift.checks,
-             rt->policy.allow_db_exec ? "true" : "false",
-             rt->policy.allow_all_ops ? "true" : "false",
-             rt->cap_required ? "true" : "false",
-             rt->cap_max_future_sec,
-             rt->gateway_enable ? "true" : "false",
-             rt->gateway_human_indirect ? "true" : "false",
-             (unsigned long long)rt->metric_requests_total,
-             (unsigned long long)rt->metric_responses_2xx,
-             (unsigned long long)rt->metric_responses_4xx,
-             (unsigned long long)rt->metric_responses_5xx,
-             rt->audit_path,
-             rt->state.wal_path,
-             wal_exists,
-             rt->state.snapshot_path,
-             snap_exists);
-    json_response_tr(rt, cfd, 200, body);
-    request_log(rt, peer, method, path, 200, "health", start_ms);
-    free(req);
+    uint64_t m[MET_COUNT];
+    metrics_sum(rt, m);
+    uint64_t drift_count = atomic_load(&rt->drift_total);
+    uint64_t drift_checks = atomic_load(&rt->drift_checks_total);
+    size_t mark = resp_stage_begin(out);
+    bool ok = RESP_STAGE_LIT(out, "{\"ok\":1,\"service\":\"ai-ir-runtime-native\",\"dbMode\":\"") &&
+              resp_stage_escaped_str(out, db_mode) &&
+              RESP_STAGE_LIT(out, "\",\"driftCount\":") && resp_stage_u64(out, drift_count) &&
+              RESP_STAGE_LIT(out, ",\"checks\":") && resp_stage_u64(out, drift_checks) &&
+              RESP_STAGE_LIT(out, ",\"policy\":{\"allowDbExec\":") && resp_stage_bool(out, rt->policy.allow_db_exec) &&
+              RESP_STAGE_LIT(out, ",\"allowAllOps\":") && resp_stage_bool(out, rt->policy.allow_all_ops) &&
+              RESP_STAGE_LIT(out, "},\"capability\":{\"required\":") && resp_stage_bool(out, rt->cap_required) &&
+              RESP_STAGE_LIT(out, ",\"maxFutureSec\":") && resp_stage_u64(out, rt->cap_max_future_sec) &&
+              RESP_STAGE_LIT(out, "},\"gateway\":{\"enabled\":") && resp_stage_bool(out, rt->gateway_enable) &&
+              RESP_STAGE_LIT(out, ",\"humanIndirect\":") && resp_stage_bool(out, rt->gateway_human_indirect) &&
+              RESP_STAGE_LIT(out, "},\"core\":{\"generation\":") && resp_stage_u64(out, core->id) &&
+              RESP_STAGE_LIT(out, ",\"reloads\":") && resp_stage_u64(out, atomic_load(&rt->core_reload_total)) &&
+              RESP_STAGE_LIT(out, ",\"reloadFailures\":") && resp_stage_u64(out, atomic_load(&rt->core_reload_fail_total)) &&
+              RESP_STAGE_LIT(out, ",\"watch\":\"") && resp_stage_str(out, atomic_load(&rt->drift_inotify) ? "inotify" : "poll") &&
+              RESP_STAGE_LIT(out, "\",\"rehashes\":") && resp_stage_u64(out, atomic_load(&rt->drift_rehash_total)) &&
+              RESP_STAGE_LIT(out, "},\"metrics\":{\"requestsTotal\":") && resp_stage_u64(out, m[MET_REQUESTS_TOTAL]) &&
+              RESP_STAGE_LIT(out, ",\"responses2xx\":") && resp_stage_u64(out, m[MET_RESPONSES_2XX]) &&
+              RESP_STAGE_LIT(out, ",\"responses4xx\":") && resp_stage_u64(out, m[MET_RESPONSES_4XX]) &&
+              RESP_STAGE_LIT(out, ",\"responses5xx\":") && resp_stage_u64(out, m[MET_RESPONSES_5XX]) &&
+              RESP_STAGE_LIT(out, "},\"audit\":{\"path\":\"") && resp_stage_escaped_str(out, rt->audit_path) &&
+              RESP_STAGE_LIT(out, "\"},\"state\":{\"walPath\":\"") && resp_stage_escaped_str(out, rt->state.wal_path) &&
+              RESP_STAGE_LIT(out, "\",\"walExists\":") && resp_stage_u64(out, (uint64_t)wal_exists) &&
+              RESP_STAGE_LIT(out, ",\"snapshotPath\":\"") && resp_stage_escaped_str(out, rt->state.snapshot_path) &&
+              RESP_STAGE_LIT(out, "\",\"snapshotExists\":") && resp_stage_u64(out, (uint64_t)snap_exists) &&
+              RESP_STAGE_LIT(out, ",\"snapshotLsn\":") && resp_stage_u64(out, atomic_load(&rt->state.written_lsn)) &&
+              RESP_STAGE_LIT(out, "}}");
+    if (!ok) {
+      resp_stage_abort(out, mark);
+      return -1;
+    }
+    json_response_staged_tr(w, out, 200, mark);
+    request_log(rt, peer, method, path, 200, "health", start_us);
     return 0;
   }
 
   if (strcmp(method, "GET") == 0 && strcmp(path, "/ai/meta") == 0) {
-    uint32_t files = (uint32_t)(rt->lite_table.len / 3u);
-    char body[512];
-    snprintf(body, sizeof(body),
-             "{\"files\":%u,\"liteBlobWords\":%zu,\"sourceAdaptRows\":%zu,\"sourceAdaptWords\":%zu,\"dbPacketWords\":%zu}",
-             files, rt->lite_blob.len, rt->adapt_table.len / 3u, rt->adapt_blob.len, rt->db_packet.len);
-    json_response_tr(rt, cfd, 200, body);
-    request_log(rt, peer, method, path, 200, "meta", start_ms);
-    free(req);
+    w->route = ROUTE_META;
+    uint32_t files = (uint32_t)(core->lite_table.len / 3u);
+    size_t mark = resp_stage_begin(out);
+    bool ok = RESP_STAGE_LIT(out, "{\"files\":") && resp_stage_u64(out, files) &&
+              RESP_STAGE_LIT(out, ",\"liteBlobWords\":") && resp_stage_u64(out, core->lite_blob.len) &&
+              RESP_STAGE_LIT(out, ",\"sourceAdaptRows\":") && resp_stage_u64(out, core->adapt_table.len / 3u) &&
+              RESP_STAGE_LIT(out, ",\"sourceAdaptWords\":") && resp_stage_u64(out, core->adapt_blob.len) &&
+              RESP_STAGE_LIT(out, ",\"dbPacketWords\":") && resp_stage_u64(out, core->db_packet.len) &&
+              RESP_STAGE_LIT(out, "}");
+    if (!ok) {
+      resp_stage_abort(out, mark);
+      return -1;
+    }
+    json_response_staged_tr(w, out, 200, mark);
+    request_log(rt, peer, method, path, 200, "meta", start_us);
     return 0;
   }
 
   if (strcmp(method, "GET") == 0 && strncmp(path, "/ai/render/", 11) == 0) {
+    w->route = ROUTE_RENDER;
     char *end = NULL;
     long idl = strtol(path + 11, &end, 10);
     if (!end || *end != '\0' || idl < 0) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"id\"}");
-      request_log(rt, peer, method, path, 400, "render-id", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_ID);
+      request_log(rt, peer, method, path, 400, "render-id", start_us);
       return 0;
     }
+    RenderCache *rc = &rt->render_cache;
+    if (rc->cap_bytes > 0 && idl <= (long)UINT32_MAX) {
+      RenderEntry *e = render_cache_get(rc, core->id, (uint32_t)idl);
+      bool hit = false;
+      if (e) {
+        size_t mark = resp_stage_begin(out);
+        hit = resp_stage(out, e->body, e->len) && json_response_staged_tr(w, out, 200, mark) == 0;
+        if (!hit) resp_stage_abort(out, mark);
+        render_entry_release(e);
+      }
+      if (hit) {
+        metric_inc(w, MET_RENDER_CACHE_HIT_TOTAL);
+        request_log(rt, peer, method, path, 200, "render", start_us);
+        return 0;
+      }
+      metric_inc(w, MET_RENDER_CACHE_MISS_TOTAL);
+    }
     const uint32_t *pkt = NULL;
     uint32_t pkt_len = 0;
-    if (!get_packet_by_id(rt, (uint32_t)idl, &pkt, &pkt_len)) {
-      json_response_tr(rt, cfd, 404, "{\"ok\":0,\"err\":\"file-id\"}");
-      request_log(rt, peer, method, path, 404, "render-file-id", start_ms);
-      free(req);
+    if (!get_packet_by_id(core, (uint32_t)idl, &pkt, &pkt_len)) {
+      json_error_tr(w, out, RESP_ERR_FILE_ID);
+      request_log(rt, peer, method, path, 404, "render-file-id", start_us);
       return 0;
     }
 
     uint32_t cr = 0, sr = 0, mr = 0;
     if (!parse_a2a_summary(pkt, pkt_len, &cr, &sr, &mr)) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"packet\"}");
-      request_log(rt, peer, method, path, 400, "render-packet", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_PACKET);
+      request_log(rt, peer, method, path, 400, "render-packet", start_us);
       return 0;
     }
 
-    char preview[4096];
-    uint32_t fallback_len = 0;
-    bool ok_preview = build_source_preview(rt, (uint32_t)idl, preview, sizeof(preview), &fallback_len);
-    if (!ok_preview) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"adapt\"}");
-      request_log(rt, peer, method, path, 400, "render-adapt", start_ms);
-      free(req);
+    /* The body is rendered straight into the response buffer; the preview is escaped in
+       place, so its size is bounded by the 4 KiB source window rather than a fixed buffer. */
+    uint32_t src_off = 0, fallback_len = 0;
+    bool has_src = find_adapt(core, (uint32_t)idl, &src_off, &fallback_len);
+    size_t mark = resp_stage_begin(out);
+    bool ok_body = (!has_src || (uint64_t)src_off + (uint64_t)fallback_len <= core->adapt_blob.len) &&
+                   RESP_STAGE_LIT(out, "{\"ok\":1,\"render\":{\"fileId\":") && resp_stage_u64(out, (uint64_t)idl) &&
+                   RESP_STAGE_LIT(out, ",\"codeRecords\":") && resp_stage_u64(out, cr) &&
+                   RESP_STAGE_LIT(out, ",\"slotRecords\":") && resp_stage_u64(out, sr) &&
+                   RESP_STAGE_LIT(out, ",\"metaRecords\":") && resp_stage_u64(out, mr) &&
+                   RESP_STAGE_LIT(out, ",\"hasSourceFallback\":") && resp_stage_bool(out, fallback_len > 0) &&
+                   RESP_STAGE_LIT(out, ",\"sourceFallbackLen\":") && resp_stage_u64(out, fallback_len) &&
+                   RESP_STAGE_LIT(out, ",\"sourcePreview\":\"") &&
+                   (!has_src || stage_source_preview(core, src_off, fallback_len, out)) &&
+                   RESP_STAGE_LIT(out, "\"}}");
+    if (!ok_body) {
+      resp_stage_abort(out, mark);
+      json_error_tr(w, out, RESP_ERR_ADAPT);
+      request_log(rt, peer, method, path, 400, "render-adapt", start_us);
       return 0;
     }
-
-    char body[RESP_BUF_MAX];
-    snprintf(body, sizeof(body),
-             "{\"ok\":1,\"render\":{\"fileId\":%ld,\"codeRecords\":%u,\"slotRecords\":%u,\"metaRecords\":%u,\"hasSourceFallback\":%s,\"sourceFallbackLen\":%u,\"sourcePreview\":\"%s\"}}",
-             idl, cr, sr, mr, (fallback_len > 0 ? "true" : "false"), fallback_len, preview);
-    json_response_tr(rt, cfd, 200, body);
-    request_log(rt, peer, method, path, 200, "render", start_ms);
-    free(req);
+    size_t evicted = render_cache_put(rc, core->id, (uint32_t)idl, out->buf + mark, out->len - mark);
+    for (size_t i = 0; i < evicted; i++) metric_inc(w, MET_RENDER_CACHE_EVICT_TOTAL);
+    json_response_staged_tr(w, out, 200, mark);
+    request_log(rt, peer, method, path, 200, "render", start_us);
     return 0;
   }
 
   if (strcmp(method, "POST") == 0 && strcmp(path, "/aiir/project/create") == 0) {
+    w->route = ROUTE_GATEWAY_PROJECT_CREATE;
     if (!rt->gateway_enable) {
-      json_response_tr(rt, cfd, 404, "{\"ok\":0,\"err\":\"gateway-disabled\"}");
-      request_log(rt, peer, method, path, 404, "gateway-disabled", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_GATEWAY_DISABLED);
+      request_log(rt, peer, method, path, 404, "gateway-disabled", start_us);
       return 0;
     }
-    size_t hdr_end = 0;
-    if (!find_header_end(req, (size_t)got, &hdr_end)) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"headers\"}");
-      request_log(rt, peer, method, path, 400, "headers", start_ms);
-      free(req);
+    if (!req->head_done) {
+      json_error_tr(w, out, RESP_ERR_HEADERS);
+      request_log(rt, peer, method, path, 400, "headers", start_us);
       return 0;
     }
-    long cl = parse_content_length(req);
+    long cl = req->content_length;
     if (cl < 0 || cl > (long)body_cap) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"content-length\"}");
-      request_log(rt, peer, method, path, 400, "content-length", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_CONTENT_LENGTH);
+      request_log(rt, peer, method, path, 400, "content-length", start_us);
       return 0;
     }
-    const char *bodyp = req + hdr_end;
-    long have = (long)got - (long)hdr_end;
+    const char *bodyp = req->base + req->head_len;
+    long have = (long)req->body_len;
     if (have < cl) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"body-short\"}");
-      request_log(rt, peer, method, path, 400, "body-short", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_BODY_SHORT);
+      request_log(rt, peer, method, path, 400, "body-short", start_us);
+      return 0;
+    }
+
+    JsonIndex ix;
+    if (!json_index_build(&ix, bodyp, (size_t)cl)) {
+      json_error_tr(w, out, RESP_ERR_JSON);
+      request_log(rt, peer, method, path, 400, "json", start_us);
       return 0;
     }
 
     char project_name[96], db_profile[64], region[64], idem[96], contract_version[24], intent[40];
-    if (!parse_json_string_key(bodyp, "\"project_name\"", project_name, sizeof(project_name))) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"project_name\"}");
-      request_log(rt, peer, method, path, 400, "project_name", start_ms);
-      free(req);
+    if (!json_get_string(&ix, "project_name", project_name, sizeof(project_name))) {
+      json_error_tr(w, out, RESP_ERR_PROJECT_NAME);
+      request_log(rt, peer, method, path, 400, "project_name", start_us);
       return 0;
     }
     strncpy(db_profile, rt->gateway_db_default_profile, sizeof(db_profile) - 1u);
@@ -1274,498 +3060,1303 @@ static int handle_request(Runtime *rt, int cfd, const char *peer, const char *db
     strncpy(region, rt->gateway_db_region, sizeof(region) - 1u);
     region[sizeof(region) - 1u] = '\0';
     idem[0] = '\0';
-    (void)parse_json_string_key(bodyp, "\"db_profile\"", db_profile, sizeof(db_profile));
-    (void)parse_json_string_key(bodyp, "\"region\"", region, sizeof(region));
-    (void)parse_json_string_key(bodyp, "\"idempotency_key\"", idem, sizeof(idem));
+    (void)json_get_string(&ix, "db_profile", db_profile, sizeof(db_profile));
+    (void)json_get_string(&ix, "region", region, sizeof(region));
+    if (json_index_find(&ix, "idempotency_key") && !json_get_string(&ix, "idempotency_key", idem, sizeof(idem))) {
+      json_error_tr(w, out, RESP_ERR_IDEMPOTENCY_KEY);
+      request_log(rt, peer, method, path, 400, "idempotency_key", start_us);
+      return 0;
+    }
     strncpy(contract_version, "hal.v1", sizeof(contract_version) - 1u);
     contract_version[sizeof(contract_version) - 1u] = '\0';
     strncpy(intent, "create_project", sizeof(intent) - 1u);
     intent[sizeof(intent) - 1u] = '\0';
-    (void)parse_json_string_key(bodyp, "\"contract_version\"", contract_version, sizeof(contract_version));
-    (void)parse_json_string_key(bodyp, "\"intent\"", intent, sizeof(intent));
+    (void)json_get_string(&ix, "contract_version", contract_version, sizeof(contract_version));
+    (void)json_get_string(&ix, "intent", intent, sizeof(intent));
     long long retention_lli = (long long)rt->gateway_db_retention_days;
     long long parsed_ret = 0;
-    if (parse_json_int(bodyp, "\"retention_days\"", &parsed_ret) && parsed_ret > 0 && parsed_ret <= 3650) {
+    if (json_get_int(&ix, "retention_days", &parsed_ret) && parsed_ret > 0 && parsed_ret <= 3650) {
       retention_lli = parsed_ret;
     }
 
     if (!is_ascii_token(project_name, 2u, 95u, "._-")) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"project_name\"}");
-      request_log(rt, peer, method, path, 400, "project_name-invalid", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_PROJECT_NAME);
+      request_log(rt, peer, method, path, 400, "project_name-invalid", start_us);
       return 0;
     }
     if (!is_ascii_token(db_profile, 1u, 63u, "._-")) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"db_profile\"}");
-      request_log(rt, peer, method, path, 400, "db_profile", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_DB_PROFILE);
+      request_log(rt, peer, method, path, 400, "db_profile", start_us);
       return 0;
     }
     if (!is_ascii_token(region, 1u, 63u, "._-")) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"region\"}");
-      request_log(rt, peer, method, path, 400, "region", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_REGION);
+      request_log(rt, peer, method, path, 400, "region", start_us);
       return 0;
     }
     if (idem[0] != '\0' && !is_ascii_token(idem, 8u, 95u, "._-:")) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"idempotency_key\"}");
-      request_log(rt, peer, method, path, 400, "idempotency_key", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_IDEMPOTENCY_KEY);
+      request_log(rt, peer, method, path, 400, "idempotency_key", start_us);
       return 0;
     }
     if (!is_known_contract_version(contract_version)) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"contract_version\"}");
-      request_log(rt, peer, method, path, 400, "contract_version", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_CONTRACT_VERSION);
+      request_log(rt, peer, method, path, 400, "contract_version", start_us);
       return 0;
     }
     if (!is_known_create_intent(intent)) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"intent\"}");
-      request_log(rt, peer, method, path, 400, "intent", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_INTENT);
+      request_log(rt, peer, method, path, 400, "intent", start_us);
       return 0;
     }
 
+    /* Idempotency lookup and append must not interleave across workers. */
+    pthread_mutex_lock(&rt->gateway_lock);
     if (idem[0] != '\0') {
       char existing_project_ref[64], existing_db_ref[64];
       if (gateway_find_project_by_idempotency(rt, idem, existing_project_ref, sizeof(existing_project_ref),
                                               existing_db_ref, sizeof(existing_db_ref))) {
-        char existing_channel[96];
-        snprintf(existing_channel, sizeof(existing_channel), "aiir.ev.project.%s", existing_project_ref);
-        char out_existing[1024];
-        snprintf(out_existing, sizeof(out_existing),
-                 "{\"ok\":1,\"project_ref\":\"%s\",\"db_ref\":\"%s\",\"status\":\"provisioning\",\"events_channel\":\"%s\",\"idempotent\":1}",
-                 existing_project_ref, existing_db_ref, existing_channel);
-        json_response_tr(rt, cfd, 202, out_existing);
-        request_log(rt, peer, method, path, 202, "project-create-idempotent", start_ms);
-        free(req);
+        pthread_mutex_unlock(&rt->gateway_lock);
+        size_t mark = resp_stage_begin(out);
+        if (!stage_project_created(out, existing_project_ref, existing_db_ref, true)) {
+          resp_stage_abort(out, mark);
+          return -1;
+        }
+        json_response_staged_tr(w, out, 202, mark);
+        request_log(rt, peer, method, path, 202, "project-create-idempotent", start_us);
         return 0;
       }
     }
 
-    char project_ref[64], db_ref[64], channel[96];
+    char project_ref[64], db_ref[64];
     gen_ref(project_ref, sizeof(project_ref), "prj", rt);
     gen_ref(db_ref, sizeof(db_ref), "db", rt);
-    snprintf(channel, sizeof(channel), "aiir.ev.project.%s", project_ref);
 
-    if (!gateway_store_project(rt, project_ref, db_ref, project_name, db_profile, region, (size_t)retention_lli,
-                               idem, contract_version, intent)) {
-      json_response_tr(rt, cfd, 503, "{\"ok\":0,\"err\":\"store\"}");
-      request_log(rt, peer, method, path, 503, "store", start_ms);
-      free(req);
+    bool stored = gateway_store_project(rt, project_ref, db_ref, project_name, db_profile, region, (size_t)retention_lli,
+                                        idem, contract_version, intent);
+    pthread_mutex_unlock(&rt->gateway_lock);
+    if (!stored) {
+      json_error_tr(w, out, RESP_ERR_STORE);
+      request_log(rt, peer, method, path, 503, "store", start_us);
       return 0;
     }
 
-    char out[1024];
-    snprintf(out, sizeof(out),
-             "{\"ok\":1,\"project_ref\":\"%s\",\"db_ref\":\"%s\",\"status\":\"provisioning\",\"events_channel\":\"%s\"}",
-             project_ref, db_ref, channel);
-    json_response_tr(rt, cfd, 202, out);
+    size_t mark = resp_stage_begin(out);
+    if (!stage_project_created(out, project_ref, db_ref, false)) {
+      resp_stage_abort(out, mark);
+      return -1;
+    }
+    json_response_staged_tr(w, out, 202, mark);
     audit_log(rt, peer, method, path, 202, "gateway-project-create", 0u, project_name);
-    request_log(rt, peer, method, path, 202, "project-create", start_ms);
-    free(req);
+    request_log(rt, peer, method, path, 202, "project-create", start_us);
     return 0;
   }
 
   if (strcmp(method, "POST") == 0 && strcmp(path, "/aiir/db/exec") == 0) {
+    w->route = ROUTE_GATEWAY_DB_EXEC;
     if (!rt->gateway_enable) {
-      json_response_tr(rt, cfd, 404, "{\"ok\":0,\"err\":\"gateway-disabled\"}");
-      request_log(rt, peer, method, path, 404, "gateway-disabled", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_GATEWAY_DISABLED);
+      request_log(rt, peer, method, path, 404, "gateway-disabled", start_us);
       return 0;
     }
-    size_t hdr_end = 0;
-    if (!find_header_end(req, (size_t)got, &hdr_end)) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"headers\"}");
-      request_log(rt, peer, method, path, 400, "headers", start_ms);
-      free(req);
+    if (!req->head_done) {
+      json_error_tr(w, out, RESP_ERR_HEADERS);
+      request_log(rt, peer, method, path, 400, "headers", start_us);
       return 0;
     }
-    long cl = parse_content_length(req);
+    long cl = req->content_length;
     if (cl < 0 || cl > (long)body_cap) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"content-length\"}");
-      request_log(rt, peer, method, path, 400, "content-length", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_CONTENT_LENGTH);
+      request_log(rt, peer, method, path, 400, "content-length", start_us);
       return 0;
     }
-    const char *bodyp = req + hdr_end;
-    long have = (long)got - (long)hdr_end;
+    const char *bodyp = req->base + req->head_len;
+    long have = (long)req->body_len;
     if (have < cl) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"body-short\"}");
-      request_log(rt, peer, method, path, 400, "body-short", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_BODY_SHORT);
+      request_log(rt, peer, method, path, 400, "body-short", start_us);
+      return 0;
+    }
+
+    JsonIndex ix;
+    if (!json_index_build(&ix, bodyp, (size_t)cl)) {
+      json_error_tr(w, out, RESP_ERR_JSON);
+      request_log(rt, peer, method, path, 400, "json", start_us);
       return 0;
     }
 
     char project_ref[64], db_ref[64], op_id[64], req_id[64], contract_version[24], intent[32];
-    if (!parse_json_string_key(bodyp, "\"project_ref\"", project_ref, sizeof(project_ref))) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"project_ref\"}");
-      request_log(rt, peer, method, path, 400, "project_ref", start_ms);
-      free(req);
+    if (!json_get_string(&ix, "project_ref", project_ref, sizeof(project_ref))) {
+      json_error_tr(w, out, RESP_ERR_PROJECT_REF);
+      request_log(rt, peer, method, path, 400, "project_ref", start_us);
       return 0;
     }
-    if (!parse_json_string_key(bodyp, "\"db_ref\"", db_ref, sizeof(db_ref))) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"db_ref\"}");
-      request_log(rt, peer, method, path, 400, "db_ref", start_ms);
-      free(req);
+    if (!json_get_string(&ix, "db_ref", db_ref, sizeof(db_ref))) {
+      json_error_tr(w, out, RESP_ERR_DB_REF);
+      request_log(rt, peer, method, path, 400, "db_ref", start_us);
       return 0;
     }
-    if (!parse_json_string_key(bodyp, "\"op_id\"", op_id, sizeof(op_id))) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"op_id\"}");
-      request_log(rt, peer, method, path, 400, "op_id", start_ms);
-      free(req);
+    if (!json_get_string(&ix, "op_id", op_id, sizeof(op_id))) {
+      json_error_tr(w, out, RESP_ERR_OP_ID);
+      request_log(rt, peer, method, path, 400, "op_id", start_us);
       return 0;
     }
-    if (!parse_json_string_key(bodyp, "\"req_id\"", req_id, sizeof(req_id))) {
+    if (!json_index_find(&ix, "req_id")) {
       gen_ref(req_id, sizeof(req_id), "req", rt);
+    } else if (!json_get_string(&ix, "req_id", req_id, sizeof(req_id))) {
+      json_error_tr(w, out, RESP_ERR_REQ_ID);
+      request_log(rt, peer, method, path, 400, "req_id", start_us);
+      return 0;
     }
     strncpy(contract_version, "hal.v1", sizeof(contract_version) - 1u);
     contract_version[sizeof(contract_version) - 1u] = '\0';
     intent[0] = '\0';
-    (void)parse_json_string_key(bodyp, "\"contract_version\"", contract_version, sizeof(contract_version));
-    (void)parse_json_string_key(bodyp, "\"intent\"", intent, sizeof(intent));
+    (void)json_get_string(&ix, "contract_version", contract_version, sizeof(contract_version));
+    if (json_index_find(&ix, "intent") && !json_get_string(&ix, "intent", intent, sizeof(intent))) {
+      json_error_tr(w, out, RESP_ERR_INTENT);
+      request_log(rt, peer, method, path, 400, "intent", start_us);
+      return 0;
+    }
 
     if (!is_ascii_token(project_ref, 8u, 63u, "._-")) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"project_ref\"}");
-      request_log(rt, peer, method, path, 400, "project_ref-invalid", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_PROJECT_REF);
+      request_log(rt, peer, method, path, 400, "project_ref-invalid", start_us);
       return 0;
     }
     if (!is_ascii_token(db_ref, 6u, 63u, "._-")) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"db_ref\"}");
-      request_log(rt, peer, method, path, 400, "db_ref-invalid", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_DB_REF);
+      request_log(rt, peer, method, path, 400, "db_ref-invalid", start_us);
       return 0;
     }
     if (!is_ascii_token(op_id, 3u, 63u, "._-:")) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"op_id\"}");
-      request_log(rt, peer, method, path, 400, "op_id-invalid", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_OP_ID);
+      request_log(rt, peer, method, path, 400, "op_id-invalid", start_us);
       return 0;
     }
     if (!is_ascii_token(req_id, 3u, 63u, "._-:")) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"req_id\"}");
-      request_log(rt, peer, method, path, 400, "req_id-invalid", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_REQ_ID);
+      request_log(rt, peer, method, path, 400, "req_id-invalid", start_us);
       return 0;
     }
     if (!is_known_contract_version(contract_version)) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"contract_version\"}");
-      request_log(rt, peer, method, path, 400, "contract_version", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_CONTRACT_VERSION);
+      request_log(rt, peer, method, path, 400, "contract_version", start_us);
       return 0;
     }
     if (intent[0] != '\0' && !is_known_db_exec_intent(intent)) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"intent\"}");
-      request_log(rt, peer, method, path, 400, "intent", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_INTENT);
+      request_log(rt, peer, method, path, 400, "intent", start_us);
       return 0;
     }
-    if (!strstr(bodyp, "\"payload\"")) {
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"payload\"}");
-      request_log(rt, peer, method, path, 400, "payload", start_ms);
-      free(req);
+    if (!json_index_find(&ix, "payload")) {
+      json_error_tr(w, out, RESP_ERR_PAYLOAD);
+      request_log(rt, peer, method, path, 400, "payload", start_us);
       return 0;
     }
     if (!gateway_project_db_exists(rt, project_ref, db_ref)) {
-      json_response_tr(rt, cfd, 404, "{\"ok\":0,\"err\":\"db_ref\"}");
-      request_log(rt, peer, method, path, 404, "db_ref-missing", start_ms);
-      free(req);
+      json_error_tr(w, out, RESP_ERR_DB_REF_MISSING);
+      request_log(rt, peer, method, path, 404, "db_ref-missing", start_us);
       return 0;
     }
     if (rt->gateway_human_indirect && !rt->gateway_allow_direct_credentials) {
       /* Human mode is indirect by design; execution stays AI-managed. */
     }
-    char out[1024];
-    snprintf(out, sizeof(out),
-             "{\"ok\":1,\"req_id\":\"%s\",\"result\":{\"status\":\"queued\",\"provider\":\"%s\",\"project_ref\":\"%s\",\"db_ref\":\"%s\",\"op_id\":\"%s\"}}",
-             req_id, rt->gateway_db_provider, project_ref, db_ref, op_id);
-    json_response_tr(rt, cfd, 200, out);
+    size_t mark = resp_stage_begin(out);
+    bool ok = RESP_STAGE_LIT(out, "{\"ok\":1,\"req_id\":\"") && resp_stage_escaped_str(out, req_id) &&
+              RESP_STAGE_LIT(out, "\",\"result\":{\"status\":\"queued\",\"provider\":\"") &&
+              resp_stage_escaped_str(out, rt->gateway_db_provider) &&
+              RESP_STAGE_LIT(out, "\",\"project_ref\":\"") && resp_stage_escaped_str(out, project_ref) &&
+              RESP_STAGE_LIT(out, "\",\"db_ref\":\"") && resp_stage_escaped_str(out, db_ref) &&
+              RESP_STAGE_LIT(out, "\",\"op_id\":\"") && resp_stage_escaped_str(out, op_id) &&
+              RESP_STAGE_LIT(out, "\"}}");
+    if (!ok) {
+      resp_stage_abort(out, mark);
+      return -1;
+    }
+    json_response_staged_tr(w, out, 200, mark);
     audit_log(rt, peer, method, path, 200, "gateway-db-exec", 0u, op_id);
-    request_log(rt, peer, method, path, 200, "gateway-db-exec", start_ms);
-    free(req);
+    request_log(rt, peer, method, path, 200, "gateway-db-exec", start_us);
     return 0;
   }
 
   if (strcmp(method, "POST") == 0 && strcmp(path, "/ai/db/exec") == 0) {
+    w->route = ROUTE_DB_EXEC;
     if (!rt->policy.allow_db_exec) {
-      rt->metric_db_exec_deny_total++;
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"policy-db-exec\"}");
+      metric_inc(w, MET_DB_EXEC_DENY_TOTAL);
+      json_error_tr(w, out, RESP_ERR_POLICY_DB_EXEC);
       audit_log(rt, peer, method, path, 400, "db-exec-deny", 0u, "policy-db-exec");
-      request_log(rt, peer, method, path, 400, "policy-db-exec", start_ms);
-      free(req);
+      request_log(rt, peer, method, path, 400, "policy-db-exec", start_us);
       return 0;
     }
-    size_t hdr_end = 0;
-    if (!find_header_end(req, (size_t)got, &hdr_end)) {
-      rt->metric_db_exec_deny_total++;
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"headers\"}");
+    if (!req->head_done) {
+      metric_inc(w, MET_DB_EXEC_DENY_TOTAL);
+      json_error_tr(w, out, RESP_ERR_HEADERS);
       audit_log(rt, peer, method, path, 400, "db-exec-deny", 0u, "headers");
-      request_log(rt, peer, method, path, 400, "headers", start_ms);
-      free(req);
+      request_log(rt, peer, method, path, 400, "headers", start_us);
       return 0;
     }
-    long cl = parse_content_length(req);
+    long cl = req->content_length;
     if (cl < 0 || cl > (long)body_cap) {
-      rt->metric_db_exec_deny_total++;
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"content-length\"}");
+      metric_inc(w, MET_DB_EXEC_DENY_TOTAL);
+      json_error_tr(w, out, RESP_ERR_CONTENT_LENGTH);
       audit_log(rt, peer, method, path, 400, "db-exec-deny", 0u, "content-length");
-      request_log(rt, peer, method, path, 400, "content-length", start_ms);
-      free(req);
+      request_log(rt, peer, method, path, 400, "content-length", start_us);
       return 0;
     }
 
-    const char *bodyp = req + hdr_end;
-    long have = (long)got - (long)hdr_end;
+    const char *bodyp = req->base + req->head_len;
+    long have = (long)req->body_len;
     if (have < cl) {
-      rt->metric_db_exec_deny_total++;
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"body-short\"}");
+      metric_inc(w, MET_DB_EXEC_DENY_TOTAL);
+      json_error_tr(w, out, RESP_ERR_BODY_SHORT);
       audit_log(rt, peer, method, path, 400, "db-exec-deny", 0u, "body-short");
-      request_log(rt, peer, method, path, 400, "body-short", start_ms);
-      free(req);
+      request_log(rt, peer, method, path, 400, "body-short", start_us);
+      return 0;
+    }
+
+    uint64_t t = trace_begin(w);
+    JsonIndex ix;
+    bool ix_ok = json_index_build(&ix, bodyp, (size_t)cl);
+    trace_span(w, AIIR_TRACE_JSON, t);
+    if (!ix_ok) {
+      metric_inc(w, MET_DB_EXEC_DENY_TOTAL);
+      json_error_tr(w, out, RESP_ERR_JSON);
+      audit_log(rt, peer, method, path, 400, "db-exec-deny", 0u, "json");
+      request_log(rt, peer, method, path, 400, "json", start_us);
       return 0;
     }
 
     long long op_lli = 0;
-    if (!parse_json_int(bodyp, "\"opId\"", &op_lli) || op_lli < 0 || op_lli > 0xffffffffLL) {
-      rt->metric_db_exec_deny_total++;
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"opId\"}");
+    if (!json_get_int(&ix, "opId", &op_lli) || op_lli < 0 || op_lli > 0xffffffffLL) {
+      metric_inc(w, MET_DB_EXEC_DENY_TOTAL);
+      json_error_tr(w, out, RESP_ERR_OPID);
       audit_log(rt, peer, method, path, 400, "db-exec-deny", 0u, "opId");
-      request_log(rt, peer, method, path, 400, "opId", start_ms);
-      free(req);
+      request_log(rt, peer, method, path, 400, "opId", start_us);
       return 0;
     }
     uint32_t op_id = (uint32_t)op_lli;
+    w->trace_op = op_id;
 
     char cap_deny[64];
-    if (!validate_capability(rt, req, op_id, cap_deny, sizeof(cap_deny))) {
-      rt->metric_db_exec_deny_total++;
-      rt->metric_capability_deny_total++;
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"capability\"}");
+    t = trace_begin(w);
+    bool cap_ok = validate_capability(rt, req, op_id, cap_deny, sizeof(cap_deny));
+    trace_span(w, AIIR_TRACE_CAPABILITY, t);
+    if (!cap_ok) {
+      db_exec_denied(w, op_id);
+      metric_inc(w, MET_CAPABILITY_DENY_TOTAL);
+      json_error_tr(w, out, RESP_ERR_CAPABILITY);
       audit_log(rt, peer, method, path, 400, "db-exec-deny", op_id, cap_deny);
-      request_log(rt, peer, method, path, 400, "capability", start_ms);
-      free(req);
+      request_log(rt, peer, method, path, 400, "capability", start_us);
       return 0;
     }
 
-    if (!aiir_policy_allow_op(&rt->policy, op_id)) {
-      rt->metric_db_exec_deny_total++;
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"policy-op\"}");
+    t = trace_begin(w);
+    bool op_allowed = aiir_policy_allow_op(&rt->policy, op_id);
+    const DbOp *op = op_allowed ? find_op(core, op_id) : NULL;
+    trace_span(w, AIIR_TRACE_POLICY, t);
+    if (!op_allowed) {
+      db_exec_denied(w, op_id);
+      json_error_tr(w, out, RESP_ERR_POLICY_OP);
       audit_log(rt, peer, method, path, 400, "db-exec-deny", op_id, "policy-op");
-      request_log(rt, peer, method, path, 400, "policy-op", start_ms);
-      free(req);
+      request_log(rt, peer, method, path, 400, "policy-op", start_us);
       return 0;
     }
-    const DbOp *op = find_op(rt, op_id);
     if (!op) {
-      rt->metric_db_exec_deny_total++;
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"op\"}");
+      db_exec_denied(w, op_id);
+      json_error_tr(w, out, RESP_ERR_OP);
       audit_log(rt, peer, method, path, 400, "db-exec-deny", op_id, "op");
-      request_log(rt, peer, method, path, 400, "op", start_ms);
-      free(req);
+      request_log(rt, peer, method, path, 400, "op", start_us);
       return 0;
     }
 
     JsonVal *args = NULL;
     size_t argc = 0;
-    if (!parse_json_args(bodyp, &args, &argc)) {
-      rt->metric_db_exec_deny_total++;
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"args\"}");
+    t = trace_begin(w);
+    bool args_ok = parse_json_args(&w->arena, &ix, &args, &argc);
+    trace_span(w, AIIR_TRACE_ARGS, t);
+    if (!args_ok) {
+      db_exec_denied(w, op_id);
+      json_error_tr(w, out, RESP_ERR_ARGS);
       audit_log(rt, peer, method, path, 400, "db-exec-deny", op_id, "args");
-      request_log(rt, peer, method, path, 400, "args", start_ms);
-      free(req);
+      request_log(rt, peer, method, path, 400, "args", start_us);
       return 0;
     }
 
+    t = trace_begin(w);
     if (argc < op->min_args || argc > op->max_args) {
-      for (size_t i = 0; i < argc; i++) free(args[i].s);
-      free(args);
-      rt->metric_db_exec_deny_total++;
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"argc\"}");
+      trace_span(w, AIIR_TRACE_SIG, t);
+      db_exec_denied(w, op_id);
+      json_error_tr(w, out, RESP_ERR_ARGC);
       audit_log(rt, peer, method, path, 400, "db-exec-deny", op_id, "argc");
-      request_log(rt, peer, method, path, 400, "argc", start_ms);
-      free(req);
+      request_log(rt, peer, method, path, 400, "argc", start_us);
       return 0;
     }
 
-    uint32_t sigc = count_sig_for_op(rt, op_id);
-    if (sigc != argc) {
-      for (size_t i = 0; i < argc; i++) free(args[i].s);
-      free(args);
-      rt->metric_db_exec_deny_total++;
-      json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"sig-arity\"}");
+    if (op->sig_len != argc) {
+      trace_span(w, AIIR_TRACE_SIG, t);
+      db_exec_denied(w, op_id);
+      json_error_tr(w, out, RESP_ERR_SIG_ARITY);
       audit_log(rt, peer, method, path, 400, "db-exec-deny", op_id, "sig-arity");
-      request_log(rt, peer, method, path, 400, "sig-arity", start_ms);
-      free(req);
+      request_log(rt, peer, method, path, 400, "sig-arity", start_us);
       return 0;
     }
 
+    const DbSig *sigs = core->sigs + op->sig_off;
     for (size_t i = 0; i < argc; i++) {
-      const DbSig *sg = find_sig(rt, op_id, (uint32_t)i);
-      if (!sg || !type_check(sg->type_id, &args[i])) {
-        for (size_t k = 0; k < argc; k++) free(args[k].s);
-        free(args);
-        rt->metric_db_exec_deny_total++;
-        json_response_tr(rt, cfd, 400, "{\"ok\":0,\"err\":\"type\"}");
+      if (sigs[i].arg_index != i || !type_check(sigs[i].type_id, &args[i])) {
+        trace_span(w, AIIR_TRACE_SIG, t);
+        db_exec_denied(w, op_id);
+        json_error_tr(w, out, RESP_ERR_TYPE);
         audit_log(rt, peer, method, path, 400, "db-exec-deny", op_id, "type");
-        request_log(rt, peer, method, path, 400, "type", start_ms);
-        free(req);
+        request_log(rt, peer, method, path, 400, "type", start_us);
         return 0;
       }
     }
 
-    for (size_t i = 0; i < argc; i++) free(args[i].s);
-    free(args);
-
-    char body[512];
-    snprintf(body, sizeof(body),
-             "{\"ok\":1,\"result\":{\"ok\":1,\"mode\":\"dry-run\",\"opId\":%u,\"procId\":%u,\"argsCount\":%zu}}",
-             op->op_id, op->proc_id, argc);
-    aiir_state_log_dbexec(&rt->state, op->op_id, op->proc_id, argc);
-    rt->metric_db_exec_allow_total++;
-    json_response_tr(rt, cfd, 200, body);
+    trace_span(w, AIIR_TRACE_SIG, t);
+
+    t = trace_begin(w);
+    (void)aiir_state_log_dbexec(&rt->state, op->op_id, op->proc_id, argc);
+    trace_span(w, AIIR_TRACE_WAL, t);
+    metric_inc(w, MET_DB_EXEC_ALLOW_TOTAL);
+    op_stats_note(&rt->op_stats, op_id, true);
+    t = trace_begin(w);
+    size_t mark = resp_stage_begin(out);
+    bool ok = RESP_STAGE_LIT(out, "{\"ok\":1,\"result\":{\"ok\":1,\"mode\":\"dry-run\",\"opId\":") &&
+              resp_stage_u64(out, op->op_id) && RESP_STAGE_LIT(out, ",\"procId\":") && resp_stage_u64(out, op->proc_id) &&
+              RESP_STAGE_LIT(out, ",\"argsCount\":") && resp_stage_u64(out, argc) && RESP_STAGE_LIT(out, "}}");
+    if (!ok) {
+      resp_stage_abort(out, mark);
+      return -1;
+    }
+    json_response_staged_tr(w, out, 200, mark);
+    trace_span(w, AIIR_TRACE_RESPOND, t);
     audit_log(rt, peer, method, path, 200, "db-exec-allow", op_id, "ok");
-    request_log(rt, peer, method, path, 200, "db-exec", start_ms);
-    free(req);
+    request_log(rt, peer, method, path, 200, "db-exec", start_us);
     return 0;
   }
 
-  json_response_tr(rt, cfd, 404, "{\"ok\":0,\"err\":\"route\"}");
-  request_log(rt, peer, method, path, 404, "route", start_ms);
-  free(req);
+  json_error_tr(w, out, RESP_ERR_ROUTE);
+  request_log(rt, peer, method, path, 404, "route", start_us);
   return 0;
 }
 
-int ai_runtime_native_main(int argc, char **argv) {
-  (void)argc;
-  (void)argv;
-  const char *core_dir = getenv("AI_CORE_DIR");
-  if (!core_dir || !*core_dir) core_dir = "/var/www/aiir/ai/core";
-  const char *host = getenv("AI_RUNTIME_HOST");
-  if (!host || !*host) host = "127.0.0.1";
-  const char *port_s = getenv("AI_RUNTIME_PORT");
-  int port = port_s && *port_s ? atoi(port_s) : 7788;
-  if (port <= 0 || port > 65535) port = 7788;
-  const char *db_mode = getenv("AI_DB_EXEC_MODE");
-  if (!db_mode || !*db_mode) db_mode = "dry-run";
-  size_t req_cap = parse_env_size("AI_MAX_REQ_BYTES", 262144u, 4096u, REQ_BUF_MAX_HARD);
-  size_t body_cap = parse_env_size("AI_MAX_BODY_BYTES", 65536u, 1024u, req_cap);
-  size_t timeout_ms = parse_env_size("AI_IO_TIMEOUT_MS", 1500u, 100u, 60000u);
-  size_t rate_limit_rps = parse_env_size("AI_RATE_LIMIT_RPS", 60u, 1u, 100000u);
-  size_t cb_fail_threshold = parse_env_size("AI_CB_FAIL_THRESHOLD", 20u, 1u, 100000u);
-  size_t cb_cooldown_sec = parse_env_size("AI_CB_COOLDOWN_SEC", 15u, 1u, 3600u);
+typedef enum {
+  CONN_READ = 0,
+  CONN_WRITE = 1,
+  CONN_IDLE = 2,
+  CONN_PROFILE = 3, /* waiting for the /debug/profile run it asked for */
+} ConnState;
+
+typedef struct Conn {
+  int fd;
+  ConnState st;
+  bool want_out;
+  bool keep_alive;
+  bool peer_closed; /* read side hit EOF; buffered requests are still served */
+  bool resume;      /* requests buffered behind a deferred one still wait to be served */
+  size_t served;
+  HttpReq req;
+  char peer[128];
+  char *in;
+  size_t in_len;
+  size_t in_cap;
+  RespBuf out;
+  size_t out_off;
+  uint64_t deadline_ms;
+  AiirTraceEvent trace_read; /* reads since the last request was served */
+  AiirTraceEvent trace_tag;  /* last request whose response is queued in `out` */
+  struct Conn *prev;
+  struct Conn *next;
+} Conn;
 
-  Runtime rt;
-  if (!load_runtime(core_dir, &rt)) {
-    fprintf(stderr, "load-runtime-failed\n");
-    return 1;
+typedef struct {
+  Conn *head;
+  Conn *tail;
+  size_t count;
+} ConnList;
+
+/* Busy connections (reading a request or writing responses) expire after AI_IO_TIMEOUT_MS,
+   idle keep-alive connections after AI_KEEPALIVE_TIMEOUT_MS. Each list uses one timeout,
+   so both stay in deadline order. A connection parked on a profile run does not expire; the
+   run's timerfd ends its wait. */
+typedef struct {
+  int efd;
+  ConnList busy;
+  ConnList idle;
+  ConnList parked;
+  int profile_tfd;
+  Conn *profile_conn;
+  RespBuf scratch;
+} EpollLoop;
+
+static void format_peer(const struct sockaddr_storage *peer_addr, char *peer, size_t peer_cap) {
+  peer[0] = '\0';
+  if (peer_addr->ss_family == AF_INET) {
+    const struct sockaddr_in *a4 = (const struct sockaddr_in *)peer_addr;
+    char ip[64];
+    if (inet_ntop(AF_INET, &a4->sin_addr, ip, sizeof(ip))) {
+      snprintf(peer, peer_cap, "%s:%u", ip, (unsigned)ntohs(a4->sin_port));
+    }
+  } else if (peer_addr->ss_family == AF_INET6) {
+    snprintf(peer, peer_cap, "ipv6");
   }
+  if (peer[0] == '\0') snprintf(peer, peer_cap, "unknown");
+}
 
-  int sfd = socket(AF_INET, SOCK_STREAM, 0);
-  if (sfd < 0) {
-    perror("socket");
-    free_runtime(&rt);
-    return 1;
+/* Admission control shared by both serving modes and by all workers: circuit breaker
+   first, then the per-second rate limit. On deny the response is rendered into `out`. */
+static bool guard_admit(Worker *w, time_t now, RespBuf *out, const char *peer) {
+  ServeGuard *g = w->guard;
+  bool circuit_open = atomic_load_explicit(&g->cb_open_until, memory_order_relaxed) > (int64_t)now;
+  bool limited = false;
+  if (!circuit_open) {
+    uint64_t window = (uint64_t)(uint32_t)now << 32;
+    uint64_t cur = atomic_load_explicit(&g->rl_state, memory_order_relaxed);
+    while (1) {
+      uint64_t next = (cur & ~0xffffffffull) == window ? cur + 1u : window | 1u;
+      if ((next & 0xffffffffull) > w->cfg->rate_limit_rps) {
+        limited = true;
+        break;
+      }
+      if (atomic_compare_exchange_weak_explicit(&g->rl_state, &cur, next, memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    }
+  }
+  if (circuit_open) {
+    metric_inc(w, MET_CIRCUIT_OPEN_TOTAL);
+    json_error_tr(w, out, RESP_ERR_CIRCUIT_OPEN);
+    audit_log(w->rt, peer, "-", "-", 503, "runtime-deny", 0u, "circuit-open");
+    return false;
   }
+  if (limited) {
+    metric_inc(w, MET_RATE_LIMITED_TOTAL);
+    json_error_tr(w, out, RESP_ERR_RATE_LIMIT);
+    audit_log(w->rt, peer, "-", "-", 429, "runtime-deny", 0u, "rate-limit");
+    return false;
+  }
+  return true;
+}
 
-  int one = 1;
-  setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+static void guard_note_result(Worker *w, int rc, time_t now) {
+  ServeGuard *g = w->guard;
+  if (rc < 0) {
+    size_t n = atomic_fetch_add_explicit(&g->consecutive_fail, 1u, memory_order_relaxed) + 1u;
+    if (n >= w->cfg->cb_fail_threshold) {
+      atomic_store_explicit(&g->cb_open_until, (int64_t)now + (int64_t)w->cfg->cb_cooldown_sec,
+                            memory_order_relaxed);
+      atomic_store_explicit(&g->consecutive_fail, 0u, memory_order_relaxed);
+    }
+  } else if (atomic_load_explicit(&g->consecutive_fail, memory_order_relaxed) != 0u) {
+    /* Successes only write when there is a streak to break, so they leave the line shared. */
+    atomic_store_explicit(&g->consecutive_fail, 0u, memory_order_relaxed);
+  }
+}
 
-  struct sockaddr_in addr;
-  memset(&addr, 0, sizeof(addr));
-  addr.sin_family = AF_INET;
-  addr.sin_port = htons((uint16_t)port);
-  if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
-    fprintf(stderr, "bad-host\n");
-    close(sfd);
-    free_runtime(&rt);
-    return 1;
+/* Pins the current core generation for the duration of one request. */
+static int serve_request(Worker *w, RespBuf *out, const char *peer, const HttpReq *req) {
+  uint64_t start_us = mono_us();
+  w->core = core_acquire(w);
+  w->route = ROUTE_OTHER;
+  w->status = 0;
+  w->trace_op = 0;
+  int rc = handle_request(w, out, peer, req, start_us);
+  uint64_t dur_us = mono_us() - start_us;
+  latency_observe(w, w->route, dur_us);
+  AIIR_PROBE4(request__end, w->id, w->route, w->status, dur_us);
+  trace_request_end(w, start_us);
+  core_release(w);
+  w->core = NULL;
+  arena_reset(&w->arena);
+  return rc;
+}
+
+static void drift_publish(Runtime *rt) {
+  atomic_store(&rt->drift_total, rt->drift.drift_count);
+  atomic_store(&rt->drift_checks_total, rt->drift.checks);
+  atomic_store(&rt->drift_rehash_total, rt->drift.rehash_count);
+}
+
+/* Drains pending inotify events; returns true if any of them names a core file. */
+static bool drift_drain_inotify(int ifd) {
+  _Alignas(struct inotify_event) char buf[4096];
+  bool hit = false;
+  for (;;) {
+    ssize_t n = read(ifd, buf, sizeof(buf));
+    if (n <= 0) break;
+    for (char *p = buf; p < buf + n;) {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      if ((ev->mask & IN_Q_OVERFLOW) || (ev->len > 0 && aiir_drift_is_core_file(ev->name))) hit = true;
+      p += sizeof(*ev) + ev->len;
+    }
   }
+  return hit;
+}
 
-  if (bind(sfd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
-    perror("bind");
-    close(sfd);
-    free_runtime(&rt);
-    return 1;
+static _Noreturn void terminate_on_signal(Runtime *rt, int sig) {
+  (void)aiir_wal_sync(&rt->state.wal, 1000u);
+  if (rt->state.running) (void)aiir_state_snapshot(&rt->state);
+  (void)aiir_audit_sync(&rt->audit, 1000u);
+  aiir_trace_sink_stop(&rt->trace_sink);
+  sigset_t one;
+  sigemptyset(&one);
+  sigaddset(&one, sig);
+  signal(sig, SIG_DFL);
+  pthread_sigmask(SIG_UNBLOCK, &one, NULL);
+  raise(sig);
+  _exit(128 + sig);
+}
+
+/* Core watcher: owns drift detection and reloading, so request threads never hash or load
+   core files. An inotify event on a core file arms a check that runs once the directory has
+   been quiet for AI_CORE_DRIFT_SETTLE_MS (a rebuild replaces several files in a row), and a
+   sweep every AI_CORE_DRIFT_POLL_MS covers missed events. A check only rehashes files whose
+   inode, size or mtime moved. SIGHUP (blocked in every other thread) always reloads.
+   SIGTERM and SIGINT are taken here too, so queued WAL records and audit lines are written
+   before the signal's default action ends the process. */
+static void *reload_main(void *arg) {
+  Runtime *rt = (Runtime *)arg;
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGHUP);
+  sigaddset(&set, SIGTERM);
+  sigaddset(&set, SIGINT);
+  int sfd = signalfd(-1, &set, SFD_CLOEXEC);
+  int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (ifd >= 0 && inotify_add_watch(ifd, rt->core_dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE) < 0) {
+    close(ifd);
+    ifd = -1;
   }
-  if (listen(sfd, 64) != 0) {
-    perror("listen");
-    close(sfd);
-    free_runtime(&rt);
-    return 1;
+  atomic_store(&rt->drift_inotify, ifd >= 0);
+  struct pollfd pfd[3] = {
+    {.fd = rt->reload_efd, .events = POLLIN},
+    {.fd = sfd, .events = POLLIN},
+    {.fd = ifd, .events = POLLIN},
+  };
+  uint64_t next_sweep = now_ms() + rt->drift_poll_ms;
+  bool armed = false;
+  while (!atomic_load(&rt->reload_stop)) {
+    uint64_t now = now_ms();
+    uint64_t wait = next_sweep > now ? next_sweep - now : 0u;
+    if (armed && wait > rt->drift_settle_ms) wait = rt->drift_settle_ms;
+    int n = poll(pfd, 3, (int)wait);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (atomic_load(&rt->reload_stop)) break;
+    bool hup = false;
+    if (pfd[1].revents & POLLIN) {
+      struct signalfd_siginfo si;
+      if (read(sfd, &si, sizeof(si)) == (ssize_t)sizeof(si)) {
+        if (si.ssi_signo != SIGHUP) terminate_on_signal(rt, (int)si.ssi_signo);
+        hup = true;
+      }
+    }
+    if ((pfd[2].revents & POLLIN) && drift_drain_inotify(ifd)) armed = true;
+    now = now_ms();
+    bool due = (armed && n == 0) || now >= next_sweep;
+    if (!hup && !due) continue;
+    armed = false;
+    next_sweep = now + rt->drift_poll_ms;
+    bool drifted = aiir_drift_check(&rt->drift);
+    drift_publish(rt);
+    if (hup || (drifted && rt->reload_on_drift)) (void)core_reload(rt);
   }
+  if (ifd >= 0) close(ifd);
+  if (sfd >= 0) close(sfd);
+  return NULL;
+}
 
-  printf("1 %s %d %zu\n", host, port, rt.lite_table.len / 3u);
-  fflush(stdout);
+/* Reads until the request is framed, the buffer is full, or the peer stops sending.
+   Returns the number of bytes that belong to the request. */
+static size_t read_request(int cfd, char *buf, size_t cap, size_t body_cap, HttpReq *r) {
+  size_t got = 0;
+  size_t need = 0;
+  while (got < cap) {
+    ssize_t n = read(cfd, buf + got, cap - got);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    got += (size_t)n;
+    if (!http_scan_head(r, buf, got)) continue;
+    if (!http_frame(r, body_cap, &need) || got >= need) break;
+  }
+  if (need > 0 && got > need) got = need;
+  return got;
+}
 
-  time_t rl_window = 0;
-  size_t rl_count = 0;
-  size_t consecutive_fail = 0;
-  time_t cb_open_until = 0;
+static void serve_blocking(Worker *w) {
+  const ServeCfg *cfg = w->cfg;
+  RespBuf out = {0};
+  HttpReq hr;
+  char *req = (char *)malloc(cfg->req_cap + 1u);
+  if (!req) return;
 
   while (1) {
     struct sockaddr_storage peer_addr;
     socklen_t peer_len = sizeof(peer_addr);
-    int cfd = accept(sfd, (struct sockaddr *)&peer_addr, &peer_len);
+    int cfd = accept(w->sfd, (struct sockaddr *)&peer_addr, &peer_len);
     if (cfd < 0) {
       if (errno == EINTR) continue;
       perror("accept");
       break;
     }
     char peer[128];
-    peer[0] = '\0';
-    if (peer_addr.ss_family == AF_INET) {
-      struct sockaddr_in *a4 = (struct sockaddr_in *)&peer_addr;
-      char ip[64];
-      if (inet_ntop(AF_INET, &a4->sin_addr, ip, sizeof(ip))) {
-        snprintf(peer, sizeof(peer), "%s:%u", ip, (unsigned)ntohs(a4->sin_port));
-      }
-    } else if (peer_addr.ss_family == AF_INET6) {
-      snprintf(peer, sizeof(peer), "ipv6");
-    }
-    if (peer[0] == '\0') strncpy(peer, "unknown", sizeof(peer) - 1u);
+    format_peer(&peer_addr, peer, sizeof(peer));
     struct timeval tv;
-    tv.tv_sec = (time_t)(timeout_ms / 1000u);
-    tv.tv_usec = (suseconds_t)((timeout_ms % 1000u) * 1000u);
+    tv.tv_sec = (time_t)(cfg->timeout_ms / 1000u);
+    tv.tv_usec = (suseconds_t)((cfg->timeout_ms % 1000u) * 1000u);
     (void)setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
     (void)setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
     time_t now = time(NULL);
-    if (cb_open_until > now) {
-      rt.metric_circuit_open_total++;
-      json_response_tr(&rt, cfd, 503, "{\"ok\":0,\"err\":\"circuit-open\"}");
-      audit_log(&rt, peer, "-", "-", 503, "runtime-deny", 0u, "circuit-open");
+    resp_reset(&out);
+    if (!guard_admit(w, now, &out, peer)) {
+      (void)resp_write_all(cfd, &out);
       close(cfd);
       continue;
     }
-    if (rl_window != now) {
-      rl_window = now;
-      rl_count = 0;
+    int rc = -1;
+    http_req_reset(&hr);
+    uint64_t t = trace_begin(w);
+    size_t got = read_request(cfd, req, cfg->req_cap, cfg->body_cap, &hr);
+    trace_stash(w, &w->trace_read, AIIR_TRACE_READ, t);
+    if (got > 0) {
+      req[got] = '\0';
+      http_bind(&hr, req, got);
+      rc = serve_request(w, &out, peer, &hr);
+      AiirTraceEvent tag;
+      trace_tag(w, &tag);
+      t = trace_begin(w);
+      if (rc == 0) (void)resp_write_all(cfd, &out);
+      trace_write(w, &tag, t);
+    }
+    memset(&w->trace_read, 0, sizeof(w->trace_read));
+    guard_note_result(w, rc, now);
+    close(cfd);
+  }
+
+  free(req);
+  resp_free(&out);
+}
+
+static void conn_list_push(ConnList *l, Conn *c) {
+  c->prev = l->tail;
+  c->next = NULL;
+  if (l->tail) l->tail->next = c;
+  else l->head = c;
+  l->tail = c;
+  l->count++;
+}
+
+static void conn_list_remove(ConnList *l, Conn *c) {
+  if (c->prev) c->prev->next = c->next;
+  else l->head = c->next;
+  if (c->next) c->next->prev = c->prev;
+  else l->tail = c->prev;
+  c->prev = c->next = NULL;
+  l->count--;
+}
+
+static ConnList *conn_list_of(EpollLoop *lp, const Conn *c) {
+  if (c->st == CONN_PROFILE) return &lp->parked;
+  return c->st == CONN_IDLE ? &lp->idle : &lp->busy;
+}
+
+/* Moves the connection to state `st` and re-queues it at the tail of the matching list. */
+static void conn_set_state(EpollLoop *lp, Conn *c, ConnState st, uint64_t deadline_ms) {
+  conn_list_remove(conn_list_of(lp, c), c);
+  c->st = st;
+  c->deadline_ms = deadline_ms;
+  conn_list_push(conn_list_of(lp, c), c);
+}
+
+static void conn_close(EpollLoop *lp, Conn *c) {
+  if (lp->profile_conn == c) lp->profile_conn = NULL;
+  (void)epoll_ctl(lp->efd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  conn_list_remove(conn_list_of(lp, c), c);
+  free(c->in);
+  resp_free(&c->out);
+  free(c);
+}
+
+static bool conn_watch(EpollLoop *lp, Conn *c, bool want_out) {
+  if (c->want_out == want_out) return true;
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = want_out ? EPOLLOUT : (EPOLLIN | EPOLLRDHUP);
+  ev.data.ptr = c;
+  if (epoll_ctl(lp->efd, EPOLL_CTL_MOD, c->fd, &ev) != 0) return false;
+  c->want_out = want_out;
+  return true;
+}
+
+/* Returns 1 when the responses are fully written, 0 when the socket is full, -1 on error. */
+static int conn_flush(EpollLoop *lp, Conn *c) {
+  while (c->out_off < c->out.total) {
+    ssize_t w = resp_writev(c->fd, &c->out, c->out_off);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return conn_watch(lp, c, true) ? 0 : -1;
+      return -1;
+    }
+    c->out_off += (size_t)w;
+  }
+  return 1;
+}
+
+/* Drains the socket into the connection buffer, stopping early once it holds req_cap bytes.
+   EOF sets c->peer_closed and still returns 0. Returns -1 when the read failed. */
+static int conn_fill(Conn *c, const ServeCfg *cfg) {
+  while (1) {
+    if (c->in_len == c->in_cap) {
+      if (c->in_cap >= cfg->req_cap) return 0;
+      size_t nc = c->in_cap * 2u;
+      if (nc > cfg->req_cap) nc = cfg->req_cap;
+      char *nb = (char *)realloc(c->in, nc + 1u);
+      if (!nb) return -1;
+      c->in = nb;
+      c->in_cap = nc;
     }
-    if (rl_count >= rate_limit_rps) {
-      rt.metric_rate_limited_total++;
-      json_response_tr(&rt, cfd, 429, "{\"ok\":0,\"err\":\"rate-limit\"}");
-      audit_log(&rt, peer, "-", "-", 429, "runtime-deny", 0u, "rate-limit");
+    ssize_t got = read(c->fd, c->in + c->in_len, c->in_cap - c->in_len);
+    if (got < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+      return -1;
+    }
+    if (got == 0) {
+      c->peer_closed = true;
+      return 0;
+    }
+    c->in_len += (size_t)got;
+    c->in[c->in_len] = '\0';
+  }
+}
+
+static void serve_epoll_accept(Worker *w, EpollLoop *lp) {
+  const ServeCfg *cfg = w->cfg;
+  while (1) {
+    struct sockaddr_storage peer_addr;
+    socklen_t peer_len = sizeof(peer_addr);
+    int cfd = accept4(w->sfd, (struct sockaddr *)&peer_addr, &peer_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+      return;
+    }
+    if (lp->busy.count + lp->idle.count + lp->parked.count >= cfg->max_conns) {
+      resp_reset(&lp->scratch);
+      json_error_tr(w, &lp->scratch, RESP_ERR_BUSY);
+      (void)resp_writev(cfd, &lp->scratch, 0);
       close(cfd);
       continue;
     }
-    rl_count++;
-    aiir_drift_tick(&rt.drift);
-    int rc = handle_request(&rt, cfd, peer, db_mode, req_cap, body_cap);
-    if (rc < 0) {
-      consecutive_fail++;
-      if (consecutive_fail >= cb_fail_threshold) {
-        cb_open_until = now + (time_t)cb_cooldown_sec;
-        consecutive_fail = 0;
+    Conn *c = (Conn *)calloc(1, sizeof(Conn));
+    if (c) c->in = (char *)malloc(4096u + 1u);
+    if (!c || !c->in) {
+      if (c) free(c);
+      close(cfd);
+      continue;
+    }
+    c->fd = cfd;
+    c->st = CONN_READ;
+    c->in_cap = cfg->req_cap < 4096u ? cfg->req_cap : 4096u;
+    c->in[0] = '\0';
+    format_peer(&peer_addr, c->peer, sizeof(c->peer));
+    c->deadline_ms = now_ms() + cfg->timeout_ms;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = c;
+    if (epoll_ctl(lp->efd, EPOLL_CTL_ADD, cfd, &ev) != 0) {
+      close(cfd);
+      free(c->in);
+      free(c);
+      continue;
+    }
+    conn_list_push(&lp->busy, c);
+  }
+}
+
+/* Serves every complete request already buffered on the connection, appending the responses
+   in order, and drops the consumed bytes. The head of a partially received request stays
+   indexed in c->req, so later segments only scan the new bytes. Admission control applies per
+   request, so the rate limit counts requests rather than connections. */
+static void conn_dispatch(Worker *w, Conn *c) {
+  const ServeCfg *cfg = w->cfg;
+  HttpReq *r = &c->req;
+  size_t off = 0;
+  while (off < c->in_len) {
+    char *req = c->in + off;
+    size_t avail = c->in_len - off;
+    size_t req_len = 0;
+    uint64_t t = trace_begin(w);
+    bool head = http_scan_head(r, req, avail);
+    bool framed = head && http_frame(r, cfg->body_cap, &req_len);
+    bool full = avail >= cfg->req_cap;
+    if (framed && req_len > avail) {
+      if (!full) break;
+      framed = false;
+    }
+    if (!head && !full) break;
+    /* Unframeable or larger than AI_MAX_REQ_BYTES: the handler rejects the rest of the
+       buffer and the connection closes after the response. */
+    if (!framed) req_len = avail;
+    trace_stash(w, &w->trace_parse, AIIR_TRACE_PARSE, t);
+    w->trace_read = c->trace_read;
+    memset(&c->trace_read, 0, sizeof(c->trace_read));
+    char saved = req[req_len];
+    req[req_len] = '\0';
+    http_bind(r, req, req_len);
+    c->served++;
+    /* After a half-close the last buffered request gets "Connection: close". So does one whose
+       length another parser could read differently: the bytes after it are not trusted as the
+       next request. */
+    bool last = c->peer_closed && off + req_len >= c->in_len;
+    c->keep_alive = framed && !r->frame_ambiguous && !last && c->served < cfg->keepalive_max && r->keep_alive;
+    c->out.keep_alive = c->keep_alive;
+    time_t now = time(NULL);
+    if (guard_admit(w, now, &c->out, c->peer)) {
+      guard_note_result(w, serve_request(w, &c->out, c->peer, r), now);
+      trace_tag(w, &c->trace_tag);
+    }
+    memset(&w->trace_read, 0, sizeof(w->trace_read));
+    memset(&w->trace_parse, 0, sizeof(w->trace_parse));
+    req[req_len] = saved;
+    off += req_len;
+    http_req_reset(r);
+    if (!c->keep_alive) {
+      off = c->in_len;
+      break;
+    }
+    /* The requests behind a deferred one wait, so responses keep their order. */
+    if (w->profile_deferred) break;
+  }
+  memmove(c->in, c->in + off, c->in_len - off);
+  c->in_len -= off;
+  c->in[c->in_len] = '\0';
+}
+
+static void serve_epoll_process(Worker *w, EpollLoop *lp, Conn *c);
+
+/* Called once the responses are flushed: close, or go back to reading on the same socket. */
+static void conn_finish_write(Worker *w, EpollLoop *lp, Conn *c) {
+  if (!c->keep_alive || !conn_watch(lp, c, false)) {
+    conn_close(lp, c);
+    return;
+  }
+  resp_reset(&c->out);
+  c->out_off = 0;
+  if (c->in_len > 0) conn_set_state(lp, c, CONN_READ, now_ms() + w->cfg->timeout_ms);
+  else conn_set_state(lp, c, CONN_IDLE, now_ms() + w->cfg->keepalive_timeout_ms);
+  if (c->resume) {
+    c->resume = false;
+    serve_epoll_process(w, lp, c);
+  }
+}
+
+/* Holds the connection without watching its socket until the profile run it started is due.
+   Responses staged ahead of the profile go out together with it. */
+static void serve_epoll_park(Worker *w, EpollLoop *lp, Conn *c) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.data.ptr = c;
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = (time_t)w->profile_sec;
+  if (epoll_ctl(lp->efd, EPOLL_CTL_MOD, c->fd, &ev) != 0) {
+    conn_close(lp, c);
+    c = NULL;
+  } else {
+    conn_set_state(lp, c, CONN_PROFILE, 0);
+    lp->profile_conn = c;
+  }
+  /* Without a timer the run ends right away, with what it sampled so far. */
+  if (timerfd_settime(lp->profile_tfd, 0, &its, NULL) != 0) {
+    its.it_value.tv_sec = 0;
+    its.it_value.tv_nsec = 1;
+    (void)timerfd_settime(lp->profile_tfd, 0, &its, NULL);
+  }
+}
+
+/* Serves what the connection has buffered, then starts writing the responses. */
+static void serve_epoll_process(Worker *w, EpollLoop *lp, Conn *c) {
+  const ServeCfg *cfg = w->cfg;
+  conn_dispatch(w, c);
+  if (w->profile_deferred) {
+    w->profile_deferred = false;
+    serve_epoll_park(w, lp, c);
+    return;
+  }
+  if (c->peer_closed) {
+    /* Nothing more will arrive: answer what was complete, then close once it is written. A
+       request cut off by the EOF is the only error here. */
+    c->keep_alive = false;
+    if (c->in_len > 0) guard_note_result(w, -1, time(NULL));
+    if (c->out.total == 0) {
+      conn_close(lp, c);
+      return;
+    }
+  }
+  if (c->out.total == 0) return;
+  conn_set_state(lp, c, CONN_WRITE, now_ms() + cfg->timeout_ms);
+  uint64_t t = trace_begin(w);
+  int r = conn_flush(lp, c);
+  trace_write(w, &c->trace_tag, t);
+  if (r < 0) conn_close(lp, c);
+  else if (r > 0) conn_finish_write(w, lp, c);
+}
+
+static void serve_epoll_readable(Worker *w, EpollLoop *lp, Conn *c) {
+  const ServeCfg *cfg = w->cfg;
+  uint64_t t = trace_begin(w);
+  int filled = conn_fill(c, cfg);
+  trace_stash(w, &c->trace_read, AIIR_TRACE_READ, t);
+  if (filled < 0 || (c->peer_closed && c->in_len == 0)) {
+    /* A peer closing an idle keep-alive connection is the normal end of it. */
+    if (c->st == CONN_READ) guard_note_result(w, -1, time(NULL));
+    conn_close(lp, c);
+    return;
+  }
+  if (c->st == CONN_IDLE && c->in_len > 0) conn_set_state(lp, c, CONN_READ, now_ms() + cfg->timeout_ms);
+  serve_epoll_process(w, lp, c);
+}
+
+/* The profile run is due: stage its folded stacks on the parked connection (or discard them
+   when it went away) and let it carry on with any requests it buffered behind the profile. */
+static void serve_epoll_profile_done(Worker *w, EpollLoop *lp) {
+  uint64_t ticks;
+  if (read(lp->profile_tfd, &ticks, sizeof(ticks)) != (ssize_t)sizeof(ticks) || !w->profile_run) return;
+  Conn *c = lp->profile_conn;
+  lp->profile_conn = NULL;
+  RespBuf *out = c ? &c->out : &lp->scratch;
+  if (!c) resp_reset(out);
+  size_t mark = resp_stage_begin(out);
+  bool ok = aiir_profile_finish(w->profile_run, profile_emit, out, NULL);
+  w->profile_run = NULL;
+  atomic_store(&w->rt->profile_busy, false);
+  if (ok) {
+    plain_response_staged_tr(w, out, 200, mark);
+    request_log(w->rt, w->profile_peer, "GET", w->profile_path, 200, "profile", w->profile_start_us);
+  } else {
+    resp_stage_abort(out, mark);
+    guard_note_result(w, -1, time(NULL));
+    if (c) c->keep_alive = false;
+  }
+  if (!c) return;
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.ptr = c;
+  if (epoll_ctl(lp->efd, EPOLL_CTL_MOD, c->fd, &ev) != 0) {
+    conn_close(lp, c);
+    return;
+  }
+  c->resume = c->in_len > 0;
+  conn_set_state(lp, c, CONN_WRITE, now_ms() + w->cfg->timeout_ms);
+  uint64_t t = trace_begin(w);
+  int r = conn_flush(lp, c);
+  trace_write(w, &c->trace_tag, t);
+  if (r < 0) conn_close(lp, c);
+  else if (r > 0) conn_finish_write(w, lp, c);
+}
+
+static void serve_epoll_expire(Worker *w, EpollLoop *lp) {
+  uint64_t n = now_ms();
+  time_t now = time(NULL);
+  while (lp->busy.head && lp->busy.head->deadline_ms <= n) {
+    Conn *c = lp->busy.head;
+    if (c->st == CONN_READ) guard_note_result(w, -1, now);
+    conn_close(lp, c);
+  }
+  while (lp->idle.head && lp->idle.head->deadline_ms <= n) conn_close(lp, lp->idle.head);
+}
+
+static void serve_epoll(Worker *w) {
+  int sfd = w->sfd;
+  EpollLoop lp;
+  memset(&lp, 0, sizeof(lp));
+  lp.efd = epoll_create1(EPOLL_CLOEXEC);
+  if (lp.efd < 0) {
+    perror("epoll_create1");
+    return;
+  }
+  int fl = fcntl(sfd, F_GETFL, 0);
+  if (fl < 0 || fcntl(sfd, F_SETFL, fl | O_NONBLOCK) != 0) {
+    perror("fcntl");
+    close(lp.efd);
+    return;
+  }
+  struct epoll_event lev;
+  memset(&lev, 0, sizeof(lev));
+  lev.events = EPOLLIN;
+  lev.data.ptr = NULL;
+  if (epoll_ctl(lp.efd, EPOLL_CTL_ADD, sfd, &lev) != 0) {
+    perror("epoll_ctl");
+    close(lp.efd);
+    return;
+  }
+  lp.profile_tfd = -1;
+  if (w->rt->profile_enabled) {
+    lp.profile_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event tev;
+    memset(&tev, 0, sizeof(tev));
+    tev.events = EPOLLIN;
+    tev.data.ptr = &lp.profile_tfd;
+    if (lp.profile_tfd >= 0 && epoll_ctl(lp.efd, EPOLL_CTL_ADD, lp.profile_tfd, &tev) == 0) w->profile_defer = true;
+  }
+
+  struct epoll_event evs[128];
+  while (1) {
+    int n = epoll_wait(lp.efd, evs, (int)(sizeof(evs) / sizeof(evs[0])), 100);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("epoll_wait");
+      break;
+    }
+    /* The profile timer is handled after the connection events, which may close the parked
+       connection it would resume. */
+    bool profile_due = false;
+    for (int i = 0; i < n; i++) {
+      if (evs[i].data.ptr == &lp.profile_tfd) {
+        profile_due = true;
+        continue;
+      }
+      Conn *c = (Conn *)evs[i].data.ptr;
+      if (!c) {
+        serve_epoll_accept(w, &lp);
+        continue;
+      }
+      /* A parked connection is only woken by a hangup or an error. */
+      if (c->st == CONN_PROFILE) {
+        conn_close(&lp, c);
+        continue;
       }
+      if (c->st != CONN_WRITE) {
+        serve_epoll_readable(w, &lp, c);
+        continue;
+      }
+      uint64_t t = trace_begin(w);
+      int r = (evs[i].events & (EPOLLERR | EPOLLHUP)) ? -1 : conn_flush(&lp, c);
+      trace_write(w, &c->trace_tag, t);
+      if (r < 0) conn_close(&lp, c);
+      else if (r > 0) conn_finish_write(w, &lp, c);
+    }
+    if (profile_due) serve_epoll_profile_done(w, &lp);
+    serve_epoll_expire(w, &lp);
+  }
+
+  if (w->profile_run) {
+    (void)aiir_profile_finish(w->profile_run, NULL, NULL, NULL);
+    w->profile_run = NULL;
+    atomic_store(&w->rt->profile_busy, false);
+  }
+  while (lp.busy.head) conn_close(&lp, lp.busy.head);
+  while (lp.idle.head) conn_close(&lp, lp.idle.head);
+  while (lp.parked.head) conn_close(&lp, lp.parked.head);
+  resp_free(&lp.scratch);
+  if (lp.profile_tfd >= 0) close(lp.profile_tfd);
+  close(lp.efd);
+}
+
+static int open_listener(const char *host, int port, bool reuseport) {
+  int sfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sfd < 0) {
+    perror("socket");
+    return -1;
+  }
+
+  int one = 1;
+  setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (reuseport && setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0) {
+    perror("setsockopt");
+    close(sfd);
+    return -1;
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t)port);
+  if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+    fprintf(stderr, "bad-host\n");
+    close(sfd);
+    return -1;
+  }
+
+  if (bind(sfd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    perror("bind");
+    close(sfd);
+    return -1;
+  }
+  if (listen(sfd, 512) != 0) {
+    perror("listen");
+    close(sfd);
+    return -1;
+  }
+  return sfd;
+}
+
+static void *worker_main(void *arg) {
+  Worker *w = (Worker *)arg;
+  if (w->rt->profile_enabled) aiir_profile_register_thread(&w->rt->profiler, w->id);
+  if (w->cfg->blocking) serve_blocking(w);
+  else serve_epoll(w);
+  arena_free(&w->arena);
+  return NULL;
+}
+
+int ai_runtime_native_main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  const char *core_dir = getenv("AI_CORE_DIR");
+  if (!core_dir || !*core_dir) core_dir = "/var/www/aiir/ai/core";
+  const char *host = getenv("AI_RUNTIME_HOST");
+  if (!host || !*host) host = "127.0.0.1";
+  const char *port_s = getenv("AI_RUNTIME_PORT");
+  int port = port_s && *port_s ? atoi(port_s) : 7788;
+  if (port <= 0 || port > 65535) port = 7788;
+  const char *io_mode = getenv("AI_RUNTIME_IO_MODE");
+  if (!io_mode || !*io_mode) io_mode = "epoll";
+  if (strcmp(io_mode, "epoll") != 0 && strcmp(io_mode, "blocking") != 0) {
+    fprintf(stderr, "bad-io-mode\n");
+    return 1;
+  }
+  ServeCfg cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.db_mode = getenv("AI_DB_EXEC_MODE");
+  if (!cfg.db_mode || !*cfg.db_mode) cfg.db_mode = "dry-run";
+  cfg.req_cap = parse_env_size("AI_MAX_REQ_BYTES", 262144u, 4096u, REQ_BUF_MAX_HARD);
+  cfg.body_cap = parse_env_size("AI_MAX_BODY_BYTES", 65536u, 1024u, cfg.req_cap);
+  cfg.timeout_ms = parse_env_size("AI_IO_TIMEOUT_MS", 1500u, 100u, 60000u);
+  cfg.rate_limit_rps = parse_env_size("AI_RATE_LIMIT_RPS", 60u, 1u, 100000u);
+  cfg.cb_fail_threshold = parse_env_size("AI_CB_FAIL_THRESHOLD", 20u, 1u, 100000u);
+  cfg.cb_cooldown_sec = parse_env_size("AI_CB_COOLDOWN_SEC", 15u, 1u, 3600u);
+  cfg.max_conns = parse_env_size("AI_MAX_CONNS", 2048u, 1u, 1000000u);
+  cfg.keepalive_timeout_ms = parse_env_size("AI_KEEPALIVE_TIMEOUT_MS", 5000u, 100u, 600000u);
+  cfg.keepalive_max = parse_env_size("AI_KEEPALIVE_MAX_REQUESTS", 100u, 1u, 1000000u);
+  cfg.blocking = strcmp(io_mode, "blocking") == 0;
+  /* 0 means one worker per online CPU. */
+  size_t worker_count = parse_env_size("AI_RUNTIME_WORKERS", 1u, 0u, WORKERS_MAX);
+  if (worker_count == 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    worker_count = ncpu > 0 ? (size_t)ncpu : 1u;
+    if (worker_count > WORKERS_MAX) worker_count = WORKERS_MAX;
+  }
+
+  json_scan_init();
+  aiir_sha256_select();
+  if (!resp_errors_init()) return 1;
+  Runtime rt;
+  if (!load_runtime(core_dir, &rt)) {
+    fprintf(stderr, "load-runtime-failed\n");
+    resp_errors_free();
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  /* Read before the reload thread starts; after that only a pin keeps a generation alive. */
+  size_t core_rows = atomic_load(&rt.core)->lite_table.len / 3u;
+
+  ServeGuard guard;
+  memset(&guard, 0, sizeof(guard));
+  rt.workers = (Worker *)calloc(worker_count, sizeof(Worker));
+  if (!rt.workers) {
+    free_runtime(&rt);
+    resp_errors_free();
+    return 1;
+  }
+  /* Counters restored from the snapshot are carried by the first worker. Ids are only ever
+     appended, so a snapshot from an older build restores the ones it knows. */
+  size_t restored = rt.state.live.metric_count < MET_COUNT ? rt.state.live.metric_count : MET_COUNT;
+  for (size_t k = 0; k < restored; k++) atomic_init(&rt.workers[0].metrics.v[k], rt.state.live.metrics[k]);
+
+  /* Each worker owns a listener (SO_REUSEPORT when there is more than one) and its own
+     connections; the core buffers, policy and capability state in `rt` are shared. */
+  bool ok = true;
+  for (size_t i = 0; i < worker_count; i++) {
+    Worker *w = &rt.workers[i];
+    w->rt = &rt;
+    w->cfg = &cfg;
+    w->guard = &guard;
+    w->id = i;
+    w->sfd = open_listener(host, port, worker_count > 1u);
+    if (w->sfd < 0) {
+      ok = false;
+      break;
+    }
+    rt.worker_count = i + 1u;
+    if (rt.trace_enabled && !aiir_trace_ring_init(&w->trace, rt.trace_ring)) {
+      ok = false;
+      break;
+    }
+  }
+
+  /* SIGHUP, SIGTERM and SIGINT are taken by the reload thread through a signalfd, so they
+     must stay blocked in every thread created after this point. */
+  bool reloader = false;
+  if (ok) {
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGHUP);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    rt.reload_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (rt.reload_efd >= 0 && pthread_create(&rt.reload_thread, NULL, reload_main, &rt) == 0) {
+      reloader = true;
     } else {
-      consecutive_fail = 0;
+      fprintf(stderr, "core-reload-disabled\n");
+      sigdelset(&sigs, SIGHUP);
+      pthread_sigmask(SIG_UNBLOCK, &sigs, NULL);
     }
-    close(cfd);
   }
 
-  close(sfd);
+  if (ok && !aiir_state_start_snapshots(&rt.state, rt.snapshot_interval_sec, state_collect, &rt)) {
+    fprintf(stderr, "state-snapshots-disabled\n");
+  }
+
+  if (ok && rt.profile_enabled && !aiir_profile_init(&rt.profiler, rt.worker_count)) {
+    fprintf(stderr, "profile-disabled\n");
+    rt.profile_enabled = false;
+  }
+
+  if (ok && rt.trace_enabled && rt.trace_path[0] != '\0') {
+    rt.trace_rings = (AiirTraceRing **)calloc(rt.worker_count, sizeof(AiirTraceRing *));
+    for (size_t i = 0; rt.trace_rings && i < rt.worker_count; i++) rt.trace_rings[i] = &rt.workers[i].trace;
+    if (!rt.trace_rings ||
+        !aiir_trace_sink_start(&rt.trace_sink, rt.trace_path, rt.trace_rings, rt.worker_count, rt.trace_flush_ms)) {
+      fprintf(stderr, "trace-file-disabled\n");
+    }
+  }
+
+  if (ok) {
+    printf("1 %s %d %zu\n", host, port, core_rows);
+    fflush(stdout);
+    size_t started = 1;
+    while (started < rt.worker_count) {
+      Worker *w = &rt.workers[started];
+      if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+        fprintf(stderr, "worker-start-failed\n");
+        break;
+      }
+      started++;
+    }
+    worker_main(&rt.workers[0]);
+    for (size_t i = 1; i < started; i++) pthread_join(rt.workers[i].thread, NULL);
+  }
+  if (reloader) {
+    uint64_t one = 1;
+    atomic_store(&rt.reload_stop, true);
+    (void)!write(rt.reload_efd, &one, sizeof(one));
+    pthread_join(rt.reload_thread, NULL);
+  }
+  if (rt.reload_efd >= 0) close(rt.reload_efd);
+
+  for (size_t i = 0; i < rt.worker_count; i++) close(rt.workers[i].sfd);
   free_runtime(&rt);
-  return 0;
+  resp_errors_free();
+  return ok ? 0 : 1;
 }
 
 #ifdef AI_RUNTIME_STANDALONE
@@ -2,5 +2,7 @@
 #define AI_RUNTIME_NATIVE_H
 
 int ai_runtime_native_main(int argc, char **argv);
+/* Route label used in metrics and trace files; NULL for an unknown id. */
+const char *ai_runtime_route_name(unsigned route);
 
 #endif
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <dirent.h>
 #include <errno.h>
 #include <limits.h>
@@ -11,6 +13,11 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "../native-core/aiir_projstore.h"
+#include "../native-core/aiir_sdt.h"
+#include "../native-core/aiir_sha256.h"
+#include "../native-core/aiir_trace.h"
+#include "../native-core/aiir_wal.h"
 #include "../runtime-server-native/ai_runtime_native.h"
 
 #ifndef PATH_MAX
@@ -53,121 +60,6 @@ typedef struct {
   size_t c;
 } ContentVec;
 
-typedef struct {
-  uint32_t s[8];
-  uint64_t bits;
-  uint8_t buf[64];
-  size_t len;
-} Sha256Ctx;
-
-static const uint32_t k256[64] = {
-  0x428a2f98u,0x71374491u,0xb5c0fbcfu,0xe9b5dba5u,0x3956c25bu,0x59f111f1u,0x923f82a4u,0xab1c5ed5u,
-  0xd807aa98u,0x12835b01u,0x243185beu,0x550c7dc3u,0x72be5d74u,0x80deb1feu,0x9bdc06a7u,0xc19bf174u,
-  0xe49b69c1u,0xefbe4786u,0x0fc19dc6u,0x240ca1ccu,0x2de92c6fu,0x4a7484aau,0x5cb0a9dcu,0x76f988dau,
-  0x983e5152u,0xa831c66du,0xb00327c8u,0xbf597fc7u,0xc6e00bf3u,0xd5a79147u,0x06ca6351u,0x14292967u,
-  0x27b70a85u,0x2e1b2138u,0x4d2c6dfcu,0x53380d13u,0x650a7354u,0x766a0abbu,0x81c2c92eu,0x92722c85u,
-  0xa2bfe8a1u,0xa81a664bu,0xc24b8b70u,0xc76c51a3u,0xd192e819u,0xd6990624u,0xf40e3585u,0x106aa070u,
-  0x19a4c116u,0x1e376c08u,0x2748774cu,0x34b0bcb5u,0x391c0cb3u,0x4ed8aa4au,0x5b9cca4fu,0x682e6ff3u,
-  0x748f82eeu,0x78a5636fu,0x84c87814u,0x8cc70208u,0x90befffau,0xa4506cebu,0xbef9a3f7u,0xc67178f2u
-};
-
-static uint32_t ror32(uint32_t x, uint32_t n) { return (x >> n) | (x << (32u - n)); }
-
-static void sha256_block(Sha256Ctx *c, const uint8_t b[64]) {
-  uint32_t w[64];
-  for (uint32_t i = 0; i < 16; i++) {
-    uint32_t j = i * 4u;
-    w[i] = ((uint32_t)b[j] << 24) | ((uint32_t)b[j + 1u] << 16) | ((uint32_t)b[j + 2u] << 8) | (uint32_t)b[j + 3u];
-  }
-  for (uint32_t i = 16; i < 64; i++) {
-    uint32_t s0 = ror32(w[i - 15u], 7u) ^ ror32(w[i - 15u], 18u) ^ (w[i - 15u] >> 3u);
-    uint32_t s1 = ror32(w[i - 2u], 17u) ^ ror32(w[i - 2u], 19u) ^ (w[i - 2u] >> 10u);
-    w[i] = w[i - 16u] + s0 + w[i - 7u] + s1;
-  }
-  uint32_t a = c->s[0], b0 = c->s[1], c0 = c->s[2], d = c->s[3], e = c->s[4], f = c->s[5], g = c->s[6], h = c->s[7];
-  for (uint32_t i = 0; i < 64; i++) {
-    uint32_t S1 = ror32(e, 6u) ^ ror32(e, 11u) ^ ror32(e, 25u);
-    uint32_t ch = (e & f) ^ ((~e) & g);
-    uint32_t t1 = h + S1 + ch + k256[i] + w[i];
-    uint32_t S0 = ror32(a, 2u) ^ ror32(a, 13u) ^ ror32(a, 22u);
-    uint32_t maj = (a & b0) ^ (a & c0) ^ (b0 & c0);
-    uint32_t t2 = S0 + maj;
-    h = g; g = f; f = e; e = d + t1; d = c0; c0 = b0; b0 = a; a = t1 + t2;
-  }
-  c->s[0] += a; c->s[1] += b0; c->s[2] += c0; c->s[3] += d;
-  c->s[4] += e; c->s[5] += f; c->s[6] += g; c->s[7] += h;
-}
-
-static void sha256_init(Sha256Ctx *c) {
-  c->s[0] = 0x6a09e667u; c->s[1] = 0xbb67ae85u; c->s[2] = 0x3c6ef372u; c->s[3] = 0xa54ff53au;
-  c->s[4] = 0x510e527fu; c->s[5] = 0x9b05688cu; c->s[6] = 0x1f83d9abu; c->s[7] = 0x5be0cd19u;
-  c->bits = 0;
-  c->len = 0;
-}
-
-static void sha256_update(Sha256Ctx *c, const uint8_t *p, size_t n) {
-  while (n > 0) {
-    size_t take = 64u - c->len;
-    if (take > n) take = n;
-    memcpy(c->buf + c->len, p, take);
-    c->len += take;
-    p += take;
-    n -= take;
-    if (c->len == 64u) {
-      sha256_block(c, c->buf);
-      c->bits += 512u;
-      c->len = 0;
-    }
-  }
-}
-
-static void sha256_final(Sha256Ctx *c, uint8_t out[32]) {
-  c->bits += (uint64_t)c->len * 8u;
-  c->buf[c->len++] = 0x80u;
-  if (c->len > 56u) {
-    while (c->len < 64u) c->buf[c->len++] = 0u;
-    sha256_block(c, c->buf);
-    c->len = 0u;
-  }
-  while (c->len < 56u) c->buf[c->len++] = 0u;
-  for (int i = 7; i >= 0; i--) c->buf[c->len++] = (uint8_t)((c->bits >> (i * 8)) & 0xffu);
-  sha256_block(c, c->buf);
-  for (uint32_t i = 0; i < 8u; i++) {
-    out[i * 4u] = (uint8_t)(c->s[i] >> 24);
-    out[i * 4u + 1u] = (uint8_t)(c->s[i] >> 16);
-    out[i * 4u + 2u] = (uint8_t)(c->s[i] >> 8);
-    out[i * 4u + 3u] = (uint8_t)(c->s[i]);
-  }
-}
-
-static void hmac_sha256(const uint8_t *key, size_t key_len, const uint8_t *msg, size_t msg_len, uint8_t out[32]) {
-  uint8_t k0[64], kipad[64], kopad[64], tmp[32];
-  memset(k0, 0, sizeof(k0));
-  if (key_len > 64u) {
-    Sha256Ctx c;
-    sha256_init(&c);
-    sha256_update(&c, key, key_len);
-    sha256_final(&c, k0);
-  } else {
-    memcpy(k0, key, key_len);
-  }
-  for (size_t i = 0; i < 64u; i++) {
-    kipad[i] = (uint8_t)(k0[i] ^ 0x36u);
-    kopad[i] = (uint8_t)(k0[i] ^ 0x5cu);
-  }
-  Sha256Ctx c1;
-  sha256_init(&c1);
-  sha256_update(&c1, kipad, sizeof(kipad));
-  sha256_update(&c1, msg, msg_len);
-  sha256_final(&c1, tmp);
-
-  Sha256Ctx c2;
-  sha256_init(&c2);
-  sha256_update(&c2, kopad, sizeof(kopad));
-  sha256_update(&c2, tmp, sizeof(tmp));
-  sha256_final(&c2, out);
-}
-
 static int cmd_cap_sign(const char *secret, const char *op_id_s, const char *exp_s, const char *nonce) {
   char *end = NULL;
   unsigned long op_ul = strtoul(op_id_s, &end, 10);
@@ -181,7 +73,8 @@ static int cmd_cap_sign(const char *secret, const char *op_id_s, const char *exp
   if ((size_t)n >= sizeof(msg)) n = (int)(sizeof(msg) - 1u);
 
   uint8_t mac[32];
-  hmac_sha256((const uint8_t *)secret, strlen(secret), (const uint8_t *)msg, (size_t)n, mac);
+  aiir_sha256_select();
+  aiir_hmac_sha256((const uint8_t *)secret, strlen(secret), (const uint8_t *)msg, (size_t)n, mac);
   static const char *hex = "0123456789abcdef";
   char out[65];
   for (size_t i = 0; i < 32u; i++) {
@@ -193,6 +86,106 @@ static int cmd_cap_sign(const char *secret, const char *op_id_s, const char *exp
   return 0;
 }
 
+static bool wal_dump_record(const AiirWalRecord *r, void *ctx) {
+  (void)ctx;
+  printf("{\"lsn\":%llu,\"ts\":%llu,\"tsMs\":%llu,\"type\":\"%s\",\"opId\":%u,\"procId\":%u,\"argc\":%u}\n",
+         (unsigned long long)r->lsn, (unsigned long long)(r->ts_ms / 1000u), (unsigned long long)r->ts_ms,
+         r->type == AIIR_WAL_REC_DBEXEC ? "dbexec" : "unknown", r->op_id, r->proc_id, (unsigned)r->argc);
+  return true;
+}
+
+/* Prints every WAL record (rotated segments first) as one JSON line; the summary goes to
+   stderr so stdout stays line-per-record. */
+static int cmd_wal_dump(const char *wal_path, const char *from_s) {
+  uint64_t from = 0;
+  if (from_s) {
+    char *end = NULL;
+    unsigned long long v = strtoull(from_s, &end, 10);
+    if (end == from_s || *end != '\0') return 1;
+    from = (uint64_t)v;
+  }
+  AiirWalScanStats st;
+  if (!aiir_wal_scan(wal_path, from, wal_dump_record, NULL, &st)) {
+    fprintf(stderr, "wal-unreadable %s\n", wal_path);
+    return 1;
+  }
+  fflush(stdout);
+  fprintf(stderr, "1 %llu %llu %llu %llu %llu\n", (unsigned long long)st.segments, (unsigned long long)st.records,
+          (unsigned long long)st.last_lsn, (unsigned long long)st.torn, (unsigned long long)st.corrupt);
+  return st.corrupt > 0 ? 1 : 0;
+}
+
+/* Loads a projects.ndjson into a project store; projects whose db_ref is already stored are
+   skipped, so it can be rerun. Run it while no runtime has the store open. */
+static int cmd_project_import(const char *ndjson_path, const char *store_dir) {
+  AiirProjectStoreConfig cfg;
+  cfg.seal_records = 65536u;
+  cfg.compact_segments = 4u;
+  cfg.fdatasync = false;
+  cfg.export_path = NULL;
+  cfg.export_interval_ms = 0;
+  AiirProjectStore ps;
+  if (!aiir_projstore_open(&ps, store_dir, &cfg)) {
+    fprintf(stderr, "project-store-unavailable %s\n", store_dir);
+    return 1;
+  }
+  size_t imported = 0, skipped = 0;
+  bool ok = aiir_projstore_import_ndjson(&ps, ndjson_path, &imported, &skipped);
+  size_t total = aiir_projstore_count(&ps);
+  aiir_projstore_close(&ps);
+  if (!ok) {
+    fprintf(stderr, "project-import-failed %s\n", ndjson_path);
+    return 1;
+  }
+  printf("1 %zu %zu %zu\n", imported, skipped, total);
+  return 0;
+}
+
+/* Writes a store out as projects.ndjson, oldest project first. Like project-import it opens
+   the store itself, so run it while no runtime has the store open. */
+static int cmd_project_export(const char *store_dir, const char *ndjson_path) {
+  AiirProjectStoreConfig cfg;
+  cfg.seal_records = 65536u;
+  cfg.compact_segments = 4u;
+  cfg.fdatasync = false;
+  cfg.export_path = NULL;
+  cfg.export_interval_ms = 0;
+  AiirProjectStore ps;
+  if (!aiir_projstore_open(&ps, store_dir, &cfg)) {
+    fprintf(stderr, "project-store-unavailable %s\n", store_dir);
+    return 1;
+  }
+  size_t exported = 0;
+  bool ok = aiir_projstore_export_ndjson(&ps, ndjson_path, &exported);
+  aiir_projstore_close(&ps);
+  if (!ok) {
+    fprintf(stderr, "project-export-failed %s\n", ndjson_path);
+    return 1;
+  }
+  printf("1 %zu\n", exported);
+  return 0;
+}
+
+/* Converts a runtime trace file (AI_TRACE_FILE, or a saved /debug/trace body) to Chrome
+   trace-event JSON for chrome://tracing or Perfetto; stdout when no output path is given. */
+static int cmd_trace_chrome(const char *trace_path, const char *out_path) {
+  FILE *out = out_path ? fopen(out_path, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "trace-out-failed %s\n", out_path);
+    return 1;
+  }
+  uint64_t events = 0;
+  bool ok = aiir_trace_to_chrome(trace_path, out, ai_runtime_route_name, &events);
+  if (out_path && fclose(out) != 0) ok = false;
+  if (!ok) {
+    fprintf(stderr, "trace-convert-failed %s\n", trace_path);
+    return 1;
+  }
+  fflush(stdout);
+  fprintf(stderr, "1 %llu\n", (unsigned long long)events);
+  return 0;
+}
+
 static char *str_dup_local(const char *s) {
   size_t n = strlen(s);
   char *p = (char *)malloc(n + 1);
@@ -311,8 +304,11 @@ static bool read_file(const char *path, uint8_t **out, size_t *out_len) {
   return true;
 }
 
+/* Replaces `path` by rename: a running runtime may have the old file mapped. */
 static bool write_u32_le(const char *path, const uint32_t *w, size_t n) {
-  FILE *f = fopen(path, "wb");
+  char tmp[PATH_MAX + 32];
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long)getpid()) >= (int)sizeof(tmp)) return false;
+  FILE *f = fopen(tmp, "wb");
   if (!f) return false;
   for (size_t i = 0; i < n; i++) {
     uint8_t b[4];
@@ -320,9 +316,9 @@ static bool write_u32_le(const char *path, const uint32_t *w, size_t n) {
     b[1] = (uint8_t)((w[i] >> 8u) & 0xffu);
     b[2] = (uint8_t)((w[i] >> 16u) & 0xffu);
     b[3] = (uint8_t)((w[i] >> 24u) & 0xffu);
-    if (fwrite(b, 1, 4, f) != 4) { fclose(f); return false; }
+    if (fwrite(b, 1, 4, f) != 4) { fclose(f); unlink(tmp); return false; }
   }
-  fclose(f);
+  if (fclose(f) != 0 || rename(tmp, path) != 0) { unlink(tmp); return false; }
   return true;
 }
 
@@ -716,7 +712,10 @@ static int cmd_rebuild_core(const char *git_root, const char *core_dir) {
 
       uint32_t *pw = NULL;
       uint32_t plen = 0;
-      if (!make_packet(raw, raw_len, key, lang_id_for_ext(fp), PREVIEW_BYTES, MAX_TOKENS, &pw, &plen)) {
+      AIIR_PROBE2(packet__start, key, raw_len);
+      bool packed = make_packet(raw, raw_len, key, lang_id_for_ext(fp), PREVIEW_BYTES, MAX_TOKENS, &pw, &plen);
+      AIIR_PROBE3(packet__done, key, plen, packed);
+      if (!packed) {
         free(raw);
         continue;
       }
@@ -1072,10 +1071,14 @@ static void usage(const char *argv0) {
           "  %s build-package <src-dir> <out-dir> <core-dir>\n"
           "  %s unpack-package <package-dir> <out-dir>\n"
           "  %s cap-sign <secret> <op-id> <exp-ts> <nonce>\n"
+          "  %s wal-dump <wal-path> [from-lsn]\n"
+          "  %s project-import <projects.ndjson> <store-dir>\n"
+          "  %s project-export <store-dir> <projects.ndjson>\n"
+          "  %s trace-chrome <trace-file> [out.json]\n"
           "  %s serve\n"
           "  %s bootstrap <git-root> <core-dir> [serve]\n"
           "  %s conformance <core-dir> [iters]\n",
-          argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0);
+          argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0);
 }
 
 int main(int argc, char **argv) {
@@ -1105,6 +1108,22 @@ int main(int argc, char **argv) {
     if (argc != 6) { usage(argv[0]); return 1; }
     return cmd_cap_sign(argv[2], argv[3], argv[4], argv[5]);
   }
+  if (strcmp(argv[1], "wal-dump") == 0) {
+    if (argc < 3 || argc > 4) { usage(argv[0]); return 1; }
+    return cmd_wal_dump(argv[2], argc == 4 ? argv[3] : NULL);
+  }
+  if (strcmp(argv[1], "project-import") == 0) {
+    if (argc != 4) { usage(argv[0]); return 1; }
+    return cmd_project_import(argv[2], argv[3]);
+  }
+  if (strcmp(argv[1], "project-export") == 0) {
+    if (argc != 4) { usage(argv[0]); return 1; }
+    return cmd_project_export(argv[2], argv[3]);
+  }
+  if (strcmp(argv[1], "trace-chrome") == 0) {
+    if (argc < 3 || argc > 4) { usage(argv[0]); return 1; }
+    return cmd_trace_chrome(argv[2], argc == 4 ? argv[3] : NULL);
+  }
   if (strcmp(argv[1], "serve") == 0) {
     return ai_runtime_native_main(argc - 1, argv + 1);
   }
@@ -7,13 +7,20 @@ if ! command -v "$CC" >/dev/null 2>&1; then
   CC=gcc
 fi
 
-$CC -O2 -std=c11 -Wall -Wextra -static -s \
+$CC -O2 -fno-omit-frame-pointer -std=c11 -Wall -Wextra -static -s \
   -o aiird-static \
   aiir_toolchain.c \
   ../runtime-server-native/ai_runtime_native.c \
   ../native-core/aiir_core.c \
   ../native-core/aiir_policy.c \
   ../native-core/aiir_state.c \
-  ../native-core/aiir_drift.c
+  ../native-core/aiir_drift.c \
+  ../native-core/aiir_sha256.c \
+  ../native-core/aiir_audit.c \
+  ../native-core/aiir_wal.c \
+  ../native-core/aiir_projstore.c \
+  ../native-core/aiir_profile.c \
+  ../native-core/aiir_trace.c \
+  -pthread
 
 ln -sf aiird-static aiir-toolchain-static
@@ -83,6 +83,7 @@ content=$(cat <<ENV
 AI_RATE_LIMIT_RPS=${rate_limit}
 AI_IO_TIMEOUT_MS=${io_timeout}
 AI_CB_FAIL_THRESHOLD=${cb_threshold}
+AI_RUNTIME_WORKERS=${cpu}
 AIIR_FULL_ANALYSIS_MAX_MB=${full_analysis_mb}
 AIIR_INGEST_TIMEOUT_SEC=${ingest_timeout}
 AIIR_PARITY_TIMEOUT_SEC=${parity_timeout}
@@ -101,5 +102,5 @@ mkdir -p "$(dirname "$TUNE_FILE")"
 printf '%s\n' "$content" > "$TUNE_FILE"
 
 cat <<EOF2
-{"ok":1,"action":"tune_self","mode":"write","file":"${TUNE_FILE}","cpu":${cpu},"mem_mib":${mem_mib},"ai_rate_limit_rps":${rate_limit},"ai_io_timeout_ms":${io_timeout},"aiir_full_analysis_max_mb":${full_analysis_mb},"aiir_ingest_timeout_sec":${ingest_timeout},"aiir_parity_timeout_sec":${parity_timeout}}
+{"ok":1,"action":"tune_self","mode":"write","file":"${TUNE_FILE}","cpu":${cpu},"mem_mib":${mem_mib},"ai_rate_limit_rps":${rate_limit},"ai_io_timeout_ms":${io_timeout},"ai_runtime_workers":${cpu},"aiir_full_analysis_max_mb":${full_analysis_mb},"aiir_ingest_timeout_sec":${ingest_timeout},"aiir_parity_timeout_sec":${parity_timeout}}
 EOF2
@@ -8,13 +8,31 @@ CODEC_ENV_FILE="/var/www/aiir/server/env/ai-codec.env"
 RUNTIME_BIN="/var/www/aiir/ai/toolchain-native/aiird"
 
 CLI_AI_CORE_DIR="${AI_CORE_DIR-}"
+CLI_AI_CORE_MMAP="${AI_CORE_MMAP-}"
+CLI_AI_CORE_MMAP_POPULATE="${AI_CORE_MMAP_POPULATE-}"
+CLI_AI_CORE_RELOAD_ON_DRIFT="${AI_CORE_RELOAD_ON_DRIFT-}"
+CLI_AI_CORE_DRIFT_POLL_MS="${AI_CORE_DRIFT_POLL_MS-}"
+CLI_AI_CORE_DRIFT_SETTLE_MS="${AI_CORE_DRIFT_SETTLE_MS-}"
+CLI_AI_CORE_MADVISE="${AI_CORE_MADVISE-}"
 CLI_AI_RUNTIME_HOST="${AI_RUNTIME_HOST-}"
 CLI_AI_RUNTIME_PORT="${AI_RUNTIME_PORT-}"
+CLI_AI_RUNTIME_IO_MODE="${AI_RUNTIME_IO_MODE-}"
+CLI_AI_MAX_CONNS="${AI_MAX_CONNS-}"
+CLI_AI_RUNTIME_WORKERS="${AI_RUNTIME_WORKERS-}"
+CLI_AI_KEEPALIVE_TIMEOUT_MS="${AI_KEEPALIVE_TIMEOUT_MS-}"
+CLI_AI_KEEPALIVE_MAX_REQUESTS="${AI_KEEPALIVE_MAX_REQUESTS-}"
+CLI_AI_RENDER_CACHE_BYTES="${AI_RENDER_CACHE_BYTES-}"
 CLI_AI_DB_EXEC_MODE="${AI_DB_EXEC_MODE-}"
 CLI_AI_POLICY_ALLOW_DB_EXEC="${AI_POLICY_ALLOW_DB_EXEC-}"
 CLI_AI_POLICY_ALLOW_OPS="${AI_POLICY_ALLOW_OPS-}"
 CLI_AI_WAL_PATH="${AI_WAL_PATH-}"
 CLI_AI_SNAPSHOT_PATH="${AI_SNAPSHOT_PATH-}"
+CLI_AI_WAL_SYNC_COMMIT="${AI_WAL_SYNC_COMMIT-}"
+CLI_AI_WAL_FSYNC="${AI_WAL_FSYNC-}"
+CLI_AI_WAL_COMMIT_DELAY_US="${AI_WAL_COMMIT_DELAY_US-}"
+CLI_AI_WAL_GROUP_MAX="${AI_WAL_GROUP_MAX-}"
+CLI_AI_WAL_SEGMENT_BYTES="${AI_WAL_SEGMENT_BYTES-}"
+CLI_AI_SNAPSHOT_INTERVAL_SEC="${AI_SNAPSHOT_INTERVAL_SEC-}"
 CLI_AI_MAX_REQ_BYTES="${AI_MAX_REQ_BYTES-}"
 CLI_AI_MAX_BODY_BYTES="${AI_MAX_BODY_BYTES-}"
 CLI_AI_IO_TIMEOUT_MS="${AI_IO_TIMEOUT_MS-}"
@@ -24,8 +42,22 @@ CLI_AI_CB_COOLDOWN_SEC="${AI_CB_COOLDOWN_SEC-}"
 CLI_AI_CAP_REQUIRE="${AI_CAP_REQUIRE-}"
 CLI_AI_CAP_SECRET="${AI_CAP_SECRET-}"
 CLI_AI_CAP_MAX_FUTURE_SEC="${AI_CAP_MAX_FUTURE_SEC-}"
+CLI_AI_CAP_NONCE_CACHE="${AI_CAP_NONCE_CACHE-}"
 CLI_AI_AUDIT_LOG_PATH="${AI_AUDIT_LOG_PATH-}"
+CLI_AI_AUDIT_QUEUE="${AI_AUDIT_QUEUE-}"
+CLI_AI_AUDIT_FLUSH_MS="${AI_AUDIT_FLUSH_MS-}"
+CLI_AI_AUDIT_DURABILITY="${AI_AUDIT_DURABILITY-}"
+CLI_AI_AUDIT_STDERR="${AI_AUDIT_STDERR-}"
 CLI_AI_LOG_REQUESTS="${AI_LOG_REQUESTS-}"
+CLI_AI_OP_METRICS_MAX="${AI_OP_METRICS_MAX-}"
+CLI_AI_TRACE="${AI_TRACE-}"
+CLI_AI_TRACE_RING="${AI_TRACE_RING-}"
+CLI_AI_TRACE_FILE="${AI_TRACE_FILE-}"
+CLI_AI_TRACE_FLUSH_MS="${AI_TRACE_FLUSH_MS-}"
+CLI_AI_PROFILE="${AI_PROFILE-}"
+CLI_AI_PROFILE_HZ="${AI_PROFILE_HZ-}"
+CLI_AI_PROFILE_MAX_SEC="${AI_PROFILE_MAX_SEC-}"
+CLI_AI_PROFILE_STACKS="${AI_PROFILE_STACKS-}"
 CLI_AIIR_GATEWAY_ENABLE="${AIIR_GATEWAY_ENABLE-}"
 CLI_AIIR_PROJECT_AUTOCREATE_DB="${AIIR_PROJECT_AUTOCREATE_DB-}"
 CLI_AIIR_HUMAN_DB_MODE="${AIIR_HUMAN_DB_MODE-}"
@@ -37,6 +69,12 @@ CLI_AIIR_DB_REQUIRE_CAPABILITY="${AIIR_DB_REQUIRE_CAPABILITY-}"
 CLI_AIIR_DB_AUDIT_ENABLE="${AIIR_DB_AUDIT_ENABLE-}"
 CLI_AIIR_DB_ALLOW_DIRECT_CREDENTIALS="${AIIR_DB_ALLOW_DIRECT_CREDENTIALS-}"
 CLI_AIIR_PROJECTS_FILE="${AIIR_PROJECTS_FILE-}"
+CLI_AIIR_PROJECT_STORE_DIR="${AIIR_PROJECT_STORE_DIR-}"
+CLI_AIIR_PROJECT_STORE_SEAL_RECORDS="${AIIR_PROJECT_STORE_SEAL_RECORDS-}"
+CLI_AIIR_PROJECT_STORE_COMPACT_SEGMENTS="${AIIR_PROJECT_STORE_COMPACT_SEGMENTS-}"
+CLI_AIIR_PROJECT_STORE_FSYNC="${AIIR_PROJECT_STORE_FSYNC-}"
+CLI_AIIR_PROJECTS_FILE_EXPORT="${AIIR_PROJECTS_FILE_EXPORT-}"
+CLI_AIIR_PROJECTS_FILE_EXPORT_MS="${AIIR_PROJECTS_FILE_EXPORT_MS-}"
 
 if [[ -f "$ENV_FILE" ]]; then
   # shellcheck disable=SC1090
@@ -56,13 +94,31 @@ if [[ -f "$CODEC_ENV_FILE" ]]; then
 fi
 
 if [[ -n "$CLI_AI_CORE_DIR" ]]; then AI_CORE_DIR="$CLI_AI_CORE_DIR"; fi
+if [[ -n "$CLI_AI_CORE_MMAP" ]]; then AI_CORE_MMAP="$CLI_AI_CORE_MMAP"; fi
+if [[ -n "$CLI_AI_CORE_MMAP_POPULATE" ]]; then AI_CORE_MMAP_POPULATE="$CLI_AI_CORE_MMAP_POPULATE"; fi
+if [[ -n "$CLI_AI_CORE_RELOAD_ON_DRIFT" ]]; then AI_CORE_RELOAD_ON_DRIFT="$CLI_AI_CORE_RELOAD_ON_DRIFT"; fi
+if [[ -n "$CLI_AI_CORE_DRIFT_POLL_MS" ]]; then AI_CORE_DRIFT_POLL_MS="$CLI_AI_CORE_DRIFT_POLL_MS"; fi
+if [[ -n "$CLI_AI_CORE_DRIFT_SETTLE_MS" ]]; then AI_CORE_DRIFT_SETTLE_MS="$CLI_AI_CORE_DRIFT_SETTLE_MS"; fi
+if [[ -n "$CLI_AI_CORE_MADVISE" ]]; then AI_CORE_MADVISE="$CLI_AI_CORE_MADVISE"; fi
 if [[ -n "$CLI_AI_RUNTIME_HOST" ]]; then AI_RUNTIME_HOST="$CLI_AI_RUNTIME_HOST"; fi
 if [[ -n "$CLI_AI_RUNTIME_PORT" ]]; then AI_RUNTIME_PORT="$CLI_AI_RUNTIME_PORT"; fi
+if [[ -n "$CLI_AI_RUNTIME_IO_MODE" ]]; then AI_RUNTIME_IO_MODE="$CLI_AI_RUNTIME_IO_MODE"; fi
+if [[ -n "$CLI_AI_MAX_CONNS" ]]; then AI_MAX_CONNS="$CLI_AI_MAX_CONNS"; fi
+if [[ -n "$CLI_AI_RUNTIME_WORKERS" ]]; then AI_RUNTIME_WORKERS="$CLI_AI_RUNTIME_WORKERS"; fi
+if [[ -n "$CLI_AI_KEEPALIVE_TIMEOUT_MS" ]]; then AI_KEEPALIVE_TIMEOUT_MS="$CLI_AI_KEEPALIVE_TIMEOUT_MS"; fi
+if [[ -n "$CLI_AI_KEEPALIVE_MAX_REQUESTS" ]]; then AI_KEEPALIVE_MAX_REQUESTS="$CLI_AI_KEEPALIVE_MAX_REQUESTS"; fi
+if [[ -n "$CLI_AI_RENDER_CACHE_BYTES" ]]; then AI_RENDER_CACHE_BYTES="$CLI_AI_RENDER_CACHE_BYTES"; fi
 if [[ -n "$CLI_AI_DB_EXEC_MODE" ]]; then AI_DB_EXEC_MODE="$CLI_AI_DB_EXEC_MODE"; fi
 if [[ -n "$CLI_AI_POLICY_ALLOW_DB_EXEC" ]]; then AI_POLICY_ALLOW_DB_EXEC="$CLI_AI_POLICY_ALLOW_DB_EXEC"; fi
 if [[ -n "${CLI_AI_POLICY_ALLOW_OPS+x}" ]]; then AI_POLICY_ALLOW_OPS="$CLI_AI_POLICY_ALLOW_OPS"; fi
 if [[ -n "$CLI_AI_WAL_PATH" ]]; then AI_WAL_PATH="$CLI_AI_WAL_PATH"; fi
 if [[ -n "$CLI_AI_SNAPSHOT_PATH" ]]; then AI_SNAPSHOT_PATH="$CLI_AI_SNAPSHOT_PATH"; fi
+if [[ -n "$CLI_AI_WAL_SYNC_COMMIT" ]]; then AI_WAL_SYNC_COMMIT="$CLI_AI_WAL_SYNC_COMMIT"; fi
+if [[ -n "$CLI_AI_WAL_FSYNC" ]]; then AI_WAL_FSYNC="$CLI_AI_WAL_FSYNC"; fi
+if [[ -n "$CLI_AI_WAL_COMMIT_DELAY_US" ]]; then AI_WAL_COMMIT_DELAY_US="$CLI_AI_WAL_COMMIT_DELAY_US"; fi
+if [[ -n "$CLI_AI_WAL_GROUP_MAX" ]]; then AI_WAL_GROUP_MAX="$CLI_AI_WAL_GROUP_MAX"; fi
+if [[ -n "$CLI_AI_WAL_SEGMENT_BYTES" ]]; then AI_WAL_SEGMENT_BYTES="$CLI_AI_WAL_SEGMENT_BYTES"; fi
+if [[ -n "$CLI_AI_SNAPSHOT_INTERVAL_SEC" ]]; then AI_SNAPSHOT_INTERVAL_SEC="$CLI_AI_SNAPSHOT_INTERVAL_SEC"; fi
 if [[ -n "$CLI_AI_MAX_REQ_BYTES" ]]; then AI_MAX_REQ_BYTES="$CLI_AI_MAX_REQ_BYTES"; fi
 if [[ -n "$CLI_AI_MAX_BODY_BYTES" ]]; then AI_MAX_BODY_BYTES="$CLI_AI_MAX_BODY_BYTES"; fi
 if [[ -n "$CLI_AI_IO_TIMEOUT_MS" ]]; then AI_IO_TIMEOUT_MS="$CLI_AI_IO_TIMEOUT_MS"; fi
@@ -72,8 +128,22 @@ if [[ -n "$CLI_AI_CB_COOLDOWN_SEC" ]]; then AI_CB_COOLDOWN_SEC="$CLI_AI_CB_COOLD
 if [[ -n "$CLI_AI_CAP_REQUIRE" ]]; then AI_CAP_REQUIRE="$CLI_AI_CAP_REQUIRE"; fi
 if [[ -n "$CLI_AI_CAP_SECRET" ]]; then AI_CAP_SECRET="$CLI_AI_CAP_SECRET"; fi
 if [[ -n "$CLI_AI_CAP_MAX_FUTURE_SEC" ]]; then AI_CAP_MAX_FUTURE_SEC="$CLI_AI_CAP_MAX_FUTURE_SEC"; fi
+if [[ -n "$CLI_AI_CAP_NONCE_CACHE" ]]; then AI_CAP_NONCE_CACHE="$CLI_AI_CAP_NONCE_CACHE"; fi
 if [[ -n "$CLI_AI_AUDIT_LOG_PATH" ]]; then AI_AUDIT_LOG_PATH="$CLI_AI_AUDIT_LOG_PATH"; fi
+if [[ -n "$CLI_AI_AUDIT_QUEUE" ]]; then AI_AUDIT_QUEUE="$CLI_AI_AUDIT_QUEUE"; fi
+if [[ -n "$CLI_AI_AUDIT_FLUSH_MS" ]]; then AI_AUDIT_FLUSH_MS="$CLI_AI_AUDIT_FLUSH_MS"; fi
+if [[ -n "$CLI_AI_AUDIT_DURABILITY" ]]; then AI_AUDIT_DURABILITY="$CLI_AI_AUDIT_DURABILITY"; fi
+if [[ -n "$CLI_AI_AUDIT_STDERR" ]]; then AI_AUDIT_STDERR="$CLI_AI_AUDIT_STDERR"; fi
 if [[ -n "$CLI_AI_LOG_REQUESTS" ]]; then AI_LOG_REQUESTS="$CLI_AI_LOG_REQUESTS"; fi
+if [[ -n "$CLI_AI_OP_METRICS_MAX" ]]; then AI_OP_METRICS_MAX="$CLI_AI_OP_METRICS_MAX"; fi
+if [[ -n "$CLI_AI_TRACE" ]]; then AI_TRACE="$CLI_AI_TRACE"; fi
+if [[ -n "$CLI_AI_TRACE_RING" ]]; then AI_TRACE_RING="$CLI_AI_TRACE_RING"; fi
+if [[ -n "$CLI_AI_TRACE_FILE" ]]; then AI_TRACE_FILE="$CLI_AI_TRACE_FILE"; fi
+if [[ -n "$CLI_AI_TRACE_FLUSH_MS" ]]; then AI_TRACE_FLUSH_MS="$CLI_AI_TRACE_FLUSH_MS"; fi
+if [[ -n "$CLI_AI_PROFILE" ]]; then AI_PROFILE="$CLI_AI_PROFILE"; fi
+if [[ -n "$CLI_AI_PROFILE_HZ" ]]; then AI_PROFILE_HZ="$CLI_AI_PROFILE_HZ"; fi
+if [[ -n "$CLI_AI_PROFILE_MAX_SEC" ]]; then AI_PROFILE_MAX_SEC="$CLI_AI_PROFILE_MAX_SEC"; fi
+if [[ -n "$CLI_AI_PROFILE_STACKS" ]]; then AI_PROFILE_STACKS="$CLI_AI_PROFILE_STACKS"; fi
 if [[ -n "$CLI_AIIR_GATEWAY_ENABLE" ]]; then AIIR_GATEWAY_ENABLE="$CLI_AIIR_GATEWAY_ENABLE"; fi
 if [[ -n "$CLI_AIIR_PROJECT_AUTOCREATE_DB" ]]; then AIIR_PROJECT_AUTOCREATE_DB="$CLI_AIIR_PROJECT_AUTOCREATE_DB"; fi
 if [[ -n "$CLI_AIIR_HUMAN_DB_MODE" ]]; then AIIR_HUMAN_DB_MODE="$CLI_AIIR_HUMAN_DB_MODE"; fi
@@ -85,15 +155,39 @@ if [[ -n "$CLI_AIIR_DB_REQUIRE_CAPABILITY" ]]; then AIIR_DB_REQUIRE_CAPABILITY="
 if [[ -n "$CLI_AIIR_DB_AUDIT_ENABLE" ]]; then AIIR_DB_AUDIT_ENABLE="$CLI_AIIR_DB_AUDIT_ENABLE"; fi
 if [[ -n "$CLI_AIIR_DB_ALLOW_DIRECT_CREDENTIALS" ]]; then AIIR_DB_ALLOW_DIRECT_CREDENTIALS="$CLI_AIIR_DB_ALLOW_DIRECT_CREDENTIALS"; fi
 if [[ -n "$CLI_AIIR_PROJECTS_FILE" ]]; then AIIR_PROJECTS_FILE="$CLI_AIIR_PROJECTS_FILE"; fi
+if [[ -n "$CLI_AIIR_PROJECT_STORE_DIR" ]]; then AIIR_PROJECT_STORE_DIR="$CLI_AIIR_PROJECT_STORE_DIR"; fi
+if [[ -n "$CLI_AIIR_PROJECT_STORE_SEAL_RECORDS" ]]; then AIIR_PROJECT_STORE_SEAL_RECORDS="$CLI_AIIR_PROJECT_STORE_SEAL_RECORDS"; fi
+if [[ -n "$CLI_AIIR_PROJECT_STORE_COMPACT_SEGMENTS" ]]; then AIIR_PROJECT_STORE_COMPACT_SEGMENTS="$CLI_AIIR_PROJECT_STORE_COMPACT_SEGMENTS"; fi
+if [[ -n "$CLI_AIIR_PROJECT_STORE_FSYNC" ]]; then AIIR_PROJECT_STORE_FSYNC="$CLI_AIIR_PROJECT_STORE_FSYNC"; fi
+if [[ -n "$CLI_AIIR_PROJECTS_FILE_EXPORT" ]]; then AIIR_PROJECTS_FILE_EXPORT="$CLI_AIIR_PROJECTS_FILE_EXPORT"; fi
+if [[ -n "$CLI_AIIR_PROJECTS_FILE_EXPORT_MS" ]]; then AIIR_PROJECTS_FILE_EXPORT_MS="$CLI_AIIR_PROJECTS_FILE_EXPORT_MS"; fi
 
 : "${AI_CORE_DIR:=/var/www/aiir/ai/core}"
+: "${AI_CORE_MMAP:=1}"
+: "${AI_CORE_MMAP_POPULATE:=0}"
+: "${AI_CORE_RELOAD_ON_DRIFT:=1}"
+: "${AI_CORE_DRIFT_POLL_MS:=5000}"
+: "${AI_CORE_DRIFT_SETTLE_MS:=200}"
+: "${AI_CORE_MADVISE:=}"
 : "${AI_RUNTIME_HOST:=127.0.0.1}"
 : "${AI_RUNTIME_PORT:=7788}"
+: "${AI_RUNTIME_IO_MODE:=epoll}"
+: "${AI_MAX_CONNS:=2048}"
+: "${AI_RUNTIME_WORKERS:=1}"
+: "${AI_KEEPALIVE_TIMEOUT_MS:=5000}"
+: "${AI_KEEPALIVE_MAX_REQUESTS:=100}"
+: "${AI_RENDER_CACHE_BYTES:=8388608}"
 : "${AI_DB_EXEC_MODE:=dry-run}"
 : "${AI_POLICY_ALLOW_DB_EXEC:=0}"
 : "${AI_POLICY_ALLOW_OPS:=}"
 : "${AI_WAL_PATH:=/var/www/aiir/ai/state/ai.wal}"
-: "${AI_SNAPSHOT_PATH:=/var/www/aiir/ai/state/snapshot.json}"
+: "${AI_SNAPSHOT_PATH:=/var/www/aiir/ai/state/snapshot.aiir}"
+: "${AI_WAL_SYNC_COMMIT:=1}"
+: "${AI_WAL_FSYNC:=1}"
+: "${AI_WAL_COMMIT_DELAY_US:=0}"
+: "${AI_WAL_GROUP_MAX:=1024}"
+: "${AI_WAL_SEGMENT_BYTES:=67108864}"
+: "${AI_SNAPSHOT_INTERVAL_SEC:=60}"
 : "${AI_MAX_REQ_BYTES:=262144}"
 : "${AI_MAX_BODY_BYTES:=65536}"
 : "${AI_IO_TIMEOUT_MS:=1500}"
@@ -103,8 +197,22 @@ if [[ -n "$CLI_AIIR_PROJECTS_FILE" ]]; then AIIR_PROJECTS_FILE="$CLI_AIIR_PROJEC
 : "${AI_CAP_REQUIRE:=0}"
 : "${AI_CAP_SECRET:=}"
 : "${AI_CAP_MAX_FUTURE_SEC:=120}"
+: "${AI_CAP_NONCE_CACHE:=65536}"
 : "${AI_AUDIT_LOG_PATH:=/var/www/aiir/ai/log/runtime_audit.log}"
+: "${AI_AUDIT_QUEUE:=2048}"
+: "${AI_AUDIT_FLUSH_MS:=50}"
+: "${AI_AUDIT_DURABILITY:=write}"
+: "${AI_AUDIT_STDERR:=1}"
 : "${AI_LOG_REQUESTS:=1}"
+: "${AI_OP_METRICS_MAX:=4096}"
+: "${AI_TRACE:=0}"
+: "${AI_TRACE_RING:=16384}"
+: "${AI_TRACE_FILE:=}"
+: "${AI_TRACE_FLUSH_MS:=200}"
+: "${AI_PROFILE:=0}"
+: "${AI_PROFILE_HZ:=99}"
+: "${AI_PROFILE_MAX_SEC:=60}"
+: "${AI_PROFILE_STACKS:=16384}"
 : "${AIIR_GATEWAY_ENABLE:=1}"
 : "${AIIR_PROJECT_AUTOCREATE_DB:=1}"
 : "${AIIR_HUMAN_DB_MODE:=indirect}"
@@ -116,6 +224,12 @@ if [[ -n "$CLI_AIIR_PROJECTS_FILE" ]]; then AIIR_PROJECTS_FILE="$CLI_AIIR_PROJEC
 : "${AIIR_DB_AUDIT_ENABLE:=1}"
 : "${AIIR_DB_ALLOW_DIRECT_CREDENTIALS:=0}"
 : "${AIIR_PROJECTS_FILE:=/var/www/aiir/ai/state/projects.ndjson}"
+: "${AIIR_PROJECT_STORE_DIR:=/var/www/aiir/ai/state/projects.store}"
+: "${AIIR_PROJECT_STORE_SEAL_RECORDS:=65536}"
+: "${AIIR_PROJECT_STORE_COMPACT_SEGMENTS:=4}"
+: "${AIIR_PROJECT_STORE_FSYNC:=1}"
+: "${AIIR_PROJECTS_FILE_EXPORT:=1}"
+: "${AIIR_PROJECTS_FILE_EXPORT_MS:=1000}"
 : "${AIIR_CODEC_OPERATIONAL:=binary}"
 : "${AIIR_CODEC_TEXT_FALLBACK:=base64}"
 : "${AIIR_CODEC_HUMAN_EMERGENCY:=base32}"
@@ -125,14 +239,16 @@ if [[ "$AIIR_CODEC_OPERATIONAL" != "binary" || "$AIIR_CODEC_TEXT_FALLBACK" != "b
 fi
 
 export AI_CORE_DIR AI_RUNTIME_HOST AI_RUNTIME_PORT AI_DB_EXEC_MODE
-export AI_POLICY_ALLOW_DB_EXEC AI_POLICY_ALLOW_OPS AI_WAL_PATH AI_SNAPSHOT_PATH
+export AI_CORE_MMAP AI_CORE_MMAP_POPULATE AI_CORE_MADVISE AI_CORE_RELOAD_ON_DRIFT AI_CORE_DRIFT_POLL_MS AI_CORE_DRIFT_SETTLE_MS
+export AI_RUNTIME_IO_MODE AI_MAX_CONNS AI_RUNTIME_WORKERS AI_KEEPALIVE_TIMEOUT_MS AI_KEEPALIVE_MAX_REQUESTS AI_RENDER_CACHE_BYTES
+export AI_POLICY_ALLOW_DB_EXEC AI_POLICY_ALLOW_OPS AI_WAL_PATH AI_SNAPSHOT_PATH AI_WAL_SYNC_COMMIT AI_WAL_FSYNC AI_WAL_COMMIT_DELAY_US AI_WAL_GROUP_MAX AI_WAL_SEGMENT_BYTES AI_SNAPSHOT_INTERVAL_SEC
 export AI_MAX_REQ_BYTES AI_MAX_BODY_BYTES AI_IO_TIMEOUT_MS
 export AI_RATE_LIMIT_RPS AI_CB_FAIL_THRESHOLD AI_CB_COOLDOWN_SEC
-export AI_CAP_REQUIRE AI_CAP_SECRET AI_CAP_MAX_FUTURE_SEC AI_AUDIT_LOG_PATH
-export AI_LOG_REQUESTS
+export AI_CAP_REQUIRE AI_CAP_SECRET AI_CAP_MAX_FUTURE_SEC AI_CAP_NONCE_CACHE AI_AUDIT_LOG_PATH AI_AUDIT_QUEUE AI_AUDIT_FLUSH_MS AI_AUDIT_DURABILITY AI_AUDIT_STDERR
+export AI_LOG_REQUESTS AI_OP_METRICS_MAX AI_TRACE AI_TRACE_RING AI_TRACE_FILE AI_TRACE_FLUSH_MS AI_PROFILE AI_PROFILE_HZ AI_PROFILE_MAX_SEC AI_PROFILE_STACKS
 export AIIR_GATEWAY_ENABLE AIIR_PROJECT_AUTOCREATE_DB AIIR_HUMAN_DB_MODE
 export AIIR_DB_PROVIDER AIIR_DB_DEFAULT_PROFILE AIIR_DB_REGION AIIR_DB_RETENTION_DAYS
-export AIIR_DB_REQUIRE_CAPABILITY AIIR_DB_AUDIT_ENABLE AIIR_DB_ALLOW_DIRECT_CREDENTIALS AIIR_PROJECTS_FILE
+export AIIR_DB_REQUIRE_CAPABILITY AIIR_DB_AUDIT_ENABLE AIIR_DB_ALLOW_DIRECT_CREDENTIALS AIIR_PROJECTS_FILE AIIR_PROJECT_STORE_DIR AIIR_PROJECT_STORE_SEAL_RECORDS AIIR_PROJECT_STORE_COMPACT_SEGMENTS AIIR_PROJECT_STORE_FSYNC AIIR_PROJECTS_FILE_EXPORT AIIR_PROJECTS_FILE_EXPORT_MS
 export AIIR_CODEC_OPERATIONAL AIIR_CODEC_TEXT_FALLBACK AIIR_CODEC_HUMAN_EMERGENCY
 if [[ ! -x "$RUNTIME_BIN" ]]; then
   /var/www/aiir/ai/toolchain-native/build-static.sh